@@ -5,6 +5,7 @@
 #include "noise.h"
 #include "console.h"
 #include <math.h>
+#include <string.h>
 #include <time.h>
 
 // 127 bytes
@@ -147,6 +148,38 @@ void SoundEngine::refresh() {
     unmute();
 }
 
+void SoundEngine::copyState(SoundEngine* s) {
+    cyclesToSoundEvent = s->cyclesToSoundEvent;
+    chan4FreqRatio = s->chan4FreqRatio;
+    chan1SweepTime = s->chan1SweepTime;
+    chan1SweepCounter = s->chan1SweepCounter;
+    chan1SweepDir = s->chan1SweepDir;
+    chan1SweepAmount = s->chan1SweepAmount;
+    memcpy(chanLen, s->chanLen, sizeof(chanLen));
+    memcpy(chanLenCounter, s->chanLenCounter, sizeof(chanLenCounter));
+    memcpy(chanUseLen, s->chanUseLen, sizeof(chanUseLen));
+    memcpy(chanFreq, s->chanFreq, sizeof(chanFreq));
+    memcpy(chanVol, s->chanVol, sizeof(chanVol));
+    memcpy(chanEnvDir, s->chanEnvDir, sizeof(chanEnvDir));
+    memcpy(chanEnvCounter, s->chanEnvCounter, sizeof(chanEnvCounter));
+    memcpy(chanEnvSweep, s->chanEnvSweep, sizeof(chanEnvSweep));
+
+    lfsr = s->lfsr;
+    noiseVal = s->noiseVal;
+    chan3WavPos = s->chan3WavPos;
+    memcpy(chanPolarity, s->chanPolarity, sizeof(chanPolarity));
+    memcpy(chanPolarityCounter, s->chanPolarityCounter, sizeof(chanPolarityCounter));
+    chan4Width = s->chan4Width;
+    memcpy(chanDuty, s->chanDuty, sizeof(chanDuty));
+    memcpy(chanFreqClocks, s->chanFreqClocks, sizeof(chanFreqClocks));
+    memcpy(chanOn, s->chanOn, sizeof(chanOn));
+    memcpy(chanToOut1, s->chanToOut1, sizeof(chanToOut1));
+    memcpy(chanToOut2, s->chanToOut2, sizeof(chanToOut2));
+    SO1Vol = s->SO1Vol;
+    SO2Vol = s->SO2Vol;
+    cyclesUntilSample = s->cyclesUntilSample;
+}
+
 void SoundEngine::mute() {
     muted = true;
 }
@@ -258,7 +291,7 @@ void SoundEngine::updateSound(int cycles)
 		}
 	}
 
-    if (!csndInitialized)
+    if (!csndInitialized || muted)
         return;
 
     cyclesUntilSample -= cycles;
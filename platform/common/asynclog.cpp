@@ -0,0 +1,362 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include "console.h"
+#include "hosttime.h"
+
+#ifdef ASYNC_LOG
+
+#define LOG_RING_SIZE       512     // Records per thread, must be a power of 2
+#define MAX_LOG_THREADS     64      // Logging at once; a ring is freed when its thread exits
+
+#define LOG_SITE_BUSY       0xffffffff  // A thread is filling in the site
+
+// Single producer (the thread that owns it), single consumer (the log thread)
+struct LogRing {
+    LogRecord records[LOG_RING_SIZE];
+    std::atomic<u32> head;      // Next record to write
+    std::atomic<u32> tail;      // Next record to read
+    std::atomic<u32> dropped;   // Messages lost because the ring was full
+    std::atomic<bool> exited;   // The thread is gone; the log thread frees the ring once it's empty
+};
+
+// Gives the thread's ring to the log thread when the thread exits
+struct ThreadRing {
+    LogRing* ring;
+
+    ~ThreadRing() {
+        if (ring != NULL)
+            ring->exited.store(true, std::memory_order_release);
+    }
+};
+
+volatile int logLevel = LOG_LEVEL_INFO;
+
+// Slots are taken under ringMutex, and only the log thread empties them
+static std::atomic<LogRing*> rings[MAX_LOG_THREADS];
+static std::mutex ringMutex;
+static thread_local ThreadRing threadRing;
+static std::atomic<u32> threadsDropped(0);     // Messages from threads that found every slot taken
+static std::atomic<u32> nextSiteId(1);
+
+static std::thread logThread;
+static std::atomic<bool> logThreadRunning(false);
+
+static bool atLineStart = true;
+
+static u64 logStartTime = getNanoseconds();
+
+
+// The only allocation, made the first time a thread logs something. NULL if
+// every slot is taken.
+static LogRing* getThreadRing() {
+    if (threadRing.ring == NULL) {
+        std::lock_guard<std::mutex> lock(ringMutex);
+        for (int i=0; i<MAX_LOG_THREADS; i++) {
+            if (rings[i].load(std::memory_order_relaxed) != NULL)
+                continue;
+            LogRing* ring = new LogRing();
+            ring->head = 0;
+            ring->tail = 0;
+            ring->dropped = 0;
+            ring->exited = false;
+            rings[i].store(ring, std::memory_order_release);
+            threadRing.ring = ring;
+            break;
+        }
+    }
+    return threadRing.ring;
+}
+
+// The first thread to log from a site claims it with a compare-and-swap and
+// fills in its format; any other thread there at the time waits for that.
+static void claimSite(LogSite* site, const char* format) {
+    u32 id = 0;
+    if (__atomic_compare_exchange_n(&site->id, &id, LOG_SITE_BUSY, false,
+                __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+        site->format = format;
+        __atomic_store_n(&site->id, nextSiteId.fetch_add(1, std::memory_order_relaxed),
+                __ATOMIC_RELEASE);
+        return;
+    }
+    while (id == LOG_SITE_BUSY)
+        id = __atomic_load_n(&site->id, __ATOMIC_ACQUIRE);
+}
+
+LogRecord* logBeginRecord(LogSite* site, const char* format) {
+    u64 time = getNanoseconds() - logStartTime;
+
+    u32 id = __atomic_load_n(&site->id, __ATOMIC_ACQUIRE);
+    if (id == 0 || id == LOG_SITE_BUSY)
+        claimSite(site, format);
+
+    // Whichever thread starts a new window resets the count
+    u32 ms = time / 1000000;
+    u32 windowStart = __atomic_load_n(&site->windowStart, __ATOMIC_RELAXED);
+    if (ms - windowStart >= 1000 && __atomic_compare_exchange_n(&site->windowStart, &windowStart,
+                ms, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        __atomic_store_n(&site->windowCount, 0, __ATOMIC_RELAXED);
+    if (__atomic_fetch_add(&site->windowCount, 1, __ATOMIC_RELAXED) >= LOG_SITE_RATE_LIMIT) {
+        __atomic_fetch_add(&site->suppressed, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    LogRing* ring = getThreadRing();
+    if (ring == NULL) {
+        threadsDropped.fetch_add(1, std::memory_order_relaxed);
+        return NULL;
+    }
+    u32 head = ring->head.load(std::memory_order_relaxed);
+    if (head - ring->tail.load(std::memory_order_acquire) == LOG_RING_SIZE) {
+        ring->dropped.fetch_add(1, std::memory_order_relaxed);
+        return NULL;
+    }
+
+    LogRecord* r = &ring->records[head & (LOG_RING_SIZE-1)];
+    r->site = site;
+    r->time = time;
+    r->suppressed = __atomic_exchange_n(&site->suppressed, 0, __ATOMIC_RELAXED);
+    r->numArgs = 0;
+    r->stringBytes = 0;
+    return r;
+}
+
+void logCommitRecord(LogRecord* record) {
+    LogRing* ring = threadRing.ring;
+    ring->head.store(ring->head.load(std::memory_order_relaxed)+1, std::memory_order_release);
+}
+
+
+// Formats one conversion from the record's arguments. "spec" holds the flags,
+// width and precision, with any length modifier stripped.
+static int formatArg(char* out, int size, const char* spec, int length, char conversion,
+        LogRecord* r, int arg) {
+    char fmt[32];
+    if (arg >= r->numArgs)
+        return snprintf(out, size, "<?>");
+
+    int type = r->argTypes[arg];
+    switch (conversion) {
+        case 'd':
+        case 'i':
+        case 'c':
+            {
+                long long value = r->args[arg].i;
+                if (type == LOG_ARG_INT)
+                    value = (int)value;
+                if (conversion == 'c') {
+                    snprintf(fmt, sizeof(fmt), "%%%sc", spec);
+                    return snprintf(out, size, fmt, (int)value);
+                }
+                if (length == 'H')
+                    value = (signed char)value;
+                else if (length == 'h')
+                    value = (short)value;
+                snprintf(fmt, sizeof(fmt), "%%%sll%c", spec, conversion);
+                return snprintf(out, size, fmt, value);
+            }
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+            {
+                unsigned long long value = r->args[arg].i;
+                if (type == LOG_ARG_INT)
+                    value = (u32)value;
+                if (length == 'H')
+                    value = (u8)value;
+                else if (length == 'h')
+                    value = (u16)value;
+                snprintf(fmt, sizeof(fmt), "%%%sll%c", spec, conversion);
+                return snprintf(out, size, fmt, value);
+            }
+        case 'e':
+        case 'E':
+        case 'f':
+        case 'F':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            {
+                double value = type == LOG_ARG_DOUBLE ? r->args[arg].d : (double)r->args[arg].i;
+                snprintf(fmt, sizeof(fmt), "%%%s%c", spec, conversion);
+                return snprintf(out, size, fmt, value);
+            }
+        case 's':
+            snprintf(fmt, sizeof(fmt), "%%%ss", spec);
+            if (type != LOG_ARG_STRING)
+                return snprintf(out, size, fmt, "<?>");
+            return snprintf(out, size, fmt, r->strings+r->args[arg].string);
+        case 'p':
+            snprintf(fmt, sizeof(fmt), "%%%sp", spec);
+            return snprintf(out, size, fmt, r->args[arg].p);
+        default:
+            return 0;
+    }
+}
+
+static void formatRecord(LogRecord* r, char* out, int size) {
+    const char* s = r->site->format;
+    int pos = 0;
+    int arg = 0;
+
+    while (*s && pos < size-1) {
+        if (*s != '%') {
+            out[pos++] = *s++;
+            continue;
+        }
+        s++;
+        if (*s == '%') {
+            out[pos++] = *s++;
+            continue;
+        }
+
+        char spec[24];
+        int specLen = 0;
+        while (*s && strchr("-+ #0123456789.*", *s)) {
+            if (*s == '*') {
+                int value = arg < r->numArgs ? (int)r->args[arg++].i : 0;
+                specLen += snprintf(spec+specLen, sizeof(spec)-specLen, "%d", value);
+            }
+            else if (specLen < (int)sizeof(spec)-1)
+                spec[specLen++] = *s;
+            s++;
+            if (specLen >= (int)sizeof(spec)-1)
+                specLen = sizeof(spec)-1;
+        }
+        spec[specLen] = '\0';
+
+        // 'H' stands in for "hh"
+        char length = 0;
+        while (*s && strchr("hlLqjzt", *s)) {
+            if (*s == 'h')
+                length = length == 'h' ? 'H' : 'h';
+            else
+                length = *s;
+            s++;
+        }
+        if (*s == '\0')
+            break;
+
+        int len = formatArg(out+pos, size-pos, spec, length, *s++, r, arg++);
+        if (len > 0)
+            pos += len;
+        if (pos > size-1)
+            pos = size-1;
+    }
+    out[pos] = '\0';
+}
+
+static void writeRecord(LogRecord* r) {
+    static const char* levelNames[] = { "debug: ", "", "warning: ", "error: ", "" };
+    char text[1024];
+    formatRecord(r, text, sizeof(text));
+
+    if (atLineStart) {
+        printf("[%5u.%06u] ", (u32)(r->time/1000000000), (u32)(r->time/1000%1000000));
+        if (r->suppressed)
+            printf("(%u more suppressed) ", r->suppressed);
+        printf("%s", levelNames[r->site->level]);
+    }
+    fputs(text, stdout);
+    int len = strlen(text);
+    atLineStart = len == 0 || text[len-1] == '\n';
+}
+
+// Frees the rings of threads that have exited, once everything in them is
+// written out. Their slots can then go to new threads.
+static void freeExitedRings() {
+    for (int i=0; i<MAX_LOG_THREADS; i++) {
+        LogRing* ring = rings[i].load(std::memory_order_acquire);
+        if (ring == NULL || !ring->exited.load(std::memory_order_acquire))
+            continue;
+        if (ring->tail.load(std::memory_order_relaxed) != ring->head.load(std::memory_order_acquire) ||
+                ring->dropped.load(std::memory_order_relaxed) != 0)
+            continue;
+        rings[i].store(NULL, std::memory_order_release);
+        delete ring;
+    }
+}
+
+// Writes out everything queued so far, oldest first. Returns false if there
+// was nothing to do.
+static bool drainRings() {
+    LogRing* ringList[MAX_LOG_THREADS];
+    int n = 0;
+    for (int i=0; i<MAX_LOG_THREADS; i++) {
+        LogRing* ring = rings[i].load(std::memory_order_acquire);
+        if (ring != NULL)
+            ringList[n++] = ring;
+    }
+    bool wroteAnything = false;
+
+    for (int i=0; i<n; i++) {
+        u32 dropped = ringList[i]->dropped.exchange(0, std::memory_order_relaxed);
+        if (dropped) {
+            printf("%s[log] %u messages dropped, the ring was full\n", atLineStart ? "" : "\n", dropped);
+            atLineStart = true;
+            wroteAnything = true;
+        }
+    }
+    u32 dropped = threadsDropped.exchange(0, std::memory_order_relaxed);
+    if (dropped) {
+        printf("%s[log] %u messages dropped, more than %d threads were logging\n",
+                atLineStart ? "" : "\n", dropped, MAX_LOG_THREADS);
+        atLineStart = true;
+        wroteAnything = true;
+    }
+
+    for (;;) {
+        LogRing* oldest = NULL;
+        for (int i=0; i<n; i++) {
+            LogRing* ring = ringList[i];
+            u32 tail = ring->tail.load(std::memory_order_relaxed);
+            if (tail == ring->head.load(std::memory_order_acquire))
+                continue;
+            if (oldest == NULL ||
+                    ring->records[tail & (LOG_RING_SIZE-1)].time <
+                    oldest->records[oldest->tail.load(std::memory_order_relaxed) & (LOG_RING_SIZE-1)].time)
+                oldest = ring;
+        }
+        if (oldest == NULL)
+            break;
+
+        u32 tail = oldest->tail.load(std::memory_order_relaxed);
+        writeRecord(&oldest->records[tail & (LOG_RING_SIZE-1)]);
+        oldest->tail.store(tail+1, std::memory_order_release);
+        wroteAnything = true;
+    }
+
+    if (wroteAnything)
+        fflush(stdout);
+    freeExitedRings();
+    return wroteAnything;
+}
+
+static void logThreadFunc() {
+    while (logThreadRunning.load()) {
+        if (!drainRings())
+            usleep(2000);
+    }
+    drainRings();
+}
+
+void startAsyncLog() {
+    if (logThreadRunning.load())
+        return;
+    logThreadRunning = true;
+    logThread = std::thread(logThreadFunc);
+}
+
+void stopAsyncLog() {
+    if (!logThreadRunning.load())
+        return;
+    logThreadRunning = false;
+    logThread.join();
+}
+
+#endif
@@ -1,13 +1,11 @@
 #include <string.h>
 #include <algorithm>
 #include "gameboy.h"
-#include "gbmanager.h"
 #include "mmu.h"
 #include "console.h"
 #include "menu.h"
 #include "main.h"
 #include "cheats.h"
-#include "inputhelper.h"
 #include "gbgfx.h"
 #include "romfile.h"
 #include "io.h"
@@ -26,6 +24,15 @@ void CheatEngine::setRomFile(RomFile* r) {
     romFile = r;
 }
 
+void CheatEngine::copyCheats(CheatEngine* c) {
+    romFile = c->romFile;
+    cheatsEnabled = c->cheatsEnabled;
+    numCheats = c->numCheats;
+    strcpy(cheatsRomTitle, c->cheatsRomTitle);
+    for (int i=0; i<numCheats; i++)
+        cheats[i] = c->cheats[i];
+}
+
 void CheatEngine::enableCheats (bool enable)
 {
     cheatsEnabled = enable;
@@ -219,109 +226,3 @@ void CheatEngine::saveCheats(const char* filename) {
     }
     file_close(file);
 }
-
-// Menu code
-
-const int cheatsPerPage=18;
-int cheatMenuSelection=0;
-bool cheatMenu_gameboyWasPaused;
-CheatEngine* ch; // cheat engine to display the menu for
-
-void redrawCheatMenu() {
-    int numCheats = ch->getNumCheats();
-
-    int numPages = (numCheats-1)/cheatsPerPage+1;
-
-    int page = cheatMenuSelection/cheatsPerPage;
-
-    clearConsole();
-
-    printf("          Cheat Menu      ");
-    printf("%d/%d\n\n", page+1, numPages);
-    for (int i=page*cheatsPerPage; i<numCheats && i < (page+1)*cheatsPerPage; i++) {
-        int nameColor = (cheatMenuSelection == i ? CONSOLE_COLOR_LIGHT_YELLOW : CONSOLE_COLOR_WHITE);
-        iprintfColored(nameColor, ch->cheats[i].name);
-        for (unsigned int j=0; j<25-strlen(ch->cheats[i].name); j++)
-            printf(" ");
-        if (ch->isCheatEnabled(i)) {
-            if (cheatMenuSelection == i) {
-                iprintfColored(CONSOLE_COLOR_LIGHT_YELLOW, "* ");
-                iprintfColored(CONSOLE_COLOR_LIGHT_GREEN, "On");
-                iprintfColored(CONSOLE_COLOR_LIGHT_YELLOW, " * ");
-            }
-            else
-                iprintfColored(CONSOLE_COLOR_WHITE, "  On   ");
-        }
-        else {
-            if (cheatMenuSelection == i) {
-                iprintfColored(CONSOLE_COLOR_LIGHT_YELLOW, "* ");
-                iprintfColored(CONSOLE_COLOR_LIGHT_GREEN, "Off");
-                iprintfColored(CONSOLE_COLOR_LIGHT_YELLOW, " *");
-            }
-            else
-                iprintfColored(CONSOLE_COLOR_WHITE, "  Off  ");
-        }
-    }
-
-}
-
-void updateCheatMenu() {
-    bool redraw=false;
-    int numCheats = ch->getNumCheats();
-
-    if (cheatMenuSelection >= numCheats) {
-        cheatMenuSelection = 0;
-    }
-
-    if (keyPressedAutoRepeat(mapMenuKey(MENU_KEY_UP))) {
-        if (cheatMenuSelection > 0) {
-            cheatMenuSelection--;
-            redraw = true;
-        }
-    }
-    else if (keyPressedAutoRepeat(mapMenuKey(MENU_KEY_DOWN))) {
-        if (cheatMenuSelection < numCheats-1) {
-            cheatMenuSelection++;
-            redraw = true;
-        }
-    }
-    else if (keyJustPressed(mapMenuKey(MENU_KEY_RIGHT)) |
-            keyJustPressed(mapMenuKey(MENU_KEY_LEFT))) {
-        ch->toggleCheat(cheatMenuSelection, !ch->isCheatEnabled(cheatMenuSelection));
-        redraw = true;
-    }
-    else if (keyJustPressed(mapMenuKey(MENU_KEY_R))) {
-        cheatMenuSelection += cheatsPerPage;
-        if (cheatMenuSelection >= numCheats)
-            cheatMenuSelection = 0;
-        redraw = true;
-    }
-    else if (keyJustPressed(mapMenuKey(MENU_KEY_L))) {
-        cheatMenuSelection -= cheatsPerPage;
-        if (cheatMenuSelection < 0)
-            cheatMenuSelection = numCheats-1;
-        redraw = true;
-    }
-    if (keyJustPressed(mapMenuKey(MENU_KEY_B))) {
-        closeSubMenu();
-        if (!cheatMenu_gameboyWasPaused)
-            mgr_unpause();
-    }
-
-    if (redraw)
-        doAtVBlank(redrawCheatMenu);
-}
-
-bool startCheatMenu() {
-    ch = gameboy->getCheatEngine();
-
-    if (ch == NULL || ch->getNumCheats() == 0)
-        return false;
-
-    cheatMenu_gameboyWasPaused = mgr_isPaused();
-    mgr_pause();
-    displaySubMenu(updateCheatMenu);
-    redrawCheatMenu();
-
-    return true;
-}
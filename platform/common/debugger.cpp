@@ -1,5 +1,6 @@
 #ifdef SDL
 #include <SDL.h>
+#include "pipeline.h"
 #endif
 
 #include <cstdio>
@@ -138,7 +139,12 @@ void parseCommand(Gameboy* g, const Registers& regs)
 #ifdef CPU_LOG
             fclose(logFile);
 #endif
+#ifdef SDL
+            // This is the emulation thread; the main thread does the exiting
+            stopEmulationThread();
+#else
             exit(0);
+#endif
         }
         else if (word.compare("b") == 0) {
             stream >> hex >> breakpointAddr;
@@ -13,6 +13,7 @@ extern "C" {
 
 #include <string.h>
 #include <stdlib.h>
+#include <malloc.h>
 #include <stdio.h>
 #include <dirent.h>
 #include <unistd.h>
@@ -28,14 +29,19 @@ extern "C" {
 #include "console.h"
 #include "cheats.h"
 #include "gbs.h"
+#ifdef CPU_PROFILE
+#include "profiler.h"
+#endif
 #include "romfile.h"
 #include "menu.h"
 #include "io.h"
 #include "gbmanager.h"
+#include "telemetry.h"
+#include "trace.h"
 
 const int MAX_WAIT_CYCLES=1000000;
 
-Gameboy::Gameboy() : hram(highram+0xe00), ioRam(highram+0xf00) {
+Gameboy::Gameboy() {
     saveFile=NULL;
 
     romFile = NULL;
@@ -43,20 +49,169 @@ Gameboy::Gameboy() : hram(highram+0xe00), ioRam(highram+0xf00) {
     // private
     resettingGameboy = false;
     framesSinceAutosaveStarted=0;
-
-    externRam = NULL;
+    // init reads it before initMMU sets it
+    biosOn = false;
+    totalCycles = 0;
+
+    arena = NULL;
+    arenaAllocator = NULL;
+    arenaAllocatorData = NULL;
+    pageHashes = NULL;
+    resizeArena(0);
     saveModified = false;
     autosaveStarted = false;
+    numSaveSectors = 0;
+    dirtySectors = NULL;
+    saveFileSectors = NULL;
 
-    cheatEngine = new CheatEngine(this);
+    cheatEngine = NULL;
     soundEngine = new SoundEngine(this);
+    video = &nullVideo;
+    serialOutput = NULL;
+    serialOutputData = NULL;
+    linkCable = NULL;
+    linkCableData = NULL;
+    cpuEngine = CPU_ENGINE_INTERPRETER;
+    singleStep = false;
+    profile = *findRomProfile(NULL);
+
+#ifdef MEM_PROFILE
+    memProfile = NULL;
+#endif
 }
 
 Gameboy::~Gameboy() {
+#ifdef MEM_PROFILE
+    free(memProfile);
+#endif
     unloadRom();
 
     delete cheatEngine;
     delete soundEngine;
+    freeArena(arena);
+    free(pageHashes);
+}
+
+Gameboy* Gameboy::clone() {
+    Gameboy* gb = new Gameboy();
+    gb->copyFrom(this);
+    return gb;
+}
+
+// Everything but the pointers below is plain data, so the whole object is
+// copied at once, followed by the arena.
+void Gameboy::copyFrom(Gameboy* gb) {
+    if (gb == this)
+        return;
+
+    CheatEngine* myCheatEngine = cheatEngine;
+    SoundEngine* mySoundEngine = soundEngine;
+    const VideoSink* myVideo = video;
+    void (*mySerialOutput)(void*, u8) = serialOutput;
+    void* mySerialOutputData = serialOutputData;
+    const LinkCable* myLinkCable = linkCable;
+    void* myLinkCableData = linkCableData;
+    const ArenaAllocator* myArenaAllocator = arenaAllocator;
+    void* myArenaAllocatorData = arenaAllocatorData;
+    int myCpuEngine = cpuEngine;
+    bool mySingleStep = singleStep;
+#ifdef MEM_PROFILE
+    MemoryProfile* myMemProfile = memProfile;
+#endif
+    if (saveFile != NULL)
+        file_close(saveFile);
+    free(dirtySectors);
+    free(saveFileSectors);
+
+    u8* myArena = arena;
+    u64* myPageHashes = pageHashes;
+    if (arenaSize != gb->arenaSize) {
+        myArena = reallocArena(myArena, arenaSize, gb->arenaSize);
+        myPageHashes = (u64*)realloc(myPageHashes, (gb->arenaSize>>DIRTY_PAGE_SHIFT)*sizeof(u64));
+    }
+
+    memcpy((void*)this, (void*)gb, sizeof(Gameboy));
+
+    cheatEngine = myCheatEngine;
+    soundEngine = mySoundEngine;
+    video = myVideo;
+    serialOutput = mySerialOutput;
+    serialOutputData = mySerialOutputData;
+    linkCable = myLinkCable;
+    linkCableData = myLinkCableData;
+    arenaAllocator = myArenaAllocator;
+    arenaAllocatorData = myArenaAllocatorData;
+    cpuEngine = myCpuEngine;
+    singleStep = mySingleStep;
+#ifdef MEM_PROFILE
+    memProfile = myMemProfile;
+#endif
+    saveFile = NULL;
+    autosaveStarted = false;
+    saveModified = false;
+    numSaveSectors = 0;
+    dirtySectors = NULL;
+    saveFileSectors = NULL;
+    linkedGameboy = NULL;
+
+    memcpy(myArena, gb->arena, gb->arenaSize);
+    setArena(myArena, gb->arenaSize);
+    pageHashes = myPageHashes;
+    memcpy(pageHashes, gb->pageHashes, (arenaSize>>DIRTY_PAGE_SHIFT)*sizeof(u64));
+    // The hashes came along with the arena, but anything may have changed
+    memset(dirtyPages, 0xff, sizeof(dirtyPages));
+
+    if (gb->cheatEngine != NULL) {
+        if (cheatEngine == NULL)
+            cheatEngine = new CheatEngine(this);
+        cheatEngine->copyCheats(gb->cheatEngine);
+    }
+    else {
+        delete cheatEngine;
+        cheatEngine = NULL;
+    }
+    soundEngine->copyState(gb->soundEngine);
+}
+
+void Gameboy::restoreFrom(Gameboy* gb) {
+    if (gb == this)
+        return;
+
+    // Cartridge ram that changes is written out like any other write to it
+    if (autoSavingEnabled && dirtySectors != NULL && arenaSize == gb->arenaSize) {
+        for (int pos=0; pos<numSaveSectors*512; pos+=512) {
+            if (memcmp(externRam+pos, gb->externRam+pos, 512) != 0) {
+                dirtySectors[pos/fatBytesPerSector] = true;
+                saveModified = true;
+            }
+        }
+    }
+
+    // Taken out of the way so that copyFrom doesn't close or free them
+    FileHandle* mySaveFile = saveFile;
+    int myNumSaveSectors = numSaveSectors;
+    bool* myDirtySectors = dirtySectors;
+    int* mySaveFileSectors = saveFileSectors;
+    bool mySaveModified = saveModified;
+    bool myAutosaveStarted = autosaveStarted;
+    int myFramesSinceAutosaveStarted = framesSinceAutosaveStarted;
+    Gameboy* myLinkedGameboy = linkedGameboy;
+    saveFile = NULL;
+    dirtySectors = NULL;
+    saveFileSectors = NULL;
+
+    copyFrom(gb);
+
+    saveFile = mySaveFile;
+    numSaveSectors = myNumSaveSectors;
+    dirtySectors = myDirtySectors;
+    saveFileSectors = mySaveFileSectors;
+    saveModified = mySaveModified;
+    autosaveStarted = myAutosaveStarted;
+    framesSinceAutosaveStarted = myFramesSinceAutosaveStarted;
+    linkedGameboy = myLinkedGameboy;
+
+    video->refresh();
 }
 
 void Gameboy::init()
@@ -137,6 +292,7 @@ void Gameboy::init()
     gameboyFrameCounter = 0;
 
     resettingGameboy = false;
+    registersReset = false;
 
     initSND();
     initMMU();
@@ -164,8 +320,7 @@ void Gameboy::init()
     if (gbsMode)
         gbsInit();
 
-    if (isMainGameboy())
-        refreshGFX();
+    video->refresh();
 }
 
 void Gameboy::initGBMode() {
@@ -268,7 +423,10 @@ void Gameboy::checkInput() {
 void Gameboy::updateVBlank() {
     cyclesSinceVBlank = 0;
 
-    gameboy->getSoundEngine()->soundUpdateVBlank();
+    {
+        TRACE_SCOPE("soundUpdateVBlank", this);
+        gameboy->getSoundEngine()->soundUpdateVBlank();
+    }
 
     if (!gbsMode) {
         if (resettingGameboy) {
@@ -288,12 +446,17 @@ void Gameboy::updateVBlank() {
 
         updateAutosave();
 
-        if (cheatEngine->areCheatsEnabled())
+        if (cheatEngine != NULL && cheatEngine->areCheatsEnabled())
             cheatEngine->applyGSCheats();
 
         updateGbPrinter();
     }
 
+#ifdef MEM_PROFILE
+    if (memProfile != NULL)
+        memoryProfilerFrame(this);
+#endif
+
     gameboyFrameCounter++;
 }
 
@@ -305,6 +468,7 @@ void Gameboy::resetGameboy() {
 
 int Gameboy::runEmul()
 {
+    TRACE_SCOPE("runEmul", this);
     emuRet = 0;
     memcpy(&g_gbRegs, &gbRegs, sizeof(Registers));
 
@@ -314,10 +478,15 @@ int Gameboy::runEmul()
     {
         cyclesToEvent -= extraCycles;
         int cycles;
-        if (halt)
+        if (halt) {
             cycles = cyclesToEvent;
+#ifdef CPU_PROFILE
+            if (cpuProfilerEnabled && isMainGameboy())
+                profileHalt(this, cycles);
+#endif
+        }
         else
-            cycles = runOpcode(cyclesToEvent);
+            cycles = runOpcode(singleStep ? 1 : cyclesToEvent);
 
         bool opTriggeredInterrupt = cyclesToExecute == -1;
 
@@ -328,6 +497,7 @@ int Gameboy::runEmul()
 
         cyclesSinceVBlank += cycles;
         cycleCount += cycles>>doubleSpeed;
+        totalCycles += cycles>>doubleSpeed;
 
         // For external clock
         if (cycleToSerialTransfer != -1) {
@@ -336,22 +506,36 @@ int Gameboy::runEmul()
             else {
                 cycleToSerialTransfer = -1;
 
-                if ((ioRam[0x02] & 0x81) == 0x80) {
-                    u8 tmp = ioRam[0x01];
-                    ioRam[0x01] = linkedGameboy->ioRam[0x01];
-                    linkedGameboy->ioRam[0x01] = tmp;
-                    emuRet |= RET_LINK;
-                    // Execution will be passed back to the other gameboy (the 
-                    // internal clock gameboy).
+                bool waiting = (ioRam[0x02] & 0x81) == 0x80;
+                if (linkedGameboy == NULL) {
+                    // The cable may set cycleToSerialTransfer again for its
+                    // next byte. It may also have been unplugged since it last did.
+                    if (linkCable != NULL) {
+                        u8 val = linkCable->clocked(linkCableData, waiting ? ioRam[0x01] : 0xff);
+                        if (waiting) {
+                            ioRam[0x01] = val;
+                            TRACE_INSTANT("serial transfer", this, "received", ioRam[0x01]);
+                        }
+                    }
+                }
+                else {
+                    if (waiting) {
+                        u8 tmp = ioRam[0x01];
+                        ioRam[0x01] = linkedGameboy->ioRam[0x01];
+                        linkedGameboy->ioRam[0x01] = tmp;
+                        TRACE_INSTANT("serial transfer", this, "received", ioRam[0x01]);
+                        emuRet |= RET_LINK;
+                        // Execution will be passed back to the other gameboy (the 
+                        // internal clock gameboy).
+                    }
+                    else
+                        linkedGameboy->ioRam[0x01] = 0xff;
+                    linkedGameboy->ioRam[0x02] &= ~0x80;
                 }
-                else
-                    linkedGameboy->ioRam[0x01] = 0xff;
                 if (ioRam[0x02] & 0x80) {
                     requestInterrupt(INT_SERIAL);
                     ioRam[0x02] &= ~0x80;
                 }
-
-                linkedGameboy->ioRam[0x02] &= ~0x80;
             }
         }
         // For internal clock
@@ -371,19 +555,29 @@ int Gameboy::runEmul()
 
 #ifdef LINK_DEBUG
                     if (isMainGameboy())
-                        printLog("Main: sent packet\n");
+                        printLogAt(LOG_LEVEL_DEBUG, "Main: sent packet\n");
                     else
-                        printLog("Other: sent packet\n");
+                        printLogAt(LOG_LEVEL_DEBUG, "Other: sent packet\n");
 #endif
                     // Execution will stop here, and this gameboy's SB will be 
                     // updated when the other gameboy runs to the appropriate 
                     // cycle.
                 }
+                else if (linkCable != NULL) {
+                    ioRam[0x01] = linkCable->transfer(linkCableData, ioRam[0x01]);
+                    ioRam[0x02] &= ~0x80;
+                }
                 else if (printerEnabled) {
                     ioRam[0x01] = sendGbPrinterByte(ioRam[0x01]);
+                    ioRam[0x02] &= ~0x80;
                 }
-                else
+                else {
+                    if (serialOutput != NULL)
+                        serialOutput(serialOutputData, ioRam[0x01]);
                     ioRam[0x01] = 0xff;
+                    ioRam[0x02] &= ~0x80;
+                }
+                TRACE_INSTANT("serial transfer", this, "received", ioRam[0x01]);
                 requestInterrupt(INT_SERIAL);
             }
             else
@@ -407,6 +601,8 @@ int Gameboy::runEmul()
 
         soundCycles += cycles>>doubleSpeed;
         if (soundCycles >= soundEngine->cyclesToSoundEvent) {
+            TELEMETRY_SCOPE(TEL_APU);
+            TRACE_SCOPE("updateSound", this);
             soundEngine->cyclesToSoundEvent = 10000;
             soundEngine->updateSound(soundCycles);
             soundCycles = 0;
@@ -433,7 +629,15 @@ int Gameboy::runEmul()
             interruptTriggered = ioRam[0x0F] & ioRam[0xFF];
         }
 
+        // A halted cpu gets no cycles the first time round, until the next
+        // event is known
+        if (singleStep && cycles > 0)
+            emuRet |= RET_STEP;
         if (emuRet) {
+#ifdef CHROME_TRACE
+            if (emuRet & RET_LINK)
+                TRACE_INSTANT("link handoff", this, "cycle", cycleCount);
+#endif
             memcpy(&gbRegs, &g_gbRegs, sizeof(Registers));
             return emuRet;
         }
@@ -488,6 +692,7 @@ void Gameboy::checkLYC() {
 
 inline int Gameboy::updateLCD(int cycles)
 {
+    TELEMETRY_SCOPE(TEL_PPU);
     if (!(ioRam[0x40] & 0x80))		// If LCD is off
     {
         scanlineCounter = 456*(doubleSpeed?2:1);
@@ -520,8 +725,10 @@ inline int Gameboy::updateLCD(int cycles)
             {
                 ioRam[0x41]++; // Set mode 3
                 scanlineCounter += 172<<doubleSpeed;
-                if (isMainGameboy())
-                    drawScanline(ioRam[0x44]);
+                {
+                    TRACE_SCOPE_ARG("drawScanline", this, "line", ioRam[0x44]);
+                    video->drawScanline(ioRam[0x44]);
+                }
             }
             break;
         case 3:
@@ -533,8 +740,7 @@ inline int Gameboy::updateLCD(int cycles)
 
                 scanlineCounter += 204<<doubleSpeed;
 
-                if (isMainGameboy())
-                    drawScanline_P2(ioRam[0x44]);
+                video->drawScanline_P2(ioRam[0x44]);
                 if (updateHBlankDMA()) {
                     extraCycles += 8<<doubleSpeed;
                 }
@@ -661,29 +867,44 @@ void Gameboy::setDoubleSpeed(int val) {
 
 void Gameboy::setRomFile(RomFile* r) {
     romFile = r;
-    cheatEngine->setRomFile(r);
+    profile = *findRomProfile(r);
+    if (cheatEngine != NULL)
+        cheatEngine->setRomFile(r);
 
     /*
     if (isMainGameboy()) {
         // Load cheats
         if (gbsMode)
-            cheatEngine->loadCheats("");
+            loadCheats("");
         else {
             char nameBuf[256];
             sprintf(nameBuf, "%s.cht", romFile->getBasename());
-            cheatEngine->loadCheats(nameBuf);
+            loadCheats(nameBuf);
         }
     }
     */
 }
 
+void Gameboy::loadCheats(const char* filename) {
+    if (cheatEngine == NULL)
+        cheatEngine = new CheatEngine(this);
+    cheatEngine->loadCheats(filename);
+}
+
 void Gameboy::unloadRom() {
     gameboySyncAutosave();
     if (saveFile != NULL)
         file_close(saveFile);
     saveFile = NULL;
+    free(dirtySectors);
+    free(saveFileSectors);
+    numSaveSectors = 0;
+    dirtySectors = NULL;
+    saveFileSectors = NULL;
     romFile = NULL;
-    cheatEngine->setRomFile(NULL);
+    profile = *findRomProfile(NULL);
+    if (cheatEngine != NULL)
+        cheatEngine->setRomFile(NULL);
 }
 
 const char *mbcNames[] = {"ROM","MBC1","MBC2","MBC3","MBC4","MBC5","MBC7","HUC1","HUC3"};
@@ -711,14 +932,11 @@ int Gameboy::loadSave(int saveId)
         strcat(savename, buf);
     }
 
-    if (externRam != NULL)
-        free(externRam);
+    resizeArena(getNumSramBanks()*0x2000);
 
     if (getNumSramBanks() == 0)
         return 0;
 
-    externRam = (u8*)malloc(getNumSramBanks()*0x2000);
-
     if (gbsMode || saveId == -1) {
         saveFile = NULL;
         return 0;
@@ -753,6 +971,7 @@ int Gameboy::loadSave(int saveId)
     }
 
     file_read(externRam, 1, 0x2000*getNumSramBanks(), saveFile);
+    markDirtyRange(externRam, 0x2000*getNumSramBanks());
 
     switch (romFile->getMBC()) {
         case MBC3:
@@ -761,6 +980,12 @@ int Gameboy::loadSave(int saveId)
             break;
     }
 
+    free(dirtySectors);
+    free(saveFileSectors);
+    numSaveSectors = getNumSramBanks()*0x2000/512;
+    dirtySectors = (bool*)calloc(numSaveSectors, sizeof(bool));
+    saveFileSectors = (int*)calloc(numSaveSectors, sizeof(int));
+
     // Get the save file's sectors on the sd card.
 
 #ifdef DS
@@ -820,7 +1045,7 @@ int Gameboy::saveGame()
     }
 
     flushFatCache();
-    memset(dirtySectors, 0, sizeof(dirtySectors));
+    memset(dirtySectors, 0, numSaveSectors*sizeof(bool));
 
     return 0;
 }
@@ -893,7 +1118,7 @@ void Gameboy::updateAutosave() {
 
 
 
-const int STATE_VERSION = 5;
+const int STATE_VERSION = 6;
 
 struct StateStruct {
     // version
@@ -924,26 +1149,127 @@ struct StateStruct {
     //   u8 sgbCommand;
     //   u8 gfxMask;
     //   u8[20*18] sgbMap;
+    //   v6:
+    //   u8[16] sgbPacket;
+    //   u8 sgbNumControllers, sgbSelectedController, sgbButtonsChecked;
+    //   int sgbCmdData.numDataSets;
+    //   u8[7] sgbCmdData.attrBlock;
+    // v6
+    //  StateTimeline timeline;
+    //  SoundCounters sound;
 };
 
-void Gameboy::saveState(int stateNum) {
-    if (!isRomLoaded())
-        return;
+void Gameboy::getTimeline(StateTimeline* t) {
+    t->extraCycles = extraCycles;
+    t->interruptTriggered = interruptTriggered;
+    t->cyclesSinceVBlank = cyclesSinceVBlank;
+    t->soundCycles = soundCycles;
+    t->cycleCount = cycleCount;
+    t->cycleToSerialTransfer = cycleToSerialTransfer;
+    t->dmaSource = dmaSource;
+    t->dmaDest = dmaDest;
+    t->dmaLength = dmaLength;
+    t->dmaMode = dmaMode;
+    t->mbc7State = mbc7State;
+    t->mbc7Buffer = mbc7Buffer;
+    t->mbc7RA = mbc7RA;
+}
 
-    FileHandle* outFile;
-    StateStruct state;
-    char statename[100];
+void Gameboy::setTimeline(const StateTimeline* t) {
+    extraCycles = t->extraCycles;
+    interruptTriggered = t->interruptTriggered;
+    cyclesSinceVBlank = t->cyclesSinceVBlank;
+    soundCycles = t->soundCycles;
+    cycleCount = t->cycleCount;
+    cycleToSerialTransfer = t->cycleToSerialTransfer;
+    dmaSource = t->dmaSource;
+    dmaDest = t->dmaDest;
+    dmaLength = t->dmaLength;
+    dmaMode = t->dmaMode;
+    mbc7State = t->mbc7State;
+    mbc7Buffer = t->mbc7Buffer;
+    mbc7RA = t->mbc7RA;
+}
 
-    if (stateNum == -1)
-        sprintf(statename, "%s.yss", romFile->getBasename());
-    else
-        sprintf(statename, "%s.ys%d", romFile->getBasename(), stateNum);
-    outFile = file_open(statename, "w");
+// The counters are declared the same way on every platform, so they're copied
+// out here rather than in each sound engine. The DS has no chanOn.
+void SoundEngine::getCounters(SoundCounters* c) {
+    memset(c, 0, sizeof(SoundCounters));
+    c->cyclesToSoundEvent = cyclesToSoundEvent;
+    c->chan1SweepTime = chan1SweepTime;
+    c->chan1SweepCounter = chan1SweepCounter;
+    c->chan1SweepDir = chan1SweepDir;
+    c->chan1SweepAmount = chan1SweepAmount;
+    memcpy(c->chanLen, chanLen, sizeof(chanLen));
+    memcpy(c->chanLenCounter, chanLenCounter, sizeof(chanLenCounter));
+    memcpy(c->chanUseLen, chanUseLen, sizeof(chanUseLen));
+    memcpy(c->chanFreq, chanFreq, sizeof(chanFreq));
+    memcpy(c->chanVol, chanVol, sizeof(chanVol));
+    memcpy(c->chanEnvDir, chanEnvDir, sizeof(chanEnvDir));
+    memcpy(c->chanEnvCounter, chanEnvCounter, sizeof(chanEnvCounter));
+    memcpy(c->chanEnvSweep, chanEnvSweep, sizeof(chanEnvSweep));
+#ifndef DS
+    memcpy(c->chanOn, chanOn, sizeof(chanOn));
+#endif
+}
 
-    if (outFile == 0) {
-        printMenuMessage("Error opening file for writing.");
-        return;
+void SoundEngine::setCounters(const SoundCounters* c) {
+    cyclesToSoundEvent = c->cyclesToSoundEvent;
+    chan1SweepTime = c->chan1SweepTime;
+    chan1SweepCounter = c->chan1SweepCounter;
+    chan1SweepDir = c->chan1SweepDir;
+    chan1SweepAmount = c->chan1SweepAmount;
+    memcpy(chanLen, c->chanLen, sizeof(chanLen));
+    memcpy(chanLenCounter, c->chanLenCounter, sizeof(chanLenCounter));
+    memcpy(chanUseLen, c->chanUseLen, sizeof(chanUseLen));
+    memcpy(chanFreq, c->chanFreq, sizeof(chanFreq));
+    memcpy(chanVol, c->chanVol, sizeof(chanVol));
+    memcpy(chanEnvDir, c->chanEnvDir, sizeof(chanEnvDir));
+    memcpy(chanEnvCounter, c->chanEnvCounter, sizeof(chanEnvCounter));
+    memcpy(chanEnvSweep, c->chanEnvSweep, sizeof(chanEnvSweep));
+#ifndef DS
+    memcpy(chanOn, c->chanOn, sizeof(chanOn));
+#endif
+}
+
+void StateStream::write(const void* src, int bytes) {
+    if (file != NULL)
+        file_write(src, 1, bytes, file);
+    else if (data != NULL) {
+        if (pos + bytes > size) {
+            pos = size+1; // Leaves pos past the end, which marks the stream as overflowed
+            return;
+        }
+        memcpy(data+pos, src, bytes);
+    }
+    pos += bytes;
+}
+
+bool StateStream::read(void* dest, int bytes) {
+    if (file != NULL) {
+        file_read(dest, 1, bytes, file);
+        return true;
     }
+    if (pos + bytes > size)
+        return false;
+    if (!checkOnly)
+        memcpy(dest, data+pos, bytes);
+    pos += bytes;
+    return true;
+}
+
+// For the values that decide what comes next, which are needed even when
+// only checking
+bool StateStream::readValue(void* dest, int bytes) {
+    bool wasCheckOnly = checkOnly;
+    checkOnly = false;
+    bool ok = read(dest, bytes);
+    checkOnly = wasCheckOnly;
+    return ok;
+}
+
+void Gameboy::saveStateTo(StateStream* out) {
+    StateStruct state;
 
     state.regs = gbRegs;
     state.halt = halt;
@@ -964,79 +1290,101 @@ void Gameboy::saveState(int stateNum) {
     state.serialCounter = serialCounter;
     state.ramEnabled = ramEnabled;
 
-    file_write(&STATE_VERSION, sizeof(int), 1, outFile);
-    file_write((char*)bgPaletteData, 1, sizeof(bgPaletteData), outFile);
-    file_write((char*)sprPaletteData, 1, sizeof(sprPaletteData), outFile);
-    file_write((char*)vram, 1, sizeof(vram), outFile);
-    file_write((char*)wram, 1, sizeof(wram), outFile);
-    file_write((char*)hram, 1, 0x200, outFile);
-    file_write((char*)externRam, 1, 0x2000*getNumSramBanks(), outFile);
+    out->write(&STATE_VERSION, sizeof(int));
+    out->write(bgPaletteData, sizeof(bgPaletteData));
+    out->write(sprPaletteData, sizeof(sprPaletteData));
+    out->write(vram, 2*0x2000);
+    out->write(wram, 8*0x1000);
+    out->write(hram, 0x200);
+    out->write(externRam, 0x2000*getNumSramBanks());
 
-    file_write((char*)&state, 1, sizeof(StateStruct), outFile);
+    out->write(&state, sizeof(StateStruct));
 
     switch (romFile->getMBC()) {
         case HUC3:
-            file_write(&HuC3Mode,  1, sizeof(u8), outFile);
-            file_write(&HuC3Value, 1, sizeof(u8), outFile);
-            file_write(&HuC3Shift, 1, sizeof(u8), outFile);
+            out->write(&HuC3Mode,  sizeof(u8));
+            out->write(&HuC3Value, sizeof(u8));
+            out->write(&HuC3Shift, sizeof(u8));
             break;
     }
 
-    file_write(&sgbMode, 1, sizeof(bool), outFile);
+    out->write(&sgbMode, sizeof(bool));
     if (sgbMode) {
-        file_write(&sgbPacketLength, 1, sizeof(int), outFile);
-        file_write(&sgbPacketsTransferred, 1, sizeof(int), outFile);
-        file_write(&sgbPacketBit, 1, sizeof(int), outFile);
-        file_write(&sgbCommand, 1, sizeof(u8), outFile);
-        file_write(&gfxMask, 1, sizeof(u8), outFile);
-        file_write(sgbMap, 1, sizeof(sgbMap), outFile);
+        out->write(&sgbPacketLength, sizeof(int));
+        out->write(&sgbPacketsTransferred, sizeof(int));
+        out->write(&sgbPacketBit, sizeof(int));
+        out->write(&sgbCommand, sizeof(u8));
+        out->write(&gfxMask, sizeof(u8));
+        out->write(sgbMap, sizeof(sgbMap));
+        out->write(sgbPacket, sizeof(sgbPacket));
+        out->write(&sgbNumControllers, sizeof(u8));
+        out->write(&sgbSelectedController, sizeof(u8));
+        out->write(&sgbButtonsChecked, sizeof(u8));
+        out->write(&sgbCmdData.numDataSets, sizeof(int));
+        out->write(&sgbCmdData.attrBlock, sizeof(sgbCmdData.attrBlock));
     }
 
-    file_close(outFile);
+    StateTimeline timeline;
+    getTimeline(&timeline);
+    out->write(&timeline, sizeof(StateTimeline));
+    SoundCounters sound;
+    soundEngine->getCounters(&sound);
+    out->write(&sound, sizeof(SoundCounters));
 }
 
-int Gameboy::loadState(int stateNum) {
-    if (!isRomLoaded())
-        return 1;
+// Size of a state for this rom; the same for every state, so it can be used
+// to size a buffer for saveStateTo.
+int Gameboy::getStateSize() {
+    StateStream counter = { NULL, NULL, 0, 0 };
+    saveStateTo(&counter);
+    return counter.pos;
+}
+
+// Returns 0 on success, STATE_INCOMPATIBLE or STATE_TRUNCATED otherwise. A
+// state in memory is gone through once without keeping anything first, so a
+// bad one leaves the gameboy as it was; one in a file isn't checked.
+int Gameboy::loadStateFrom(StateStream* in) {
+    if (in->file == NULL) {
+        StateStream check = *in;
+        check.checkOnly = true;
+        int result = readState(&check);
+        if (result != 0)
+            return result;
+    }
+    return readState(in);
+}
 
-    FileHandle *inFile;
+int Gameboy::readState(StateStream* in) {
     StateStruct state;
-    char statename[256];
+    StateTimeline timeline;
+    SoundCounters sound;
     int version;
+    bool newSgbMode = false;
+    bool ok = true;
 
     memset(&state, 0, sizeof(StateStruct));
 
-    if (stateNum == -1)
-        sprintf(statename, "%s.yss", romFile->getBasename());
-    else
-        sprintf(statename, "%s.ys%d", romFile->getBasename(), stateNum);
-    inFile = file_open(statename, "r");
+    if (!in->readValue(&version, sizeof(int)))
+        return STATE_TRUNCATED;
 
-    if (inFile == 0) {
-        printMenuMessage("State doesn't exist.");
-        return 1;
-    }
-
-    file_read(&version, sizeof(int), 1, inFile);
-
-    if (version == 0 || version > STATE_VERSION) {
-        printMenuMessage("State is incompatible.");
-        return 1;
-    }
+    if (version == 0 || version > STATE_VERSION)
+        return STATE_INCOMPATIBLE;
 
-    file_read((char*)bgPaletteData, 1, sizeof(bgPaletteData), inFile);
-    file_read((char*)sprPaletteData, 1, sizeof(sprPaletteData), inFile);
-    file_read((char*)vram, 1, sizeof(vram), inFile);
-    file_read((char*)wram, 1, sizeof(wram), inFile);
-    file_read((char*)hram, 1, 0x200, inFile);
+    ok &= in->read(bgPaletteData, sizeof(bgPaletteData));
+    ok &= in->read(sprPaletteData, sizeof(sprPaletteData));
+    ok &= in->read(vram, 2*0x2000);
+    ok &= in->read(wram, 8*0x1000);
+    ok &= in->read(hram, 0x200);
 
     if (version <= 4 && romFile->getRamSize() == 0x04)
         // Value "0x04" for ram size wasn't interpreted correctly before
-        file_read((char*)externRam, 1, 0x2000*4, inFile);
+        ok &= in->read(externRam, 0x2000*4);
     else
-        file_read((char*)externRam, 1, 0x2000*getNumSramBanks(), inFile);
+        ok &= in->read(externRam, 0x2000*getNumSramBanks());
+    if (!in->checkOnly)
+        markAllDirty();
 
-    file_read((char*)&state, 1, sizeof(StateStruct), inFile);
+    ok &= in->read(&state, sizeof(StateStruct));
 
     /* MBC-specific values have been introduced in v3 */
     if (version >= 3) {
@@ -1044,37 +1392,51 @@ int Gameboy::loadState(int stateNum) {
             case MBC3:
                 if (version == 3) {
                     u8 rtcReg;
-                    file_read(&rtcReg, 1, sizeof(u8), inFile);
-                    if (rtcReg != 0)
+                    ok &= in->read(&rtcReg, sizeof(u8));
+                    if (!in->checkOnly && rtcReg != 0)
                         currentRamBank = rtcReg;
                 }
                 break;
             case HUC3:
-                file_read(&HuC3Mode,  1, sizeof(u8), inFile);
-                file_read(&HuC3Value, 1, sizeof(u8), inFile);
-                file_read(&HuC3Shift, 1, sizeof(u8), inFile);
+                ok &= in->read(&HuC3Mode,  sizeof(u8));
+                ok &= in->read(&HuC3Value, sizeof(u8));
+                ok &= in->read(&HuC3Shift, sizeof(u8));
                 break;
         }
 
-        file_read(&sgbMode, 1, sizeof(bool), inFile);
-        if (sgbMode) {
-            file_read(&sgbPacketLength, 1, sizeof(int), inFile);
-            file_read(&sgbPacketsTransferred, 1, sizeof(int), inFile);
-            file_read(&sgbPacketBit, 1, sizeof(int), inFile);
-            file_read(&sgbCommand, 1, sizeof(u8), inFile);
-            file_read(&gfxMask, 1, sizeof(u8), inFile);
-            file_read(sgbMap, 1, sizeof(sgbMap), inFile);
+        ok &= in->readValue(&newSgbMode, sizeof(bool));
+        if (!in->checkOnly)
+            sgbMode = newSgbMode;
+        if (newSgbMode) {
+            ok &= in->read(&sgbPacketLength, sizeof(int));
+            ok &= in->read(&sgbPacketsTransferred, sizeof(int));
+            ok &= in->read(&sgbPacketBit, sizeof(int));
+            ok &= in->read(&sgbCommand, sizeof(u8));
+            ok &= in->read(&gfxMask, sizeof(u8));
+            ok &= in->read(sgbMap, sizeof(sgbMap));
+            if (version >= 6) {
+                ok &= in->read(sgbPacket, sizeof(sgbPacket));
+                ok &= in->read(&sgbNumControllers, sizeof(u8));
+                ok &= in->read(&sgbSelectedController, sizeof(u8));
+                ok &= in->read(&sgbButtonsChecked, sizeof(u8));
+                ok &= in->read(&sgbCmdData.numDataSets, sizeof(int));
+                ok &= in->read(&sgbCmdData.attrBlock, sizeof(sgbCmdData.attrBlock));
+            }
         }
     }
-    else
+    else if (!in->checkOnly)
         sgbMode = false;
 
-
-    file_close(inFile);
-    if (stateNum == -1) {
-        fs_deleteFile(statename);
+    if (version >= 6) {
+        ok &= in->read(&timeline, sizeof(StateTimeline));
+        ok &= in->read(&sound, sizeof(SoundCounters));
     }
 
+    if (!ok)
+        return STATE_TRUNCATED;
+    if (in->checkOnly)
+        return 0;
+
     gbRegs = state.regs;
     halt = state.halt;
     ime = state.ime;
@@ -1104,13 +1466,88 @@ int Gameboy::loadState(int stateNum) {
     mapMemory();
     setDoubleSpeed(doubleSpeed);
 
+    // Older states didn't keep these, so they start as init() leaves them
+    if (version < 6) {
+        memset(&timeline, 0, sizeof(StateTimeline));
+        timeline.cycleToSerialTransfer = -1;
+        timeline.interruptTriggered = ioRam[0x0F] & ioRam[0xFF];
+        if (sgbMode) {
+            memset(sgbPacket, 0, sizeof(sgbPacket));
+            sgbNumControllers = 1;
+            sgbSelectedController = 0;
+            sgbButtonsChecked = 0;
+            memset(&sgbCmdData, 0, sizeof(sgbCmdData));
+        }
+    }
+    setTimeline(&timeline);
+    resettingGameboy = false;
+
+    video->refresh();
+    soundEngine->refresh();
+    // refresh() starts the counters over from the registers
+    if (version >= 6)
+        soundEngine->setCounters(&sound);
+    else
+        soundEngine->cyclesToSoundEvent = 0;
+
+    return 0;
+}
+
+void Gameboy::saveState(int stateNum) {
+    if (!isRomLoaded())
+        return;
+
+    char statename[100];
+
+    if (stateNum == -1)
+        sprintf(statename, "%s.yss", romFile->getBasename());
+    else
+        sprintf(statename, "%s.ys%d", romFile->getBasename(), stateNum);
+    FileHandle* outFile = file_open(statename, "w");
+
+    if (outFile == 0) {
+        printMenuMessage("Error opening file for writing.");
+        return;
+    }
+
+    StateStream out = { outFile, NULL, 0, 0 };
+    saveStateTo(&out);
+
+    file_close(outFile);
+}
+
+int Gameboy::loadState(int stateNum) {
+    if (!isRomLoaded())
+        return 1;
+
+    char statename[256];
+
+    if (stateNum == -1)
+        sprintf(statename, "%s.yss", romFile->getBasename());
+    else
+        sprintf(statename, "%s.ys%d", romFile->getBasename(), stateNum);
+    FileHandle* inFile = file_open(statename, "r");
+
+    if (inFile == 0) {
+        printMenuMessage("State doesn't exist.");
+        return 1;
+    }
+
+    StateStream in = { inFile, NULL, 0, 0 };
+    int result = loadStateFrom(&in);
+
+    file_close(inFile);
+    if (result != 0) {
+        printMenuMessage("State is incompatible.");
+        return 1;
+    }
+    if (stateNum == -1) {
+        fs_deleteFile(statename);
+    }
 
     if (autoSavingEnabled && stateNum != -1)
         saveGame(); // Synchronize save file on sd with file in ram
 
-    refreshGFX();
-    soundEngine->refresh();
-
     return 0;
 }
 
@@ -1131,7 +1568,8 @@ void Gameboy::deleteState(int stateNum) {
 }
 
 bool Gameboy::checkStateExists(int stateNum) {
-    if (!isRomLoaded())
+    // Roms loaded from memory without a name don't keep anything on disk
+    if (!isRomLoaded() || romFile->getBasename()[0] == '\0')
         return false;
 
     char statename[MAX_FILENAME_LEN];
@@ -13,10 +13,15 @@
 #include "soundengine.h"
 #include "gameboy.h"
 #include "main.h"
+#include "telemetry.h"
+#include "trace.h"
 
 #ifdef CPU_DEBUG
 #include "debugger.h"
 #endif
+#ifdef CPU_PROFILE
+#include "profiler.h"
+#endif
 
 
 #define FLAG_Z 0x80
@@ -36,7 +41,6 @@
 #define zeroSet()	(locF & 0x80)
 #define negativeSet()	(locF & 0x40)
 #define halfSet()		(locF & 0x20)
-#define numberedGbReg(n)	((u8 *) &g_gbRegs + reg8Offsets[n])
 
 #define carryBit() 	(locF & 0x10 ? 1 : 0)
 
@@ -119,6 +123,10 @@ int Gameboy::handleInterrupts(unsigned int interruptTriggered)
 {
     const u16 isrVectors[] = { 0x40, 0x48, 0x50, 0x58, 0x60 };
     /* Halt state is always reset */
+#ifdef CHROME_TRACE
+    if (halt)
+        TRACE_INSTANT("halt exit", this, "flags", interruptTriggered);
+#endif
     halt = 0;
     /* Avoid processing irqs */
     if (!ime) {
@@ -127,18 +135,18 @@ int Gameboy::handleInterrupts(unsigned int interruptTriggered)
 
     ime = 0;
 
-#ifdef SPEEDHAX
-    quickWrite(--g_gbRegs.sp.w, g_gbRegs.pc.b.h);
-    quickWrite(--g_gbRegs.sp.w, g_gbRegs.pc.b.l);
-#else
     writeMemory(--g_gbRegs.sp.w, g_gbRegs.pc.b.h);
     writeMemory(--g_gbRegs.sp.w, g_gbRegs.pc.b.l);
-#endif
 
     /* __builtin_ffs returns the first bit set plus one */
     int irqNo = __builtin_ffs(interruptTriggered) - 1;
     /* Jump to the vector */
     g_gbRegs.pc.w = isrVectors[irqNo];
+    TRACE_INSTANT("interrupt", this, "vector", g_gbRegs.pc.w);
+#ifdef CPU_PROFILE
+    if (cpuProfilerEnabled && isMainGameboy())
+        profileCall(this, g_gbRegs.pc.w, g_gbRegs.sp.w);
+#endif
     /* Clear the IF bit */
     ioRam[0x0F] &= ~(1<<irqNo);
 
@@ -146,28 +154,25 @@ int Gameboy::handleInterrupts(unsigned int interruptTriggered)
     return 20;
 }
 
-const u8 reg8Offsets[]
-#ifdef DS
-DTCM_DATA
-#endif
-= {
-    offsetof(struct Registers, bc.b.h),
-    offsetof(struct Registers, bc.b.l),
-    offsetof(struct Registers, de.b.h),
-    offsetof(struct Registers, de.b.l),
-    offsetof(struct Registers, hl.b.h),
-    offsetof(struct Registers, hl.b.l),
-    0,
-    offsetof(struct Registers, af.b.h)
-};
-
-#define setPC(val) { g_gbRegs.pc.w = (val); pcAddr = &memory[(g_gbRegs.pc.w)>>12][(g_gbRegs.pc.w)&0xfff]; firstPcAddr=pcAddr;} 
-#define getPC() (g_gbRegs.pc.w+(pcAddr-firstPcAddr))
+// pcEnd is the last byte of pcAddr's page an opcode can start at and still
+// have its operands in the page
+#define setPC(val) { locPC = (val); pcAddr = &memory[locPC>>12][locPC&0xfff]; firstPcAddr=pcAddr; \
+                     pcEnd = pcAddr + (0xffd - (locPC&0xfff));}
+#define getPC() (locPC+(pcAddr-firstPcAddr))
 #define readPC() *(pcAddr++)
 #define readPC_noinc() (*pcAddr)
 #define readPC16() ((*pcAddr) | ((*(pcAddr+1))<<8)); pcAddr += 2
 #define readPC16_noinc() ((*pcAddr) | ((*(pcAddr+1))<<8))
 
+#ifdef CPU_PROFILE
+// Shadow call stack upkeep; only the profiled instantiation of runOpcode pays for these
+#define PROFILE_CALL()  if (profiling) profileCall(this, getPC(), locSP)
+#define PROFILE_RET()   if (profiling) profileReturn(this, locSP)
+#else
+#define PROFILE_CALL()
+#define PROFILE_RET()
+#endif
+
 #define OP_JR(cond)  \
                 if (cond) { \
                     setPC((getPC()+(s8)readPC_noinc()+1)&0xffff); \
@@ -177,6 +182,166 @@ DTCM_DATA
                     totalCycles -= 4; \
                 }
 
+// Instructions which come in one opcode for each of B, C, D, E, H and L. Each
+// opcode gets its own case, so "reg" is always a local variable.
+
+#define OP_ADD(reg) { \
+    locF = 0; \
+    u8 r = reg; \
+    if (locA + r > 0xFF) \
+        setCFlag(); \
+    if ((locA & 0xF) + (r & 0xF) > 0xF) \
+        setHFlag(); \
+    locA += r; \
+    if (locA == 0) \
+        setZFlag(); \
+}
+#define OP_ADC(reg) { \
+    int val = carryBit(); \
+    locF = 0; \
+    u8 r = reg; \
+    if (locA + r + val > 0xFF) \
+        setCFlag(); \
+    if ((locA & 0xF) + (r & 0xF) + val > 0xF) \
+        setHFlag(); \
+    locA += r + val; \
+    if (locA == 0) \
+        setZFlag(); \
+}
+#define OP_SUB(reg) { \
+    locF = FLAG_N; \
+    u8 r = reg; \
+    if (locA < r) \
+        setCFlag(); \
+    if ((locA & 0xF) < (r & 0xF)) \
+        setHFlag(); \
+    locA -= r; \
+    if (locA == 0) \
+        setZFlag(); \
+}
+#define OP_SBC(reg) { \
+    u8 r = reg; \
+    int val2 = carryBit(); \
+    locF = FLAG_N; \
+    if (locA < r + val2) \
+        setCFlag(); \
+    if ((locA & 0xF) < (r & 0xF) + val2) \
+        setHFlag(); \
+    locA -= (r + val2); \
+    if (locA == 0) \
+        setZFlag(); \
+}
+#define OP_AND(reg) { \
+    locF = FLAG_H; \
+    locA &= reg; \
+    if (locA == 0) \
+        setZFlag(); \
+}
+#define OP_OR(reg) { \
+    locF = 0; \
+    locA |= reg; \
+    if (locA == 0) \
+        setZFlag(); \
+}
+#define OP_XOR(reg) { \
+    locF = 0; \
+    locA ^= reg; \
+    if (locA == 0) \
+        setZFlag(); \
+}
+#define OP_CP(reg) { \
+    locF = FLAG_N; \
+    u8 r = reg; \
+    if (locA < r) \
+        setCFlag(); \
+    if ((locA & 0xF) < (r & 0xF)) \
+        setHFlag(); \
+    if (locA - r == 0) \
+        setZFlag(); \
+}
+#define OP_INC(reg) { \
+    locF &= FLAG_C; \
+    reg++; \
+    u8 r = reg; \
+    if (r == 0) \
+        setZFlag(); \
+    if ((r & 0xF) == 0) \
+        setHFlag(); \
+}
+#define OP_DEC(reg) { \
+    locF &= FLAG_C; \
+    reg--; \
+    u8 r = reg; \
+    if (r == 0) \
+        setZFlag(); \
+    if ((r & 0xF) == 0xF) \
+        setHFlag(); \
+    setNFlag(); \
+}
+
+// The rotates and shifts on the CB page, numbered by bits 3-5 of the opcode.
+// Each gets its own instance of cbShift, so "op" is folded away.
+enum {
+    CB_RLC = 0,
+    CB_RRC,
+    CB_RL,
+    CB_RR,
+    CB_SLA,
+    CB_SRA,
+    CB_SWAP,
+    CB_SRL
+};
+
+template <int op>
+static inline u8 cbShift(u8 val, int& locF) {
+    int carryIn = carryBit();
+    u8 r;
+    bool carry;
+    switch (op) {
+        case CB_RLC:
+            r = (val << 1) | (val >> 7);
+            carry = val & 0x80;
+            break;
+        case CB_RRC:
+            r = (val >> 1) | (val << 7);
+            carry = val & 1;
+            break;
+        case CB_RL:
+            r = (val << 1) | carryIn;
+            carry = val & 0x80;
+            break;
+        case CB_RR:
+            r = (val >> 1) | (carryIn << 7);
+            carry = val & 1;
+            break;
+        case CB_SLA:
+            r = val << 1;
+            carry = val & 0x80;
+            break;
+        case CB_SRA:
+            r = (val >> 1) | (val & 0x80);
+            carry = val & 1;
+            break;
+        case CB_SWAP:
+            r = (val << 4) | (val >> 4);
+            carry = false;
+            break;
+        default: // CB_SRL
+            r = val >> 1;
+            carry = val & 1;
+            break;
+    }
+    locF = 0;
+    if (carry)
+        setCFlag();
+    if (r == 0)
+        setZFlag();
+    return r;
+}
+
+#ifdef GY_CORE
+thread_local
+#endif
 struct Registers g_gbRegs
 #ifdef DS
 DTCM_BSS
@@ -189,36 +354,88 @@ DTCM_BSS
 #endif
 ;
 
-u8* haltBugAddr
-#ifdef DS
-DTCM_BSS
-#endif
-= NULL;
-
-u8* firstPcAddr
-#ifdef DS
-DTCM_BSS
+int Gameboy::runOpcode(int cycles) {
+    TELEMETRY_SCOPE(TEL_CPU);
+#ifdef CPU_PROFILE
+    if (cpuProfilerEnabled && isMainGameboy())
+        return runOpcodes<true>(cycles);
 #endif
-;
+    switch (cpuEngine) {
+        case CPU_ENGINE_INTERPRETER:
+        default:
+            return runOpcodes<false>(cycles);
+    }
+}
 
-int Gameboy::runOpcode(int cycles) {
+template <bool profiling>
+int Gameboy::runOpcodes(int cycles) {
     cyclesToExecute = cycles;
-    // Having these commonly-used registers in local variables should improve speed
-    register u8* pcAddr;
-    pcAddr = memory[g_gbRegs.pc.w>>12]+(g_gbRegs.pc.w&0xfff);
-    firstPcAddr = pcAddr;
-    int locSP=g_gbRegs.sp.w;
-    int  locF =g_gbRegs.af.b.l;
-
-    register int totalCycles=0;
-
+    // All of the registers are kept in local variables while the loop runs,
+    // and only written back to g_gbRegs when it exits.
+    // pcAddr points at the next opcode; the pc is locPC plus however far it
+    // has moved since firstPcAddr.
+    int locPC;
+    u8* pcAddr;
+    u8* firstPcAddr;
+    u8* pcEnd;
+    setPC(g_gbRegs.pc.w);
+    int locSP = g_gbRegs.sp.w;
+    int locF = g_gbRegs.af.b.l;
+    u8 locA = g_gbRegs.af.b.h;
+    Register locBC = g_gbRegs.bc;
+    Register locDE = g_gbRegs.de;
+    Register locHL = g_gbRegs.hl;
+
+    int totalCycles=0;
+    // Holds the opcode at the end of a page and what comes after it, or the
+    // one after a halt with the halt bug
+    u8 pageCrossing[3];
+
+run:
     while (totalCycles < cyclesToExecute)
     {
 #ifdef CPU_DEBUG
         setPC(getPC());
+        g_gbRegs.pc.w = locPC;
         g_gbRegs.sp.w = locSP;
         g_gbRegs.af.b.l = locF;
+        g_gbRegs.af.b.h = locA;
+        g_gbRegs.bc = locBC;
+        g_gbRegs.de = locDE;
+        g_gbRegs.hl = locHL;
         runDebugger(this, g_gbRegs);
+        // The debugger can change registers
+        locA = g_gbRegs.af.b.h;
+        locBC = g_gbRegs.bc;
+        locDE = g_gbRegs.de;
+        locHL = g_gbRegs.hl;
+#endif
+        // pcAddr only points into one page, so near its end the bytes are
+        // read the slow way, instead of off the end of whatever holds it.
+        // Opcodes run from pageCrossing one at a time: with pcEnd at its
+        // start, the next one comes back here.
+        if (pcAddr > pcEnd) {
+            int pc = getPC() & 0xffff;
+            if ((pc&0xfff) > 0xffd) {
+                for (int i=0; i<3; i++)
+                    pageCrossing[i] = quickRead((pc+i)&0xffff);
+                locPC = pc;
+                pcAddr = firstPcAddr = pcEnd = pageCrossing;
+            }
+            else
+                setPC(pc);
+        }
+#ifdef CPU_PROFILE
+        // Taken before the opcode runs, since it may jump or switch banks
+        int profPC = 0, profBank = 0, profCycles = 0;
+        u8 profOpcode = 0, profCbOpcode = 0;
+        if (profiling) {
+            profPC = getPC();
+            profBank = getBank(profPC);
+            profOpcode = pcAddr[0];
+            profCbOpcode = pcAddr[1];
+            profCycles = totalCycles;
+        }
 #endif
         u8 opcode = *pcAddr;
         pcAddr++;
@@ -228,15 +445,25 @@ int Gameboy::runOpcode(int cycles) {
         {
             // 8-bit loads
             case 0x06:		// LD B, n		8
+                locBC.b.h = readPC();
+                break;
             case 0x0E:		// LD C, n		8
+                locBC.b.l = readPC();
+                break;
             case 0x16:		// LD D, n		8
+                locDE.b.h = readPC();
+                break;
             case 0x1E:		// LD E, n		8
+                locDE.b.l = readPC();
+                break;
             case 0x26:		// LD H, n		8
+                locHL.b.h = readPC();
+                break;
             case 0x2E:		// LD L, n		8
-                (*numberedGbReg(opcode>>3)) = readPC();
+                locHL.b.l = readPC();
                 break;
             case 0x3E:		// LD A, n		8
-                g_gbRegs.af.b.h = readPC();
+                locA = readPC();
                 break;
                 /* These are equivalent to NOPs. */
             case 0x7F:		// LD A, A		4
@@ -248,162 +475,240 @@ int Gameboy::runOpcode(int cycles) {
             case 0x6D:		// LD L, L		4
                 break;
             case 0x78:		// LD A, B		4
-                g_gbRegs.af.b.h = g_gbRegs.bc.b.h;
+                locA = locBC.b.h;
                 break;
             case 0x79:		// LD A, C		4
-                g_gbRegs.af.b.h = g_gbRegs.bc.b.l;
+                locA = locBC.b.l;
                 break;
             case 0x7A:		// LD A, D		4
-                g_gbRegs.af.b.h = g_gbRegs.de.b.h;
+                locA = locDE.b.h;
                 break;
             case 0x7B:		// LD A, E		4
-                g_gbRegs.af.b.h = g_gbRegs.de.b.l;
+                locA = locDE.b.l;
                 break;
             case 0x7C:		// LD A, H		4
-                g_gbRegs.af.b.h = g_gbRegs.hl.b.h;
+                locA = locHL.b.h;
                 break;
             case 0x7D:		// LD A, L		4
-                g_gbRegs.af.b.h = g_gbRegs.hl.b.l;
+                locA = locHL.b.l;
                 break;
             case 0x41:		// LD B, C		4
+                locBC.b.h = locBC.b.l;
+                break;
             case 0x42:		// LD B, D		4
+                locBC.b.h = locDE.b.h;
+                break;
             case 0x43:		// LD B, E		4
+                locBC.b.h = locDE.b.l;
+                break;
             case 0x44:		// LD B, H		4
+                locBC.b.h = locHL.b.h;
+                break;
             case 0x45:		// LD B, L		4
+                locBC.b.h = locHL.b.l;
+                break;
             case 0x48:		// LD C, B		4
+                locBC.b.l = locBC.b.h;
+                break;
             case 0x4A:		// LD C, D		4
+                locBC.b.l = locDE.b.h;
+                break;
             case 0x4B:		// LD C, E		4
+                locBC.b.l = locDE.b.l;
+                break;
             case 0x4C:		// LD C, H		4
+                locBC.b.l = locHL.b.h;
+                break;
             case 0x4D:		// LD C, L		4
+                locBC.b.l = locHL.b.l;
+                break;
             case 0x50:		// LD D, B		4
+                locDE.b.h = locBC.b.h;
+                break;
             case 0x51:		// LD D, C		4
+                locDE.b.h = locBC.b.l;
+                break;
             case 0x53:		// LD D, E		4
+                locDE.b.h = locDE.b.l;
+                break;
             case 0x54:		// LD D, H		4
+                locDE.b.h = locHL.b.h;
+                break;
             case 0x55:		// LD D, L		4
+                locDE.b.h = locHL.b.l;
+                break;
             case 0x58:		// LD E, B		4
+                locDE.b.l = locBC.b.h;
+                break;
             case 0x59:		// LD E, C		4
+                locDE.b.l = locBC.b.l;
+                break;
             case 0x5A:		// LD E, D		4
+                locDE.b.l = locDE.b.h;
+                break;
             case 0x5C:		// LD E, H		4
+                locDE.b.l = locHL.b.h;
+                break;
             case 0x5D:		// LD E, L		4
+                locDE.b.l = locHL.b.l;
+                break;
             case 0x60:		// LD H, B		4
+                locHL.b.h = locBC.b.h;
+                break;
             case 0x61:		// LD H, C		4
+                locHL.b.h = locBC.b.l;
+                break;
             case 0x62:		// LD H, D		4
+                locHL.b.h = locDE.b.h;
+                break;
             case 0x63:		// LD H, E		4
+                locHL.b.h = locDE.b.l;
+                break;
             case 0x65:		// LD H, L		4
+                locHL.b.h = locHL.b.l;
+                break;
             case 0x68:		// LD L, B		4
+                locHL.b.l = locBC.b.h;
+                break;
             case 0x69:		// LD L, C		4
+                locHL.b.l = locBC.b.l;
+                break;
             case 0x6A:		// LD L, D		4
+                locHL.b.l = locDE.b.h;
+                break;
             case 0x6B:		// LD L, E		4
+                locHL.b.l = locDE.b.l;
+                break;
             case 0x6C:		// LD L, H		4
-                (*numberedGbReg((opcode>>3)&7)) = *numberedGbReg(opcode&7);
+                locHL.b.l = locHL.b.h;
                 break;
             case 0x47:		// LD B, A		4
-                g_gbRegs.bc.b.h = g_gbRegs.af.b.h;
+                locBC.b.h = locA;
                 break;
             case 0x4F:		// LD C, A		4
-                g_gbRegs.bc.b.l = g_gbRegs.af.b.h;
+                locBC.b.l = locA;
                 break;
             case 0x57:		// LD D, A		4
-                g_gbRegs.de.b.h = g_gbRegs.af.b.h;
+                locDE.b.h = locA;
                 break;
             case 0x5F:		// LD E, A		4
-                g_gbRegs.de.b.l = g_gbRegs.af.b.h;
+                locDE.b.l = locA;
                 break;
             case 0x67:		// LD H, A		4
-                g_gbRegs.hl.b.h = g_gbRegs.af.b.h;
+                locHL.b.h = locA;
                 break;
             case 0x6F:		// LD L, A		4
-                g_gbRegs.hl.b.l = g_gbRegs.af.b.h;
+                locHL.b.l = locA;
                 break;
             case 0x7E:		// LD A, (hl)	8
-                g_gbRegs.af.b.h = readMemory(g_gbRegs.hl.w);
+                locA = readMemory(locHL.w);
                 break;
             case 0x46:		// LD B, (hl)	8
+                locBC.b.h = readMemory(locHL.w);
+                break;
             case 0x4E:		// LD C, (hl)	8
+                locBC.b.l = readMemory(locHL.w);
+                break;
             case 0x56:		// LD D, (hl)	8
+                locDE.b.h = readMemory(locHL.w);
+                break;
             case 0x5E:		// LD E, (hl)	8
+                locDE.b.l = readMemory(locHL.w);
+                break;
             case 0x66:		// LD H, (hl)	8
+                locHL.b.h = readMemory(locHL.w);
+                break;
             case 0x6E:		// LD L, (hl)	8
-                (*numberedGbReg((opcode>>3)&7)) = readMemory(g_gbRegs.hl.w);
+                locHL.b.l = readMemory(locHL.w);
                 break;
             case 0x77:		// LD (hl), A	8
-                writeMemory(g_gbRegs.hl.w, g_gbRegs.af.b.h);
+                writeMemory(locHL.w, locA);
                 break;
             case 0x70:		// LD (hl), B	8
+                writeMemory(locHL.w, locBC.b.h);
+                break;
             case 0x71:		// LD (hl), C	8
+                writeMemory(locHL.w, locBC.b.l);
+                break;
             case 0x72:		// LD (hl), D	8
+                writeMemory(locHL.w, locDE.b.h);
+                break;
             case 0x73:		// LD (hl), E	8
+                writeMemory(locHL.w, locDE.b.l);
+                break;
             case 0x74:		// LD (hl), H	8
+                writeMemory(locHL.w, locHL.b.h);
+                break;
             case 0x75:		// LD (hl), L	8
-                writeMemory(g_gbRegs.hl.w, *numberedGbReg(opcode&7));
+                writeMemory(locHL.w, locHL.b.l);
                 break;
             case 0x36:		// LD (hl), n	12
-                writeMemory(g_gbRegs.hl.w, readPC_noinc());
+                writeMemory(locHL.w, readPC_noinc());
                 pcAddr++;
                 break;
             case 0x0A:		// LD A, (BC)	8
-                g_gbRegs.af.b.h = readMemory(g_gbRegs.bc.w);
+                locA = readMemory(locBC.w);
                 break;
             case 0x1A:		// LD A, (de)	8
-                g_gbRegs.af.b.h = readMemory(g_gbRegs.de.w);
+                locA = readMemory(locDE.w);
                 break;
             case 0xFA:		// LD A, (nn)	16
-                g_gbRegs.af.b.h = readMemory(readPC16_noinc());
+                locA = readMemory(readPC16_noinc());
                 pcAddr += 2;
                 break;
             case 0x02:		// LD (BC), A	8
-                writeMemory(g_gbRegs.bc.w, g_gbRegs.af.b.h);
+                writeMemory(locBC.w, locA);
                 break;
             case 0x12:		// LD (de), A	8
-                writeMemory(g_gbRegs.de.w, g_gbRegs.af.b.h);
+                writeMemory(locDE.w, locA);
                 break;
             case 0xEA:		// LD (nn), A	16
-                writeMemory(readPC16_noinc(), g_gbRegs.af.b.h);
+                writeMemory(readPC16_noinc(), locA);
                 pcAddr += 2;
                 break;
             case 0xF2:		// LDH A, (C)	8
-                g_gbRegs.af.b.h = readIO(g_gbRegs.bc.b.l);
+                locA = readIO(locBC.b.l);
                 break;
             case 0xE2:		// LDH (C), A	8
-                writeIO(g_gbRegs.bc.b.l, g_gbRegs.af.b.h);
+                writeIO(locBC.b.l, locA);
                 break;
             case 0x3A:		// LDD A, (hl)	8
-                g_gbRegs.af.b.h = readMemory(g_gbRegs.hl.w--);
+                locA = readMemory(locHL.w--);
                 break;
             case 0x32:		// LDD (hl), A	8
-                writeMemory(g_gbRegs.hl.w--, g_gbRegs.af.b.h);
+                writeMemory(locHL.w--, locA);
                 break;
             case 0x2A:		// LDI A, (hl)	8
-                g_gbRegs.af.b.h = readMemory(g_gbRegs.hl.w++);
+                locA = readMemory(locHL.w++);
                 break;
             case 0x22:		// LDI (hl), A	8
-                writeMemory(g_gbRegs.hl.w++, g_gbRegs.af.b.h);
+                writeMemory(locHL.w++, locA);
                 break;
             case 0xE0:		// LDH (n), A   12
-                writeIO(readPC_noinc(), g_gbRegs.af.b.h);
+                writeIO(readPC_noinc(), locA);
                 pcAddr++;
                 break;
             case 0xF0:		// LDH A, (n)   12
-                g_gbRegs.af.b.h = readIO(readPC_noinc());
+                locA = readIO(readPC_noinc());
                 pcAddr++;
                 break;
 
                 // 16-bit loads
 
             case 0x01:		// LD BC, nn	12
-                g_gbRegs.bc.w = readPC16();
+                locBC.w = readPC16();
                 break;
             case 0x11:		// LD de, nn	12
-                g_gbRegs.de.w = readPC16();
+                locDE.w = readPC16();
                 break;
             case 0x21:		// LD hl, nn	12
-                g_gbRegs.hl.w = readPC16();
+                locHL.w = readPC16();
                 break;
             case 0x31:		// LD SP, nn	12
                 locSP = readPC16();
                 break;
             case 0xF9:		// LD SP, hl	8
-                locSP = g_gbRegs.hl.w;
+                locSP = locHL.w;
                 break;
             case 0xF8:		// LDHL SP, n   12
                 {
@@ -413,7 +718,7 @@ int Gameboy::runOpcode(int cycles) {
                         setCFlag();
                     if ((locSP&0xF)+(val&0xF) > 0xF)
                         setHFlag();
-                    g_gbRegs.hl.w = locSP+(s8)val;
+                    locHL.w = locSP+(s8)val;
                     break;
                 }
             case 0x08:		// LD (nn), SP	20
@@ -424,57 +729,37 @@ int Gameboy::runOpcode(int cycles) {
                     break;
                 }
             case 0xF5:		// PUSH AF
-#ifdef SPEEDHAX
-                quickWrite(--locSP, g_gbRegs.af.b.h);
-                quickWrite(--locSP, locF);
-#else
-                writeMemory(--locSP, g_gbRegs.af.b.h);
+                writeMemory(--locSP, locA);
                 writeMemory(--locSP, locF);
-#endif
                 break;
                 // Some games use the stack in exotic ways.
                 // Better to use writeMemory than writeMemory.
             case 0xC5:		// PUSH BC			16
-#ifdef SPEEDHAX
-                quickWrite(--locSP, g_gbRegs.bc.b.h);
-                quickWrite(--locSP, g_gbRegs.bc.b.l);
-#else
-                writeMemory(--locSP, g_gbRegs.bc.b.h);
-                writeMemory(--locSP, g_gbRegs.bc.b.l);
-#endif
+                writeMemory(--locSP, locBC.b.h);
+                writeMemory(--locSP, locBC.b.l);
                 break;
             case 0xD5:		// PUSH de			16
-#ifdef SPEEDHAX
-                quickWrite(--locSP, g_gbRegs.de.b.h);
-                quickWrite(--locSP, g_gbRegs.de.b.l);
-#else
-                writeMemory(--locSP, g_gbRegs.de.b.h);
-                writeMemory(--locSP, g_gbRegs.de.b.l);
-#endif
+                writeMemory(--locSP, locDE.b.h);
+                writeMemory(--locSP, locDE.b.l);
                 break;
             case 0xE5:		// PUSH hl			16
-#ifdef SPEEDHAX
-                quickWrite(--locSP, g_gbRegs.hl.b.h);
-                quickWrite(--locSP, g_gbRegs.hl.b.l);
-#else
-                writeMemory(--locSP, g_gbRegs.hl.b.h);
-                writeMemory(--locSP, g_gbRegs.hl.b.l);
-#endif
+                writeMemory(--locSP, locHL.b.h);
+                writeMemory(--locSP, locHL.b.l);
                 break;
             case 0xF1:		// POP AF				12
                 locF = quickRead(locSP++) & 0xF0;
-                g_gbRegs.af.b.h = quickRead(locSP++);
+                locA = quickRead(locSP++);
                 break;
             case 0xC1:		// POP BC				12
-                g_gbRegs.bc.w = quickRead16(locSP);
+                locBC.w = quickRead16(locSP);
                 locSP += 2;
                 break;
             case 0xD1:		// POP de				12
-                g_gbRegs.de.w = quickRead16(locSP);
+                locDE.w = quickRead16(locSP);
                 locSP += 2;
                 break;
             case 0xE1:		// POP hl				12
-                g_gbRegs.hl.w = quickRead16(locSP);
+                locHL.w = quickRead16(locSP);
                 locSP += 2;
                 break;
 
@@ -482,44 +767,44 @@ int Gameboy::runOpcode(int cycles) {
             case 0x87:		// ADD A, A			4
                 {
                     locF = 0;
-                    u8 r = g_gbRegs.af.b.h;
+                    u8 r = locA;
                     if (r + r > 0xFF)
                         setCFlag();
                     if ((r & 0xF) + (r & 0xF) > 0xF)
                         setHFlag();
-                    g_gbRegs.af.b.h += r;
-                    if (g_gbRegs.af.b.h == 0)
+                    locA += r;
+                    if (locA == 0)
                         setZFlag();
                     break;
                 }
             case 0x80:		// ADD A, B			4
+                OP_ADD(locBC.b.h);
+                break;
             case 0x81:		// ADD A, C			4
+                OP_ADD(locBC.b.l);
+                break;
             case 0x82:		// ADD A, D			4
+                OP_ADD(locDE.b.h);
+                break;
             case 0x83:		// ADD A, E			4
+                OP_ADD(locDE.b.l);
+                break;
             case 0x84:		// ADD A, H			4
+                OP_ADD(locHL.b.h);
+                break;
             case 0x85:		// ADD A, L			4
-                {
-                    locF = 0;
-                    u8 r = *numberedGbReg(opcode&7);
-                    if (g_gbRegs.af.b.h + r > 0xFF)
-                        setCFlag();
-                    if ((g_gbRegs.af.b.h & 0xF) + (r & 0xF) > 0xF)
-                        setHFlag();
-                    g_gbRegs.af.b.h += r;
-                    if (g_gbRegs.af.b.h == 0)
-                        setZFlag();
-                    break;
-                }
+                OP_ADD(locHL.b.l);
+                break;
             case 0x86:		// ADD A, (hl)	8
                 {
                     locF = 0;
-                    int val = readMemory(g_gbRegs.hl.w);
-                    if (g_gbRegs.af.b.h + val > 0xFF)
+                    int val = readMemory(locHL.w);
+                    if (locA + val > 0xFF)
                         setCFlag();
-                    if ((g_gbRegs.af.b.h & 0xF) + (val & 0xF) > 0xF)
+                    if ((locA & 0xF) + (val & 0xF) > 0xF)
                         setHFlag();
-                    g_gbRegs.af.b.h += val;
-                    if (g_gbRegs.af.b.h == 0)
+                    locA += val;
+                    if (locA == 0)
                         setZFlag();
                     break;
                 }
@@ -527,12 +812,12 @@ int Gameboy::runOpcode(int cycles) {
                 {
                     locF = 0;
                     int val = readPC();
-                    if (g_gbRegs.af.b.h + val > 0xFF)
+                    if (locA + val > 0xFF)
                         setCFlag();
-                    if ((g_gbRegs.af.b.h & 0xF) + (val & 0xF) > 0xF)
+                    if ((locA & 0xF) + (val & 0xF) > 0xF)
                         setHFlag();
-                    g_gbRegs.af.b.h += val;
-                    if (g_gbRegs.af.b.h == 0)
+                    locA += val;
+                    if (locA == 0)
                         setZFlag();
                     break;
                 }
@@ -542,46 +827,45 @@ int Gameboy::runOpcode(int cycles) {
                 {
                     int val = carryBit();
                     locF = 0;
-                    u8 r = g_gbRegs.af.b.h;
+                    u8 r = locA;
                     if (r + r + val > 0xFF)
                         setCFlag();
                     if ((r & 0xF) + (r & 0xF) + val > 0xF)
                         setHFlag();
-                    g_gbRegs.af.b.h += r + val;
-                    if (g_gbRegs.af.b.h == 0)
+                    locA += r + val;
+                    if (locA == 0)
                         setZFlag();
                     break;
                 }
             case 0x88:		// ADC A, B			4
+                OP_ADC(locBC.b.h);
+                break;
             case 0x89:		// ADC A, C			4
+                OP_ADC(locBC.b.l);
+                break;
             case 0x8A:		// ADC A, D			4
+                OP_ADC(locDE.b.h);
+                break;
             case 0x8B:		// ADC A, E			4
+                OP_ADC(locDE.b.l);
+                break;
             case 0x8C:		// ADC A, H			4
+                OP_ADC(locHL.b.h);
+                break;
             case 0x8D:		// ADC A, L			4
-                {
-                    int val = carryBit();
-                    locF = 0;
-                    u8 r = *numberedGbReg(opcode&7);
-                    if (g_gbRegs.af.b.h + r + val > 0xFF)
-                        setCFlag();
-                    if ((g_gbRegs.af.b.h & 0xF) + (r & 0xF) + val > 0xF)
-                        setHFlag();
-                    g_gbRegs.af.b.h += r + val;
-                    if (g_gbRegs.af.b.h == 0)
-                        setZFlag();
-                    break;
-                }
+                OP_ADC(locHL.b.l);
+                break;
             case 0x8E:		// ADC A, (hl)	8
                 {
-                    int val = readMemory(g_gbRegs.hl.w);
+                    int val = readMemory(locHL.w);
                     int val2 = carryBit();
                     locF = 0;
-                    if (g_gbRegs.af.b.h + val + val2 > 0xFF)
+                    if (locA + val + val2 > 0xFF)
                         setCFlag();
-                    if ((g_gbRegs.af.b.h & 0xF) + (val & 0xF) + val2 > 0xF)
+                    if ((locA & 0xF) + (val & 0xF) + val2 > 0xF)
                         setHFlag();
-                    g_gbRegs.af.b.h += val + val2;
-                    if (g_gbRegs.af.b.h == 0)
+                    locA += val + val2;
+                    if (locA == 0)
                         setZFlag();
                     break;
                 }
@@ -590,19 +874,19 @@ int Gameboy::runOpcode(int cycles) {
                     int val = readPC();
                     int val2 = carryBit();
                     locF = 0;
-                    if (g_gbRegs.af.b.h + val + val2 > 0xFF)
+                    if (locA + val + val2 > 0xFF)
                         setCFlag();
-                    if ((g_gbRegs.af.b.h & 0xF) + (val & 0xF) + val2 > 0xF)
+                    if ((locA & 0xF) + (val & 0xF) + val2 > 0xF)
                         setHFlag();
-                    g_gbRegs.af.b.h += val + val2;
-                    if (g_gbRegs.af.b.h == 0)
+                    locA += val + val2;
+                    if (locA == 0)
                         setZFlag();
                     break;
                 }
 
             case 0x97:		// SUB A, A			4
                 {
-                    g_gbRegs.af.b.h = 0;
+                    locA = 0;
                     clearCFlag();
                     clearHFlag();
                     setZFlag();
@@ -610,33 +894,33 @@ int Gameboy::runOpcode(int cycles) {
                     break;
                 }
             case 0x90:		// SUB A, B			4
+                OP_SUB(locBC.b.h);
+                break;
             case 0x91:		// SUB A, C			4
+                OP_SUB(locBC.b.l);
+                break;
             case 0x92:		// SUB A, D			4
+                OP_SUB(locDE.b.h);
+                break;
             case 0x93:		// SUB A, E			4
+                OP_SUB(locDE.b.l);
+                break;
             case 0x94:		// SUB A, H			4
+                OP_SUB(locHL.b.h);
+                break;
             case 0x95:		// SUB A, L			4
-                {
-                    locF = FLAG_N;
-                    u8 r = *numberedGbReg(opcode&7);
-                    if (g_gbRegs.af.b.h < r)
-                        setCFlag();
-                    if ((g_gbRegs.af.b.h & 0xF) < (r & 0xF))
-                        setHFlag();
-                    g_gbRegs.af.b.h -= r;
-                    if (g_gbRegs.af.b.h == 0)
-                        setZFlag();
-                    break;
-                }
+                OP_SUB(locHL.b.l);
+                break;
             case 0x96:		// SUB A, (hl)	8
                 {
                     locF = FLAG_N;
-                    int val = readMemory(g_gbRegs.hl.w);
-                    if (g_gbRegs.af.b.h < val)
+                    int val = readMemory(locHL.w);
+                    if (locA < val)
                         setCFlag();
-                    if ((g_gbRegs.af.b.h & 0xF) < (val & 0xF))
+                    if ((locA & 0xF) < (val & 0xF))
                         setHFlag();
-                    g_gbRegs.af.b.h -= val;
-                    if (g_gbRegs.af.b.h == 0)
+                    locA -= val;
+                    if (locA == 0)
                         setZFlag();
                     break;
                 }
@@ -644,60 +928,59 @@ int Gameboy::runOpcode(int cycles) {
                 {
                     locF = FLAG_N;
                     int val = readPC();
-                    if (g_gbRegs.af.b.h < val)
+                    if (locA < val)
                         setCFlag();
-                    if ((g_gbRegs.af.b.h & 0xF) < (val & 0xF))
+                    if ((locA & 0xF) < (val & 0xF))
                         setHFlag();
-                    g_gbRegs.af.b.h -= val;
-                    if (g_gbRegs.af.b.h == 0)
+                    locA -= val;
+                    if (locA == 0)
                         setZFlag();
                     break;
 
                 }
             case 0x9F:		// SBC A, A			4
                 {
-                    u8 r = g_gbRegs.af.b.h;
+                    u8 r = locA;
                     int val2 = carryBit();
                     locF = FLAG_N;
                     if (val2 /* != 0 */) {
                         setCFlag();
                         setHFlag();
                     }
-                    g_gbRegs.af.b.h -= (r + val2);
-                    if (g_gbRegs.af.b.h == 0)
+                    locA -= (r + val2);
+                    if (locA == 0)
                         setZFlag();
                     break;
                 }
             case 0x98:		// SBC A, B			4
+                OP_SBC(locBC.b.h);
+                break;
             case 0x99:		// SBC A, C			4
+                OP_SBC(locBC.b.l);
+                break;
             case 0x9A:		// SBC A, D			4
+                OP_SBC(locDE.b.h);
+                break;
             case 0x9B:		// SBC A, E			4
+                OP_SBC(locDE.b.l);
+                break;
             case 0x9C:		// SBC A, H			4
+                OP_SBC(locHL.b.h);
+                break;
             case 0x9D:		// SBC A, L			4
-                {
-                    u8 r = *numberedGbReg(opcode&7);
-                    int val2 = carryBit();
-                    locF = FLAG_N;
-                    if (g_gbRegs.af.b.h < r + val2)
-                        setCFlag();
-                    if ((g_gbRegs.af.b.h & 0xF) < (r & 0xF) + val2)
-                        setHFlag();
-                    g_gbRegs.af.b.h -= (r + val2);
-                    if (g_gbRegs.af.b.h == 0)
-                        setZFlag();
-                    break;
-                }
+                OP_SBC(locHL.b.l);
+                break;
             case 0x9E:		// SBC A, (hl)	8
                 {
                     int val2 = carryBit();
-                    int val = readMemory(g_gbRegs.hl.w);
+                    int val = readMemory(locHL.w);
                     locF = FLAG_N;
-                    if (g_gbRegs.af.b.h < val + val2)
+                    if (locA < val + val2)
                         setCFlag();
-                    if ((g_gbRegs.af.b.h & 0xF) < (val & 0xF)+val2)
+                    if ((locA & 0xF) < (val & 0xF)+val2)
                         setHFlag();
-                    g_gbRegs.af.b.h -= val + val2;
-                    if (g_gbRegs.af.b.h == 0)
+                    locA -= val + val2;
+                    if (locA == 0)
                         setZFlag();
                     break;
                 }
@@ -706,99 +989,120 @@ int Gameboy::runOpcode(int cycles) {
                     int val = readPC();
                     int val2 = carryBit();
                     locF = FLAG_N;
-                    if (g_gbRegs.af.b.h <val + val2)
+                    if (locA <val + val2)
                         setCFlag();
-                    if ((g_gbRegs.af.b.h & 0xF) < (val & 0xF)+val2)
+                    if ((locA & 0xF) < (val & 0xF)+val2)
                         setHFlag();
-                    g_gbRegs.af.b.h -= (val + val2);
-                    if (g_gbRegs.af.b.h == 0)
+                    locA -= (val + val2);
+                    if (locA == 0)
                         setZFlag();
                     break;
                 }
 
             case 0xA7:		// AND A, A		4
                 locF = FLAG_H;
-                if (g_gbRegs.af.b.h == 0)
+                if (locA == 0)
                     locF |= FLAG_Z;
                 break;
             case 0xA0:		// AND A, B		4
+                OP_AND(locBC.b.h);
+                break;
             case 0xA1:		// AND A, C		4
+                OP_AND(locBC.b.l);
+                break;
             case 0xA2:		// AND A, D		4
+                OP_AND(locDE.b.h);
+                break;
             case 0xA3:		// AND A, E		4
+                OP_AND(locDE.b.l);
+                break;
             case 0xA4:		// AND A, H		4
+                OP_AND(locHL.b.h);
+                break;
             case 0xA5:		// AND A, L		4
-                locF = FLAG_H;
-                g_gbRegs.af.b.h &= *numberedGbReg(opcode&7);
-                if (g_gbRegs.af.b.h == 0)
-                    setZFlag();
+                OP_AND(locHL.b.l);
                 break;
             case 0xA6:		// AND A, (hl)	8
                 locF = FLAG_H;
-                g_gbRegs.af.b.h &= readMemory(g_gbRegs.hl.w);
-                if (g_gbRegs.af.b.h == 0)
+                locA &= readMemory(locHL.w);
+                if (locA == 0)
                     setZFlag();
                 break;
             case 0xE6:		// AND A, n			8
                 locF = FLAG_H;
-                g_gbRegs.af.b.h &= readPC();
-                if (g_gbRegs.af.b.h == 0)
+                locA &= readPC();
+                if (locA == 0)
                     setZFlag();
                 break;
 
             case 0xB7:		// OR A, A			4
                 locF = 0;
-                if (g_gbRegs.af.b.h == 0)
+                if (locA == 0)
                     locF |= FLAG_Z;
                 break;
             case 0xB0:		// OR A, B			4
+                OP_OR(locBC.b.h);
+                break;
             case 0xB1:		// OR A, C			4
+                OP_OR(locBC.b.l);
+                break;
             case 0xB2:		// OR A, D			4
+                OP_OR(locDE.b.h);
+                break;
             case 0xB3:		// OR A, E			4
+                OP_OR(locDE.b.l);
+                break;
             case 0xB4:		// OR A, H			4
+                OP_OR(locHL.b.h);
+                break;
             case 0xB5:		// OR A, L			4
-                locF = 0;
-                g_gbRegs.af.b.h |= *numberedGbReg(opcode&7);
-                if (g_gbRegs.af.b.h == 0)
-                    setZFlag();
+                OP_OR(locHL.b.l);
                 break;
             case 0xB6:		// OR A, (hl)		8
                 locF = 0;
-                g_gbRegs.af.b.h |= readMemory(g_gbRegs.hl.w);
-                if (g_gbRegs.af.b.h == 0)
+                locA |= readMemory(locHL.w);
+                if (locA == 0)
                     setZFlag();
                 break;
             case 0xF6:		// OR A, n			4
                 locF = 0;
-                g_gbRegs.af.b.h |= readPC();
-                if (g_gbRegs.af.b.h == 0)
+                locA |= readPC();
+                if (locA == 0)
                     setZFlag();
                 break;
 
             case 0xAF:		// XOR A, A			4
-                g_gbRegs.af.b.h = 0;
+                locA = 0;
                 locF = FLAG_Z;
                 break;
             case 0xA8:		// XOR A, B			4
+                OP_XOR(locBC.b.h);
+                break;
             case 0xA9:		// XOR A, C			4
+                OP_XOR(locBC.b.l);
+                break;
             case 0xAA:		// XOR A, D			4
+                OP_XOR(locDE.b.h);
+                break;
             case 0xAB:		// XOR A, E			4
+                OP_XOR(locDE.b.l);
+                break;
             case 0xAC:		// XOR A, H			4
+                OP_XOR(locHL.b.h);
+                break;
             case 0xAD:		// XOR A, L			4
-                locF = 0;
-                g_gbRegs.af.b.h ^= *numberedGbReg(opcode&7);
-                if (g_gbRegs.af.b.h == 0)
-                    setZFlag();
+                OP_XOR(locHL.b.l);
                 break;
             case 0xAE:		// XOR A, (hl)	8
                 locF = 0;
-                g_gbRegs.af.b.h ^= readMemory(g_gbRegs.hl.w);
-                if (g_gbRegs.af.b.h == 0)
+                locA ^= readMemory(locHL.w);
+                if (locA == 0)
                     setZFlag();
                 break;
             case 0xEE:		// XOR A, n			8
                 locF = 0;
-                g_gbRegs.af.b.h ^= readPC();
-                if (g_gbRegs.af.b.h == 0)
+                locA ^= readPC();
+                if (locA == 0)
                     setZFlag();
                 break;
 
@@ -811,31 +1115,32 @@ int Gameboy::runOpcode(int cycles) {
                     break;
                 }
             case 0xB8:		// CP B					4
+                OP_CP(locBC.b.h);
+                break;
             case 0xB9:		// CP C				4
+                OP_CP(locBC.b.l);
+                break;
             case 0xBA:		// CP D					4
+                OP_CP(locDE.b.h);
+                break;
             case 0xBB:		// CP E					4
+                OP_CP(locDE.b.l);
+                break;
             case 0xBC:		// CP H					4
+                OP_CP(locHL.b.h);
+                break;
             case 0xBD:		// CP L					4
-                {
-                    locF = FLAG_N;
-                    u8 r = *numberedGbReg(opcode&7);
-                    if (g_gbRegs.af.b.h < r)
-                        setCFlag();
-                    if ((g_gbRegs.af.b.h & 0xF) < (r & 0xF))
-                        setHFlag();
-                    if (g_gbRegs.af.b.h - r == 0)
-                        setZFlag();
-                    break;
-                }
+                OP_CP(locHL.b.l);
+                break;
             case 0xBE:		// CP (hl)			8
                 {
                     locF = FLAG_N;
-                    int val = readMemory(g_gbRegs.hl.w);
-                    if (g_gbRegs.af.b.h < val)
+                    int val = readMemory(locHL.w);
+                    if (locA < val)
                         setCFlag();
-                    if ((g_gbRegs.af.b.h & 0xF) < (val & 0xF))
+                    if ((locA & 0xF) < (val & 0xF))
                         setHFlag();
-                    if (g_gbRegs.af.b.h - val == 0)
+                    if (locA - val == 0)
                         setZFlag();
                     break;
                 }
@@ -843,11 +1148,11 @@ int Gameboy::runOpcode(int cycles) {
                 {
                     locF = FLAG_N;
                     int val = readPC();
-                    if (g_gbRegs.af.b.h < val)
+                    if (locA < val)
                         setCFlag();
-                    if ((g_gbRegs.af.b.h & 0xF) < (val & 0xF))
+                    if ((locA & 0xF) < (val & 0xF))
                         setHFlag();
-                    if (g_gbRegs.af.b.h - val == 0)
+                    if (locA - val == 0)
                         setZFlag();
                     break;
                 }
@@ -856,35 +1161,36 @@ int Gameboy::runOpcode(int cycles) {
             case 0x3C:		// INC A				4
                 {
                     locF &= FLAG_C;
-                    g_gbRegs.af.b.h++;
-                    if (g_gbRegs.af.b.h == 0)
+                    locA++;
+                    if (locA == 0)
                         setZFlag();
-                    if ((g_gbRegs.af.b.h & 0xF) == 0)
+                    if ((locA & 0xF) == 0)
                         setHFlag();
                     break;
                 }
             case 0x04:		// INC B				4
+                OP_INC(locBC.b.h);
+                break;
             case 0x0C:		// INC C				4
+                OP_INC(locBC.b.l);
+                break;
             case 0x14:		// INC D				4
+                OP_INC(locDE.b.h);
+                break;
             case 0x1C:		// INC E				4
+                OP_INC(locDE.b.l);
+                break;
             case 0x24:		// INC H				4
+                OP_INC(locHL.b.h);
+                break;
             case 0x2C:		// INC L				4
-                {
-                    locF &= FLAG_C;
-                    u8* reg = numberedGbReg(opcode>>3);
-                    (*reg)++;
-                    u8 r = *reg;
-                    if (r == 0)
-                        setZFlag();
-                    if ((r & 0xF) == 0)
-                        setHFlag();
-                    break;
-                }
+                OP_INC(locHL.b.l);
+                break;
             case 0x34:		// INC (hl)		12
                 {
                     locF &= FLAG_C;
-                    u8 val = readMemory(g_gbRegs.hl.w)+1;
-                    writeMemory(g_gbRegs.hl.w, val);
+                    u8 val = readMemory(locHL.w)+1;
+                    writeMemory(locHL.w, val);
                     if (val == 0)
                         setZFlag();
                     if ((val & 0xF) == 0)
@@ -895,37 +1201,37 @@ int Gameboy::runOpcode(int cycles) {
             case 0x3D:		// DEC A				4
                 {
                     locF &= FLAG_C;
-                    g_gbRegs.af.b.h--;
-                    if (g_gbRegs.af.b.h == 0)
+                    locA--;
+                    if (locA == 0)
                         setZFlag();
-                    if ((g_gbRegs.af.b.h & 0xF) == 0xF)
+                    if ((locA & 0xF) == 0xF)
                         setHFlag();
                     setNFlag();
                     break;
                 }
             case 0x05:		// DEC B				4
+                OP_DEC(locBC.b.h);
+                break;
             case 0x0D:		// DEC C				4
+                OP_DEC(locBC.b.l);
+                break;
             case 0x15:		// DEC D				4
+                OP_DEC(locDE.b.h);
+                break;
             case 0x1D:		// DEC E				4
+                OP_DEC(locDE.b.l);
+                break;
             case 0x25:		// DEC H				4
+                OP_DEC(locHL.b.h);
+                break;
             case 0x2D:		// DEC L				4
-                {
-                    locF &= FLAG_C;
-                    u8 *reg = numberedGbReg(opcode>>3);
-                    (*reg)--;
-                    u8 r = *reg;
-                    if (r == 0)
-                        setZFlag();
-                    if ((r & 0xF) == 0xF)
-                        setHFlag();
-                    setNFlag();
-                    break;
-                }
+                OP_DEC(locHL.b.l);
+                break;
             case 0x35:		// DEC (hl)			12
                 {
                     locF &= FLAG_C;
-                    u8 val = readMemory(g_gbRegs.hl.w)-1;
-                    writeMemory(g_gbRegs.hl.w, val);
+                    u8 val = readMemory(locHL.w)-1;
+                    writeMemory(locHL.w, val);
                     if (val == 0)
                         setZFlag();
                     if ((val & 0xF) == 0xF)
@@ -938,35 +1244,35 @@ int Gameboy::runOpcode(int cycles) {
 
             case 0x09:		// ADD hl, BC		8
                 locF &= FLAG_Z;
-                if (g_gbRegs.hl.w + g_gbRegs.bc.w > 0xFFFF)
+                if (locHL.w + locBC.w > 0xFFFF)
                     setCFlag();
-                if ((g_gbRegs.hl.w & 0xFFF) + (g_gbRegs.bc.w & 0xFFF) > 0xFFF)
+                if ((locHL.w & 0xFFF) + (locBC.w & 0xFFF) > 0xFFF)
                     setHFlag();
-                g_gbRegs.hl.w += g_gbRegs.bc.w;
+                locHL.w += locBC.w;
                 break;
             case 0x19:		// ADD hl, de		8
                 locF &= FLAG_Z;
-                if (g_gbRegs.hl.w + g_gbRegs.de.w > 0xFFFF)
+                if (locHL.w + locDE.w > 0xFFFF)
                     setCFlag();
-                if ((g_gbRegs.hl.w & 0xFFF) + (g_gbRegs.de.w & 0xFFF) > 0xFFF)
+                if ((locHL.w & 0xFFF) + (locDE.w & 0xFFF) > 0xFFF)
                     setHFlag();
-                g_gbRegs.hl.w += g_gbRegs.de.w;
+                locHL.w += locDE.w;
                 break;
             case 0x29:		// ADD hl, hl		8
                 locF &= FLAG_Z;
-                if (g_gbRegs.hl.w + g_gbRegs.hl.w > 0xFFFF)
+                if (locHL.w + locHL.w > 0xFFFF)
                     setCFlag();
-                if ((g_gbRegs.hl.w & 0xFFF) + (g_gbRegs.hl.w & 0xFFF) > 0xFFF)
+                if ((locHL.w & 0xFFF) + (locHL.w & 0xFFF) > 0xFFF)
                     setHFlag();
-                g_gbRegs.hl.w += g_gbRegs.hl.w;
+                locHL.w += locHL.w;
                 break;
             case 0x39:		// ADD hl, SP		8
                 locF &= FLAG_Z;
-                if (g_gbRegs.hl.w + locSP > 0xFFFF)
+                if (locHL.w + locSP > 0xFFFF)
                     setCFlag();
-                if ((g_gbRegs.hl.w & 0xFFF) + (locSP & 0xFFF) > 0xFFF)
+                if ((locHL.w & 0xFFF) + (locSP & 0xFFF) > 0xFFF)
                     setHFlag();
-                g_gbRegs.hl.w += locSP;
+                locHL.w += locSP;
                 break;
 
             case 0xE8:		// ADD SP, n		16
@@ -981,26 +1287,26 @@ int Gameboy::runOpcode(int cycles) {
                     break;
                 }
             case 0x03:		// INC BC				8
-                g_gbRegs.bc.w++;
+                locBC.w++;
                 break;
             case 0x13:		// INC de				8
-                g_gbRegs.de.w++;
+                locDE.w++;
                 break;
             case 0x23:		// INC hl				8
-                g_gbRegs.hl.w++;
+                locHL.w++;
                 break;
             case 0x33:		// INC SP				8
                 locSP++;
                 break;
 
             case 0x0B:		// DEC BC				8
-                g_gbRegs.bc.w--;
+                locBC.w--;
                 break;
             case 0x1B:		// DEC de				8
-                g_gbRegs.de.w--;
+                locDE.w--;
                 break;
             case 0x2B:		// DEC hl				8
-                g_gbRegs.hl.w--;
+                locHL.w--;
                 break;
             case 0x3B:		// DEC SP				8
                 locSP--;
@@ -1008,7 +1314,7 @@ int Gameboy::runOpcode(int cycles) {
 
             case 0x27:		// DAA					4
                 {
-                    int a = g_gbRegs.af.b.h;
+                    int a = locA;
 
                     if (!negativeSet())
                     {
@@ -1037,13 +1343,13 @@ int Gameboy::runOpcode(int cycles) {
                     if (a == 0)
                         setZFlag();
 
-                    g_gbRegs.af.b.h = a;
+                    locA = a;
 
                 }
                 break;
 
             case 0x2F:		// CPL					4
-                g_gbRegs.af.b.h = ~g_gbRegs.af.b.h;
+                locA = ~locA;
                 setNFlag();
                 setHFlag();
                 break;
@@ -1071,20 +1377,20 @@ int Gameboy::runOpcode(int cycles) {
                     if (gbMode == CGB)
                         break;
                     else {
-                        // DI + Halt bug
-                        // Fixes smurfs
-                        if (haltBugAddr == NULL) {
-                            haltBugAddr = pcAddr-1;
-                            // Write over 'halt' to produce the effect.
-                            *haltBugAddr = *pcAddr;
-                            pcAddr--;
-                            cyclesToExecute = totalCycles+1;
-                            // 'halt' will be restored after the opcode is executed.
-                        }
+                        // DI + Halt bug: the next opcode is read twice, as
+                        // if it were also where the halt is. It runs from
+                        // pageCrossing, which makes the opcode after it go
+                        // back to memory. Fixes smurfs
+                        int pc = getPC() & 0xffff;
+                        pageCrossing[0] = pageCrossing[1] = quickRead(pc);
+                        pageCrossing[2] = quickRead((pc+1)&0xffff);
+                        locPC = (pc-1)&0xffff;
+                        pcAddr = firstPcAddr = pcEnd = pageCrossing;
                         break;
                     }
                 }
                 halt = 1;
+                TRACE_INSTANT("halt", this, "pc", getPC()-1);
                 goto end;
 
             case 0x10:		// STOP					4
@@ -1098,6 +1404,7 @@ int Gameboy::runOpcode(int cycles) {
                 }
                 else {
                     halt = 2;
+                    TRACE_INSTANT("stop", this, "pc", getPC()-1);
                     goto end;
                 }
                 pcAddr++;
@@ -1114,21 +1421,21 @@ int Gameboy::runOpcode(int cycles) {
             case 0x07:		// RLCA 4
                 {
                     locF = 0;
-                    int val = g_gbRegs.af.b.h;
-                    g_gbRegs.af.b.h <<= 1;
+                    int val = locA;
+                    locA <<= 1;
                     if (val & 0x80)
                     {
                         setCFlag();
-                        g_gbRegs.af.b.h |= 1;
+                        locA |= 1;
                     }
                     break;
                 }
 
             case 0x17:		// RLA					4
                 {
-                    int val = (g_gbRegs.af.b.h & 0x80);
-                    g_gbRegs.af.b.h <<= 1;
-                    g_gbRegs.af.b.h |= carryBit();
+                    int val = (locA & 0x80);
+                    locA <<= 1;
+                    locA |= carryBit();
                     locF = 0;
                     if (val)
                         setCFlag();
@@ -1138,21 +1445,21 @@ int Gameboy::runOpcode(int cycles) {
             case 0x0F:		// RRCA 4
                 {
                     locF = 0;
-                    int val = g_gbRegs.af.b.h;
-                    g_gbRegs.af.b.h >>= 1;
+                    int val = locA;
+                    locA >>= 1;
                     if ((val & 1))
                     {
                         setCFlag();
-                        g_gbRegs.af.b.h |= 0x80;
+                        locA |= 0x80;
                     }
                     break;
                 }
 
             case 0x1F:		// RRA					4
                 {
-                    int val = g_gbRegs.af.b.h & 1;
-                    g_gbRegs.af.b.h >>= 1;
-                    g_gbRegs.af.b.h |= (carryBit() << 7);
+                    int val = locA & 1;
+                    locA >>= 1;
+                    locA |= (carryBit() << 7);
                     locF = 0;
                     if (val)
                         setCFlag();
@@ -1207,7 +1514,7 @@ int Gameboy::runOpcode(int cycles) {
                     break;
                 }
             case 0xE9:		// JP (hl)	4
-                setPC(g_gbRegs.hl.w);
+                setPC(locHL.w);
                 break;
             case 0x18:		// JR n 12
                 OP_JR(true);
@@ -1228,28 +1535,20 @@ int Gameboy::runOpcode(int cycles) {
             case 0xCD:		// CALL nn			24
                 {
                     int val = getPC() + 2;
-#ifdef SPEEDHAX
-                    quickWrite(--locSP, (val) >> 8);
-                    quickWrite(--locSP, (val & 0xFF));
-#else
                     writeMemory(--locSP, (val) >> 8);
                     writeMemory(--locSP, (val & 0xFF));
-#endif
                     setPC(readPC16_noinc());
+                    PROFILE_CALL();
                     break;
                 }
             case 0xC4:		// CALL NZ, nn	12/24
                 if (!zeroSet())
                 {
                     int val = getPC() + 2;
-#ifdef SPEEDHAX
-                    quickWrite(--locSP, (val) >> 8);
-                    quickWrite(--locSP, (val & 0xFF));
-#else
                     writeMemory(--locSP, (val) >> 8);
                     writeMemory(--locSP, (val & 0xFF));
-#endif
                     setPC(readPC16_noinc());
+                    PROFILE_CALL();
                     break;
                 }
                 else {
@@ -1261,14 +1560,10 @@ int Gameboy::runOpcode(int cycles) {
                 if (zeroSet())
                 {
                     int val = getPC() + 2;
-#ifdef SPEEDHAX
-                    quickWrite(--locSP, (val) >> 8);
-                    quickWrite(--locSP, (val & 0xFF));
-#else
                     writeMemory(--locSP, (val) >> 8);
                     writeMemory(--locSP, (val & 0xFF));
-#endif
                     setPC(readPC16_noinc());
+                    PROFILE_CALL();
                     break;
                 }
                 else {
@@ -1280,14 +1575,10 @@ int Gameboy::runOpcode(int cycles) {
                 if (!carrySet())
                 {
                     int val = getPC() + 2;
-#ifdef SPEEDHAX
-                    quickWrite(--locSP, (val) >> 8);
-                    quickWrite(--locSP, (val & 0xFF));
-#else
                     writeMemory(--locSP, (val) >> 8);
                     writeMemory(--locSP, (val & 0xFF));
-#endif
                     setPC(readPC16_noinc());
+                    PROFILE_CALL();
                     break;
                 }
                 else {
@@ -1299,14 +1590,10 @@ int Gameboy::runOpcode(int cycles) {
                 if (carrySet())
                 {
                     int val = getPC() + 2;
-#ifdef SPEEDHAX
-                    quickWrite(--locSP, (val) >> 8);
-                    quickWrite(--locSP, (val & 0xFF));
-#else
                     writeMemory(--locSP, (val) >> 8);
                     writeMemory(--locSP, (val & 0xFF));
-#endif
                     setPC(readPC16_noinc());
+                    PROFILE_CALL();
                     break;
                 }
                 else {
@@ -1318,117 +1605,87 @@ int Gameboy::runOpcode(int cycles) {
             case 0xC7:		// RST 00H			16
                 {
                     u16 val = getPC();
-#ifdef SPEEDHAX
-                    quickWrite(--locSP, (val) >> 8);
-                    quickWrite(--locSP, (val & 0xFF));
-#else
                     writeMemory(--locSP, (val) >> 8);
                     writeMemory(--locSP, (val & 0xFF));
-#endif
                     setPC(0x0);
+                    PROFILE_CALL();
                 }
                 break;
             case 0xCF:		// RST 08H			16
                 {
                     u16 val = getPC();
-#ifdef SPEEDHAX
-                    quickWrite(--locSP, (val) >> 8);
-                    quickWrite(--locSP, (val & 0xFF));
-#else
                     writeMemory(--locSP, (val) >> 8);
                     writeMemory(--locSP, (val & 0xFF));
-#endif
                     setPC(0x8);
+                    PROFILE_CALL();
                     break;
                 }
             case 0xD7:		// RST 10H			16
                 {
                     u16 val = getPC();
-#ifdef SPEEDHAX
-                    quickWrite(--locSP, (val) >> 8);
-                    quickWrite(--locSP, (val & 0xFF));
-#else
                     writeMemory(--locSP, (val) >> 8);
                     writeMemory(--locSP, (val & 0xFF));
-#endif
                     setPC(0x10);
+                    PROFILE_CALL();
                 }
                 break;
             case 0xDF:		// RST 18H			16
                 {
                     u16 val = getPC();
-#ifdef SPEEDHAX
-                    quickWrite(--locSP, (val) >> 8);
-                    quickWrite(--locSP, (val & 0xFF));
-#else
                     writeMemory(--locSP, (val) >> 8);
                     writeMemory(--locSP, (val & 0xFF));
-#endif
                     setPC(0x18);
+                    PROFILE_CALL();
                 }
                 break;
             case 0xE7:		// RST 20H			16
                 {
                     u16 val = getPC();
-#ifdef SPEEDHAX
-                    quickWrite(--locSP, (val) >> 8);
-                    quickWrite(--locSP, (val & 0xFF));
-#else
                     writeMemory(--locSP, (val) >> 8);
                     writeMemory(--locSP, (val & 0xFF));
-#endif
                     setPC(0x20);
+                    PROFILE_CALL();
                 }
                 break;
             case 0xEF:		// RST 28H			16
                 {
                     u16 val = getPC();
-#ifdef SPEEDHAX
-                    quickWrite(--locSP, (val) >> 8);
-                    quickWrite(--locSP, (val & 0xFF));
-#else
                     writeMemory(--locSP, (val) >> 8);
                     writeMemory(--locSP, (val & 0xFF));
-#endif
                     setPC(0x28);
+                    PROFILE_CALL();
                 }
                 break;
             case 0xF7:		// RST 30H			16
                 {
                     u16 val = getPC();
-#ifdef SPEEDHAX
-                    quickWrite(--locSP, (val) >> 8);
-                    quickWrite(--locSP, (val & 0xFF));
-#else
                     writeMemory(--locSP, (val) >> 8);
                     writeMemory(--locSP, (val & 0xFF));
-#endif
                     setPC(0x30);
+                    PROFILE_CALL();
                 }
                 break;
             case 0xFF:		// RST 38H			16
                 {
                     u16 val = getPC();
-#ifdef SPEEDHAX
-                    quickWrite(--locSP, (val) >> 8);
-                    quickWrite(--locSP, (val & 0xFF));
-#else
                     writeMemory(--locSP, (val) >> 8);
                     writeMemory(--locSP, (val & 0xFF));
-#endif
                     setPC(0x38);
+                    PROFILE_CALL();
                 }
                 break;
 
             case 0xC9:		// RET					16
                 setPC(quickRead16(locSP));
                 locSP += 2;
+                PROFILE_RET();
                 break;
             case 0xC0:		// RET NZ				8/20
                 if (!zeroSet())
                 {
                     setPC(quickRead16(locSP));
                     locSP += 2;
+                    PROFILE_RET();
                     break;
                 }
                 else {
@@ -1440,6 +1697,7 @@ int Gameboy::runOpcode(int cycles) {
                 {
                     setPC(quickRead16(locSP));
                     locSP += 2;
+                    PROFILE_RET();
                     break;
                 }
                 else {
@@ -1451,6 +1709,7 @@ int Gameboy::runOpcode(int cycles) {
                 {
                     setPC(quickRead16(locSP));
                     locSP += 2;
+                    PROFILE_RET();
                     break;
                 }
                 else {
@@ -1462,6 +1721,7 @@ int Gameboy::runOpcode(int cycles) {
                 {
                     setPC(quickRead16(locSP));
                     locSP += 2;
+                    PROFILE_RET();
                     break;
                 }
                 else {
@@ -1471,1052 +1731,99 @@ int Gameboy::runOpcode(int cycles) {
             case 0xD9:		// RETI					16
                 setPC(quickRead16(locSP));
                 locSP += 2;
+                PROFILE_RET();
                 enableInterrupts();
                 break;
 
             case 0xCB:
                 opcode = readPC();
                 totalCycles += CBopCycles[opcode];
-                switch(opcode)
                 {
-                    case 0x37:		// SWAP A			8
-                        {
-                            locF = 0;
-                            u8 r = g_gbRegs.af.b.h;
-                            int val = r >> 4;
-                            r <<= 4;
-                            r |= val;
-                            if (r == 0)
-                                setZFlag();
-                            g_gbRegs.af.b.h = r;
-                            break;
-                        }
-                    case 0x30:		// SWAP B			8
-                    case 0x31:		// SWAP C			8
-                    case 0x32:		// SWAP D			8
-                    case 0x33:		// SWAP E			8
-                    case 0x34:		// SWAP H			8
-                    case 0x35:		// SWAP L			8
-                        {
-                            locF = 0;
-                            u8 *reg = numberedGbReg(opcode&7);
-                            u8 r = *reg;
-                            int val = r >> 4;
-                            r <<= 4;
-                            r |= val;
-                            if (r == 0)
-                                setZFlag();
-                            *reg = r;
-                            break;
-                        }
-                    case 0x36:		// SWAP (hl)		16
-                        {
-                            locF = 0;
-                            int val = readMemory(g_gbRegs.hl.w);
-                            int val2 = val >> 4;
-                            val <<= 4;
-                            val |= val2;
-                            writeMemory(g_gbRegs.hl.w, val);
-                            if (val == 0)
-                                setZFlag();
-                            break;
-                        }
-
-                    case 0x07:		// RLC A					8
-                        {
-                            locF = 0;
-                            u8 r = g_gbRegs.af.b.h;
-                            r <<= 1;
-                            if (((g_gbRegs.af.b.h) & 0x80) != 0)
-                            {
-                                setCFlag();
-                                r |= 1;
-                            }
-                            if (r == 0)
-                                setZFlag();
-                            g_gbRegs.af.b.h = r;
-                            break;
-                        }
-                    case 0x00:		// RLC B					8
-                    case 0x01:		// RLC C					8
-                    case 0x02:		// RLC D					8
-                    case 0x03:		// RLC E					8
-                    case 0x04:		// RLC H					8
-                    case 0x05:		// RLC L					8
-                        {
-                            locF = 0;
-                            u8 *reg = numberedGbReg(opcode);
-                            u8 r = *reg;
-                            r <<= 1;
-                            if (((*reg) & 0x80) != 0)
-                            {
-                                setCFlag();
-                                r |= 1;
-                            }
-                            if (r == 0)
-                                setZFlag();
-                            *reg = r;
-                            break;
-                        }
-
-                    case 0x06:		// RLC (hl)				16
-                        {
-                            locF = 0;
-                            int val = readMemory(g_gbRegs.hl.w);
-                            int val2 = val;
-                            val2 <<= 1;
-                            if ((val & 0x80) != 0)
-                            {
-                                setCFlag();
-                                val2 |= 1;
-                            }
-                            if (val2 == 0)
-                                setZFlag();
-                            writeMemory(g_gbRegs.hl.w, val2);
-                            break;
+                    // Bits 0-2 pick the operand, bits 3-5 the bit or the
+                    // shift, and bits 6-7 the operation. The operand is
+                    // fetched and stored once, (hl) through memory.
+                    int reg = opcode & 7;
+                    u8 val;
+                    switch (reg) {
+                        case 0: val = locBC.b.h; break;
+                        case 1: val = locBC.b.l; break;
+                        case 2: val = locDE.b.h; break;
+                        case 3: val = locDE.b.l; break;
+                        case 4: val = locHL.b.h; break;
+                        case 5: val = locHL.b.l; break;
+                        case 6: val = readMemory(locHL.w); break;
+                        default: val = locA; break;
+                    }
 
-                        }
-                    case 0x17:		// RL A				8
-                        {
-                            u8 r = g_gbRegs.af.b.h;
-                            int val = (r & 0x80);
-                            r <<= 1;
-                            r |= carryBit();
-                            locF = 0;
-                            if (val)
-                                setCFlag();
-                            if (r == 0)
-                                setZFlag();
-                            g_gbRegs.af.b.h = r;
-                            break;
-                        }
-                    case 0x10:		// RL B				8
-                    case 0x11:		// RL C				8
-                    case 0x12:		// RL D				8
-                    case 0x13:		// RL E				8
-                    case 0x14:		// RL H				8
-                    case 0x15:		// RL L				8
-                        {
-                            u8 *reg = numberedGbReg(opcode&7);
-                            u8 r = *reg;
-                            int val = (r & 0x80);
-                            r <<= 1;
-                            r |= carryBit();
-                            locF = 0;
-                            if (val)
-                                setCFlag();
-                            if (r == 0)
-                                setZFlag();
-                            *reg = r;
-                            break;
-                        }
-                    case 0x16:		// RL (hl)			16
-                        {
-                            u8 val2 = readMemory(g_gbRegs.hl.w);
-                            int val = (val2 & 0x80);
-                            val2 <<= 1;
-                            val2 |= carryBit();
-                            locF = 0;
-                            if (val)
-                                setCFlag();
-                            if (val2 == 0)
-                                setZFlag();
-                            writeMemory(g_gbRegs.hl.w, val2);
-                            break;
-                        }
-                    case 0x0F:		// RRC A					8
-                        {
-                            locF = 0;
-                            u8 r = g_gbRegs.af.b.h;
-                            int val = r;
-                            r >>= 1;
-                            if (val&1)
-                            {
-                                setCFlag();
-                                r |= 0x80;
-                            }
-                            if (r == 0)
-                                setZFlag();
-                            g_gbRegs.af.b.h = r;
-                            break;
-                        }
-                    case 0x08:		// RRC B					8
-                    case 0x09:		// RRC C					8
-                    case 0x0A:		// RRC D					8
-                    case 0x0B:		// RRC E					8
-                    case 0x0C:		// RRC H					8
-                    case 0x0D:		// RRC L					8
-                        {
-                            locF = 0;
-                            u8 *reg = numberedGbReg(opcode&7);
-                            u8 r = *reg;
-                            int val = r;
-                            r >>= 1;
-                            if (val&1)
-                            {
-                                setCFlag();
-                                r |= 0x80;
+                    int bit = (opcode >> 3) & 7;
+                    switch (opcode >> 6) {
+                        case 0:
+                            switch (bit) {
+                                case CB_RLC:  val = cbShift<CB_RLC>(val, locF); break;
+                                case CB_RRC:  val = cbShift<CB_RRC>(val, locF); break;
+                                case CB_RL:   val = cbShift<CB_RL>(val, locF); break;
+                                case CB_RR:   val = cbShift<CB_RR>(val, locF); break;
+                                case CB_SLA:  val = cbShift<CB_SLA>(val, locF); break;
+                                case CB_SRA:  val = cbShift<CB_SRA>(val, locF); break;
+                                case CB_SWAP: val = cbShift<CB_SWAP>(val, locF); break;
+                                default:      val = cbShift<CB_SRL>(val, locF); break;
                             }
-                            if (r == 0)
-                                setZFlag();
-                            *reg = r;
                             break;
-                        }
-                    case 0x0E:		// RRC (hl)				16
-                        {
-                            locF = 0;
-                            u8 val2 = readMemory(g_gbRegs.hl.w);
-                            int val = val2;
-                            val2 >>= 1;
-                            if ((val & 1) != 0)
-                            {
-                                setCFlag();
-                                val2 |= 0x80;
-                            }
-                            if (val2 == 0)
+                        case 1:     // BIT, which doesn't write back
+                            locF = (locF & FLAG_C) | FLAG_H;
+                            if ((val & (1 << bit)) == 0)
                                 setZFlag();
-                            writeMemory(g_gbRegs.hl.w, val2);
+                            goto cbDone;
+                        case 2:     // RES
+                            val &= ~(1 << bit);
                             break;
-                        }
-
-                    case 0x1F:		// RR A					8
-                        {
-                            u8 r = g_gbRegs.af.b.h;
-                            int val = r & 1;
-                            r >>= 1;
-                            r |= carryBit() << 7;
-                            locF = 0;
-                            if (val)
-                                setCFlag();
-                            if (r == 0)
-                                setZFlag();
-                            g_gbRegs.af.b.h = r;
-                            break;
-                        }
-                    case 0x18:		// RR B					8
-                    case 0x19:		// RR C					8
-                    case 0x1A:		// RR D					8
-                    case 0x1B:		// RR E					8
-                    case 0x1C:		// RR H					8
-                    case 0x1D:		// RR L					8
-                        {
-                            u8 *reg = numberedGbReg(opcode&7);
-                            u8 r = *reg;
-                            int val = r & 1;
-                            r >>= 1;
-                            r |= carryBit() << 7;
-                            locF = 0;
-                            if (val)
-                                setCFlag();
-                            if (r == 0)
-                                setZFlag();
-                            *reg = r;
-                            break;
-                        }
-                    case 0x1E:		// RR (hl)			16
-                        {
-                            u8 val2 = readMemory(g_gbRegs.hl.w);
-                            int val = val2 & 1;
-                            val2 >>= 1;
-                            val2 |= carryBit() << 7;
-                            locF = 0;
-                            if (val)
-                                setCFlag();
-                            if (val2 == 0)
-                                setZFlag();
-                            writeMemory(g_gbRegs.hl.w, val2);
-                            break;
-                        }
-
-
-                    case 0x27:		// SLA A				8
-                        {
-                            locF = 0;
-                            u8 r = g_gbRegs.af.b.h;
-                            int val = (r & 0x80);
-                            r <<= 1;
-                            if (val)
-                                setCFlag();
-                            if (r == 0)
-                                setZFlag();
-                            g_gbRegs.af.b.h = r;
-                            break;
-                        }
-                    case 0x20:		// SLA B				8
-                    case 0x21:		// SLA C				8
-                    case 0x22:		// SLA D				8
-                    case 0x23:		// SLA E				8
-                    case 0x24:		// SLA H				8
-                    case 0x25:		// SLA L				8
-                        {
-                            locF = 0;
-                            u8 *reg = numberedGbReg(opcode&7);
-                            u8 r = *reg;
-                            int val = (r & 0x80);
-                            r <<= 1;
-                            if (val)
-                                setCFlag();
-                            if (r == 0)
-                                setZFlag();
-                            *reg = r;
-                            break;
-                        }
-                    case 0x26:		// SLA (hl)			16
-                        {
-                            locF = 0;
-                            u8 val2 = readMemory(g_gbRegs.hl.w);
-                            int val = (val2 & 0x80);
-                            val2 <<= 1;
-                            if (val)
-                                setCFlag();
-                            if (val2 == 0)
-                                setZFlag();
-                            writeMemory(g_gbRegs.hl.w, val2);
-                            break;
-                        }
-
-                    case 0x2F:		// SRA A				8
-                        {
-                            locF = 0;
-                            u8 r = g_gbRegs.af.b.h;
-                            if (r & 1)
-                                setCFlag();
-                            r >>= 1;
-                            if (r & 0x40)
-                                r |= 0x80;
-                            if (r == 0)
-                                setZFlag();
-                            g_gbRegs.af.b.h = r;
-                            break;
-                        }
-                    case 0x28:		// SRA B				8
-                    case 0x29:		// SRA C				8
-                    case 0x2A:		// SRA D				8
-                    case 0x2B:		// SRA E				8
-                    case 0x2C:		// SRA H				8
-                    case 0x2D:		// SRA L				8
-                        {
-                            locF = 0;
-                            u8 *reg = numberedGbReg(opcode&7);
-                            u8 r = *reg;
-                            if (r & 1)
-                                setCFlag();
-                            r >>= 1;
-                            if (r & 0x40)
-                                r |= 0x80;
-                            if (r == 0)
-                                setZFlag();
-                            *reg = r;
-                            break;
-                        }
-                    case 0x2E:		// SRA (hl)			16
-                        {
-                            locF = 0;
-                            int val = readMemory(g_gbRegs.hl.w);
-                            if (val & 1)
-                                setCFlag();
-                            val >>= 1;
-                            if (val & 0x40)
-                                val |= 0x80;
-                            if (val == 0)
-                                setZFlag();
-                            writeMemory(g_gbRegs.hl.w, val);
-                            break;
-                        }
-
-                    case 0x3F:		// SRL A				8
-                        {
-                            locF = 0;
-                            u8 r = g_gbRegs.af.b.h;
-                            if (r & 1)
-                                setCFlag();
-                            r >>= 1;
-                            if (r == 0)
-                                setZFlag();
-                            g_gbRegs.af.b.h = r;
-                            break;
-                        }
-                    case 0x38:		// SRL B				8
-                    case 0x39:		// SRL C				8
-                    case 0x3A:		// SRL D				8
-                    case 0x3B:		// SRL E				8
-                    case 0x3C:		// SRL H				8
-                    case 0x3D:		// SRL L				8
-                        {
-                            locF = 0;
-                            u8 *reg = numberedGbReg(opcode&7);
-                            u8 r = *reg;
-                            if (r & 1)
-                                setCFlag();
-                            r >>= 1;
-                            if (r == 0)
-                                setZFlag();
-                            *reg = r;
+                        default:    // SET
+                            val |= 1 << bit;
                             break;
-                        }
-                    case 0x3E:		// SRL (hl)			16
-                        {
-                            locF = 0;
-                            int val = readMemory(g_gbRegs.hl.w);
-                            if (val & 1)
-                                setCFlag();
-                            val >>= 1;
-                            if (val == 0)
-                                setZFlag();
-                            writeMemory(g_gbRegs.hl.w, val);
-                            break;
-                        }
-
-                    case 0x47:		// BIT 0, A
-                    case 0x4F:		// BIT 1, A
-                    case 0x57:		// BIT 2, A
-                    case 0x5F:		// BIT 3, A
-                    case 0x67:		// BIT 4, A
-                    case 0x6F:		// BIT 5, A
-                    case 0x77:		// BIT 6, A
-                    case 0x7F:		// BIT 7, A
-                        {
-                            if (((g_gbRegs.af.b.h) & (1<<((opcode>>3)&7))) == 0)
-                                setZFlag();
-                            else
-                                clearZFlag();
-                            clearNFlag();
-                            setHFlag();
-                            break;
-                        }
-                    case 0x40:		// BIT 0, B     8
-                    case 0x41:		// BIT 0, C     8
-                    case 0x42:		// BIT 0, D     8
-                    case 0x43:		// BIT 0, E     8
-                    case 0x44:		// BIT 0, H     8
-                    case 0x45:		// BIT 0, L     8
-                        if (((*numberedGbReg(opcode&7)) & 1) == 0)
-                            setZFlag();
-                        else
-                            clearZFlag();
-                        clearNFlag();
-                        setHFlag();
-                        break;
-                    case 0x48:		// BIT 1, B
-                    case 0x49:		// BIT 1, C
-                    case 0x4A:		// BIT 1, D
-                    case 0x4B:		// BIT 1, E
-                    case 0x4C:		// BIT 1, H
-                    case 0x4D:		// BIT 1, L
-                        if (((*numberedGbReg(opcode&7)) & 2) == 0)
-                            setZFlag();
-                        else
-                            clearZFlag();
-                        clearNFlag();
-                        setHFlag();
-                        break;
-                    case 0x50:		// BIT 2, B
-                    case 0x51:		// BIT 2, C
-                    case 0x52:		// BIT 2, D
-                    case 0x53:		// BIT 2, E
-                    case 0x54:		// BIT 2, H
-                    case 0x55:		// BIT 2, L
-                        if (((*numberedGbReg(opcode&7)) & 4) == 0)
-                            setZFlag();
-                        else
-                            clearZFlag();
-                        clearNFlag();
-                        setHFlag();
-                        break;
-                    case 0x58:		// BIT 3, B
-                    case 0x59:		// BIT 3, C
-                    case 0x5A:		// BIT 3, D
-                    case 0x5B:		// BIT 3, E
-                    case 0x5C:		// BIT 3, H
-                    case 0x5D:		// BIT 3, L
-                        if (((*numberedGbReg(opcode&7)) & 8) == 0)
-                            setZFlag();
-                        else
-                            clearZFlag();
-                        clearNFlag();
-                        setHFlag();
-                        break;
-                    case 0x60:		// BIT 4, B
-                    case 0x61:		// BIT 4, C
-                    case 0x62:		// BIT 4, D
-                    case 0x63:		// BIT 4, E
-                    case 0x64:		// BIT 4, H
-                    case 0x65:		// BIT 4, L
-                        if (((*numberedGbReg(opcode&7)) & 0x10) == 0)
-                            setZFlag();
-                        else
-                            clearZFlag();
-                        clearNFlag();
-                        setHFlag();
-                        break;
-                    case 0x68:		// BIT 5, B
-                    case 0x69:		// BIT 5, C
-                    case 0x6A:		// BIT 5, D
-                    case 0x6B:		// BIT 5, E
-                    case 0x6C:		// BIT 5, H
-                    case 0x6D:		// BIT 5, L
-                        if (((*numberedGbReg(opcode&7)) & 0x20) == 0)
-                            setZFlag();
-                        else
-                            clearZFlag();
-                        clearNFlag();
-                        setHFlag();
-                        break;
-                    case 0x70:		// BIT 6, B
-                    case 0x71:		// BIT 6, C
-                    case 0x72:		// BIT 6, D
-                    case 0x73:		// BIT 6, E
-                    case 0x74:		// BIT 6, H
-                    case 0x75:		// BIT 6, L
-                        if (((*numberedGbReg(opcode&7)) & 0x40) == 0)
-                            setZFlag();
-                        else
-                            clearZFlag();
-                        clearNFlag();
-                        setHFlag();
-                        break;
-                    case 0x78:		// BIT 7, B
-                    case 0x79:		// BIT 7, C
-                    case 0x7A:		// BIT 7, D
-                    case 0x7B:		// BIT 7, E
-                    case 0x7C:		// BIT 7, H
-                    case 0x7D:		// BIT 7, L
-                        if (((*numberedGbReg(opcode&7)) & 0x80) == 0)
-                            setZFlag();
-                        else
-                            clearZFlag();
-                        clearNFlag();
-                        setHFlag();
-                        break;
-                    case 0x46:		// BIT 0, (hl)      12
-                        if ((readMemory(g_gbRegs.hl.w) & 0x1) == 0)
-                            setZFlag();
-                        else
-                            clearZFlag();
-                        clearNFlag();
-                        setHFlag();
-                        break;
-                    case 0x4E:		// BIT 1, (hl)
-                        if ((readMemory(g_gbRegs.hl.w) & 0x2) == 0)
-                            setZFlag();
-                        else
-                            clearZFlag();
-                        clearNFlag();
-                        setHFlag();
-                        break;
-                    case 0x56:		// BIT 2, (hl)
-                        if ((readMemory(g_gbRegs.hl.w) & 0x4) == 0)
-                            setZFlag();
-                        else
-                            clearZFlag();
-                        clearNFlag();
-                        setHFlag();
-                        break;
-                    case 0x5E:		// BIT 3, (hl)
-                        if ((readMemory(g_gbRegs.hl.w) & 0x8) == 0)
-                            setZFlag();
-                        else
-                            clearZFlag();
-                        clearNFlag();
-                        setHFlag();
-                        break;
-                    case 0x66:		// BIT 4, (hl)
-                        if ((readMemory(g_gbRegs.hl.w) & 0x10) == 0)
-                            setZFlag();
-                        else
-                            clearZFlag();
-                        clearNFlag();
-                        setHFlag();
-                        break;
-                    case 0x6E:		// BIT 5, (hl)
-                        if ((readMemory(g_gbRegs.hl.w) & 0x20) == 0)
-                            setZFlag();
-                        else
-                            clearZFlag();
-                        clearNFlag();
-                        setHFlag();
-                        break;
-                    case 0x76:		// BIT 6, (hl)
-                        if ((readMemory(g_gbRegs.hl.w) & 0x40) == 0)
-                            setZFlag();
-                        else
-                            clearZFlag();
-                        clearNFlag();
-                        setHFlag();
-                        break;
-                    case 0x7E:		// BIT 7, (hl)
-                        if ((readMemory(g_gbRegs.hl.w) & 0x80) == 0)
-                            setZFlag();
-                        else
-                            clearZFlag();
-                        clearNFlag();
-                        setHFlag();
-                        break;
-                    case 0xC0:		// SET 0, B
-                        g_gbRegs.bc.b.h |= 1;
-                        break;
-                    case 0xC1:		// SET 0, C
-                        g_gbRegs.bc.b.l |= 1;
-                        break;
-                    case 0xC2:		// SET 0, D
-                        g_gbRegs.de.b.h |= 1;
-                        break;
-                    case 0xC3:		// SET 0, E
-                        g_gbRegs.de.b.l |= 1;
-                        break;
-                    case 0xC4:		// SET 0, H
-                        g_gbRegs.hl.b.h |= 1;
-                        break;
-                    case 0xC5:		// SET 0, L
-                        g_gbRegs.hl.b.l |= 1;
-                        break;
-                    case 0xC6:		// SET 0, (hl)  16
-                        {
-                            int val = readMemory(g_gbRegs.hl.w);
-                            val |= 1;
-                            writeMemory(g_gbRegs.hl.w, val);
-                            break;
-                        }
-                    case 0xC7:		// SET 0, A
-                        g_gbRegs.af.b.h |= 1;
-                        break;
-                    case 0xC8:		// SET 1, B
-                        g_gbRegs.bc.b.h |= 2;
-                        break;
-                    case 0xC9:		// SET 1, C
-                        g_gbRegs.bc.b.l |= 2;
-                        break;
-                    case 0xCA:		// SET 1, D
-                        g_gbRegs.de.b.h |= 2;
-                        break;
-                    case 0xCB:		// SET 1, E
-                        g_gbRegs.de.b.l |= 2;
-                        break;
-                    case 0xCC:		// SET 1, H
-                        g_gbRegs.hl.b.h |= 2;
-                        break;
-                    case 0xCD:		// SET 1, L
-                        g_gbRegs.hl.b.l |= 2;
-                        break;
-                    case 0xCE:		// SET 1, (hl)
-                        {
-                            int val = readMemory(g_gbRegs.hl.w);
-                            val |= 2;
-                            writeMemory(g_gbRegs.hl.w, val);
-                            break;
-                        }
-                    case 0xCF:		// SET 1, A
-                        g_gbRegs.af.b.h |= 2;
-                        break;
-                    case 0xD0:		// SET 2, B
-                        g_gbRegs.bc.b.h |= 4;
-                        break;
-                    case 0xD1:		// SET 2, C
-                        g_gbRegs.bc.b.l |= 4;
-                        break;
-                    case 0xD2:		// SET 2, D
-                        g_gbRegs.de.b.h |= 4;
-                        break;
-                    case 0xD3:		// SET 2, E
-                        g_gbRegs.de.b.l |= 4;
-                        break;
-                    case 0xD4:		// SET 2, H
-                        g_gbRegs.hl.b.h |= 4;
-                        break;
-                    case 0xD5:		// SET 2, L
-                        g_gbRegs.hl.b.l |= 4;
-                        break;
-                    case 0xD6:		// SET 2, (hl)
-                        {
-                            int val = readMemory(g_gbRegs.hl.w);
-                            val |= 4;
-                            writeMemory(g_gbRegs.hl.w, val);
-                            break;
-                        }
-                    case 0xD7:		// SET 2, A
-                        g_gbRegs.af.b.h |= 4;
-                        break;
-                    case 0xD8:		// SET 3, B
-                        g_gbRegs.bc.b.h |= 8;
-                        break;
-                    case 0xD9:		// SET 3, C
-                        g_gbRegs.bc.b.l |= 8;
-                        break;
-                    case 0xDA:		// SET 3, D
-                        g_gbRegs.de.b.h |= 8;
-                        break;
-                    case 0xDB:		// SET 3, E
-                        g_gbRegs.de.b.l |= 8;
-                        break;
-                    case 0xDC:		// SET 3, H
-                        g_gbRegs.hl.b.h |= 8;
-                        break;
-                    case 0xDD:		// SET 3, L
-                        g_gbRegs.hl.b.l |= 8;
-                        break;
-                    case 0xDE:		// SET 3, (hl)
-                        {
-                            int val = readMemory(g_gbRegs.hl.w);
-                            val |= 8;
-                            writeMemory(g_gbRegs.hl.w, val);
-                            break;
-                        }
-                    case 0xDF:		// SET 3, A
-                        g_gbRegs.af.b.h |= 8;
-                        break;
-                    case 0xE0:		// SET 4, B
-                        g_gbRegs.bc.b.h |= 0x10;
-                        break;
-                    case 0xE1:		// SET 4, C
-                        g_gbRegs.bc.b.l |= 0x10;
-                        break;
-                    case 0xE2:		// SET 4, D
-                        g_gbRegs.de.b.h |= 0x10;
-                        break;
-                    case 0xE3:		// SET 4, E
-                        g_gbRegs.de.b.l |= 0x10;
-                        break;
-                    case 0xE4:		// SET 4, H
-                        g_gbRegs.hl.b.h |= 0x10;
-                        break;
-                    case 0xE5:		// SET 4, L
-                        g_gbRegs.hl.b.l |= 0x10;
-                        break;
-                    case 0xE6:		// SET 4, (hl)
-                        {
-                            int val = readMemory(g_gbRegs.hl.w);
-                            val |= 0x10;
-                            writeMemory(g_gbRegs.hl.w, val);
-                            break;
-                        }
-                    case 0xE7:		// SET 4, A
-                        g_gbRegs.af.b.h |= 0x10;
-                        break;
-                    case 0xE8:		// SET 5, B
-                        g_gbRegs.bc.b.h |= 0x20;
-                        break;
-                    case 0xE9:		// SET 5, C
-                        g_gbRegs.bc.b.l |= 0x20;
-                        break;
-                    case 0xEA:		// SET 5, D
-                        g_gbRegs.de.b.h |= 0x20;
-                        break;
-                    case 0xEB:		// SET 5, E
-                        g_gbRegs.de.b.l |= 0x20;
-                        break;
-                    case 0xEC:		// SET 5, H
-                        g_gbRegs.hl.b.h |= 0x20;
-                        break;
-                    case 0xED:		// SET 5, L
-                        g_gbRegs.hl.b.l |= 0x20;
-                        break;
-                    case 0xEE:		// SET 5, (hl)
-                        {
-                            int val = readMemory(g_gbRegs.hl.w);
-                            val |= 0x20;
-                            writeMemory(g_gbRegs.hl.w, val);
-                            break;
-                        }
-                    case 0xEF:		// SET 5, A
-                        g_gbRegs.af.b.h |= 0x20;
-                        break;
-                    case 0xF0:		// SET 6, B
-                        g_gbRegs.bc.b.h |= 0x40;
-                        break;
-                    case 0xF1:		// SET 6, C
-                        g_gbRegs.bc.b.l |= 0x40;
-                        break;
-                    case 0xF2:		// SET 6, D
-                        g_gbRegs.de.b.h |= 0x40;
-                        break;
-                    case 0xF3:		// SET 6, E
-                        g_gbRegs.de.b.l |= 0x40;
-                        break;
-                    case 0xF4:		// SET 6, H
-                        g_gbRegs.hl.b.h |= 0x40;
-                        break;
-                    case 0xF5:		// SET 6, L
-                        g_gbRegs.hl.b.l |= 0x40;
-                        break;
-                    case 0xF6:		// SET 6, (hl)
-                        {
-                            int val = readMemory(g_gbRegs.hl.w);
-                            val |= 0x40;
-                            writeMemory(g_gbRegs.hl.w, val);
-                            break;
-                        }
-                    case 0xF7:		// SET 6, A
-                        g_gbRegs.af.b.h |= 0x40;
-                        break;
-                    case 0xF8:		// SET 7, B
-                        g_gbRegs.bc.b.h |= 0x80;
-                        break;
-                    case 0xF9:		// SET 7, C
-                        g_gbRegs.bc.b.l |= 0x80;
-                        break;
-                    case 0xFA:		// SET 7, D
-                        g_gbRegs.de.b.h |= 0x80;
-                        break;
-                    case 0xFB:		// SET 7, E
-                        g_gbRegs.de.b.l |= 0x80;
-                        break;
-                    case 0xFC:		// SET 7, H
-                        g_gbRegs.hl.b.h |= 0x80;
-                        break;
-                    case 0xFD:		// SET 7, L
-                        g_gbRegs.hl.b.l |= 0x80;
-                        break;
-                    case 0xFE:		// SET 7, (hl)
-                        {
-                            int val = readMemory(g_gbRegs.hl.w);
-                            val |= 0x80;
-                            writeMemory(g_gbRegs.hl.w, val);
-                            break;
-                        }
-                    case 0xFF:		// SET 7, A
-                        g_gbRegs.af.b.h |= 0x80;
-                        break;
+                    }
 
-                    case 0x80:		// RES 0, B
-                        g_gbRegs.bc.b.h &= 0xFE;
-                        break;
-                    case 0x81:		// RES 0, C
-                        g_gbRegs.bc.b.l &= 0xFE;
-                        break;
-                    case 0x82:		// RES 0, D
-                        g_gbRegs.de.b.h &= 0xFE;
-                        break;
-                    case 0x83:		// RES 0, E
-                        g_gbRegs.de.b.l &= 0xFE;
-                        break;
-                    case 0x84:		// RES 0, H
-                        g_gbRegs.hl.b.h &= 0xFE;
-                        break;
-                    case 0x85:		// RES 0, L
-                        g_gbRegs.hl.b.l &= 0xFE;
-                        break;
-                    case 0x86:		// RES 0, (hl)
-                        {
-                            int val = readMemory(g_gbRegs.hl.w);
-                            val &= 0xFE;
-                            writeMemory(g_gbRegs.hl.w, val);
-                            break;
-                        }
-                    case 0x87:		// RES 0, A
-                        g_gbRegs.af.b.h &= 0xFE;
-                        break;
-                    case 0x88:		// RES 1, B
-                        g_gbRegs.bc.b.h &= 0xFD;
-                        break;
-                    case 0x89:		// RES 1, C
-                        g_gbRegs.bc.b.l &= 0xFD;
-                        break;
-                    case 0x8A:		// RES 1, D
-                        g_gbRegs.de.b.h &= 0xFD;
-                        break;
-                    case 0x8B:		// RES 1, E
-                        g_gbRegs.de.b.l &= 0xFD;
-                        break;
-                    case 0x8C:		// RES 1, H
-                        g_gbRegs.hl.b.h &= 0xFD;
-                        break;
-                    case 0x8D:		// RES 1, L
-                        g_gbRegs.hl.b.l &= 0xFD;
-                        break;
-                    case 0x8E:		// RES 1, (hl)
-                        {
-                            int val = readMemory(g_gbRegs.hl.w);
-                            val &= 0xFD;
-                            writeMemory(g_gbRegs.hl.w, val);
-                            break;
-                        }
-                    case 0x8F:		// RES 1, A
-                        g_gbRegs.af.b.h &= 0xFD;
-                        break;
-                    case 0x90:		// RES 2, B
-                        g_gbRegs.bc.b.h &= 0xFB;
-                        break;
-                    case 0x91:		// RES 2, C
-                        g_gbRegs.bc.b.l &= 0xFB;
-                        break;
-                    case 0x92:		// RES 2, D
-                        g_gbRegs.de.b.h &= 0xFB;
-                        break;
-                    case 0x93:		// RES 2, E
-                        g_gbRegs.de.b.l &= 0xFB;
-                        break;
-                    case 0x94:		// RES 2, H
-                        g_gbRegs.hl.b.h &= 0xFB;
-                        break;
-                    case 0x95:		// RES 2, L
-                        g_gbRegs.hl.b.l &= 0xFB;
-                        break;
-                    case 0x96:		// RES 2, (hl)
-                        {
-                            int val = readMemory(g_gbRegs.hl.w);
-                            val &= 0xFB;
-                            writeMemory(g_gbRegs.hl.w, val);
-                            break;
-                        }
-                    case 0x97:		// RES 2, A
-                        g_gbRegs.af.b.h &= 0xFB;
-                        break;
-                    case 0x98:		// RES 3, B
-                        g_gbRegs.bc.b.h &= 0xF7;
-                        break;
-                    case 0x99:		// RES 3, C
-                        g_gbRegs.bc.b.l &= 0xF7;
-                        break;
-                    case 0x9A:		// RES 3, D
-                        g_gbRegs.de.b.h &= 0xF7;
-                        break;
-                    case 0x9B:		// RES 3, E
-                        g_gbRegs.de.b.l &= 0xF7;
-                        break;
-                    case 0x9C:		// RES 3, H
-                        g_gbRegs.hl.b.h &= 0xF7;
-                        break;
-                    case 0x9D:		// RES 3, L
-                        g_gbRegs.hl.b.l &= 0xF7;
-                        break;
-                    case 0x9E:		// RES 3, (hl)
-                        {
-                            int val = readMemory(g_gbRegs.hl.w);
-                            val &= 0xF7;
-                            writeMemory(g_gbRegs.hl.w, val);
-                            break;
-                        }
-                    case 0x9F:		// RES 3, A
-                        g_gbRegs.af.b.h &= 0xF7;
-                        break;
-                    case 0xA0:		// RES 4, B
-                        g_gbRegs.bc.b.h &= 0xEF;
-                        break;
-                    case 0xA1:		// RES 4, C
-                        g_gbRegs.bc.b.l &= 0xEF;
-                        break;
-                    case 0xA2:		// RES 4, D
-                        g_gbRegs.de.b.h &= 0xEF;
-                        break;
-                    case 0xA3:		// RES 4, E
-                        g_gbRegs.de.b.l &= 0xEF;
-                        break;
-                    case 0xA4:		// RES 4, H
-                        g_gbRegs.hl.b.h &= 0xEF;
-                        break;
-                    case 0xA5:		// RES 4, L
-                        g_gbRegs.hl.b.l &= 0xEF;
-                        break;
-                    case 0xA6:		// RES 4, (hl)
-                        {
-                            int val = readMemory(g_gbRegs.hl.w);
-                            val &= 0xEF;
-                            writeMemory(g_gbRegs.hl.w, val);
-                            break;
-                        }
-                    case 0xA7:		// RES 4, A
-                        g_gbRegs.af.b.h &= 0xEF;
-                        break;
-                    case 0xA8:		// RES 5, B
-                        g_gbRegs.bc.b.h &= 0xDF;
-                        break;
-                    case 0xA9:		// RES 5, C
-                        g_gbRegs.bc.b.l &= 0xDF;
-                        break;
-                    case 0xAA:		// RES 5, D
-                        g_gbRegs.de.b.h &= 0xDF;
-                        break;
-                    case 0xAB:		// RES 5, E
-                        g_gbRegs.de.b.l &= 0xDF;
-                        break;
-                    case 0xAC:		// RES 5, H
-                        g_gbRegs.hl.b.h &= 0xDF;
-                        break;
-                    case 0xAD:		// RES 5, L
-                        g_gbRegs.hl.b.l &= 0xDF;
-                        break;
-                    case 0xAE:		// RES 5, (hl)
-                        {
-                            int val = readMemory(g_gbRegs.hl.w);
-                            val &= 0xDF;
-                            writeMemory(g_gbRegs.hl.w, val);
-                            break;
-                        }
-                    case 0xAF:		// RES 5, A
-                        g_gbRegs.af.b.h &= 0xDF;
-                        break;
-                    case 0xB0:		// RES 6, B
-                        g_gbRegs.bc.b.h &= 0xBF;
-                        break;
-                    case 0xB1:		// RES 6, C
-                        g_gbRegs.bc.b.l &= 0xBF;
-                        break;
-                    case 0xB2:		// RES 6, D
-                        g_gbRegs.de.b.h &= 0xBF;
-                        break;
-                    case 0xB3:		// RES 6, E
-                        g_gbRegs.de.b.l &= 0xBF;
-                        break;
-                    case 0xB4:		// RES 6, H
-                        g_gbRegs.hl.b.h &= 0xBF;
-                        break;
-                    case 0xB5:		// RES 6, L
-                        g_gbRegs.hl.b.l &= 0xBF;
-                        break;
-                    case 0xB6:		// RES 6, (hl)
-                        {
-                            int val = readMemory(g_gbRegs.hl.w);
-                            val &= 0xBF;
-                            writeMemory(g_gbRegs.hl.w, val);
-                            break;
-                        }
-                    case 0xB7:		// RES 6, A
-                        g_gbRegs.af.b.h &= 0xBF;
-                        break;
-                    case 0xB8:		// RES 7, B
-                        g_gbRegs.bc.b.h &= 0x7F;
-                        break;
-                    case 0xB9:		// RES 7, C
-                        g_gbRegs.bc.b.l &= 0x7F;
-                        break;
-                    case 0xBA:		// RES 7, D
-                        g_gbRegs.de.b.h &= 0x7F;
-                        break;
-                    case 0xBB:		// RES 7, E
-                        g_gbRegs.de.b.l &= 0x7F;
-                        break;
-                    case 0xBC:		// RES 7, H
-                        g_gbRegs.hl.b.h &= 0x7F;
-                        break;
-                    case 0xBD:		// RES 7, L
-                        g_gbRegs.hl.b.l &= 0x7F;
-                        break;
-                    case 0xBE:		// RES 7, (hl)
-                        {
-                            int val = readMemory(g_gbRegs.hl.w);
-                            val &= 0x7F;
-                            writeMemory(g_gbRegs.hl.w, val);
-                            break;
-                        }
-                    case 0xBF:		// RES 7, A
-                        g_gbRegs.af.b.h &= 0x7F;
-                        break;
-                    default:
-                        break;
+                    switch (reg) {
+                        case 0: locBC.b.h = val; break;
+                        case 1: locBC.b.l = val; break;
+                        case 2: locDE.b.h = val; break;
+                        case 3: locDE.b.l = val; break;
+                        case 4: locHL.b.h = val; break;
+                        case 5: locHL.b.l = val; break;
+                        case 6: writeMemory(locHL.w, val); break;
+                        default: locA = val; break;
+                    }
                 }
+cbDone:
                 break;
             default:
                 break;
         }
+#ifdef CPU_PROFILE
+        if (profiling)
+            profileInstruction(this, profPC, profBank, profOpcode, profCbOpcode,
+                    totalCycles - profCycles);
+#endif
     }
 
-end:
-    if (haltBugAddr != NULL) {
-        *haltBugAddr = 0x76;
-        haltBugAddr = NULL;
+    if (registersReset) {
+        // The bios was switched off, and initGameboyMode gave the registers
+        // their starting values
+        registersReset = false;
+        locA = g_gbRegs.af.b.h;
+        locBC = g_gbRegs.bc;
+        locDE = g_gbRegs.de;
+        locHL = g_gbRegs.hl;
+        cyclesToExecute = resetCyclesToExecute;
+        goto run;
     }
+
+end:
     g_gbRegs.af.b.l = locF;
-    g_gbRegs.pc.w += (pcAddr-firstPcAddr);
+    g_gbRegs.af.b.h = locA;
+    g_gbRegs.bc = locBC;
+    g_gbRegs.de = locDE;
+    g_gbRegs.hl = locHL;
+    g_gbRegs.pc.w = getPC();
     g_gbRegs.sp.w = locSP;
     return totalCycles;
 }
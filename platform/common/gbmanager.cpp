@@ -10,6 +10,14 @@
 #include "soundengine.h"
 #include "error.h"
 #include "timer.h"
+#ifdef CPU_PROFILE
+#include "profiler.h"
+#endif
+#ifdef MEM_PROFILE
+#include "memprofile.h"
+#endif
+#include "telemetry.h"
+#include "trace.h"
 
 Gameboy* gameboy = NULL;
 Gameboy* gb2 = NULL;
@@ -26,6 +34,7 @@ int autoFireCounterA=0, autoFireCounterB=0;
 
 
 int fps = 0;
+int lastFps = 0;    // Frames counted in the last full second
 
 time_t rawTime;
 time_t lastRawTime;
@@ -39,6 +48,7 @@ void mgr_init() {
         delete gb2;
 
     gameboy = new Gameboy();
+    gameboy->setVideoSink(&platformVideo);
     hostGb = gameboy;
     gbUno = gameboy;
     gbDuo = NULL;
@@ -67,6 +77,7 @@ void mgr_runFrame() {
     if (!gbUno || emulationPaused)
         return;
 
+    TRACE_SCOPE("runFrame", NULL);
     int ret1=0;
 
     if (gbDuo) {
@@ -119,7 +130,7 @@ void mgr_runFrame() {
     }
 
     if (mgr_areBothUsingExternalClock())
-        printLog("Both waiting\n");
+        printLogAt(LOG_LEVEL_DEBUG, "Both waiting\n");
 
     mgr_frameCounter++;
 }
@@ -151,6 +162,8 @@ void mgr_swapFocus() {
         gb2->getSoundEngine()->mute();
         gameboy->getSoundEngine()->refresh();
 
+        gb2->setVideoSink(&nullVideo);
+        gameboy->setVideoSink(&platformVideo);
         refreshGFX();
     }
 }
@@ -210,6 +223,23 @@ void mgr_loadRom(const char* filename) {
 
     gameboy->init();
 
+#ifdef CPU_PROFILE
+    if (cpuProfilerEnabled)
+        startCpuProfiler(gameboy);
+#endif
+#ifdef MEM_PROFILE
+    if (memProfilerEnabled)
+        startMemoryProfiler(gameboy);
+#endif
+#ifdef TELEMETRY
+    if (telemetryEnabled)
+        startTelemetry(gameboy);
+#endif
+#ifdef CHROME_TRACE
+    if (traceEnabled)
+        startTrace(gameboy);
+#endif
+
     if (gbsMode) {
         disableMenuOption("State Slot");
         disableMenuOption("Save State");
@@ -247,6 +277,19 @@ void mgr_unloadRom() {
 #ifdef CPU_DEBUG
     stopDebugger();
 #endif
+#ifdef CPU_PROFILE
+    if (cpuProfilerEnabled)
+        stopCpuProfiler(gameboy);
+#endif
+#ifdef MEM_PROFILE
+    stopMemoryProfiler(gameboy);
+#endif
+#ifdef TELEMETRY
+    stopTelemetry(gameboy);
+#endif
+#ifdef CHROME_TRACE
+    stopTrace(gameboy);
+#endif
 
     if (gb2) {
         if (gb2->getRomFile() != NULL && gb2->getRomFile() != gameboy->getRomFile())  {
@@ -295,11 +338,26 @@ void mgr_save() {
 }
 
 void mgr_updateVBlank() {
-    drawScreen();
+    {
+        TELEMETRY_SCOPE(TEL_PRESENT);
+        TRACE_SCOPE("drawScreen", NULL);
+        gameboy->getVideoSink()->drawScreen();
+    }
 
-    system_checkPolls();
+    {
+        TELEMETRY_SCOPE(TEL_INPUT);
+        TRACE_SCOPE("input", NULL);
+        system_checkPolls();
 
-    inputUpdateVBlank();
+        inputUpdateVBlank();
+    }
+
+#ifdef TELEMETRY
+    telemetryFrame();
+#endif
+#ifdef CHROME_TRACE
+    traceFrame();
+#endif
 
     buttonsPressed = 0xff;
     if (isMenuOn())
@@ -415,19 +473,26 @@ void mgr_updateVBlank() {
     rawTime = getTime();
 #endif
 
-#ifndef SDL
     fps++;
 
-    if (isConsoleOn() && !isMenuOn() && !consoleDebugOutput && (rawTime > lastRawTime))
+    bool newSecond = rawTime > lastRawTime;
+    if (newSecond) {
+        lastFps = fps;
+        fps = 0;
+        lastRawTime = rawTime;
+    }
+
+    // The SDL build shows the fps over the game screen instead
+#ifndef SDL
+    if (isConsoleOn() && !isMenuOn() && !consoleDebugOutput && newSecond)
     {
         setPrintConsole(menuConsole);
         int line=0;
         if (fpsOutput) {
             clearConsole();
-            iprintf("FPS: %d\n", fps);
+            iprintf("FPS: %d\n", lastFps);
             line++;
         }
-        fps = 0;
 #ifdef DS
         if (timeOutput) {
             for (; line<23-1; line++)
@@ -449,7 +514,6 @@ void mgr_updateVBlank() {
             iprintf("%s\n", s);
         }
 #endif
-        lastRawTime = rawTime;
     }
 #endif
 }
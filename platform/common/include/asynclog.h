@@ -0,0 +1,123 @@
+#pragma once
+#include <string.h>
+#include <type_traits>
+
+// Included by console.h when ASYNC_LOG is defined.
+// Asynchronous printLog. A log call copies its format pointer, a timestamp and
+// its raw arguments into a ring owned by the calling thread, and a background
+// thread does the formatting and output. Nothing is allocated on the logging
+// path; if a ring is full, the message is dropped and counted.
+// Each call site is rate limited on its own, and messages below logLevel are
+// skipped before any arguments are copied.
+
+#define LOG_MAX_ARGS        8
+#define LOG_STRING_SPACE    96  // For copies of "%s" arguments; longer ones are cut off
+#define LOG_SITE_RATE_LIMIT 20  // Messages per second from any one call site
+
+// One for each printLog call in the source. Threads share them, so the rest
+// is only touched with atomics.
+struct LogSite {
+    const char* format; // Set once, by the thread that sets "id"
+    int level;
+    u32 id;             // 0 until the site's first message claims one
+    u32 windowStart;    // Millisecond the current rate limit window started
+    u32 windowCount;
+    u32 suppressed;     // Messages dropped by the rate limit since the last one went out
+};
+
+enum {
+    LOG_ARG_INT = 0,
+    LOG_ARG_INT64,
+    LOG_ARG_DOUBLE,
+    LOG_ARG_STRING,
+    LOG_ARG_POINTER
+};
+
+struct LogRecord {
+    LogSite* site;
+    u64 time;           // Nanoseconds since the log started
+    u32 suppressed;
+    u8 numArgs;
+    u8 stringBytes;
+    u8 argTypes[LOG_MAX_ARGS];
+    union {
+        s64 i;
+        double d;
+        const void* p;
+        int string;     // Offset into strings
+    } args[LOG_MAX_ARGS];
+    char strings[LOG_STRING_SPACE];
+};
+
+extern volatile int logLevel;
+
+void startAsyncLog();
+void stopAsyncLog(); // Writes out anything still queued
+
+LogRecord* logBeginRecord(LogSite* site, const char* format); // NULL if the message is dropped
+void logCommitRecord(LogRecord* record);
+
+// Extra arguments are ignored
+static inline bool logNextArg(LogRecord* r, int type) {
+    if (r->numArgs == LOG_MAX_ARGS)
+        return false;
+    r->argTypes[r->numArgs] = type;
+    return true;
+}
+
+template <typename T>
+static inline void logPackArg(LogRecord* r, T value) {
+    static_assert(std::is_integral<T>::value || std::is_enum<T>::value, "Unsupported printLog argument");
+    if (!logNextArg(r, sizeof(T) > 4 ? LOG_ARG_INT64 : LOG_ARG_INT))
+        return;
+    r->args[r->numArgs++].i = (s64)value;
+}
+static inline void logPackArg(LogRecord* r, double value) {
+    if (!logNextArg(r, LOG_ARG_DOUBLE))
+        return;
+    r->args[r->numArgs++].d = value;
+}
+static inline void logPackArg(LogRecord* r, float value) {
+    logPackArg(r, (double)value);
+}
+static inline void logPackArg(LogRecord* r, const char* value) {
+    if (!logNextArg(r, LOG_ARG_STRING))
+        return;
+    int offset = r->stringBytes;
+    if (value == NULL)
+        value = "(null)";
+    int len = 0;
+    while (value[len] && offset+len < LOG_STRING_SPACE-1)
+        len++;
+    memcpy(r->strings+offset, value, len);
+    r->strings[offset+len] = '\0';
+    r->stringBytes = offset+len+1 < LOG_STRING_SPACE ? offset+len+1 : LOG_STRING_SPACE-1;
+    r->args[r->numArgs++].string = offset;
+}
+static inline void logPackArg(LogRecord* r, char* value) {
+    logPackArg(r, (const char*)value);
+}
+template <typename T>
+static inline void logPackArg(LogRecord* r, T* value) {
+    if (!logNextArg(r, LOG_ARG_POINTER))
+        return;
+    r->args[r->numArgs++].p = (const void*)value;
+}
+
+template <typename... Args>
+static inline void logWrite(LogSite* site, const char* format, Args... args) {
+    LogRecord* r = logBeginRecord(site, format);
+    if (r == NULL)
+        return;
+    int unused[] = { 0, (logPackArg(r, args), 0)... };
+    (void)unused;
+    logCommitRecord(r);
+}
+
+#define printLogAt(level, ...) do { \
+        static LogSite logSite = { NULL, level, 0, 0, 0, 0 }; \
+        if ((level) >= logLevel) \
+            logWrite(&logSite, __VA_ARGS__); \
+    } while (0)
+
+#define printLog(...) printLogAt(LOG_LEVEL_INFO, __VA_ARGS__)
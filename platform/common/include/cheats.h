@@ -31,6 +31,7 @@ class CheatEngine {
     public:
         CheatEngine(Gameboy* g);
         void setRomFile(RomFile* r);
+        void copyCheats(CheatEngine* c);
 
         void enableCheats(bool enable);
         bool addCheat(const char *str);
@@ -60,5 +61,3 @@ class CheatEngine {
         RomFile* romFile;
 };
 
-bool startCheatMenu();
-void redrawCheatMenu();
@@ -6,7 +6,7 @@
 #include <nds/arm9/console.h>
 #endif
 
-#ifdef SDL
+#if defined(SDL) || defined(GY_CORE)
 struct PrintConsole {
 
 };
@@ -35,7 +35,22 @@ void updateScreens(bool waitToFinish=false);
 void consoleSetPosColor(int x, int y, int color);
 void consoleSetLineColor(int line, int color);
 void iprintfColored(int palette, const char* format, ...);
+
+// Levels for printLogAt. Only the asynchronous log filters on them.
+enum {
+    LOG_LEVEL_DEBUG = 0,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARNING,
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_NONE
+};
+
+#ifdef ASYNC_LOG
+#include "asynclog.h" // printLog becomes a macro
+#else
 void printLog(const char* format, ...);
+#define printLogAt(level, ...) printLog(__VA_ARGS__)
+#endif
 
 void printAndWait(const char* format, ...); // Used for debugging
 
@@ -5,18 +5,44 @@
 #endif
 
 #include <stdio.h>
+#include <string.h>
 #include <vector>
 #include "time.h"
 #include "gbgfx.h"
 #include "romfile.h"
+#include "romprofile.h"
 #include "io.h"
+#include "mmu.h"
 
 #ifdef CPU_DEBUG
 #include "debugger.h"
 #endif
+#ifdef MEM_PROFILE
+#include "memprofile.h"
+#endif
 
 #define MAX_SRAM_SIZE   0x20000
 
+// A Gameboy's memory is one page-aligned block, its "arena". Each region starts
+// on a page, and the arena grows to fit the cartridge's ram when it's loaded.
+#define ARENA_PAGE_SIZE 0x1000
+#define ARENA_VRAM      0x0000  // vram, 2 banks of 0x2000
+#define ARENA_WRAM      0x4000  // wram, 8 banks of 0x1000
+#define ARENA_HIGHRAM   0xc000  // fe00-ffff: oam, io and hram
+#define ARENA_SRAM      0xd000  // externRam, rounded up to whole pages
+// After that comes a page of zeros. The cpu doesn't notice when it runs off the
+// end of a 4k area, so this is what it reads past the end of cartridge ram.
+#define MAX_ARENA_SIZE  (ARENA_SRAM + MAX_SRAM_SIZE + ARENA_PAGE_SIZE)
+
+// Writes to the arena mark the 256 byte page they land in as dirty, so that
+// what changed can be found, and hashed, without going over all of it. The
+// page with the io registers and hram is always dirty: the hardware changes
+// it every scanline without going through the write functions.
+#define DIRTY_PAGE_SHIFT    8
+#define DIRTY_PAGE_SIZE     (1<<DIRTY_PAGE_SHIFT)
+#define MAX_DIRTY_PAGES     (MAX_ARENA_SIZE>>DIRTY_PAGE_SHIFT)
+#define IO_DIRTY_PAGE       ((ARENA_HIGHRAM+0xf00)>>DIRTY_PAGE_SHIFT)
+
 // IMPORTANT: This is unchanging, it DOES NOT change in double speed mode!
 #define clockSpeed 4194304
 
@@ -44,6 +70,14 @@ class RomFile;
 // Return codes for runEmul
 #define RET_VBLANK  1
 #define RET_LINK    2
+#define RET_STEP    4   // Only while single stepping
+
+// The cpu cores runOpcode can use. The interpreter is the reference; the core
+// library's gameyob-diff checks others against it.
+enum CpuEngine {
+    CPU_ENGINE_INTERPRETER = 0,
+    NUM_CPU_ENGINES
+};
 
 
 const int timerPeriods[] = {
@@ -80,6 +114,57 @@ typedef union
     } b;
 } Register;
 
+// Where saveStateTo / loadStateFrom put a state: a file if "file" is set,
+// otherwise the "size" bytes at "data". With neither, writes only count bytes.
+struct StateStream {
+    FileHandle* file;
+    u8* data;
+    int size;
+    int pos;
+    bool checkOnly; // Reads only move "pos" along, except readValue's
+
+    void write(const void* src, int bytes);
+    bool read(void* dest, int bytes); // False if the state is cut short
+    bool readValue(void* dest, int bytes);
+};
+
+// Something other than a Gameboy plugged into the link port, such as one in
+// another process (see sdl/nifi.cpp)
+struct LinkCable {
+    // This Gameboy's clock finished shifting out "val". Returns the byte
+    // shifted in.
+    u8 (*transfer)(void* data, u8 val);
+    // The far end's clock reached cycleToSerialTransfer. "val" is SB if a
+    // transfer was waiting for it, or 0xff if not. Returns the byte shifted in.
+    u8 (*clocked)(void* data, u8 val);
+};
+
+// Somewhere other than the heap for a Gameboy's arena, such as memory shared
+// with other processes (see sdl/shmexport.cpp)
+struct ArenaAllocator {
+    // Like realloc, keeping the first min(oldSize, newSize) bytes. "arena" is
+    // NULL for a new one. The result must be ARENA_PAGE_SIZE aligned.
+    u8* (*resize)(void* data, u8* arena, int oldSize, int newSize);
+    void (*release)(void* data, u8* arena);
+};
+
+// Where the emulation was within a frame, for save states and the state hash.
+// All ints, so there's no padding to hash.
+struct StateTimeline {
+    int extraCycles;
+    int interruptTriggered;
+    int cyclesSinceVBlank;
+    int soundCycles;
+    int cycleCount;
+    int cycleToSerialTransfer;
+    int dmaSource, dmaDest, dmaLength, dmaMode;  // An hdma in progress
+    int mbc7State, mbc7Buffer, mbc7RA;
+};
+
+// Return codes for loadStateFrom
+#define STATE_INCOMPATIBLE  1
+#define STATE_TRUNCATED     2
+
 struct Registers
 {
     Register sp; /* Stack Pointer */
@@ -98,6 +183,13 @@ class Gameboy {
 
         Gameboy();
         ~Gameboy();
+        // Duplicates a Gameboy that isn't running. The copy shares the rom but
+        // has its own cartridge ram, and no save file or link partner.
+        Gameboy* clone();
+        void copyFrom(Gameboy* gb); // Like clone, reusing this Gameboy's memory
+        // Like copyFrom, but keeps this Gameboy's save file and link partner,
+        // for putting a running Gameboy back to a copy taken earlier
+        void restoreFrom(Gameboy* gb);
         void init();
         void initGBMode();
         void initGBCMode();
@@ -142,6 +234,7 @@ class Gameboy {
         void setDoubleSpeed(int val);
 
         void setRomFile(RomFile* r);
+        void loadCheats(const char* filename);
         void unloadRom();
         void printRomInfo();
         bool isRomLoaded();
@@ -153,13 +246,46 @@ class Gameboy {
 
         void saveState(int num);
         int loadState(int num);
+        void saveStateTo(StateStream* out);
+        int loadStateFrom(StateStream* in);
+        int getStateSize();
+        void getTimeline(StateTimeline* t);
+        void setTimeline(const StateTimeline* t);
         void deleteState(int num);
         bool checkStateExists(int num);
 
         inline int getCyclesSinceVBlank() { return cyclesSinceVBlank + extraCycles; }
         inline bool isDoubleSpeed() { return doubleSpeed; }
 
-        inline CheatEngine* getCheatEngine() { return cheatEngine; }
+        inline CheatEngine* getCheatEngine() { return cheatEngine; } // NULL until cheats are loaded
+        inline const VideoSink* getVideoSink() { return video; }
+        // nullVideo by default. Only the main gameboy can use platformVideo.
+        inline void setVideoSink(const VideoSink* sink) { video = sink; }
+        // Gets each byte the game sends while nothing is plugged into the link
+        // port. Off (NULL) by default.
+        inline void setSerialOutput(void (*func)(void* data, u8 val), void* data) {
+            serialOutput = func;
+            serialOutputData = data;
+        }
+        // Used when linkedGameboy is NULL. Off (NULL) by default.
+        inline void setLinkCable(const LinkCable* cable, void* data) {
+            linkCable = cable;
+            linkCableData = data;
+        }
+        // Moves the arena into memory from "allocator", or back onto the heap
+        // if it's NULL, as by default. Clones start on the heap.
+        void setArenaAllocator(const ArenaAllocator* allocator, void* data);
+        // setRomFile looks the game up in the profile list. This replaces what
+        // it found, for trying a game with other hacks; the profile is copied.
+        inline void setRomProfile(const RomProfile* p) { profile = *p; }
+        inline const RomProfile* getRomProfile() { return &profile; }
+        inline int getHacks() { return profile.hacks; }
+        inline int getCpuEngine() { return cpuEngine; }
+        // CPU_ENGINE_INTERPRETER by default
+        inline void setCpuEngine(int engine) { cpuEngine = engine; }
+        // Makes runEmul return RET_STEP after every opcode, or after every
+        // event while halted. Off by default.
+        inline void setSingleStep(bool step) { singleStep = step; }
         inline SoundEngine* getSoundEngine() { return soundEngine; }
         inline RomFile* getRomFile() { return romFile; }
 
@@ -205,6 +331,8 @@ class Gameboy {
         int cyclesToExecute;
         int cycleToSerialTransfer;
         int cycleCount;
+        // Like cycleCount, but only ever goes up, even through init()
+        u64 totalCycles;
 
         int interruptTriggered;
         int gameboyFrameCounter;
@@ -212,6 +340,12 @@ class Gameboy {
         int halt;
         int ime;
         struct Registers gbRegs;
+        bool registersReset; // g_gbRegs was set while runOpcode was running
+        int resetCyclesToExecute;
+
+#ifdef MEM_PROFILE
+        MemoryProfile* memProfile; // NULL unless accesses are being counted
+#endif
 
     private:
         bool resettingGameboy;
@@ -219,10 +353,21 @@ class Gameboy {
         // Persistent stuff (not overwritten by init())
         CheatEngine* cheatEngine;
         SoundEngine* soundEngine;
+        const VideoSink* video;
+        void (*serialOutput)(void* data, u8 val);
+        void* serialOutputData;
+        const LinkCable* linkCable;
+        void* linkCableData;
+        const ArenaAllocator* arenaAllocator;
+        void* arenaAllocatorData;
+        int cpuEngine;
+        bool singleStep;
         RomFile* romFile;
+        RomProfile profile;
 
         FileHandle* saveFile;
         char savename[MAX_FILENAME_LEN];
+        int readState(StateStream* in);
 
         // gbcpu.cpp
     public:
@@ -234,18 +379,61 @@ class Gameboy {
             ITCM_CODE
 #endif
             ;
+    private:
+        // Instantiated once per configuration so that disabled features cost nothing
+        template <bool profiling> int runOpcodes(int cycles)
+#ifdef DS
+            ITCM_CODE
+#endif
+            ;
+    public:
 
         inline u8 quickRead(u16 addr) { return memory[addr>>12][addr&0xFFF]; }
         inline u8 quickReadIO(u8 addr) { return ioRam[addr]; }
         inline u16 quickRead16(u16 addr) { return quickRead(addr)|(quickRead(addr+1)<<8); }
         // Currently unused because this can actually overwrite the rom, in rare cases
-        inline void quickWrite(u16 addr, u8 val) { memory[addr>>12][addr&0xFFF] = val; }
+        inline void quickWrite(u16 addr, u8 val) {
+            u8* ptr = &memory[addr>>12][addr&0xFFF];
+            *ptr = val;
+            markDirty(ptr);
+        }
 
 
         // mmu.cpp
 
         void initMMU();
         void mapMemory();
+        void resizeArena(int sramSize);
+        u8* reallocArena(u8* oldArena, int oldSize, int newSize);
+        void freeArena(u8* oldArena);
+        void setArena(u8* newArena, int size);
+        inline u8* getArena() { return arena; }
+        inline int getArenaSize() { return arenaSize; }
+        // A bit per page of the arena (bit n&7 of byte n>>3 for page n), set
+        // when it's written and cleared by clearDirtyPages. Copying a Gameboy
+        // over this one with copyFrom marks every page.
+        inline const u8* getDirtyPages() { return dirtyPages; }
+        inline void clearDirtyPages() {
+            memset(dirtyPages, 0, sizeof(dirtyPages));
+            dirtyPages[IO_DIRTY_PAGE>>3] |= 1<<(IO_DIRTY_PAGE&7);
+        }
+        // A 64-bit hash of the arena and the rest of the emulated state;
+        // equal states hash equal. Only the pages of the arena written since
+        // the last call are hashed again.
+        u64 getStateHash();
+        inline void markArenaDirty(int offset) {
+            int page = offset>>DIRTY_PAGE_SHIFT;
+            dirtyPages[page>>3] |= 1<<(page&7);
+            unhashedPages[page>>3] |= 1<<(page&7);
+        }
+        // For pointers that may be outside the arena, like memory[] entries
+        inline void markDirty(const u8* ptr) {
+            size_t offset = ptr - arena;
+            if (offset < (size_t)arenaSize)
+                markArenaDirty(offset);
+        }
+        void markDirtyRange(const u8* ptr, int size);
+        void markAllDirty();
 //        u8 readMemory(u16 addr) ITCM_CODE;
         u8 readMemoryFast(u16 addr)
 #ifdef DS
@@ -253,13 +441,8 @@ class Gameboy {
 #endif
             ;
         u16 readMemory16(u16 addr);
-        u8 readIO(u8 ioReg)
-#ifdef DS
-            ITCM_CODE
-#endif
-            ;
 //        void writeMemory(u16 addr, u8 val) ITCM_CODE;
-        void writeIO(u8 ioReg, u8 val)
+        void writeIOSpecial(u8 ioReg, u8 val)
 #ifdef DS
             ITCM_CODE
 #endif
@@ -267,6 +450,31 @@ class Gameboy {
         void refreshP1();
         u8 readMemoryOther(u16 addr);
         void writeMemoryOther(u16 addr, u8 val);
+        // What readMemory would return, without counting the read for the
+        // profiler or tripping a watchpoint
+        u8 peekMemory(u16 addr);
+
+        inline u8 readIO(u8 ioReg)
+        {
+#ifdef MEM_PROFILE
+            if (memProfile != NULL)
+                profileIORead(this, ioReg);
+#endif
+            if (ioReg == 0x00)
+                return sgbReadP1();
+            return ioRam[ioReg] | ioReadMasks[ioReg];
+        }
+        inline void writeIO(u8 ioReg, u8 val)
+        {
+#ifdef MEM_PROFILE
+            if (memProfile != NULL)
+                profileIOWrite(this, ioReg);
+#endif
+            if (ioWriteHandlers[ioReg] == IOW_PLAIN)
+                ioRam[ioReg] = val;
+            else
+                writeIOSpecial(ioReg, val);
+        }
 
         inline u8 readMemory(u16 addr)
         {
@@ -275,6 +483,10 @@ class Gameboy {
             if (addr == readWatchAddr && (bank == readWatchBank || bank == -1)) {
                 debugMode = 1;
             }
+#endif
+#ifdef MEM_PROFILE
+            if (memProfile != NULL)
+                profileMemoryRead(this, addr);
 #endif
             int area = addr>>12;
             if (!(area & 0x8) || area == 0xc || area == 0xd) {
@@ -290,15 +502,21 @@ class Gameboy {
             if (addr == writeWatchAddr && (bank == writeWatchBank || bank == -1)) {
                 debugMode = 1;
             }
+#endif
+#ifdef MEM_PROFILE
+            if (memProfile != NULL)
+                profileMemoryWrite(this, addr);
 #endif
             int area = addr>>12;
             if (area == 0xc) {
                 // Checking for this first is a tiny bit more efficient.
                 wram[0][addr&0xfff] = val;
+                markArenaDirty(ARENA_WRAM + (addr&0xfff));
                 return;
             }
             else if (area == 0xd) {
                 wram[wramBank][addr&0xfff] = val;
+                markArenaDirty(ARENA_WRAM + wramBank*0x1000 + (addr&0xfff));
                 return;
             }
             writeMemoryOther(addr, val);
@@ -331,13 +549,21 @@ class Gameboy {
         // memory[x][yyy] = ram value at xyyy
         u8* memory[0x10];
 
-        u8 vram[2][0x2000];
-        u8* externRam;
-        u8 wram[8][0x1000];
-
-        u8 highram[0x1000];
-        u8* const hram;
-        u8* const ioRam;
+        // All of these point into the arena
+        u8 (*vram)[0x2000];
+        u8 (*wram)[0x1000];
+        u8* highram;
+        u8* hram;
+        u8* ioRam;
+        u8* externRam; // NULL if the cartridge has no ram
+
+        u8* arena;
+        int arenaSize;
+        u8 dirtyPages[MAX_DIRTY_PAGES/8];
+        u8 unhashedPages[MAX_DIRTY_PAGES/8];   // Since the last getStateHash
+        u64* pageHashes;                        // One per page of the arena
+        u64 stateHash;                          // Sum of pageHashes
+        u64 hashUnmappedState();
 
         u8 bgPaletteData[0x40]
 #ifdef DS
@@ -365,26 +591,33 @@ class Gameboy {
 
         int framesSinceAutosaveStarted;
         bool saveModified;
-        bool dirtySectors[MAX_SRAM_SIZE/512];
         int numSaveWrites;
         bool autosaveStarted;
-        int saveFileSectors[MAX_SRAM_SIZE/512];
+        // One entry per 512 bytes of cartridge ram; NULL without a save file
+        int numSaveSectors;
+        bool* dirtySectors;
+        int* saveFileSectors;
 
 
         // mbc.cpp
 
-        u8 m3r(u16 addr);
-        u8 m7r(u16 addr);
-        u8 h3r(u16 addr);
+        // Rom area and a000-bfff accesses, dispatched on mbcType
+        u8 readMbc(u16 addr);
+        void writeMbc(u16 addr, u8 val);
 
-        void m0w(u16 addr, u8 val);
-        void m1w(u16 addr, u8 val);
-        void m2w(u16 addr, u8 val);
-        void m3w(u16 addr, u8 val);
-        void m5w(u16 addr, u8 val);
-        void m7w(u16 addr, u8 val);
-        void h1w(u16 addr, u8 val);
-        void h3w(u16 addr, u8 val);
+        // Only called from readMbc / writeMbc, which inline them
+        inline u8 m3r(u16 addr);
+        inline u8 m7r(u16 addr);
+        inline u8 h3r(u16 addr);
+
+        inline void m0w(u16 addr, u8 val);
+        inline void m1w(u16 addr, u8 val);
+        inline void m2w(u16 addr, u8 val);
+        inline void m3w(u16 addr, u8 val);
+        inline void m5w(u16 addr, u8 val);
+        inline void m7w(u16 addr, u8 val);
+        inline void h1w(u16 addr, u8 val);
+        inline void h3w(u16 addr, u8 val);
 
         void handleHuC3Command(u8 command);
         void writeClockStruct();
@@ -398,10 +631,7 @@ class Gameboy {
         int romBank;
         int currentRamBank;
 
-        void (Gameboy::*writeFunc)(u16, u8);
-        u8 (Gameboy::*readFunc)(u16);
-
-        bool rockmanMapper;
+        int mbcType; // romFile->getMBC(), cached by initMMU
 
         int rumbleValue;
         int lastRumbleValue;
@@ -475,16 +705,14 @@ class Gameboy {
         } sgbCmdData;
 };
 
-typedef void (Gameboy::*mbcWrite)(u16,u8);
-typedef u8   (Gameboy::*mbcRead )(u16);
-
-const mbcRead mbcReads[] = {
-    NULL, NULL, NULL, &Gameboy::m3r, NULL, NULL, &Gameboy::m7r, NULL, &Gameboy::h3r
-};
-const mbcWrite mbcWrites[] = {
-    &Gameboy::m0w, &Gameboy::m1w, &Gameboy::m2w, &Gameboy::m3w, NULL, &Gameboy::m5w, &Gameboy::m7w, &Gameboy::h1w, &Gameboy::h3w
-};
+// The core library runs Gameboys on several threads at once, so whatever
+// belongs to the Gameboy that's running is kept per thread there.
+#ifdef GY_CORE
+extern thread_local Gameboy* gameboy;
 
+extern thread_local struct Registers g_gbRegs;
+#else
 extern Gameboy* gameboy;
 
 extern struct Registers g_gbRegs;
+#endif
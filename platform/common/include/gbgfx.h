@@ -52,6 +52,25 @@ void writeVram16(u16 addr, u16 src);
 void writeHram(u16 addr, u8 val);
 void handleVideoRegister(u8 ioReg, u8 val);
 
+// Where a Gameboy's picture goes, chosen per Gameboy. The emulated video
+// hardware (LY, STAT, vram and so on) runs the same whichever it is.
+struct VideoSink {
+    void (*drawScanline)(int scanline);
+    void (*drawScanline_P2)(int scanline);
+    void (*drawScreen)();
+    void (*refresh)();
+    void (*writeVram)(u16 addr, u8 val);
+    void (*writeVram16)(u16 addr, u16 src);
+    void (*writeHram)(u16 addr, u8 val);
+    void (*handleVideoRegister)(u8 ioReg, u8 val);
+    void (*setSgbMask)(int mask);
+    void (*setSgbTiles)(u8* src, u8 flags);
+    void (*setSgbMap)(u8* src);
+};
+
+extern const VideoSink platformVideo; // The functions above, which draw "gameboy"
+extern const VideoSink nullVideo;     // Draws nothing
+
 enum {
     BORDER_NONE=0,
     BORDER_SGB,
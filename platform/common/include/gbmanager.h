@@ -1,11 +1,16 @@
 class Gameboy;
 
+#ifdef GY_CORE
+extern thread_local Gameboy* gameboy;
+#else
 extern Gameboy* gameboy;
+#endif
 extern Gameboy* gb2;
 
 extern Gameboy* hostGb;
 
 extern int mgr_frameCounter;
+extern int lastFps;
 
 void mgr_init();
 void mgr_reset();
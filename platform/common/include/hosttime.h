@@ -0,0 +1,17 @@
+#pragma once
+#include <time.h>
+
+// The host's monotonic clock, for timing and pacing. Not the gameboy's clock;
+// that's in timer.h.
+
+static inline u64 getNanoseconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+static inline double getMilliseconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1000.0 + ts.tv_nsec/1000000.0;
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include "romfile.h"
+
+class Gameboy;
+
+// Counts memory and IO register accesses made by the emulated program, per
+// region and per bank, along with bank switches. A row is appended to
+// "<rom>.mem.csv" every frame, and totals go to "<rom>.mem.txt" when stopped.
+// Stack pushes and pops (quickRead / quickWrite) aren't counted.
+
+enum {
+    MEM_ROM0 = 0,
+    MEM_ROMX,
+    MEM_VRAM,
+    MEM_SRAM,
+    MEM_RTC,        // a000-bfff with an MBC3 clock register selected
+    MEM_WRAM0,
+    MEM_WRAMX,
+    MEM_ECHO,
+    MEM_OAM,
+    MEM_UNUSABLE,   // fea0-feff
+    MEM_IO,
+    MEM_HRAM,
+    NUM_MEM_REGIONS
+};
+
+// Every field must be a u32; counters are summed as an array.
+struct MemoryCounters {
+    u32 reads[NUM_MEM_REGIONS];
+    u32 writes[NUM_MEM_REGIONS];
+    u32 romxReads[MAX_ROM_BANKS];
+    u32 vramReads[2], vramWrites[2];
+    u32 sramReads[16], sramWrites[16];
+    u32 wramReads[8], wramWrites[8];
+    u32 ioReads[0x100], ioWrites[0x100];
+    u32 mbcWrites[4];       // ROM area writes by 0x2000-byte region
+    u32 romBankSwitches;    // Calls to refreshRomBank
+    u32 romBankChanges;     // ... which selected a different bank
+    u32 ramBankSwitches;
+    u32 ramBankChanges;
+};
+
+struct MemoryProfile {
+    MemoryCounters frame;
+    MemoryCounters total;
+    FileHandle* csvFile;
+    int frames;
+};
+
+extern bool memProfilerEnabled;
+
+void startMemoryProfiler(Gameboy* gameboy);
+void stopMemoryProfiler(Gameboy* gameboy);
+void memoryProfilerFrame(Gameboy* gameboy);
+
+void profileMemoryRead(Gameboy* gameboy, u16 addr);
+void profileMemoryWrite(Gameboy* gameboy, u16 addr);
+void profileIORead(Gameboy* gameboy, u8 ioReg);
+void profileIOWrite(Gameboy* gameboy, u8 ioReg);
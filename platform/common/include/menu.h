@@ -43,6 +43,9 @@ void printMenuMessage(const char* s);
 void displaySubMenu(void (*updateFunc)());
 void closeSubMenu();
 
+bool startCheatMenu(); // False if there are no cheats to show
+void redrawCheatMenu();
+
 int getMenuOption(const char* name);
 void setMenuOption(const char* name, int value);
 void enableMenuOption(const char* name);
@@ -1 +1,35 @@
 #pragma once
+
+// What writeIO does with each IO register. Plain registers are stored to
+// ioRam without a call; everything else goes through writeIOSpecial.
+enum {
+    IOW_PLAIN = 0,
+    IOW_P1,
+    IOW_SC,
+    IOW_DIV,
+    IOW_TAC,
+    IOW_IF,
+    IOW_IE,
+    IOW_SOUND,          // Dropped while the APU is off
+    IOW_SOUND_TRIGGER,  // NRx4 and NR30, which also start or stop a channel
+    IOW_NR52,
+    IOW_LCDC,
+    IOW_STAT,
+    IOW_LY,
+    IOW_LYC,
+    IOW_OAM_DMA,
+    IOW_VIDEO,          // Scroll, window and DMG palettes
+    IOW_KEY1,
+    IOW_VBK,
+    IOW_BIOS,
+    IOW_HDMA,
+    IOW_BCPS,
+    IOW_BCPD,
+    IOW_OCPS,
+    IOW_OCPD,
+    IOW_SVBK
+};
+
+// Both generated at compile time in mmu.cpp
+extern const u8 ioReadMasks[0x100];     // Bits which always read back as 1
+extern const u8 ioWriteHandlers[0x100];
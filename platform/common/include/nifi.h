@@ -26,3 +26,12 @@ void nifiPause();
 void nifiUnpause();
 
 void nifiUpdateInput();
+
+#ifdef SDL
+// Links to another GameYob process instead, over a socket. An address with a
+// '/' in it is a unix socket; otherwise it's [host:]port, on localhost if no
+// host is given. nifiHost waits for the other side to connect. Both return
+// false if they couldn't link.
+bool nifiHost(const char* address);
+bool nifiConnect(const char* address);
+#endif
@@ -0,0 +1,20 @@
+#pragma once
+class Gameboy;
+
+// Profiler for emulated code. Counts every executed instruction by bank:PC and
+// by opcode, optionally weighted by cycles, and keeps a shadow call stack from
+// CALL/RST/RET and interrupt entry to build a call graph.
+// Only the profiled instantiation of the interpreter calls into this.
+
+extern bool cpuProfilerEnabled;
+extern bool cpuProfilerByCount; // Sort reports by instruction count instead of cycles
+
+void startCpuProfiler(Gameboy* gameboy); // Resets counters and loads "<rom>.sym"
+void stopCpuProfiler(Gameboy* gameboy);  // Writes "<rom>.prof"
+
+// "bank" and the opcode bytes are as they were before the instruction ran;
+// "cbOpcode" only counts if "opcode" is 0xcb
+void profileInstruction(Gameboy* gameboy, int pc, int bank, int opcode, int cbOpcode, int cycles);
+void profileHalt(Gameboy* gameboy, int cycles);
+void profileCall(Gameboy* gameboy, int target, int sp);
+void profileReturn(Gameboy* gameboy, int sp);
@@ -26,6 +26,9 @@ enum {
 class RomFile {
     public:
         RomFile(const char* filename, bool halfMemory=false);
+        // From a rom image already in memory, which is copied. "name" stands
+        // in for the filename; with an empty name nothing is stored on disk.
+        RomFile(const u8* data, int size, const char* name);
         ~RomFile();
 
         void loadRomBank(int romBank);
@@ -52,6 +55,11 @@ class RomFile {
         u8* romSlot0;
         u8* romSlot1;
 
+        // When every bank fits in memory, where each one is; a bank switch is
+        // then just a lookup. NULL if banks are loaded on demand through
+        // loadRomBank.
+        u8* bankPtr[MAX_ROM_BANKS];
+
         u8 bios[0x900];
 
     private:
@@ -61,6 +69,8 @@ class RomFile {
         int bankSlotIDs[MAX_ROM_BANKS]; // Keeps track of which bank occupies which slot
         std::vector<int> lastBanksUsed;
         FileHandle* romFile;
+        const u8* romData; // Only set while the memory constructor runs
+        int romDataSize;
 
         int numRomBanks;
         int numRamBanks;
@@ -71,4 +81,6 @@ class RomFile {
         char romTitle[20];
 
         void loadBanks();
+        void loadBanksFromMemory();
+        void readHeader();
 };
@@ -0,0 +1,17 @@
+#pragma once
+
+class RomFile;
+
+// Workarounds for games that need them, and that other games mustn't get.
+// They're off unless a game's profile turns them on.
+#define HACK_ROCKMAN_MAPPER 0x01    // Rockman 8 by Yang Yang's take on MBC1
+#define ALL_HACKS           0x01
+
+struct RomProfile {
+    const char* title;      // As in the header, NULL for the empty profile
+    int checksum;           // The header's global checksum, or -1 for any
+    int hacks;
+};
+
+// The profile for the game in "romFile", or one with no hacks
+const RomProfile* findRomProfile(RomFile* romFile);
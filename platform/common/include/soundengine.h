@@ -3,9 +3,6 @@
 #endif
 
 #ifdef SDL
-#include "Sync_Audio.h"
-#include "Blip_Buffer.h"
-
 #define BUFFERSIZE 2048
 #define FREQUENCY 44100
 #endif
@@ -18,6 +15,25 @@ class Gameboy;
 #define CHAN_4 8
 
 
+// What a game can see of the sound hardware: NR52's channel bits turn off as
+// these run out. Kept in save states, along with the registers.
+struct SoundCounters {
+    int cyclesToSoundEvent;
+    int chan1SweepTime;
+    int chan1SweepCounter;
+    int chan1SweepDir;
+    int chan1SweepAmount;
+    int chanLen[4];
+    int chanLenCounter[4];
+    int chanUseLen[4];
+    u32 chanFreq[4];
+    int chanVol[4];
+    int chanEnvDir[4];
+    int chanEnvCounter[4];
+    int chanEnvSweep[4];
+    int chanOn[4];      // Always 0 on the DS, where the ARM7 keeps track
+};
+
 class SoundEngine {
     public:
         SoundEngine(Gameboy* g);
@@ -26,6 +42,13 @@ class SoundEngine {
 
         void init();
         void refresh();
+        void copyState(SoundEngine* s); // The emulated channels, not the audio output
+        // The same for every platform, so they're with the save state code in
+        // gameboy.cpp. Set them after refresh(), which starts the counters over.
+        void getCounters(SoundCounters* c);
+        void setCounters(const SoundCounters* c);
+        // The null audio sink: while muted the channels keep counting down, so
+        // NR52 reads the same, but no samples are made.
         void mute();
         void unmute();
 
@@ -99,11 +122,6 @@ class SoundEngine {
         float updateBufferLimit;
         int updateBufferCount;
         int panic;
-        int timePassed;
-
-        Sync_Audio audio;
-        Blip_Buffer buf;
-        Blip_Synth<blip_low_quality,20> synth;
 #endif
 
 #ifdef _3DS
@@ -0,0 +1,74 @@
+#pragma once
+class Gameboy;
+
+// Host-time accounting. Scoped timers attribute wall time to whichever
+// subsystem is innermost, so time spent loading a bank from inside the CPU
+// counts as bank loading only. Everything outside a scope is "other".
+// Frames are closed by mgr_updateVBlank; a row per frame goes to
+// "<rom>.telemetry.csv" and a summary to "<rom>.telemetry.json" when stopped.
+
+enum {
+    TEL_OTHER = 0,
+    TEL_CPU,
+    TEL_PPU,
+    TEL_APU,
+    TEL_DMA,
+    TEL_BANK,
+    TEL_PRESENT,
+    TEL_INPUT,
+    NUM_TEL_SUBSYSTEMS
+};
+
+#ifdef TELEMETRY
+
+#define TELEMETRY_WINDOW        120     // Frames used for the overlay statistics
+
+struct TelemetrySummary {
+    int frames;     // Frames in the window
+    float fps;
+    float mean;     // Frame times in milliseconds
+    float p50;
+    float p95;
+    float p99;
+    float max;
+    float share[NUM_TEL_SUBSYSTEMS];    // Percent of host time
+};
+
+extern bool telemetryEnabled;   // Set from the command line, starts with each rom
+extern bool telemetryOverlay;   // Draw the summary over the game screen
+#ifdef GY_CORE
+extern thread_local bool telemetryActive;   // Each thread's own in the core library
+#else
+extern bool telemetryActive;
+#endif
+
+extern const char* telemetryNames[];
+
+void startTelemetry(Gameboy* gameboy);
+void stopTelemetry(Gameboy* gameboy);
+void telemetryFrame();
+void telemetryGetSummary(TelemetrySummary* summary);
+
+int telemetryEnter(int subsystem);  // Returns the subsystem that was interrupted
+void telemetryLeave(int subsystem);
+
+class TelemetryScope {
+    public:
+        TelemetryScope(int subsystem) {
+            parent = telemetryActive ? telemetryEnter(subsystem) : -1;
+        }
+        ~TelemetryScope() {
+            if (parent != -1)
+                telemetryLeave(parent);
+        }
+    private:
+        int parent;
+};
+
+#define TELEMETRY_SCOPE(subsystem) TelemetryScope telemetryScope(subsystem)
+
+#else
+
+#define TELEMETRY_SCOPE(subsystem)
+
+#endif
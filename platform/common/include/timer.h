@@ -2,8 +2,13 @@
 
 #include <time.h>
 
+#ifdef GY_CORE
+extern thread_local time_t rawTime;
+extern thread_local time_t lastRawTime;
+#else
 extern time_t rawTime;
 extern time_t lastRawTime;
+#endif
 
 void clockUpdater(); 
 time_t getTime();
@@ -0,0 +1,56 @@
+#pragma once
+class Gameboy;
+
+// Timeline of host-time spans and emulator events, written as Chrome
+// trace_event JSON (open in chrome://tracing or ui.perfetto.dev). Events are
+// kept in memory while tracing and written out when the rom is unloaded.
+// Each Gameboy gets its own track; events with no Gameboy go on the host track.
+
+#ifdef CHROME_TRACE
+
+extern bool traceEnabled;   // Set from the command line, starts with each rom
+#ifdef GY_CORE
+extern thread_local bool traceActive;   // Each thread's own in the core library
+#else
+extern bool traceActive;
+#endif
+extern char traceFilename[]; // Defaults to "<rom>.trace.json" when empty
+
+void startTrace(Gameboy* gameboy);
+void stopTrace(Gameboy* gameboy);
+void traceFrame(); // Ends the current "frame" span and starts the next
+
+u64 traceGetTime();
+void traceSpan(const char* name, Gameboy* gb, u64 start, const char* argName, int arg);
+void traceInstant(const char* name, Gameboy* gb, const char* argName, int arg);
+
+class TraceScope {
+    public:
+        TraceScope(const char* name, Gameboy* gb, const char* argName=0, int arg=0)
+            : name(name), gb(gb), argName(argName), arg(arg) {
+            start = traceActive ? traceGetTime() : 0;
+        }
+        ~TraceScope() {
+            if (start != 0 && traceActive)
+                traceSpan(name, gb, start, argName, arg);
+        }
+    private:
+        const char* name;
+        Gameboy* gb;
+        const char* argName;
+        int arg;
+        u64 start;
+};
+
+#define TRACE_SCOPE(name, gb) TraceScope traceScope(name, gb)
+#define TRACE_SCOPE_ARG(name, gb, argName, arg) TraceScope traceScope(name, gb, argName, arg)
+#define TRACE_INSTANT(name, gb, argName, arg) \
+    do { if (traceActive) traceInstant(name, gb, argName, arg); } while (0)
+
+#else
+
+#define TRACE_SCOPE(name, gb)
+#define TRACE_SCOPE_ARG(name, gb, argName, arg)
+#define TRACE_INSTANT(name, gb, argName, arg)
+
+#endif
@@ -4,6 +4,7 @@
 #include <stdarg.h>
 #include <string.h>
 #include "io.h"
+#include "trace.h"
 
 
 #ifdef C_IO_FUNCTIONS
@@ -11,6 +12,7 @@
 DIR* directory = 0;
 
 FileHandle* file_open(const char* filename, const char* params) {
+    TRACE_SCOPE("file_open", NULL);
     FileHandle* h = (FileHandle*)malloc(sizeof(FileHandle));
     h->filename = (char*)malloc(strlen(filename)+1);
     strcpy(h->filename, filename);
@@ -28,14 +30,17 @@ FileHandle* file_open(const char* filename, const char* params) {
 }
 
 void file_close(FileHandle* h) {
+    TRACE_SCOPE("file_close", NULL);
     fclose(h->file);
     free(h->filename);
     free(h);
 }
 void file_read(void* buf, int bs, int size, FileHandle* h) {
+    TRACE_SCOPE_ARG("file_read", NULL, "bytes", bs*size);
     fread(buf, bs, size, h->file);
 }
 void file_write(const void* buf, int bs, int size, FileHandle* h) {
+    TRACE_SCOPE_ARG("file_write", NULL, "bytes", bs*size);
     fwrite(buf, bs, size, h->file);
 }
 void file_gets(char* buf, int size, FileHandle* h) {
@@ -62,6 +67,7 @@ int file_getSize(FileHandle* h) {
     return ret;
 }
 void file_setSize(FileHandle* h, size_t neededSize) {
+    TRACE_SCOPE_ARG("file_setSize", NULL, "bytes", neededSize);
     size_t fileSize = file_getSize(h);
     fclose(h->file);
     h->file = fopen(h->filename, "ab");
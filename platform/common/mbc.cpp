@@ -106,7 +106,7 @@ void Gameboy::m1w (u16 addr, u8 val) {
         case 0x2: /* 2000 - 3fff */
         case 0x3:
             val &= 0x1f;
-            if (rockmanMapper)
+            if (profile.hacks & HACK_ROCKMAN_MAPPER)
                 newBank = ((val > 0xf) ? val - 8 : val);
             else
                 newBank = (romBank & 0xe0) | val;
@@ -411,6 +411,54 @@ void Gameboy::h3w (u16 addr, u8 val) {
     }
 }
 
+
+// The mbc can't change while a rom is loaded, so these branches always go the
+// same way, and each handler is inlined into its case.
+
+u8 Gameboy::readMbc(u16 addr) {
+    switch (mbcType) {
+        case MBC3:
+            return m3r(addr);
+        case MBC7:
+            return m7r(addr);
+        case HUC3:
+            return h3r(addr);
+        default:
+            if (!getNumSramBanks())
+                return 0xff;
+            return memory[addr>>12][addr&0xfff];
+    }
+}
+
+void Gameboy::writeMbc(u16 addr, u8 val) {
+    switch (mbcType) {
+        case MBC0:
+            m0w(addr, val);
+            break;
+        case MBC1:
+            m1w(addr, val);
+            break;
+        case MBC2:
+            m2w(addr, val);
+            break;
+        case MBC3:
+            m3w(addr, val);
+            break;
+        case MBC5:
+            m5w(addr, val);
+            break;
+        case MBC7:
+            m7w(addr, val);
+            break;
+        case HUC1:
+            h1w(addr, val);
+            break;
+        case HUC3:
+            h3w(addr, val);
+            break;
+    }
+}
+
 void Gameboy::handleHuC3Command (u8 cmd) 
 {
     switch (cmd&0xf0) {
@@ -0,0 +1,250 @@
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include "gameboy.h"
+#include "romfile.h"
+#include "console.h"
+#include "io.h"
+#include "memprofile.h"
+
+#ifdef MEM_PROFILE
+
+bool memProfilerEnabled = false;
+
+static const char* regionNames[] = {
+    "rom0", "romx", "vram", "sram", "rtc", "wram0", "wramx", "echo", "oam", "unusable", "io", "hram"
+};
+
+static const char* ioRegisterNames[0x100] = {
+    "P1", "SB", "SC", 0, "DIV", "TIMA", "TMA", "TAC", 0, 0, 0, 0, 0, 0, 0, "IF",
+    "NR10", "NR11", "NR12", "NR13", "NR14", 0, "NR21", "NR22", "NR23", "NR24", "NR30", "NR31", "NR32", "NR33", "NR34", 0,
+    "NR41", "NR42", "NR43", "NR44", "NR50", "NR51", "NR52", 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    "WAV0", "WAV1", "WAV2", "WAV3", "WAV4", "WAV5", "WAV6", "WAV7", "WAV8", "WAV9", "WAVA", "WAVB", "WAVC", "WAVD", "WAVE", "WAVF",
+    "LCDC", "STAT", "SCY", "SCX", "LY", "LYC", "DMA", "BGP", "OBP0", "OBP1", "WY", "WX", 0, "KEY1", 0, "VBK",
+    "BOOT", "HDMA1", "HDMA2", "HDMA3", "HDMA4", "HDMA5", "RP", 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, "BCPS", "BCPD", "OCPS", "OCPD", 0, 0, 0, 0,
+    "SVBK", 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+
+static int getRegion(Gameboy* gameboy, u16 addr) {
+    switch (addr>>12) {
+        case 0x0: case 0x1: case 0x2: case 0x3:
+            return MEM_ROM0;
+        case 0x4: case 0x5: case 0x6: case 0x7:
+            return MEM_ROMX;
+        case 0x8: case 0x9:
+            return MEM_VRAM;
+        case 0xa: case 0xb:
+            // MBC3 shows its clock here when a bank from 8 to c is selected
+            if (gameboy->currentRamBank >= 8 && gameboy->getRomFile()->getMBC() == MBC3)
+                return MEM_RTC;
+            return MEM_SRAM;
+        case 0xc:
+            return MEM_WRAM0;
+        case 0xd:
+            return MEM_WRAMX;
+        case 0xe:
+            return MEM_ECHO;
+        default:
+            if (addr < 0xfe00)
+                return MEM_ECHO;
+            if (addr < 0xfea0)
+                return MEM_OAM;
+            if (addr < 0xff00)
+                return MEM_UNUSABLE;
+            if (addr < 0xff80 || addr == 0xffff)
+                return MEM_IO;
+            return MEM_HRAM;
+    }
+}
+
+// IO and HRAM accesses go through profileIORead / profileIOWrite instead.
+void profileMemoryRead(Gameboy* gameboy, u16 addr) {
+    if (addr >= 0xff00)
+        return;
+    MemoryCounters& c = gameboy->memProfile->frame;
+    int region = getRegion(gameboy, addr);
+    c.reads[region]++;
+    switch (region) {
+        case MEM_ROMX:
+            c.romxReads[gameboy->romBank]++;
+            break;
+        case MEM_VRAM:
+            c.vramReads[gameboy->vramBank]++;
+            break;
+        case MEM_SRAM:
+            c.sramReads[gameboy->currentRamBank&15]++;
+            break;
+        case MEM_WRAMX:
+            c.wramReads[gameboy->wramBank]++;
+            break;
+    }
+}
+
+void profileMemoryWrite(Gameboy* gameboy, u16 addr) {
+    if (addr >= 0xff00)
+        return;
+    MemoryCounters& c = gameboy->memProfile->frame;
+    int region = getRegion(gameboy, addr);
+    c.writes[region]++;
+    switch (region) {
+        case MEM_ROM0:
+        case MEM_ROMX:
+            c.mbcWrites[addr>>13]++;
+            break;
+        case MEM_VRAM:
+            c.vramWrites[gameboy->vramBank]++;
+            break;
+        case MEM_SRAM:
+            c.sramWrites[gameboy->currentRamBank&15]++;
+            break;
+        case MEM_WRAMX:
+            c.wramWrites[gameboy->wramBank]++;
+            break;
+    }
+}
+
+void profileIORead(Gameboy* gameboy, u8 ioReg) {
+    MemoryCounters& c = gameboy->memProfile->frame;
+    c.ioReads[ioReg]++;
+    c.reads[ioReg >= 0x80 && ioReg != 0xff ? MEM_HRAM : MEM_IO]++;
+}
+
+void profileIOWrite(Gameboy* gameboy, u8 ioReg) {
+    MemoryCounters& c = gameboy->memProfile->frame;
+    c.ioWrites[ioReg]++;
+    c.writes[ioReg >= 0x80 && ioReg != 0xff ? MEM_HRAM : MEM_IO]++;
+}
+
+static void writeCsvHeader(FileHandle* file) {
+    file_printf(file, "frame");
+    for (int i=0; i<NUM_MEM_REGIONS; i++)
+        file_printf(file, ",%s_r,%s_w", regionNames[i], regionNames[i]);
+    file_printf(file, ",rom_switches,rom_changes,ram_switches,ram_changes");
+    file_printf(file, ",mbc_0000_w,mbc_2000_w,mbc_4000_w,mbc_6000_w");
+    for (int i=0; i<0x100; i++) {
+        if (i >= 0x80 && i != 0xff)
+            continue;
+        file_printf(file, ",ff%.2x_r,ff%.2x_w", i, i);
+    }
+    file_printf(file, "\n");
+}
+
+void startMemoryProfiler(Gameboy* gameboy) {
+    if (gameboy->memProfile == NULL)
+        gameboy->memProfile = (MemoryProfile*)malloc(sizeof(MemoryProfile));
+    MemoryProfile* p = gameboy->memProfile;
+    memset(p, 0, sizeof(MemoryProfile));
+
+    char filename[MAX_FILENAME_LEN];
+    snprintf(filename, sizeof(filename), "%s.mem.csv", gameboy->getRomFile()->getBasename());
+    p->csvFile = file_open(filename, "w");
+    if (p->csvFile == NULL)
+        printLog("Couldn't open %s\n", filename);
+    else
+        writeCsvHeader(p->csvFile);
+}
+
+void memoryProfilerFrame(Gameboy* gameboy) {
+    MemoryProfile* p = gameboy->memProfile;
+    MemoryCounters& c = p->frame;
+
+    if (p->csvFile != NULL) {
+        FileHandle* file = p->csvFile;
+        file_printf(file, "%d", p->frames);
+        for (int i=0; i<NUM_MEM_REGIONS; i++)
+            file_printf(file, ",%u,%u", c.reads[i], c.writes[i]);
+        file_printf(file, ",%u,%u,%u,%u", c.romBankSwitches, c.romBankChanges,
+                c.ramBankSwitches, c.ramBankChanges);
+        for (int i=0; i<4; i++)
+            file_printf(file, ",%u", c.mbcWrites[i]);
+        for (int i=0; i<0x100; i++) {
+            if (i >= 0x80 && i != 0xff)
+                continue;
+            file_printf(file, ",%u,%u", c.ioReads[i], c.ioWrites[i]);
+        }
+        file_printf(file, "\n");
+    }
+
+    u32* frame = (u32*)&p->frame;
+    u32* total = (u32*)&p->total;
+    for (unsigned int i=0; i<sizeof(MemoryCounters)/sizeof(u32); i++)
+        total[i] += frame[i];
+    memset(&p->frame, 0, sizeof(MemoryCounters));
+    p->frames++;
+}
+
+static bool compareIOCounts(const std::pair<u32, int>& a, const std::pair<u32, int>& b) {
+    return a.first > b.first;
+}
+
+static void writeBankCounts(FileHandle* file, const char* name, u32* reads, u32* writes, int numBanks) {
+    for (int i=0; i<numBanks; i++) {
+        if (reads[i] || (writes != NULL && writes[i]))
+            file_printf(file, "  %-6s %3x  %12u %12u\n", name, i, reads[i], writes == NULL ? 0 : writes[i]);
+    }
+}
+
+void stopMemoryProfiler(Gameboy* gameboy) {
+    MemoryProfile* p = gameboy->memProfile;
+    if (p == NULL)
+        return;
+    gameboy->memProfile = NULL;
+
+    if (p->csvFile != NULL)
+        file_close(p->csvFile);
+
+    char filename[MAX_FILENAME_LEN];
+    snprintf(filename, sizeof(filename), "%s.mem.txt", gameboy->getRomFile()->getBasename());
+    FileHandle* file = file_open(filename, "w");
+    if (file == NULL) {
+        printLog("Couldn't open %s\n", filename);
+        free(p);
+        return;
+    }
+
+    MemoryCounters& c = p->total;
+    int frames = p->frames ? p->frames : 1;
+
+    file_printf(file, "Memory accesses for %s over %d frames\n\n", gameboy->getRomFile()->getRomTitle(), p->frames);
+    file_printf(file, "  %-10s %12s %12s %10s %10s\n", "region", "reads", "writes", "reads/frm", "writes/frm");
+    for (int i=0; i<NUM_MEM_REGIONS; i++)
+        file_printf(file, "  %-10s %12u %12u %10u %10u\n", regionNames[i], c.reads[i], c.writes[i],
+                c.reads[i]/frames, c.writes[i]/frames);
+
+    file_printf(file, "\nBanks:                  reads       writes\n");
+    writeBankCounts(file, "romx", c.romxReads, NULL, MAX_ROM_BANKS);
+    writeBankCounts(file, "vram", c.vramReads, c.vramWrites, 2);
+    writeBankCounts(file, "sram", c.sramReads, c.sramWrites, 16);
+    writeBankCounts(file, "wram", c.wramReads, c.wramWrites, 8);
+
+    file_printf(file, "\nBank switches: rom %u (%u changed bank, %u/frame), ram %u (%u changed bank)\n",
+            c.romBankSwitches, c.romBankChanges, c.romBankChanges/frames, c.ramBankSwitches, c.ramBankChanges);
+    file_printf(file, "MBC writes: 0000 %u, 2000 %u, 4000 %u, 6000 %u\n",
+            c.mbcWrites[0], c.mbcWrites[1], c.mbcWrites[2], c.mbcWrites[3]);
+    file_printf(file, "VRAM bank selects %u, WRAM bank selects %u\n", c.ioWrites[0x4f], c.ioWrites[0x70]);
+
+    std::vector<std::pair<u32, int> > io;
+    for (int i=0; i<0x100; i++) {
+        if ((i < 0x80 || i == 0xff) && c.ioReads[i] + c.ioWrites[i] != 0)
+            io.push_back(std::make_pair(c.ioReads[i] + c.ioWrites[i], i));
+    }
+    std::sort(io.begin(), io.end(), compareIOCounts);
+
+    file_printf(file, "\nIO registers by total accesses:\n");
+    file_printf(file, "  %-4s %-6s %12s %12s %10s\n", "reg", "name", "reads", "writes", "total/frm");
+    for (unsigned int i=0; i<io.size(); i++) {
+        int reg = io[i].second;
+        const char* name = reg == 0xff ? "IE" : ioRegisterNames[reg];
+        file_printf(file, "  ff%.2x %-6s %12u %12u %10u\n", reg, name ? name : "", c.ioReads[reg],
+                c.ioWrites[reg], io[i].first/frames);
+    }
+
+    file_close(file);
+    free(p);
+    printLog("Wrote memory profile to %s\n", filename);
+}
+
+#endif
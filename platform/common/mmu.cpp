@@ -5,8 +5,10 @@ extern "C" {
 }
 #endif
 
+#include <stddef.h>
 #include <stdio.h>
 #include <cstdlib>
+#include <malloc.h>
 #include <string.h>
 #include "mmu.h"
 #include "gameboy.h"
@@ -20,6 +22,8 @@ extern "C" {
 #include "gbs.h"
 #include "timer.h"
 #include "romfile.h"
+#include "telemetry.h"
+#include "trace.h"
 
 
 #define refreshVramBank() { \
@@ -30,34 +34,54 @@ extern "C" {
 
 void Gameboy::refreshRomBank(int bank) 
 {
+#ifdef MEM_PROFILE
+    if (memProfile != NULL) {
+        memProfile->frame.romBankSwitches++;
+        if (bank != romBank)
+            memProfile->frame.romBankChanges++;
+    }
+#endif
     if (bank < romFile->getNumRomBanks()) {
         romBank = bank;
-        romFile->loadRomBank(romBank); 
-        memory[0x4] = romFile->romSlot1;
-        memory[0x5] = romFile->romSlot1+0x1000;
-        memory[0x6] = romFile->romSlot1+0x2000;
-        memory[0x7] = romFile->romSlot1+0x3000; 
+        u8* slot = romFile->bankPtr[bank];
+        if (slot == NULL) {
+            // Not everything fits; go through the bank cache
+            romFile->loadRomBank(romBank);
+            slot = romFile->romSlot1;
+        }
+        memory[0x4] = slot;
+        memory[0x5] = slot+0x1000;
+        memory[0x6] = slot+0x2000;
+        memory[0x7] = slot+0x3000;
     }
     else
-        printLog("Tried to access bank %x\n", bank);
+        printLogAt(LOG_LEVEL_WARNING, "Tried to access bank %x\n", bank);
 }
 
 void Gameboy::refreshRamBank (int bank) 
 {
+#ifdef MEM_PROFILE
+    if (memProfile != NULL) {
+        memProfile->frame.ramBankSwitches++;
+        if (bank != currentRamBank)
+            memProfile->frame.ramBankChanges++;
+    }
+#endif
     if (bank < getNumSramBanks()) {
         currentRamBank = bank;
         memory[0xa] = externRam+currentRamBank*0x2000;
         memory[0xb] = externRam+currentRamBank*0x2000+0x1000; 
     }
     else
-        printLog("Tried to access ram bank %x\n", bank);
+        printLogAt(LOG_LEVEL_WARNING, "Tried to access ram bank %x\n", bank);
 }
 
 void Gameboy::writeSram(u16 addr, u8 val) {
     int pos = addr + currentRamBank*0x2000;
     if (externRam[pos] != val) {
         externRam[pos] = val;
-        if (autoSavingEnabled) {
+        markArenaDirty(ARENA_SRAM + pos);
+        if (autoSavingEnabled && dirtySectors != NULL) {
             /*
             file_seek(saveFile, currentRamBank*0x2000+addr, SEEK_SET);
             file_putc(val, saveFile);
@@ -84,11 +108,7 @@ void Gameboy::initMMU()
     romBank = 1;
     currentRamBank = 0;
 
-    readFunc = mbcReads[romFile->getMBC()];
-    writeFunc = mbcWrites[romFile->getMBC()];
-
-    /* Rockman8 by Yang Yang uses a silghtly different MBC1 variant */
-    rockmanMapper = !strcmp(romFile->getRomTitle(), "ROCKMAN 99");
+    mbcType = romFile->getMBC();
 
     rumbleValue = 0;
     lastRumbleValue = 0;
@@ -116,6 +136,7 @@ void Gameboy::initMMU()
 
     memset(vram[0], 0, 0x2000);
     memset(vram[1], 0, 0x2000);
+    markAllDirty();
 
     writeIO(0x02, 0x00);
     writeIO(0x05, 0x00);
@@ -134,12 +155,167 @@ void Gameboy::initMMU()
 
     ioRam[0x55] = 0xff;
 
-    memset(dirtySectors, 0, sizeof(dirtySectors));
+    if (dirtySectors != NULL)
+        memset(dirtySectors, 0, numSaveSectors*sizeof(bool));
 
     if (!biosOn)
         initGameboyMode();
 }
 
+void Gameboy::resizeArena(int sramSize) {
+    int size = ARENA_SRAM + ((sramSize + ARENA_PAGE_SIZE-1) & ~(ARENA_PAGE_SIZE-1)) + ARENA_PAGE_SIZE;
+    if (arena != NULL && size == arenaSize)
+        return;
+
+    u8* newArena = reallocArena(arena, arena != NULL ? arenaSize : 0, size);
+    memset(newArena+size-ARENA_PAGE_SIZE, 0, ARENA_PAGE_SIZE);
+    setArena(newArena, size);
+
+    // The pages past the end are gone, so the hash starts over
+    free(pageHashes);
+    pageHashes = (u64*)calloc(size>>DIRTY_PAGE_SHIFT, sizeof(u64));
+    stateHash = 0;
+    markAllDirty();
+}
+
+void Gameboy::markDirtyRange(const u8* ptr, int size) {
+    size_t offset = ptr - arena;
+    if (size <= 0 || offset >= (size_t)arenaSize)
+        return;
+    int end = offset+size < (size_t)arenaSize ? offset+size : arenaSize;
+    for (int page = offset>>DIRTY_PAGE_SHIFT; page <= (end-1)>>DIRTY_PAGE_SHIFT; page++)
+        markArenaDirty(page<<DIRTY_PAGE_SHIFT);
+}
+
+void Gameboy::markAllDirty() {
+    memset(dirtyPages, 0xff, sizeof(dirtyPages));
+    memset(unhashedPages, 0xff, sizeof(unhashedPages));
+}
+
+static u64 hashPage(const u8* page, int index) {
+    u64 hash = 0x9e3779b97f4a7c15ULL * (index+1);
+    for (int i=0; i<DIRTY_PAGE_SIZE; i+=8) {
+        u64 word;
+        memcpy(&word, page+i, 8);
+        hash ^= word;
+        hash *= 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 32;
+    }
+    return hash;
+}
+
+static u64 hashBytes(const void* data, int size, u64 hash) {
+    const u8* bytes = (const u8*)data;
+    for (int i=0; i<size; i++) {
+        hash ^= bytes[i];
+        hash *= 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 32;
+    }
+    return hash;
+}
+
+// What isn't in the arena: the cpu, the banks, the timers and the cgb
+// palettes. It's small, so it's hashed in full each time.
+u64 Gameboy::hashUnmappedState() {
+    int vals[] = {
+        halt, ime, doubleSpeed, biosOn, gbMode,
+        romBank, currentRamBank, wramBank, vramBank, memoryModel, ramEnabled,
+        HuC3Mode, HuC3Value, HuC3Shift,
+        scanlineCounter, phaseCounter, dividerCounter, timerCounter, serialCounter,
+    };
+    u64 hash = hashBytes(&gbRegs, sizeof(gbRegs), 0x9e3779b97f4a7c15ULL);
+    hash = hashBytes(vals, sizeof(vals), hash);
+    // Not "last", which is when the clock was last read on this machine
+    hash = hashBytes(&gbClock, offsetof(ClockStruct, last), hash);
+    hash = hashBytes(bgPaletteData, sizeof(bgPaletteData), hash);
+    hash = hashBytes(sprPaletteData, sizeof(sprPaletteData), hash);
+    // The rest of what's in a save state
+    StateTimeline timeline;
+    getTimeline(&timeline);
+    hash = hashBytes(&timeline, sizeof(timeline), hash);
+    SoundCounters sound;
+    soundEngine->getCounters(&sound);
+    return hashBytes(&sound, sizeof(sound), hash);
+}
+
+// The arena's part of the hash is the sum of each page's, so a page that
+// changes only has to have its own taken out and put back.
+u64 Gameboy::getStateHash() {
+    unhashedPages[IO_DIRTY_PAGE>>3] |= 1<<(IO_DIRTY_PAGE&7);
+    int pages = arenaSize>>DIRTY_PAGE_SHIFT;
+    for (int i=0; i<(pages+7)/8; i++) {
+        u8 bits = unhashedPages[i];
+        if (bits == 0)
+            continue;
+        unhashedPages[i] = 0;
+        for (int page=i*8; bits != 0 && page < pages; page++, bits >>= 1) {
+            if (!(bits & 1))
+                continue;
+            u64 hash = hashPage(arena + (page<<DIRTY_PAGE_SHIFT), page);
+            stateHash += hash - pageHashes[page];
+            pageHashes[page] = hash;
+        }
+    }
+    return stateHash + hashUnmappedState();
+}
+
+u8* Gameboy::reallocArena(u8* oldArena, int oldSize, int newSize) {
+    if (arenaAllocator != NULL)
+        return arenaAllocator->resize(arenaAllocatorData, oldArena, oldSize, newSize);
+
+    u8* newArena = (u8*)memalign(ARENA_PAGE_SIZE, newSize);
+    if (oldArena != NULL) {
+        memcpy(newArena, oldArena, oldSize < newSize ? oldSize : newSize);
+        free(oldArena);
+    }
+    return newArena;
+}
+
+void Gameboy::freeArena(u8* oldArena) {
+    if (arenaAllocator != NULL)
+        arenaAllocator->release(arenaAllocatorData, oldArena);
+    else
+        free(oldArena);
+}
+
+void Gameboy::setArenaAllocator(const ArenaAllocator* allocator, void* data) {
+    u8* newArena;
+    if (allocator != NULL)
+        newArena = allocator->resize(data, NULL, 0, arenaSize);
+    else
+        newArena = (u8*)memalign(ARENA_PAGE_SIZE, arenaSize);
+    memcpy(newArena, arena, arenaSize);
+
+    u8* oldArena = arena;
+    setArena(newArena, arenaSize);
+    freeArena(oldArena);
+    arenaAllocator = allocator;
+    arenaAllocatorData = data;
+}
+
+// Points everything at "newArena", which must hold the same contents as the
+// current arena. Mapped pages which were in the old arena move with it.
+void Gameboy::setArena(u8* newArena, int size) {
+    u8* oldArena = arena;
+    int oldSize = arenaSize;
+    arena = newArena;
+    arenaSize = size;
+
+    vram = (u8(*)[0x2000])(arena+ARENA_VRAM);
+    wram = (u8(*)[0x1000])(arena+ARENA_WRAM);
+    highram = arena+ARENA_HIGHRAM;
+    hram = highram+0xe00;
+    ioRam = highram+0xf00;
+    externRam = size > ARENA_SRAM+ARENA_PAGE_SIZE ? arena+ARENA_SRAM : NULL;
+
+    if (oldArena == NULL)
+        return;
+    for (int i=0; i<0x10; i++) {
+        if (memory[i] >= oldArena && memory[i] < oldArena+oldSize)
+            memory[i] = arena + (memory[i] - oldArena);
+    }
+}
+
 void Gameboy::mapMemory() {
     if (biosOn)
         memory[0x0] = romFile->bios;
@@ -149,6 +325,10 @@ void Gameboy::mapMemory() {
     memory[0x2] = romFile->romSlot0+0x2000;
     memory[0x3] = romFile->romSlot0+0x3000;
     refreshRomBank(romBank);
+    // Without cartridge ram, the cpu running or popping from a000-bfff gets
+    // the page of zeros
+    memory[0xa] = arena+arenaSize-ARENA_PAGE_SIZE;
+    memory[0xb] = arena+arenaSize-ARENA_PAGE_SIZE;
     refreshRamBank(currentRamBank);
     refreshVramBank();
     memory[0xc] = wram[0];
@@ -170,67 +350,79 @@ u16 Gameboy::readMemory16(u16 addr) {
     return readMemory(addr) | readMemory(addr+1)<<8;
 }
 
-u8 Gameboy::readIO(u8 ioReg)
-{
-#ifdef SPEEDHAX
-    return ioRam[ioReg];
-#else
-    switch (ioReg)
-    {
-        case 0x00:
-            return sgbReadP1();
-        case 0x10: // NR10, sweep register 1, bit 7 set on read
-            return ioRam[ioReg] | 0x80;
-        case 0x11: // NR11, sound length/pattern duty 1, bits 5-0 set on read
-            return ioRam[ioReg] | 0x3F;
-        case 0x13: // NR13, sound frequency low byte 1, all bits set on read
-            return 0xFF;
-        case 0x14: // NR14, sound frequency high byte 1, bits 7,5-0 set on read
-            return ioRam[ioReg] | 0xBF;
-        case 0x15: // No register, all bits set on read
-            return 0xFF;
-        case 0x16: // NR21, sound length/pattern duty 2, bits 5-0 set on read
-            return ioRam[ioReg] | 0x3F;
-        case 0x18: // NR23, sound frequency low byte 2, all bits set on read
-            return 0xFF;
-        case 0x19: // NR24, sound frequency high byte 2, bits 7,5-0 set on read
-            return ioRam[ioReg] | 0xBF;
-        case 0x1A: // NR30, sound mode 3, bits 6-0 set on read
-            return ioRam[ioReg] | 0x7F;
-        case 0x1B: // NR31, sound length 3, all bits set on read
-            return 0xFF;
-        case 0x1C: // NR32, sound output level 3, bits 7,4-0 set on read
-            return ioRam[ioReg] | 0x9F;
-        case 0x1D: // NR33, sound frequency low byte 2, all bits set on read
-            return 0xFF;
-        case 0x1E: // NR34, sound frequency high byte 2, bits 7,5-0 set on read
-            return ioRam[ioReg] | 0xBF;
-        case 0x1F: // No register, all bits set on read
-            return 0xFF;
-        case 0x20: // NR41, sound mode/length 4, all bits set on read
-            return 0xFF;
-        case 0x23: // NR44, sound counter/consecutive, bits 7,5-0 set on read
-            return ioRam[ioReg] | 0xBF;
-        case 0x26: // NR52, global sound status, bits 6-4 set on read
-            return ioRam[ioReg] | 0x70;
-        case 0x27: // No register, all bits set on read
-        case 0x28:
-        case 0x29:
-        case 0x2A:
-        case 0x2B:
-        case 0x2C:
-        case 0x2D:
-        case 0x2E:
-        case 0x2F:
-            return 0xFF;
-        case 0x70: // wram register
-            return ioRam[ioReg] | 0xf8;
-        default:
-            return ioRam[ioReg];
-    }
-#endif
+// Unused bits of the sound registers, and all of the unused registers around
+// them, read back as 1.
+static constexpr u8 getIOReadMask(int ioReg) {
+    return ioReg == 0x10 ? 0x80 : // NR10, sweep register 1
+        ioReg == 0x11 ? 0x3F :    // NR11, sound length/pattern duty 1
+        ioReg == 0x13 ? 0xFF :    // NR13, sound frequency low byte 1
+        ioReg == 0x14 ? 0xBF :    // NR14, sound frequency high byte 1
+        ioReg == 0x15 ? 0xFF :    // No register
+        ioReg == 0x16 ? 0x3F :    // NR21, sound length/pattern duty 2
+        ioReg == 0x18 ? 0xFF :    // NR23, sound frequency low byte 2
+        ioReg == 0x19 ? 0xBF :    // NR24, sound frequency high byte 2
+        ioReg == 0x1A ? 0x7F :    // NR30, sound mode 3
+        ioReg == 0x1B ? 0xFF :    // NR31, sound length 3
+        ioReg == 0x1C ? 0x9F :    // NR32, sound output level 3
+        ioReg == 0x1D ? 0xFF :    // NR33, sound frequency low byte 3
+        ioReg == 0x1E ? 0xBF :    // NR34, sound frequency high byte 3
+        ioReg == 0x1F ? 0xFF :    // No register
+        ioReg == 0x20 ? 0xFF :    // NR41, sound mode/length 4
+        ioReg == 0x23 ? 0xBF :    // NR44, sound counter/consecutive
+        ioReg == 0x26 ? 0x70 :    // NR52, global sound status
+        (ioReg >= 0x27 && ioReg <= 0x2F) ? 0xFF : // No registers
+        ioReg == 0x70 ? 0xF8 :    // SVBK, wram bank
+        0x00;
 }
 
+static constexpr u8 getIOWriteHandler(int ioReg) {
+    return ioReg == 0x00 ? IOW_P1 :
+        ioReg == 0x02 ? IOW_SC :
+        ioReg == 0x04 ? IOW_DIV :
+        ioReg == 0x07 ? IOW_TAC :
+        ioReg == 0x0F ? IOW_IF :
+        (ioReg == 0x14 || ioReg == 0x19 || ioReg == 0x1A || ioReg == 0x1E || ioReg == 0x23) ? IOW_SOUND_TRIGGER :
+        ioReg == 0x26 ? IOW_NR52 :
+        // Everything else from NR10 to NR51 except the unused 0x15 and 0x1F,
+        // and wave ram
+        ((ioReg >= 0x10 && ioReg <= 0x25 && ioReg != 0x15 && ioReg != 0x1F) ||
+         (ioReg >= 0x30 && ioReg <= 0x3F)) ? IOW_SOUND :
+        ioReg == 0x40 ? IOW_LCDC :
+        ioReg == 0x41 ? IOW_STAT :
+        ioReg == 0x44 ? IOW_LY :
+        ioReg == 0x45 ? IOW_LYC :
+        ioReg == 0x46 ? IOW_OAM_DMA :
+        (ioReg == 0x42 || ioReg == 0x43 || (ioReg >= 0x47 && ioReg <= 0x4B)) ? IOW_VIDEO :
+        ioReg == 0x4D ? IOW_KEY1 :
+        ioReg == 0x4F ? IOW_VBK :
+        ioReg == 0x50 ? IOW_BIOS :
+        ioReg == 0x55 ? IOW_HDMA :
+        ioReg == 0x68 ? IOW_BCPS :
+        ioReg == 0x69 ? IOW_BCPD :
+        ioReg == 0x6A ? IOW_OCPS :
+        ioReg == 0x6B ? IOW_OCPD :
+        ioReg == 0x70 ? IOW_SVBK :
+        ioReg == 0xFF ? IOW_IE :
+        IOW_PLAIN;
+}
+
+#define IO_ROW(f, r) \
+    f(r+0x0), f(r+0x1), f(r+0x2), f(r+0x3), f(r+0x4), f(r+0x5), f(r+0x6), f(r+0x7), \
+    f(r+0x8), f(r+0x9), f(r+0xA), f(r+0xB), f(r+0xC), f(r+0xD), f(r+0xE), f(r+0xF)
+#define IO_TABLE(f) { \
+    IO_ROW(f, 0x00), IO_ROW(f, 0x10), IO_ROW(f, 0x20), IO_ROW(f, 0x30), \
+    IO_ROW(f, 0x40), IO_ROW(f, 0x50), IO_ROW(f, 0x60), IO_ROW(f, 0x70), \
+    IO_ROW(f, 0x80), IO_ROW(f, 0x90), IO_ROW(f, 0xA0), IO_ROW(f, 0xB0), \
+    IO_ROW(f, 0xC0), IO_ROW(f, 0xD0), IO_ROW(f, 0xE0), IO_ROW(f, 0xF0) }
+
+constexpr u8 ioReadMasks[0x100] = IO_TABLE(getIOReadMask);
+constexpr u8 ioWriteHandlers[0x100] = IO_TABLE(getIOWriteHandler);
+
+static_assert(ioReadMasks[0x00] == 0 && ioReadMasks[0x26] == 0x70 && ioReadMasks[0xFF] == 0,
+        "IO read mask table is misaligned");
+static_assert(ioWriteHandlers[0x15] == IOW_PLAIN && ioWriteHandlers[0x3F] == IOW_SOUND &&
+        ioWriteHandlers[0xFF] == IOW_IE, "IO write handler table is misaligned");
+
 u8 Gameboy::readMemoryOther(u16 addr) {
     int area = addr>>12;
 
@@ -242,61 +434,66 @@ u8 Gameboy::readMemoryOther(u16 addr) {
             return memory[0xd][addr&0xfff];
     }
     /* Check if in range a000-bfff */
-    else if (area == 0xa || area == 0xb) {
-        /* Check if there's an handler for this mbc */
-        if (readFunc != NULL)
-            return (*this.*readFunc)(addr);
-        else if (!getNumSramBanks())
-            return 0xff;
-    }
+    else if (area == 0xa || area == 0xb)
+        return readMbc(addr);
     return memory[area][addr&0xfff];
 }
 
+u8 Gameboy::peekMemory(u16 addr) {
+    int area = addr>>12;
+    if (addr >= 0xff00) {
+        u8 ioReg = addr&0xff;
+        if (ioReg == 0x00)
+            return sgbReadP1();
+        return ioRam[ioReg] | ioReadMasks[ioReg];
+    }
+    if (!(area & 0x8) || area == 0xc || area == 0xd)
+        return memory[area][addr&0xfff];
+    return readMemoryOther(addr);
+}
+
 void Gameboy::writeMemoryOther(u16 addr, u8 val) {
     int area = addr>>12;
     switch (area)
     {
         case 0x8:
         case 0x9:
-            if (isMainGameboy())
-                writeVram(addr&0x1fff, val);
+            video->writeVram(addr&0x1fff, val);
             vram[vramBank][addr&0x1fff] = val;
+            markArenaDirty(ARENA_VRAM + vramBank*0x2000 + (addr&0x1fff));
             return;
         case 0xE: // Echo area
             wram[0][addr&0xFFF] = val;
+            markArenaDirty(ARENA_WRAM + (addr&0xfff));
             return;
         case 0xF:
             if (addr >= 0xFF00)
                 writeIO(addr & 0xFF, val);
             else if (addr >= 0xFE00) {
-                writeHram(addr&0x1ff, val);
+                video->writeHram(addr&0x1ff, val);
                 hram[addr&0x1ff] = val;
+                markArenaDirty(ARENA_HIGHRAM + 0xe00 + (addr&0x1ff));
             }
-            else // Echo area
+            else { // Echo area
                 wram[wramBank][addr&0xFFF] = val;
+                markArenaDirty(ARENA_WRAM + wramBank*0x1000 + (addr&0xfff));
+            }
             return;
     }
-    if (writeFunc != NULL)
-        (*this.*writeFunc)(addr, val);
+    writeMbc(addr, val);
 }
 
-void Gameboy::writeIO(u8 ioReg, u8 val) {
-    switch (ioReg)
+// Registers which aren't IOW_PLAIN; writeIO stores those itself.
+void Gameboy::writeIOSpecial(u8 ioReg, u8 val) {
+    switch (ioWriteHandlers[ioReg])
     {
-        case 0x00:
+        case IOW_P1:
             if (sgbMode)
                 sgbHandleP1(val);
-            else {
+            else
                 ioRam[0x00] = val;
-#ifdef SPEEDHAX
-                refreshP1();
-#endif
-            }
             return;
-        case 0x01:
-            ioRam[ioReg] = val;
-            return;
-        case 0x02:
+        case IOW_SC:
             {
                 if ((ioRam[ioReg] & 0x01) != (val & 0x01)) {
 #ifdef LINK_DEBUG
@@ -304,20 +501,21 @@ void Gameboy::writeIO(u8 ioReg, u8 val) {
                         char buf[50];
                         sprintf(buf, "%s (%s)", isMainGameboy() ? "Main" : "Other", (val & 0x02) ? "speedy" : "normal");
                         if (isMainGameboy())
-                            printLog("Internal Clock: %s\n", buf);
+                            printLogAt(LOG_LEVEL_DEBUG, "Internal Clock: %s\n", buf);
                         else
-                            printLog("Internal Clock: %s\n", buf);
+                            printLogAt(LOG_LEVEL_DEBUG, "Internal Clock: %s\n", buf);
                     }
                     else {
                         if (isMainGameboy())
-                            printLog("External Clock: Main\n");
+                            printLogAt(LOG_LEVEL_DEBUG, "External Clock: Main\n");
                         else
-                            printLog("External Clock: Other\n");
+                            printLogAt(LOG_LEVEL_DEBUG, "External Clock: Other\n");
                     }
 #endif
                 }
                 ioRam[ioReg] = val;
                 if ((val & 0x81) == 0x81) { // Internal clock
+                    TRACE_INSTANT("serial start", this, "sent", ioRam[0x01]);
                     if (serialCounter == 0) {
                         // DS can't handle high speed
                         if (false && gbMode == CGB && (val & 0x02)) {
@@ -332,6 +530,7 @@ void Gameboy::writeIO(u8 ioReg, u8 val) {
                 else {
                     serialCounter = 0;
                     if (val & 0x80) { // External clock
+                        TRACE_INSTANT("serial wait", this, "sent", ioRam[0x01]);
                         if (mgr_isInternalClockGb(this) || mgr_areBothUsingExternalClock()) {
                             int cycles = linkedGameboy->cycleCount - cycleCount;
                             if (cycles < 0)
@@ -344,61 +543,24 @@ void Gameboy::writeIO(u8 ioReg, u8 val) {
                 }
                 return;
             }
-        case 0x04:
+        case IOW_DIV:
             ioRam[ioReg] = 0;
             return;
-        case 0x05:
-            ioRam[ioReg] = val;
-            break;
-        case 0x06:
-            ioRam[ioReg] = val;
-            break;
-        case 0x07:
+        case IOW_TAC:
             timerPeriod = timerPeriods[val&0x3];
             ioRam[ioReg] = val;
-            break;
-        case 0x10:
-        case 0x11:
-        case 0x12:
-        case 0x13:
-        case 0x16:
-        case 0x17:
-        case 0x18:
-        case 0x1B:
-        case 0x1C:
-        case 0x1D:
-        case 0x20:
-        case 0x21:
-        case 0x22:
-        case 0x24:
-        case 0x25:
-        case 0x30:
-        case 0x31:
-        case 0x32:
-        case 0x33:
-        case 0x34:
-        case 0x35:
-        case 0x36:
-        case 0x37:
-        case 0x38:
-        case 0x39:
-        case 0x3A:
-        case 0x3B:
-        case 0x3C:
-        case 0x3D:
-        case 0x3E:
-        case 0x3F:
-handleSoundReg:
+            return;
+        case IOW_SOUND:
             if (soundDisabled || // If sound is disabled from menu, or
                     // If sound is globally disabled via shutting down the APU,
                     (!(ioRam[0x26] & 0x80)
                      // ignore register writes to between FF10 and FF25 inclusive.
-                     && ioReg >= 0x10 && ioReg <= 0x25))
+                     && ioReg <= 0x25))
                 return;
             ioRam[ioReg] = val;
             soundEngine->handleSoundRegister(ioReg, val);
             return;
-        case 0x26:
+        case IOW_NR52:
             ioRam[ioReg] &= ~0x80;
             ioRam[ioReg] |= (val&0x80);
 
@@ -413,50 +575,40 @@ handleSoundReg:
 
             soundEngine->handleSoundRegister(ioReg, val);
             return;
-        case 0x14:
-            if (soundDisabled || (!(ioRam[0x26] & 0x80)))
-                return;
-            if (val & 0x80)
-                setSoundChannel(CHAN_1);
-            goto handleSoundReg;
-        case 0x19:
-            if (soundDisabled || (!(ioRam[0x26] & 0x80)))
-                return;
-            if (val & 0x80)
-                setSoundChannel(CHAN_2);
-            goto handleSoundReg;
-        case 0x1A:
-            if (soundDisabled || (!(ioRam[0x26] & 0x80)))
-                return;
-            if (!(val & 0x80))
-                clearSoundChannel(CHAN_3);
-            goto handleSoundReg;
-        case 0x1E:
-            if (soundDisabled || (!(ioRam[0x26] & 0x80)))
-                return;
-            if (val & 0x80)
-                setSoundChannel(CHAN_3);
-            goto handleSoundReg;
-        case 0x23:
+        case IOW_SOUND_TRIGGER:
             if (soundDisabled || (!(ioRam[0x26] & 0x80)))
                 return;
-            if (val & 0x80)
-                setSoundChannel(CHAN_4);
-            goto handleSoundReg;
-        case 0x42:
-        case 0x43:
-        case 0x47:
-        case 0x48:
-        case 0x49:
-        case 0x4A:
-        case 0x4B:
-            if (isMainGameboy())
-                handleVideoRegister(ioReg, val);
+            switch (ioReg) {
+                case 0x14:
+                    if (val & 0x80)
+                        setSoundChannel(CHAN_1);
+                    break;
+                case 0x19:
+                    if (val & 0x80)
+                        setSoundChannel(CHAN_2);
+                    break;
+                case 0x1A:
+                    if (!(val & 0x80))
+                        clearSoundChannel(CHAN_3);
+                    break;
+                case 0x1E:
+                    if (val & 0x80)
+                        setSoundChannel(CHAN_3);
+                    break;
+                case 0x23:
+                    if (val & 0x80)
+                        setSoundChannel(CHAN_4);
+                    break;
+            }
+            ioRam[ioReg] = val;
+            soundEngine->handleSoundRegister(ioReg, val);
+            return;
+        case IOW_VIDEO:
+            video->handleVideoRegister(ioReg, val);
             ioRam[ioReg] = val;
             return;
-        case 0x69: // CGB BG Palette
-            if (isMainGameboy())
-                handleVideoRegister(ioReg, val);
+        case IOW_BCPD: // CGB BG Palette
+            video->handleVideoRegister(ioReg, val);
             {
                 int index = ioRam[0x68] & 0x3F;
                 bgPaletteData[index] = val;
@@ -465,9 +617,8 @@ handleSoundReg:
                 ioRam[0x68] = 0x80 | (ioRam[0x68]+1);
             ioRam[0x69] = bgPaletteData[ioRam[0x68]&0x3F];
             return;
-        case 0x6B: // CGB Sprite palette
-            if (isMainGameboy())
-                handleVideoRegister(ioReg, val);
+        case IOW_OCPD: // CGB Sprite palette
+            video->handleVideoRegister(ioReg, val);
             {
                 int index = ioRam[0x6A] & 0x3F;
                 sprPaletteData[index] = val;
@@ -476,11 +627,12 @@ handleSoundReg:
                 ioRam[0x6A] = 0x80 | (ioRam[0x6A]+1);
             ioRam[0x6B] = sprPaletteData[ioRam[0x6A]&0x3F];
             return;
-        case 0x46: // Sprite DMA
-            if (isMainGameboy())
-                handleVideoRegister(ioReg, val);
+        case IOW_OAM_DMA:
+            video->handleVideoRegister(ioReg, val);
             ioRam[ioReg] = val;
             {
+                TELEMETRY_SCOPE(TEL_DMA);
+                TRACE_INSTANT("oam dma", this, "source", val<<8);
                 int src = val << 8;
                 u8* mem = memory[src>>12];
                 src &= 0xfff;
@@ -488,11 +640,11 @@ handleSoundReg:
                     u8 val = mem[src++];
                     hram[i] = val;
                 }
+                markArenaDirty(ARENA_HIGHRAM + 0xe00);
             }
             return;
-        case 0x40: // LCDC
-            if (isMainGameboy())
-                handleVideoRegister(ioReg, val);
+        case IOW_LCDC:
+            video->handleVideoRegister(ioReg, val);
             ioRam[ioReg] = val;
             if (!(val & 0x80)) {
                 ioRam[0x44] = 0;
@@ -500,31 +652,31 @@ handleSoundReg:
             }
             return;
 
-        case 0x41:
+        case IOW_STAT:
             ioRam[ioReg] &= 0x7;
             ioRam[ioReg] |= val&0xF8;
             return;
-        case 0x44:
+        case IOW_LY:
             //ioRam[0x44] = 0;
-            printLog("LY Write %d\n", val);
+            printLogAt(LOG_LEVEL_DEBUG, "LY Write %d\n", val);
             return;
-        case 0x45:
+        case IOW_LYC:
             ioRam[ioReg] = val;
             checkLYC();
             return;
-        case 0x68:
+        case IOW_BCPS:
             ioRam[ioReg] = val;
             ioRam[0x69] = bgPaletteData[val&0x3F];
             return;
-        case 0x6A:
+        case IOW_OCPS:
             ioRam[ioReg] = val;
             ioRam[0x6B] = sprPaletteData[val&0x3F];
             return;
-        case 0x4D:
+        case IOW_KEY1:
             ioRam[ioReg] &= 0x80;
             ioRam[ioReg] |= (val&1);
             return;
-        case 0x4F: // Vram bank
+        case IOW_VBK:
             if (gbMode == CGB)
             {
                 vramBank = val & 1;
@@ -533,12 +685,17 @@ handleSoundReg:
             ioRam[ioReg] = val&1;
             return;
             // Special register, used by the gameboy bios
-        case 0x50:
+        case IOW_BIOS:
             biosOn = 0;
             memory[0x0] = romFile->romSlot0;
             initGameboyMode();
+            // runOpcodes holds the registers in locals. Break out of its loop
+            // after this opcode so it can reload them, then carry on.
+            registersReset = true;
+            resetCyclesToExecute = cyclesToExecute;
+            cyclesToExecute = -1;
             return;
-        case 0x55: // CGB DMA
+        case IOW_HDMA:
             if (gbMode == CGB)
             {
                 if (dmaLength > 0)
@@ -557,13 +714,15 @@ handleSoundReg:
                 dmaDest &= 0x1FF0;
                 dmaMode = val>>7;
                 ioRam[ioReg] = dmaLength-1;
+                TRACE_INSTANT(dmaMode ? "hdma start" : "gdma", this, "length", dmaLength*16);
                 if (dmaMode == 0)
                 {
+                    TELEMETRY_SCOPE(TEL_DMA);
                     int i;
                     for (i=0; i<dmaLength; i++)
                     {
-                        if (isMainGameboy())
-                            writeVram16(dmaDest, dmaSource);
+                        video->writeVram16(dmaDest, dmaSource);
+                        markArenaDirty(ARENA_VRAM + vramBank*0x2000 + dmaDest);
                         for (int i=0; i<16; i++)
                             vram[vramBank][dmaDest++] = quickRead(dmaSource++);
                         dmaDest &= 0x1FF0;
@@ -580,7 +739,7 @@ handleSoundReg:
             else
                 ioRam[ioReg] = val;
             return;
-        case 0x70:				// WRAM bank, for CGB only
+        case IOW_SVBK: // WRAM bank, for CGB only
             if (gbMode == CGB)
             {
                 wramBank = val & 0x7;
@@ -590,20 +749,17 @@ handleSoundReg:
             }
             ioRam[ioReg] = val&0x7;
             return;
-        case 0x0F: // IF
+        case IOW_IF:
             ioRam[ioReg] = val;
             interruptTriggered = val & ioRam[0xff];
             if (interruptTriggered)
                 cyclesToExecute = -1;
-            break;
-        case 0xFF: // IE
+            return;
+        case IOW_IE:
             ioRam[ioReg] = val;
             interruptTriggered = val & ioRam[0x0f];
             if (interruptTriggered)
                 cyclesToExecute = -1;
-            break;
-        default:
-            ioRam[ioReg] = val;
             return;
     }
 }
@@ -632,8 +788,10 @@ bool Gameboy::updateHBlankDMA()
 {
     if (dmaLength > 0)
     {
-        if (isMainGameboy())
-            writeVram16(dmaDest, dmaSource);
+        TELEMETRY_SCOPE(TEL_DMA);
+        TRACE_INSTANT("hdma", this, "remaining", dmaLength-1);
+        video->writeVram16(dmaDest, dmaSource);
+        markArenaDirty(ARENA_VRAM + vramBank*0x2000 + dmaDest);
         for (int i=0; i<16; i++)
             vram[vramBank][dmaDest++] = quickRead(dmaSource++);
         dmaDest &= 0x1FF0;
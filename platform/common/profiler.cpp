@@ -0,0 +1,466 @@
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include "gameboy.h"
+#include "romfile.h"
+#include "console.h"
+#include "io.h"
+#include "profiler.h"
+
+#ifdef CPU_PROFILE
+
+#define MAX_CALL_DEPTH  256
+#define ROOT_FUNCTION   0xffffffff
+#define NUM_HOT_ADDRESSES   40
+
+#ifdef CPU_DEBUG
+extern const char* opcodeList[];
+#endif
+
+struct PcCount {
+    u32 count;
+    u64 cycles;
+};
+
+struct FunctionStats {
+    u32 calls;
+    u64 selfCycles;
+    u64 inclusiveCycles;
+};
+
+struct EdgeStats {
+    u32 calls;
+    u64 inclusiveCycles;
+};
+
+struct CallFrame {
+    u32 function;
+    int sp;
+    u64 entryCycles;
+    u64 selfCycles;
+};
+
+struct Symbol {
+    int bank;
+    int addr;
+    std::string name;
+
+    bool operator<(const Symbol& s) const {
+        return bank < s.bank || (bank == s.bank && addr < s.addr);
+    }
+};
+
+bool cpuProfilerEnabled = false;
+bool cpuProfilerByCount = false;
+
+// Counters for the fixed first 16KB of ROM, and for each bank seen at 0x4000-0x7fff,
+// which are only allocated when a bank is executed from. Bank 0 can be mapped
+// there too, so the two are kept apart.
+static PcCount* fixedRomCounts;
+static PcCount* romCounts[MAX_ROM_BANKS];
+static std::map<u32, PcCount> ramCounts;
+
+static PcCount opcodeCounts[0x100];
+static PcCount cbOpcodeCounts[0x100];
+
+static u64 totalCycles;
+static u64 totalInstructions;
+static u64 haltedCycles;
+
+static CallFrame callStack[MAX_CALL_DEPTH];
+static int callDepth;
+static u32 callStackOverflows;
+
+static std::map<u32, FunctionStats> functionStats;
+static std::map<u64, EdgeStats> edgeStats;
+// Number of frames for each function / edge currently on the call stack, so
+// that recursion doesn't count inclusive time more than once
+static std::map<u32, int> activeFunctions;
+static std::map<u64, int> activeEdges;
+
+static std::vector<Symbol> symbols;
+
+
+static inline u32 makeKey(int bank, int addr) {
+    return (bank<<16) | addr;
+}
+
+static u32 getKey(int bank, int addr) {
+    if (bank == -1)
+        bank = 0;
+    return makeKey(bank, addr);
+}
+
+// Reads a no$gmb / rgblink style symbol file: "BB:AAAA Label", ';' comments.
+static void loadSymbols(const char* filename) {
+    symbols.clear();
+    FileHandle* file = file_open(filename, "r");
+    if (file == NULL)
+        return;
+
+    char line[256];
+    while (file_tell(file) < file_getSize(file)) {
+        line[0] = '\0';
+        file_gets(line, sizeof(line), file);
+        char* comment = strchr(line, ';');
+        if (comment != NULL)
+            *comment = '\0';
+
+        int bank, addr;
+        char name[200];
+        if (sscanf(line, "%x:%x %199s", &bank, &addr, name) == 3) {
+            Symbol s;
+            s.bank = bank;
+            s.addr = addr;
+            s.name = name;
+            symbols.push_back(s);
+        }
+    }
+    file_close(file);
+
+    std::sort(symbols.begin(), symbols.end());
+    printLog("Loaded %d symbols\n", (int)symbols.size());
+}
+
+// Returns the nearest symbol at or before the address, within the same bank
+// and memory region, or NULL.
+static const Symbol* findSymbol(u32 key) {
+    Symbol s;
+    s.bank = key>>16;
+    s.addr = key&0xffff;
+    std::vector<Symbol>::iterator it = std::upper_bound(symbols.begin(), symbols.end(), s);
+    if (it == symbols.begin())
+        return NULL;
+    --it;
+    if (it->bank != s.bank || (it->addr & 0xc000) != (s.addr & 0xc000))
+        return NULL;
+    return &*it;
+}
+
+static std::string getFunctionName(u32 key) {
+    char buf[300];
+    if (key == ROOT_FUNCTION)
+        return "<root>";
+
+    const Symbol* s = findSymbol(key);
+    if (s != NULL && s->addr == (int)(key&0xffff))
+        return s->name;
+
+    int addr = key&0xffff;
+    if (key < 0x10000 && addr >= 0x40 && addr <= 0x60 && (addr&7) == 0)
+        sprintf(buf, "<irq %.2x>", addr);
+    else
+        sprintf(buf, "%.2X:%.4X", key>>16, addr);
+    return buf;
+}
+
+static std::string getLocationName(u32 key) {
+    char buf[300];
+    const Symbol* s = findSymbol(key);
+    if (s == NULL)
+        sprintf(buf, "%.2X:%.4X", key>>16, key&0xffff);
+    else if (s->addr == (int)(key&0xffff))
+        sprintf(buf, "%.2X:%.4X %s", key>>16, key&0xffff, s->name.c_str());
+    else
+        sprintf(buf, "%.2X:%.4X %s+%x", key>>16, key&0xffff, s->name.c_str(), (key&0xffff) - s->addr);
+    return buf;
+}
+
+static void enterFunction(u32 caller, u32 function, int sp) {
+    functionStats[function].calls++;
+    EdgeStats& edge = edgeStats[((u64)caller<<32) | function];
+    edge.calls++;
+
+    if (callDepth == MAX_CALL_DEPTH) {
+        callStackOverflows++;
+        return;
+    }
+    activeFunctions[function]++;
+    activeEdges[((u64)caller<<32) | function]++;
+    callStack[callDepth].function = function;
+    callStack[callDepth].sp = sp;
+    callStack[callDepth].entryCycles = totalCycles;
+    callStack[callDepth].selfCycles = 0;
+    callDepth++;
+}
+
+static void leaveFunction() {
+    callDepth--;
+    CallFrame& frame = callStack[callDepth];
+    u64 cycles = totalCycles - frame.entryCycles;
+    u64 edge = ((u64)callStack[callDepth-1].function<<32) | frame.function;
+    functionStats[frame.function].selfCycles += frame.selfCycles;
+    if (--activeFunctions[frame.function] == 0)
+        functionStats[frame.function].inclusiveCycles += cycles;
+    if (--activeEdges[edge] == 0)
+        edgeStats[edge].inclusiveCycles += cycles;
+}
+
+void startCpuProfiler(Gameboy* gameboy) {
+    free(fixedRomCounts);
+    fixedRomCounts = NULL;
+    for (int i=0; i<MAX_ROM_BANKS; i++) {
+        free(romCounts[i]);
+        romCounts[i] = NULL;
+    }
+    ramCounts.clear();
+    memset(opcodeCounts, 0, sizeof(opcodeCounts));
+    memset(cbOpcodeCounts, 0, sizeof(cbOpcodeCounts));
+    functionStats.clear();
+    edgeStats.clear();
+    activeFunctions.clear();
+    activeEdges.clear();
+
+    totalCycles = 0;
+    totalInstructions = 0;
+    haltedCycles = 0;
+    callStackOverflows = 0;
+
+    callDepth = 1;
+    callStack[0].function = ROOT_FUNCTION;
+    callStack[0].sp = 0x10000;
+    callStack[0].entryCycles = 0;
+    callStack[0].selfCycles = 0;
+
+    RomFile* romFile = gameboy->getRomFile();
+    if (romFile != NULL) {
+        char filename[MAX_FILENAME_LEN];
+        snprintf(filename, sizeof(filename), "%s.sym", romFile->getBasename());
+        loadSymbols(filename);
+    }
+}
+
+void profileInstruction(Gameboy* gameboy, int pc, int bank, int opcode, int cbOpcode, int cycles) {
+    PcCount* entry;
+    if (pc < 0x4000) {
+        if (fixedRomCounts == NULL)
+            fixedRomCounts = (PcCount*)calloc(0x4000, sizeof(PcCount));
+        entry = &fixedRomCounts[pc];
+    }
+    else if (pc < 0x8000) {
+        if (romCounts[bank] == NULL)
+            romCounts[bank] = (PcCount*)calloc(0x4000, sizeof(PcCount));
+        entry = &romCounts[bank][pc&0x3fff];
+    }
+    else
+        entry = &ramCounts[getKey(bank, pc)];
+    entry->count++;
+    entry->cycles += cycles;
+
+    opcodeCounts[opcode].count++;
+    opcodeCounts[opcode].cycles += cycles;
+    if (opcode == 0xcb) {
+        cbOpcodeCounts[cbOpcode].count++;
+        cbOpcodeCounts[cbOpcode].cycles += cycles;
+    }
+
+    callStack[callDepth-1].selfCycles += cycles;
+    totalCycles += cycles;
+    totalInstructions++;
+}
+
+void profileHalt(Gameboy* gameboy, int cycles) {
+    haltedCycles += cycles;
+    totalCycles += cycles;
+}
+
+void profileCall(Gameboy* gameboy, int target, int sp) {
+    enterFunction(callStack[callDepth-1].function, getKey(gameboy->getBank(target), target), sp);
+}
+
+void profileReturn(Gameboy* gameboy, int sp) {
+    // Frames whose return address is now above the stack pointer are gone.
+    // This also unwinds frames discarded by stack manipulation.
+    while (callDepth > 1 && callStack[callDepth-1].sp < sp)
+        leaveFunction();
+}
+
+
+struct ReportEntry {
+    u32 key;
+    u32 count;
+    u64 cycles;
+};
+
+static bool compareEntries(const ReportEntry& a, const ReportEntry& b) {
+    if (cpuProfilerByCount)
+        return a.count > b.count;
+    return a.cycles > b.cycles;
+}
+
+static bool compareNamedEntries(const std::pair<ReportEntry, std::string>& a,
+        const std::pair<ReportEntry, std::string>& b) {
+    return compareEntries(a.first, b.first);
+}
+
+static double percent(u64 val, u64 total) {
+    return total == 0 ? 0 : val*100.0/total;
+}
+
+static void writeCounts(FileHandle* file, std::vector<ReportEntry>& entries, int maxEntries, bool cb) {
+    std::sort(entries.begin(), entries.end(), compareEntries);
+    for (int i=0; i<(int)entries.size() && i<maxEntries; i++) {
+        ReportEntry& e = entries[i];
+        char name[32];
+        if (cb) {
+            const char* ops[] = { "rlc", "rrc", "rl", "rr", "sla", "sra", "swap", "srl" };
+            const char* regs[] = { "b", "c", "d", "e", "h", "l", "(hl)", "a" };
+            const char* bitOps[] = { "", "bit", "res", "set" };
+            if (e.key < 0x40)
+                sprintf(name, "%s %s", ops[e.key>>3], regs[e.key&7]);
+            else
+                sprintf(name, "%s %d,%s", bitOps[e.key>>6], (e.key>>3)&7, regs[e.key&7]);
+        }
+        else {
+#ifdef CPU_DEBUG
+            snprintf(name, sizeof(name), "%s", opcodeList[e.key]);
+#else
+            name[0] = '\0';
+#endif
+        }
+        file_printf(file, "  %6.2f%% %12llu %10u  %.2X %s\n", percent(e.cycles, totalCycles),
+                (unsigned long long)e.cycles, e.count, e.key, name);
+    }
+}
+
+void stopCpuProfiler(Gameboy* gameboy) {
+    RomFile* romFile = gameboy->getRomFile();
+    if (romFile == NULL)
+        return;
+
+    // Close any open frames so inclusive times are complete
+    while (callDepth > 1)
+        leaveFunction();
+    functionStats[ROOT_FUNCTION].selfCycles += callStack[0].selfCycles;
+    callStack[0].selfCycles = 0;
+
+    char filename[MAX_FILENAME_LEN];
+    snprintf(filename, sizeof(filename), "%s.prof", romFile->getBasename());
+    FileHandle* file = file_open(filename, "w");
+    if (file == NULL) {
+        printLog("Couldn't open %s\n", filename);
+        return;
+    }
+
+    file_printf(file, "CPU profile for %s\n", romFile->getRomTitle());
+    file_printf(file, "%llu cycles, %llu instructions, %llu cycles halted (%.2f%%)\n",
+            (unsigned long long)totalCycles, (unsigned long long)totalInstructions,
+            (unsigned long long)haltedCycles, percent(haltedCycles, totalCycles));
+    file_printf(file, "Sorted by %s\n\n", cpuProfilerByCount ? "instruction count" : "cycles");
+
+    // Gather every executed address
+    std::vector<ReportEntry> addresses;
+    for (int i=0; fixedRomCounts != NULL && i<0x4000; i++) {
+        if (fixedRomCounts[i].count == 0)
+            continue;
+        ReportEntry e = { makeKey(0, i), fixedRomCounts[i].count, fixedRomCounts[i].cycles };
+        addresses.push_back(e);
+    }
+    for (int bank=0; bank<MAX_ROM_BANKS; bank++) {
+        if (romCounts[bank] == NULL)
+            continue;
+        for (int i=0; i<0x4000; i++) {
+            if (romCounts[bank][i].count == 0)
+                continue;
+            ReportEntry e = { makeKey(bank, 0x4000 + i),
+                romCounts[bank][i].count, romCounts[bank][i].cycles };
+            addresses.push_back(e);
+        }
+    }
+    for (std::map<u32, PcCount>::iterator it = ramCounts.begin(); it != ramCounts.end(); it++) {
+        ReportEntry e = { it->first, it->second.count, it->second.cycles };
+        addresses.push_back(e);
+    }
+
+    // Flat profile: addresses folded into their enclosing symbol
+    std::map<std::string, ReportEntry> flat;
+    for (unsigned int i=0; i<addresses.size(); i++) {
+        const Symbol* s = findSymbol(addresses[i].key);
+        char buf[16];
+        std::string name;
+        if (s != NULL)
+            name = s->name;
+        else {
+            sprintf(buf, "%.2X:%.1Xxxx", addresses[i].key>>16, (addresses[i].key>>12)&0xf);
+            name = buf;
+        }
+        ReportEntry& e = flat[name];
+        e.count += addresses[i].count;
+        e.cycles += addresses[i].cycles;
+    }
+    std::vector<std::pair<ReportEntry, std::string> > flatList;
+    for (std::map<std::string, ReportEntry>::iterator it = flat.begin(); it != flat.end(); it++)
+        flatList.push_back(std::make_pair(it->second, it->first));
+    std::sort(flatList.begin(), flatList.end(), compareNamedEntries);
+
+    file_printf(file, "Flat profile%s:\n", symbols.empty() ? " (no symbols, by 4KB block)" : "");
+    file_printf(file, "  %7s %12s %10s  %s\n", "cycles", "", "instrs", "symbol");
+    for (unsigned int i=0; i<flatList.size(); i++) {
+        ReportEntry& e = flatList[i].first;
+        file_printf(file, "  %6.2f%% %12llu %10u  %s\n", percent(e.cycles, totalCycles),
+                (unsigned long long)e.cycles, e.count, flatList[i].second.c_str());
+    }
+
+    std::sort(addresses.begin(), addresses.end(), compareEntries);
+    file_printf(file, "\nHottest addresses:\n");
+    for (int i=0; i<(int)addresses.size() && i<NUM_HOT_ADDRESSES; i++) {
+        ReportEntry& e = addresses[i];
+        file_printf(file, "  %6.2f%% %12llu %10u  %s\n", percent(e.cycles, totalCycles),
+                (unsigned long long)e.cycles, e.count, getLocationName(e.key).c_str());
+    }
+
+    std::vector<ReportEntry> opcodes, cbOpcodes;
+    for (int i=0; i<0x100; i++) {
+        ReportEntry e = { (u32)i, opcodeCounts[i].count, opcodeCounts[i].cycles };
+        if (e.count)
+            opcodes.push_back(e);
+        ReportEntry cb = { (u32)i, cbOpcodeCounts[i].count, cbOpcodeCounts[i].cycles };
+        if (cb.count)
+            cbOpcodes.push_back(cb);
+    }
+    file_printf(file, "\nOpcodes:\n");
+    writeCounts(file, opcodes, 0x100, false);
+    file_printf(file, "\nCB opcodes:\n");
+    writeCounts(file, cbOpcodes, 0x100, true);
+
+    // Call graph: each function followed by the functions it called
+    std::vector<ReportEntry> functions;
+    for (std::map<u32, FunctionStats>::iterator it = functionStats.begin(); it != functionStats.end(); it++) {
+        ReportEntry e = { it->first, it->second.calls, it->second.inclusiveCycles };
+        if (it->first == ROOT_FUNCTION)
+            e.cycles = totalCycles - haltedCycles;
+        functions.push_back(e);
+    }
+    std::sort(functions.begin(), functions.end(), compareEntries);
+
+    file_printf(file, "\nCall graph (inclusive / self cycles):\n");
+    if (callStackOverflows)
+        file_printf(file, "  Call stack overflowed %u times; deep frames are missing\n", callStackOverflows);
+    for (unsigned int i=0; i<functions.size(); i++) {
+        u32 key = functions[i].key;
+        FunctionStats& stats = functionStats[key];
+        file_printf(file, "\n  %6.2f%% %12llu %12llu %8u  %s\n", percent(functions[i].cycles, totalCycles),
+                (unsigned long long)functions[i].cycles, (unsigned long long)stats.selfCycles,
+                stats.calls, getFunctionName(key).c_str());
+
+        std::vector<ReportEntry> callees;
+        std::map<u64, EdgeStats>::iterator it = edgeStats.lower_bound((u64)key<<32);
+        for (; it != edgeStats.end() && (it->first>>32) == key; it++) {
+            ReportEntry e = { (u32)it->first, it->second.calls, it->second.inclusiveCycles };
+            callees.push_back(e);
+        }
+        std::sort(callees.begin(), callees.end(), compareEntries);
+        for (unsigned int j=0; j<callees.size(); j++) {
+            file_printf(file, "      -> %12llu %8u  %s\n", (unsigned long long)callees[j].cycles,
+                    callees[j].count, getFunctionName(callees[j].key).c_str());
+        }
+    }
+
+    file_close(file);
+    printLog("Wrote profile to %s\n", filename);
+}
+
+#endif
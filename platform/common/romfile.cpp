@@ -10,6 +10,8 @@
 #include "cheats.h"
 #include "error.h"
 #include "io.h"
+#include "telemetry.h"
+#include "trace.h"
 
 #ifdef EMBEDDED_ROM
 #include "rom_gb.h"
@@ -25,6 +27,7 @@ extern bool __dsimode;
 
 RomFile::RomFile(const char* f, bool halfMemory) {
     romFile=NULL;
+    romData=NULL;
     maxLoadedRomBanks = 0;
 
     strcpy(filename, f);
@@ -37,6 +40,28 @@ RomFile::RomFile(const char* f, bool halfMemory) {
     else
         fullMemoryMode();
 
+    readHeader();
+}
+
+RomFile::RomFile(const u8* data, int size, const char* name) {
+    romFile=NULL;
+    romData=data;
+    romDataSize=size;
+
+    strncpy(filename, name, MAX_FILENAME_LEN-1);
+    filename[MAX_FILENAME_LEN-1] = '\0';
+    strcpy(basename, filename);
+    char* dot = strrchr(basename, '.');
+    if (dot != NULL)
+        *dot = '\0';
+
+    loadBanksFromMemory();
+    romData = NULL;
+
+    readHeader();
+}
+
+void RomFile::readHeader() {
     u8 cgbFlag = getCgbFlag();
 
     int nameLength = 16;
@@ -138,6 +163,8 @@ void RomFile::loadRomBank(int romBank) {
         romSlot1 = romBankSlots+bankSlotIDs[romBank]*0x4000;
         return;
     }
+    TELEMETRY_SCOPE(TEL_BANK);
+    TRACE_SCOPE_ARG("rom bank miss", NULL, "bank", romBank);
     int bankToUnload = lastBanksUsed.back();
     lastBanksUsed.pop_back();
     int slot = bankSlotIDs[bankToUnload];
@@ -149,7 +176,8 @@ void RomFile::loadRomBank(int romBank) {
 
     lastBanksUsed.insert(lastBanksUsed.begin(), romBank);
 
-    gameboy->getCheatEngine()->applyGGCheatsToBank(romBank);
+    if (gameboy->getCheatEngine() != NULL)
+        gameboy->getCheatEngine()->applyGGCheatsToBank(romBank);
 
     romSlot1 = romBankSlots+slot*0x4000;
 }
@@ -238,6 +266,40 @@ void RomFile::fullMemoryMode() {
 }
 
 
+// Memory roms are always fully resident, and have no file to page banks in from
+void RomFile::loadBanksFromMemory() {
+    gbsMode = false;
+
+    numRomBanks = (romDataSize+0x3fff)/0x4000;
+    int n=1;
+    while (n < numRomBanks) n*=2;
+    numRomBanks = n;
+    if (numRomBanks > MAX_ROM_BANKS)
+        numRomBanks = MAX_ROM_BANKS;
+    if (romDataSize > numRomBanks*0x4000)
+        romDataSize = numRomBanks*0x4000;
+
+    maxLoadedRomBanks = numRomBanks;
+    numLoadedRomBanks = numRomBanks;
+    lastBanksUsed = std::vector<int>();
+
+    // Room for two banks at least, since romSlot1 always points somewhere
+    int slots = numRomBanks < 2 ? 2 : numRomBanks;
+    if (romBankSlots != NULL)
+        free(romBankSlots);
+    romBankSlots = (u8*)malloc(slots*0x4000);
+    memcpy(romBankSlots, romData, romDataSize);
+    memset(romBankSlots+romDataSize, 0xff, slots*0x4000-romDataSize);
+
+    for (int i=0; i<numRomBanks; i++) {
+        bankSlotIDs[i] = i;
+        bankPtr[i] = romBankSlots + 0x4000*i;
+    }
+
+    romSlot0 = romBankSlots;
+    romSlot1 = romBankSlots + 0x4000;
+}
+
 void RomFile::loadBanks() {
     // Check if this is a GBS file
     gbsMode = (strcasecmp(strrchr(filename, '.'), ".gbs") == 0);
@@ -312,4 +374,11 @@ void RomFile::loadBanks() {
         file_close(romFile);
         romFile = NULL;
     }
+
+    for (int i=0; i<numRomBanks; i++) {
+        if (romFile == NULL)
+            bankPtr[i] = romBankSlots + 0x4000*i;
+        else
+            bankPtr[i] = NULL;
+    }
 }
@@ -0,0 +1,27 @@
+#include <string.h>
+#include "romprofile.h"
+#include "romfile.h"
+
+// Games are found by their title, and by the global checksum in the header if
+// it's given, which sets apart revisions and hacks that share a title.
+static const RomProfile profiles[] = {
+    // Rockman 8 by Yang Yang switches rom banks its own way
+    { "ROCKMAN 99", -1, HACK_ROCKMAN_MAPPER },
+};
+
+static const RomProfile noProfile = { NULL, -1, 0 };
+
+const RomProfile* findRomProfile(RomFile* romFile) {
+    if (romFile == NULL)
+        return &noProfile;
+    const char* title = romFile->getRomTitle();
+    int checksum = (romFile->romSlot0[0x14e]<<8) | romFile->romSlot0[0x14f];
+
+    for (unsigned int i=0; i<sizeof(profiles)/sizeof(profiles[0]); i++) {
+        const RomProfile* profile = &profiles[i];
+        if (strcmp(profile->title, title) == 0 &&
+                (profile->checksum == -1 || profile->checksum == checksum))
+            return profile;
+    }
+    return &noProfile;
+}
@@ -9,6 +9,7 @@
 #define sgbAttrFiles (vram[1]+0x1000)
 
 void Gameboy::sgbDoVramTransfer(u8* dest) {
+    markDirtyRange(dest, 0x1000);
     int map = 0x1800+((ioRam[0x40]>>3)&1)*0x400;
     int index=0;
     for (int y=0; y<18; y++) {
@@ -273,7 +274,7 @@ void Gameboy::sgbPalSet(int block) {
         sgbLoadAttrFile(sgbPacket[9]&0x3f);
     }
     if (sgbPacket[9]&0x40)
-        setSgbMask(0);
+        video->setSgbMask(0);
 }
 void Gameboy::sgbPalTrn(int block) {
     sgbDoVramTransfer(sgbPalettes);
@@ -294,14 +295,14 @@ void Gameboy::sgbMltReq(int block) {
 void Gameboy::sgbChrTrn(int blonk) {
     u8* data = (u8*)malloc(0x1000);
     sgbDoVramTransfer(data);
-    setSgbTiles(data, sgbPacket[1]);
+    video->setSgbTiles(data, sgbPacket[1]);
     free(data);
 }
 
 void Gameboy::sgbPctTrn(int block) {
     u8* data = (u8*)malloc(0x1000);
     sgbDoVramTransfer(data);
-    setSgbMap(data);
+    video->setSgbMap(data);
     free(data);
 }
 
@@ -312,11 +313,11 @@ void Gameboy::sgbAttrTrn(int block) {
 void Gameboy::sgbAttrSet(int block) {
     sgbLoadAttrFile(sgbPacket[1]&0x3f);
     if (sgbPacket[1]&0x40)
-        setSgbMask(0);
+        video->setSgbMask(0);
 }
 
 void Gameboy::sgbMask(int block) {
-    setSgbMask(sgbPacket[1]&3);
+    video->setSgbMask(sgbPacket[1]&3);
 }
 
 void (Gameboy::*sgbCommands[])(int) = {
@@ -0,0 +1,244 @@
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include "gameboy.h"
+#include "romfile.h"
+#include "console.h"
+#include "io.h"
+#include "telemetry.h"
+#include "hosttime.h"
+
+#ifdef TELEMETRY
+
+#define HISTOGRAM_BUCKET_US     100
+#define HISTOGRAM_BUCKETS       1000    // Last bucket holds everything >= 100ms
+
+// The core library runs Gameboys on several threads at once, so there each
+// thread times its own
+#ifdef GY_CORE
+#define TELEMETRY_LOCAL thread_local
+#else
+#define TELEMETRY_LOCAL
+#endif
+
+bool telemetryEnabled = false;
+bool telemetryOverlay = false;
+TELEMETRY_LOCAL bool telemetryActive = false;
+
+const char* telemetryNames[] = {
+    "other", "cpu", "ppu", "apu", "dma", "bank", "present", "input"
+};
+
+static TELEMETRY_LOCAL int currentSubsystem = TEL_OTHER;
+static TELEMETRY_LOCAL u64 lastTime;
+static TELEMETRY_LOCAL u64 frameStartTime;
+static TELEMETRY_LOCAL u64 frameTimes[NUM_TEL_SUBSYSTEMS];    // Nanoseconds in the current frame
+
+// Last TELEMETRY_WINDOW frames, in microseconds
+static TELEMETRY_LOCAL u32 windowFrames[TELEMETRY_WINDOW];
+static TELEMETRY_LOCAL u32 windowSubsystems[TELEMETRY_WINDOW][NUM_TEL_SUBSYSTEMS];
+static TELEMETRY_LOCAL int windowPos;
+static TELEMETRY_LOCAL int windowCount;
+
+// Whole session
+static TELEMETRY_LOCAL u32 histogram[HISTOGRAM_BUCKETS];
+static TELEMETRY_LOCAL u64 totalTimes[NUM_TEL_SUBSYSTEMS];
+static TELEMETRY_LOCAL u64 totalFrameTime;
+static TELEMETRY_LOCAL u32 maxFrameTime;
+static TELEMETRY_LOCAL int frames;
+
+static TELEMETRY_LOCAL FileHandle* csvFile = NULL;
+
+
+int telemetryEnter(int subsystem) {
+    u64 now = getNanoseconds();
+    frameTimes[currentSubsystem] += now - lastTime;
+    lastTime = now;
+
+    int parent = currentSubsystem;
+    currentSubsystem = subsystem;
+    return parent;
+}
+
+void telemetryLeave(int subsystem) {
+    u64 now = getNanoseconds();
+    frameTimes[currentSubsystem] += now - lastTime;
+    lastTime = now;
+
+    currentSubsystem = subsystem;
+}
+
+void startTelemetry(Gameboy* gameboy) {
+    memset(frameTimes, 0, sizeof(frameTimes));
+    memset(histogram, 0, sizeof(histogram));
+    memset(totalTimes, 0, sizeof(totalTimes));
+    totalFrameTime = 0;
+    maxFrameTime = 0;
+    frames = 0;
+    windowPos = 0;
+    windowCount = 0;
+
+    char filename[MAX_FILENAME_LEN];
+    snprintf(filename, sizeof(filename), "%s.telemetry.csv", gameboy->getRomFile()->getBasename());
+    csvFile = file_open(filename, "w");
+    if (csvFile == NULL)
+        printLog("Couldn't open %s\n", filename);
+    else {
+        file_printf(csvFile, "frame,frame_us");
+        for (int i=1; i<NUM_TEL_SUBSYSTEMS; i++)
+            file_printf(csvFile, ",%s_us", telemetryNames[i]);
+        file_printf(csvFile, ",%s_us\n", telemetryNames[TEL_OTHER]);
+    }
+
+    currentSubsystem = TEL_OTHER;
+    lastTime = frameStartTime = getNanoseconds();
+    telemetryActive = true;
+}
+
+void telemetryFrame() {
+    if (!telemetryActive)
+        return;
+
+    u64 now = getNanoseconds();
+    frameTimes[currentSubsystem] += now - lastTime;
+    lastTime = now;
+
+    u32 frameTime = (now - frameStartTime) / 1000;
+    frameStartTime = now;
+
+    windowFrames[windowPos] = frameTime;
+    for (int i=0; i<NUM_TEL_SUBSYSTEMS; i++) {
+        windowSubsystems[windowPos][i] = frameTimes[i] / 1000;
+        totalTimes[i] += frameTimes[i];
+    }
+    windowPos = (windowPos+1) % TELEMETRY_WINDOW;
+    if (windowCount < TELEMETRY_WINDOW)
+        windowCount++;
+
+    histogram[std::min(frameTime / HISTOGRAM_BUCKET_US, (u32)HISTOGRAM_BUCKETS-1)]++;
+    totalFrameTime += frameTime;
+    if (frameTime > maxFrameTime)
+        maxFrameTime = frameTime;
+
+    if (csvFile != NULL) {
+        file_printf(csvFile, "%d,%u", frames, frameTime);
+        for (int i=1; i<NUM_TEL_SUBSYSTEMS; i++)
+            file_printf(csvFile, ",%u", (u32)(frameTimes[i] / 1000));
+        file_printf(csvFile, ",%u\n", (u32)(frameTimes[TEL_OTHER] / 1000));
+    }
+
+    memset(frameTimes, 0, sizeof(frameTimes));
+    frames++;
+}
+
+static float getPercentile(u32* sorted, int count, int percent) {
+    int index = (count*percent + 99) / 100 - 1;
+    if (index < 0)
+        index = 0;
+    return sorted[index] / 1000.0f;
+}
+
+void telemetryGetSummary(TelemetrySummary* summary) {
+    memset(summary, 0, sizeof(TelemetrySummary));
+    summary->frames = windowCount;
+    if (windowCount == 0)
+        return;
+
+    u32 sorted[TELEMETRY_WINDOW];
+    u64 total = 0;
+    u64 subsystems[NUM_TEL_SUBSYSTEMS] = {0};
+    for (int i=0; i<windowCount; i++) {
+        sorted[i] = windowFrames[i];
+        total += windowFrames[i];
+        for (int j=0; j<NUM_TEL_SUBSYSTEMS; j++)
+            subsystems[j] += windowSubsystems[i][j];
+    }
+    std::sort(sorted, sorted+windowCount);
+
+    summary->mean = total / 1000.0f / windowCount;
+    summary->fps = total ? windowCount * 1000000.0f / total : 0;
+    summary->p50 = getPercentile(sorted, windowCount, 50);
+    summary->p95 = getPercentile(sorted, windowCount, 95);
+    summary->p99 = getPercentile(sorted, windowCount, 99);
+    summary->max = sorted[windowCount-1] / 1000.0f;
+    for (int i=0; i<NUM_TEL_SUBSYSTEMS; i++)
+        summary->share[i] = total ? subsystems[i] * 100.0f / total : 0;
+}
+
+// Upper edge of the bucket holding the given percentile, in milliseconds
+static float getHistogramPercentile(int percent) {
+    int target = (frames*percent + 99) / 100;
+    int count = 0;
+    for (int i=0; i<HISTOGRAM_BUCKETS-1; i++) {
+        count += histogram[i];
+        if (count >= target)
+            return (i+1) * HISTOGRAM_BUCKET_US / 1000.0f;
+    }
+    return maxFrameTime / 1000.0f;
+}
+
+static void writeJsonString(FileHandle* file, const char* s) {
+    file_printf(file, "\"");
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            file_printf(file, "\\%c", *s);
+        else if ((u8)*s >= 0x20)
+            file_printf(file, "%c", *s);
+    }
+    file_printf(file, "\"");
+}
+
+void stopTelemetry(Gameboy* gameboy) {
+    if (!telemetryActive)
+        return;
+    telemetryActive = false;
+
+    if (csvFile != NULL) {
+        file_close(csvFile);
+        csvFile = NULL;
+    }
+
+    char filename[MAX_FILENAME_LEN];
+    snprintf(filename, sizeof(filename), "%s.telemetry.json", gameboy->getRomFile()->getBasename());
+    FileHandle* file = file_open(filename, "w");
+    if (file == NULL) {
+        printLog("Couldn't open %s\n", filename);
+        return;
+    }
+
+    u64 total = 0;
+    for (int i=0; i<NUM_TEL_SUBSYSTEMS; i++)
+        total += totalTimes[i];
+
+    file_printf(file, "{\n  \"rom\": ");
+    writeJsonString(file, gameboy->getRomFile()->getRomTitle());
+    file_printf(file, ",\n  \"frames\": %d,\n", frames);
+    file_printf(file, "  \"frame_ms\": {\"mean\": %.3f, \"p50\": %.3f, \"p95\": %.3f, \"p99\": %.3f, \"max\": %.3f},\n",
+            frames ? totalFrameTime / 1000.0 / frames : 0.0, getHistogramPercentile(50),
+            getHistogramPercentile(95), getHistogramPercentile(99), maxFrameTime / 1000.0);
+
+    file_printf(file, "  \"subsystems\": {\n");
+    for (int i=1; i<=NUM_TEL_SUBSYSTEMS; i++) {
+        int s = i % NUM_TEL_SUBSYSTEMS; // "other" goes last
+        file_printf(file, "    \"%s\": {\"total_ms\": %.3f, \"share\": %.2f}%s\n", telemetryNames[s],
+                totalTimes[s] / 1000000.0, total ? totalTimes[s] * 100.0 / total : 0.0,
+                i == NUM_TEL_SUBSYSTEMS ? "" : ",");
+    }
+    file_printf(file, "  },\n");
+
+    // Only buckets with frames in them, as [start_us, count]
+    file_printf(file, "  \"histogram\": {\"bucket_us\": %d, \"buckets\": [", HISTOGRAM_BUCKET_US);
+    bool first = true;
+    for (int i=0; i<HISTOGRAM_BUCKETS; i++) {
+        if (histogram[i] == 0)
+            continue;
+        file_printf(file, "%s[%d, %u]", first ? "" : ", ", i*HISTOGRAM_BUCKET_US, histogram[i]);
+        first = false;
+    }
+    file_printf(file, "]}\n}\n");
+
+    file_close(file);
+    printLog("Wrote telemetry to %s\n", filename);
+}
+
+#endif
@@ -0,0 +1,161 @@
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "gameboy.h"
+#include "romfile.h"
+#include "console.h"
+#include "io.h"
+#include "trace.h"
+#include "hosttime.h"
+
+#ifdef CHROME_TRACE
+
+#define MAX_TRACE_EVENTS    (1<<22)
+
+struct TraceEvent {
+    const char* name;
+    const char* argName;    // NULL if there's no argument
+    u64 start;              // Nanoseconds since the trace started
+    u64 duration;           // -1 for instant events
+    int arg;
+    int track;
+};
+
+// The core library runs Gameboys on several threads at once, so there each
+// thread keeps its own trace
+#ifdef GY_CORE
+#define TRACE_LOCAL thread_local
+#else
+#define TRACE_LOCAL
+#endif
+
+bool traceEnabled = false;
+TRACE_LOCAL bool traceActive = false;
+char traceFilename[MAX_FILENAME_LEN] = "";
+
+static TRACE_LOCAL std::vector<TraceEvent> events;
+static TRACE_LOCAL u64 traceStartTime;
+static TRACE_LOCAL u64 frameStartTime;
+static TRACE_LOCAL int frames;
+static TRACE_LOCAL int droppedEvents;
+
+// Tracks are handed out to Gameboys in the order they show up, so they don't
+// swap when the focus does.
+static TRACE_LOCAL Gameboy* trackGameboys[2];
+
+
+u64 traceGetTime() {
+    return getNanoseconds();
+}
+
+static int getTrack(Gameboy* gb) {
+    if (gb == NULL)
+        return 0;
+    for (int i=0; i<2; i++) {
+        if (trackGameboys[i] == gb)
+            return i+1;
+        if (trackGameboys[i] == NULL) {
+            trackGameboys[i] = gb;
+            return i+1;
+        }
+    }
+    return 3;
+}
+
+static void addEvent(const char* name, Gameboy* gb, u64 start, u64 duration, const char* argName, int arg) {
+    if (events.size() >= MAX_TRACE_EVENTS) {
+        droppedEvents++;
+        return;
+    }
+    TraceEvent e;
+    e.name = name;
+    e.argName = argName;
+    e.start = start - traceStartTime;
+    e.duration = duration;
+    e.arg = arg;
+    e.track = getTrack(gb);
+    events.push_back(e);
+}
+
+void traceSpan(const char* name, Gameboy* gb, u64 start, const char* argName, int arg) {
+    addEvent(name, gb, start, traceGetTime() - start, argName, arg);
+}
+
+void traceInstant(const char* name, Gameboy* gb, const char* argName, int arg) {
+    addEvent(name, gb, traceGetTime(), (u64)-1, argName, arg);
+}
+
+void traceFrame() {
+    if (!traceActive)
+        return;
+    u64 now = traceGetTime();
+    addEvent("frame", NULL, frameStartTime, now - frameStartTime, "frame", frames++);
+    frameStartTime = now;
+}
+
+void startTrace(Gameboy* gameboy) {
+    events.clear();
+    events.reserve(0x10000);
+    droppedEvents = 0;
+    trackGameboys[0] = gameboy;
+    trackGameboys[1] = NULL;
+    traceStartTime = frameStartTime = traceGetTime();
+    frames = 0;
+    traceActive = true;
+}
+
+static void writeTrackName(FileHandle* file, int track, const char* name) {
+    file_printf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+            track, name);
+}
+
+void stopTrace(Gameboy* gameboy) {
+    if (!traceActive)
+        return;
+    // Stop first, so writing the file doesn't trace itself
+    traceActive = false;
+
+    char filename[MAX_FILENAME_LEN];
+    if (traceFilename[0] != '\0')
+        strncpy(filename, traceFilename, sizeof(filename)-1);
+    else
+        snprintf(filename, sizeof(filename), "%s.trace.json", gameboy->getRomFile()->getBasename());
+    filename[sizeof(filename)-1] = '\0';
+
+    FileHandle* file = file_open(filename, "w");
+    if (file == NULL) {
+        printLog("Couldn't open %s\n", filename);
+        events.clear();
+        return;
+    }
+
+    file_printf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    file_printf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"GameYob\"}}");
+    writeTrackName(file, 0, "Host");
+    writeTrackName(file, 1, "Gameboy 1");
+    writeTrackName(file, 2, "Gameboy 2");
+
+    for (unsigned int i=0; i<events.size(); i++) {
+        TraceEvent& e = events[i];
+        // Timestamps are in microseconds
+        file_printf(file, ",\n{\"name\":\"%s\",\"pid\":1,\"tid\":%d,\"ts\":%llu.%03u,",
+                e.name, e.track, e.start/1000, (unsigned int)(e.start%1000));
+        if (e.duration == (u64)-1)
+            file_printf(file, "\"ph\":\"i\",\"s\":\"t\"");
+        else
+            file_printf(file, "\"ph\":\"X\",\"dur\":%llu.%03u", e.duration/1000, (unsigned int)(e.duration%1000));
+        if (e.argName != NULL)
+            file_printf(file, ",\"args\":{\"%s\":%d}", e.argName, e.arg);
+        file_printf(file, "}");
+    }
+    file_printf(file, "\n]}\n");
+    file_close(file);
+
+    printLog("Wrote %d trace events to %s\n", (int)events.size(), filename);
+    if (droppedEvents)
+        printLog("%d events were dropped, the trace buffer was full\n", droppedEvents);
+
+    std::vector<TraceEvent>().swap(events);
+}
+
+#endif
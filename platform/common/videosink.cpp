@@ -0,0 +1,47 @@
+#include "gbgfx.h"
+
+const VideoSink platformVideo = {
+    drawScanline,
+    drawScanline_P2,
+    drawScreen,
+    refreshGFX,
+    writeVram,
+    writeVram16,
+    writeHram,
+    handleVideoRegister,
+    setSgbMask,
+    setSgbTiles,
+    setSgbMap
+};
+
+
+static void nullDrawScanline(int scanline) {
+}
+static void nullDrawScreen() {
+}
+static void nullWriteVram(u16 addr, u8 val) {
+}
+static void nullWriteVram16(u16 addr, u16 src) {
+}
+static void nullHandleVideoRegister(u8 ioReg, u8 val) {
+}
+static void nullSetSgbMask(int mask) {
+}
+static void nullSetSgbTiles(u8* src, u8 flags) {
+}
+static void nullSetSgbMap(u8* src) {
+}
+
+const VideoSink nullVideo = {
+    nullDrawScanline,
+    nullDrawScanline,
+    nullDrawScreen,
+    nullDrawScreen,
+    nullWriteVram,
+    nullWriteVram16,
+    nullWriteVram,
+    nullHandleVideoRegister,
+    nullSetSgbMask,
+    nullSetSgbTiles,
+    nullSetSgbMap
+};
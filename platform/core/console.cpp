@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "console.h"
+#include "error.h"
+
+// There's no console in the library. Whatever the emulator prints goes to
+// stdout, the same as the SDL build, except for its log, which goes to stderr
+// to keep out of the way of whatever the program using it prints.
+
+volatile int consoleSelectedRow;
+
+
+bool isConsoleOn() {
+    return false;
+}
+
+void clearConsole() {
+
+}
+
+void consoleFlush() {
+    fflush(stdout);
+}
+
+PrintConsole* getDefaultConsole() {
+    return NULL;
+}
+
+int consoleGetWidth() {
+    return 32;
+}
+int consoleGetHeight() {
+    return 24;
+}
+
+void updateScreens(bool waitToFinish) {
+
+}
+
+
+void consoleSetPosColor(int x, int y, int color) {
+
+}
+
+void consoleSetLineColor(int line, int color) {
+
+}
+
+void iprintfColored(int palette, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+
+    vprintf(format, args);
+    va_end(args);
+}
+#ifndef ASYNC_LOG
+void printLog(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
+#endif
+
+int checkRumble() {
+    return 0;
+}
+
+
+void disableSleepMode() {
+
+}
+void enableSleepMode() {
+
+}
+
+void setPrintConsole(PrintConsole* console) {
+
+}
+PrintConsole* getPrintConsole() {
+    return NULL;
+}
+
+// The frontends wait here for the user to restart; the library can't, so it
+// gives up on the process instead.
+void fatalerr(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+
+    vfprintf(stderr, format, args);
+    va_end(args);
+
+    fprintf(stderr, "\n");
+    abort();
+}
@@ -0,0 +1,314 @@
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "gameyob.h"
+#include "hosttime.h"
+
+struct FarmJob {
+    GyJob job;
+    int id;
+    int framesDone;
+    std::atomic<bool> cancelled;
+    std::vector<u8> serial;     // Sent since the last result
+
+    std::mutex resultMutex;
+    std::deque<GyResult> results;
+    bool done;
+
+    // Under the farm's mutex. The job is freed once its worker is finished
+    // with it and its last result was collected, whichever comes second.
+    bool finished;
+    bool collected;
+};
+
+// Each worker takes jobs from the back of its own queue and, when that's
+// empty, steals from the front of the others'.
+struct FarmWorker {
+    std::mutex mutex;
+    std::deque<FarmJob*> queue;
+    std::thread thread;
+};
+
+struct GyFarm {
+    std::vector<FarmWorker*> workers;
+    std::atomic<int> queuedJobs;
+
+    // The rest is under "mutex"
+    std::mutex mutex;
+    int nextWorker;             // Where the next submitted job goes
+    std::condition_variable workQueued;
+    std::condition_variable allDone;
+    std::unordered_map<int, FarmJob*> jobs; // Until they're freed, by id
+    int nextJobId;
+    int unfinishedJobs;
+    bool stopping;
+
+    std::atomic<u64> frames;
+    u64 busyTime;               // Nanoseconds with unfinished jobs, not counting the current stretch
+    u64 busySince;
+};
+
+
+static FarmJob* takeJob(GyFarm* farm, int self) {
+    int numWorkers = farm->workers.size();
+    for (int i=0; i<numWorkers; i++) {
+        FarmWorker* worker = farm->workers[(self+i) % numWorkers];
+        std::lock_guard<std::mutex> lock(worker->mutex);
+        if (worker->queue.empty())
+            continue;
+
+        FarmJob* job;
+        if (i == 0) {
+            job = worker->queue.back();
+            worker->queue.pop_back();
+        }
+        else {
+            job = worker->queue.front();
+            worker->queue.pop_front();
+        }
+        farm->queuedJobs--;
+        return job;
+    }
+    return NULL;
+}
+
+static void appendSerial(void* user, unsigned char val) {
+    ((FarmJob*)user)->serial.push_back(val);
+}
+
+static void addResult(FarmJob* job, bool last) {
+    GyJob* j = &job->job;
+    GyResult result;
+    memset(&result, 0, sizeof(result));
+    result.job = job->id;
+    result.frame = job->framesDone;
+    result.done = last;
+
+    if (j->results & GY_RESULT_HASH)
+        result.hash = gy_hash(j->gy);
+    if (j->results & GY_RESULT_FRAMEBUFFER) {
+        size_t size = GY_SCREEN_WIDTH*GY_SCREEN_HEIGHT*sizeof(unsigned int);
+        result.framebuffer = (unsigned int*)malloc(size);
+        memcpy(result.framebuffer, gy_framebuffer(j->gy), size);
+    }
+    if (j->results & GY_RESULT_SERIAL) {
+        result.serialSize = job->serial.size();
+        result.serial = (unsigned char*)malloc(result.serialSize+1);
+        memcpy(result.serial, job->serial.data(), result.serialSize);
+        result.serial[result.serialSize] = '\0';
+        job->serial.clear();
+    }
+
+    std::lock_guard<std::mutex> lock(job->resultMutex);
+    job->results.push_back(result);
+    job->done = result.done;
+}
+
+static void runJob(GyFarm* farm, FarmJob* job) {
+    GyJob* j = &job->job;
+    if (j->results & GY_RESULT_SERIAL)
+        gy_set_serial_output(j->gy, appendSerial, job);
+
+    if (j->frames == 0)
+        addResult(job, true);
+    while (job->framesDone < j->frames) {
+        int frames = j->frames - job->framesDone;
+        if (j->reportInterval > 0 && frames > j->reportInterval - job->framesDone % j->reportInterval)
+            frames = j->reportInterval - job->framesDone % j->reportInterval;
+
+        if (j->input != NULL) {
+            // The input function may cancel the job, which stops it before
+            // the next frame
+            for (int i=0; i<frames; i++) {
+                u8 buttons = j->input(j->user, job->framesDone+i);
+                if (job->cancelled) {
+                    frames = i;
+                    break;
+                }
+                gy_step(j->gy, 1, &buttons);
+            }
+        }
+        else if (!job->cancelled)
+            gy_step(j->gy, frames, j->inputs != NULL ? j->inputs+job->framesDone : NULL);
+        else
+            frames = 0;
+
+        job->framesDone += frames;
+        farm->frames += frames;
+        bool last = job->framesDone == j->frames || job->cancelled;
+        if (last || j->reportInterval > 0)
+            addResult(job, last);
+        if (last)
+            break;
+    }
+
+    if (j->results & GY_RESULT_SERIAL)
+        gy_set_serial_output(j->gy, NULL, NULL);
+
+    std::lock_guard<std::mutex> lock(farm->mutex);
+    job->finished = true;
+    if (job->collected) {
+        farm->jobs.erase(job->id);
+        delete job;
+    }
+    if (--farm->unfinishedJobs == 0) {
+        farm->busyTime += getNanoseconds() - farm->busySince;
+        farm->allDone.notify_all();
+    }
+}
+
+static void workerFunc(GyFarm* farm, int self) {
+    for (;;) {
+        FarmJob* job = takeJob(farm, self);
+        if (job != NULL) {
+            runJob(farm, job);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(farm->mutex);
+        while (farm->queuedJobs == 0 && !farm->stopping)
+            farm->workQueued.wait(lock);
+        if (farm->stopping)
+            return;
+    }
+}
+
+
+GyFarm* gy_farm_create(int threads) {
+    if (threads <= 0)
+        threads = std::thread::hardware_concurrency();
+    if (threads <= 0)
+        threads = 1;
+
+    GyFarm* farm = new GyFarm;
+    farm->queuedJobs = 0;
+    farm->nextWorker = 0;
+    farm->nextJobId = 0;
+    farm->unfinishedJobs = 0;
+    farm->stopping = false;
+    farm->frames = 0;
+    farm->busyTime = 0;
+    farm->busySince = 0;
+
+    for (int i=0; i<threads; i++)
+        farm->workers.push_back(new FarmWorker);
+    for (int i=0; i<threads; i++)
+        farm->workers[i]->thread = std::thread(workerFunc, farm, i);
+    return farm;
+}
+
+void gy_farm_destroy(GyFarm* farm) {
+    if (farm == NULL)
+        return;
+    gy_farm_wait(farm);
+
+    {
+        std::lock_guard<std::mutex> lock(farm->mutex);
+        farm->stopping = true;
+        farm->workQueued.notify_all();
+    }
+    // Workers look in each other's queues, so none can go until all have
+    // stopped
+    for (size_t i=0; i<farm->workers.size(); i++)
+        farm->workers[i]->thread.join();
+    for (size_t i=0; i<farm->workers.size(); i++)
+        delete farm->workers[i];
+    for (auto it=farm->jobs.begin(); it!=farm->jobs.end(); it++) {
+        FarmJob* job = it->second;
+        for (size_t r=0; r<job->results.size(); r++)
+            gy_result_free(&job->results[r]);
+        delete job;
+    }
+    delete farm;
+}
+
+int gy_farm_submit(GyFarm* farm, const GyJob* j) {
+    FarmJob* job = new FarmJob;
+    job->job = *j;
+    job->framesDone = 0;
+    job->cancelled = false;
+    job->done = false;
+    job->finished = false;
+    job->collected = false;
+    if (job->job.frames < 0)
+        job->job.frames = 0;
+
+    FarmWorker* worker;
+    {
+        std::lock_guard<std::mutex> lock(farm->mutex);
+        job->id = farm->nextJobId++;
+        farm->jobs[job->id] = job;
+        if (farm->unfinishedJobs++ == 0)
+            farm->busySince = getNanoseconds();
+        worker = farm->workers[farm->nextWorker];
+        farm->nextWorker = (farm->nextWorker+1) % farm->workers.size();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(worker->mutex);
+        worker->queue.push_back(job);
+    }
+
+    std::lock_guard<std::mutex> lock(farm->mutex);
+    farm->queuedJobs++;
+    farm->workQueued.notify_one();
+    return job->id;
+}
+
+int gy_farm_poll(GyFarm* farm, int id, GyResult* result) {
+    std::lock_guard<std::mutex> lock(farm->mutex);
+    auto it = farm->jobs.find(id);
+    if (it == farm->jobs.end())
+        return -1;
+    FarmJob* job = it->second;
+
+    {
+        std::lock_guard<std::mutex> resultLock(job->resultMutex);
+        if (job->results.empty())
+            return job->done ? -1 : 0;
+        *result = job->results.front();
+        job->results.pop_front();
+    }
+    if (result->done) {
+        job->collected = true;
+        if (job->finished) {
+            farm->jobs.erase(it);
+            delete job;
+        }
+    }
+    return 1;
+}
+
+void gy_farm_cancel(GyFarm* farm, int id) {
+    std::lock_guard<std::mutex> lock(farm->mutex);
+    auto it = farm->jobs.find(id);
+    if (it != farm->jobs.end())
+        it->second->cancelled = true;
+}
+
+void gy_result_free(GyResult* result) {
+    free(result->framebuffer);
+    free(result->serial);
+    result->framebuffer = NULL;
+    result->serial = NULL;
+}
+
+void gy_farm_wait(GyFarm* farm) {
+    std::unique_lock<std::mutex> lock(farm->mutex);
+    while (farm->unfinishedJobs > 0)
+        farm->allDone.wait(lock);
+}
+
+double gy_farm_fps(GyFarm* farm) {
+    std::lock_guard<std::mutex> lock(farm->mutex);
+    u64 time = farm->busyTime;
+    if (farm->unfinishedJobs > 0)
+        time += getNanoseconds() - farm->busySince;
+    return time ? farm->frames * 1e9 / time : 0;
+}
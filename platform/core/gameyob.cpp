@@ -0,0 +1,326 @@
+#include <string.h>
+#include "gameyob.h"
+#include "gameboy.h"
+#include "romfile.h"
+#include "menu.h"
+#include "nifi.h"
+#include "timer.h"
+#include "framebuffer.h"
+
+struct GyHandle {
+    Gameboy* gb;
+    RomFile* romFile;
+    int* romUsers;      // Shared with clones, which use the same RomFile
+    long long time;     // What the clock reads, or -1 for the host's clock
+    u32 framebuffer[SCREEN_WIDTH*SCREEN_HEIGHT];
+};
+
+// What the frontends keep in gbmanager.cpp, the menu and nifi. The settings
+// are the menu's defaults, except that nothing is plugged into the serial
+// port. Handles are never linked to each other. What changes while a handle
+// runs is per thread, so handles can run on different threads at once.
+
+thread_local Gameboy* gameboy = NULL;
+
+thread_local time_t rawTime;
+thread_local time_t lastRawTime;
+
+int gbcModeOption = 2;
+bool gbaModeOption = false;
+int sgbModeOption = 1;
+int biosEnabled = 0;
+bool soundDisabled = false;
+bool autoSavingEnabled = false;
+bool printerEnabled = false;
+int rumbleStrength = 0;
+
+bool mgr_isInternalClockGb(Gameboy* g) {
+    return false;
+}
+bool mgr_isExternalClockGb(Gameboy* g) {
+    return false;
+}
+bool mgr_areBothUsingExternalClock() {
+    return false;
+}
+
+bool nifiIsLinked() {
+    return false;
+}
+
+void printMenuMessage(const char* s) {
+    printLog("%s\n", s);
+}
+void enableMenuOption(const char* name) {
+}
+void disableMenuOption(const char* name) {
+}
+
+
+// The renderer and a few other places work on "gameboy"
+static void selectHandle(GyHandle* gy) {
+    gameboy = gy->gb;
+    framebuffer = gy->framebuffer;
+}
+
+GyHandle* gy_create(const unsigned char* rom, size_t size) {
+    if (rom == NULL || size < 0x150)
+        return NULL;
+
+    GyHandle* gy = new GyHandle;
+    memset(gy->framebuffer, 0xff, sizeof(gy->framebuffer));
+    gy->romFile = new RomFile(rom, size, "");
+    gy->romUsers = new int(1);
+    gy->time = -1;
+    gy->gb = new Gameboy();
+    gy->gb->setVideoSink(&platformVideo);
+    selectHandle(gy);
+
+    rawTime = getTime();
+    gy->gb->setRomFile(gy->romFile);
+    gy->gb->loadSave(-1);
+    gy->gb->init();
+    return gy;
+}
+
+void gy_destroy(GyHandle* gy) {
+    if (gy == NULL)
+        return;
+    selectHandle(gy);
+    delete gy->gb;
+    if (--*gy->romUsers == 0) {
+        delete gy->romFile;
+        delete gy->romUsers;
+    }
+    delete gy;
+    gameboy = NULL;
+    framebuffer = NULL;
+}
+
+GyHandle* gy_clone(GyHandle* gy) {
+    GyHandle* copy = new GyHandle;
+    copy->romFile = gy->romFile;
+    copy->romUsers = gy->romUsers;
+    ++*copy->romUsers;
+    copy->time = gy->time;
+    copy->gb = gy->gb->clone();
+    copy->gb->setVideoSink(gy->gb->getVideoSink());
+    copy->gb->setCpuEngine(gy->gb->getCpuEngine());
+    memcpy(copy->framebuffer, gy->framebuffer, sizeof(copy->framebuffer));
+    return copy;
+}
+
+int gy_copy(GyHandle* dest, GyHandle* src) {
+    if (dest->romFile != src->romFile)
+        return -1;
+    if (dest != src) {
+        dest->gb->copyFrom(src->gb);
+        memcpy(dest->framebuffer, src->framebuffer, sizeof(dest->framebuffer));
+    }
+    return 0;
+}
+
+static void readClock(GyHandle* gy) {
+    rawTime = gy->time >= 0 ? (time_t)gy->time : getTime();
+}
+
+int gy_step(GyHandle* gy, int frames, const unsigned char* inputs) {
+    return gy_step_players(gy, frames, 1, inputs);
+}
+
+int gy_step_players(GyHandle* gy, int frames, int players, const unsigned char* inputs) {
+    if (players < 1 || players > 4)
+        return 0;
+    selectHandle(gy);
+    readClock(gy);
+
+    Gameboy* gb = gy->gb;
+    for (int i=0; i<frames; i++) {
+        for (int p=0; p<players; p++)
+            gb->controllers[p] = inputs != NULL ? (u8)~inputs[i*players+p] : 0xff;
+        gb->checkInput();
+
+        int ret = 0;
+        while (!(ret & RET_VBLANK))
+            ret |= gb->runEmul();
+        gb->cycleCount = 0;
+    }
+    return frames;
+}
+
+int gy_step_opcodes(GyHandle* gy, int count, unsigned char buttons) {
+    selectHandle(gy);
+    readClock(gy);
+
+    Gameboy* gb = gy->gb;
+    gb->controllers[0] = (u8)~buttons;
+    gb->setSingleStep(true);
+
+    int frames = 0;
+    for (int i=0; i<count; i++) {
+        if (gb->runEmul() & RET_VBLANK) {
+            // Where gy_step would start the next frame
+            gb->cycleCount = 0;
+            gb->checkInput();
+            frames++;
+        }
+    }
+    gb->setSingleStep(false);
+    return frames;
+}
+
+void gy_set_time(GyHandle* gy, long long seconds) {
+    gy->time = seconds < 0 ? -1 : seconds;
+}
+
+void gy_set_video(GyHandle* gy, int enabled) {
+    gy->gb->setVideoSink(enabled ? &platformVideo : &nullVideo);
+    if (enabled) {
+        selectHandle(gy);
+        refreshGFX();
+    }
+}
+
+int gy_video_enabled(GyHandle* gy) {
+    return gy->gb->getVideoSink() == &platformVideo;
+}
+
+const unsigned int* gy_framebuffer(GyHandle* gy) {
+    return gy->framebuffer;
+}
+
+unsigned char* gy_ram(GyHandle* gy, int region, size_t* size) {
+    Gameboy* gb = gy->gb;
+    u8* ptr = NULL;
+    size_t len = 0;
+
+    switch (region) {
+        case GY_RAM_WRAM:
+            ptr = gb->wram[0];
+            len = 8*0x1000;
+            break;
+        case GY_RAM_VRAM:
+            ptr = gb->vram[0];
+            len = 2*0x2000;
+            break;
+        case GY_RAM_OAM:
+            ptr = gb->hram;
+            len = 0xa0;
+            break;
+        case GY_RAM_IO:
+            ptr = gb->ioRam;
+            len = 0x100;
+            break;
+        case GY_RAM_SRAM:
+            ptr = gb->externRam;
+            len = ptr != NULL ? gb->getNumSramBanks()*0x2000 : 0;
+            break;
+    }
+
+    if (size != NULL)
+        *size = len;
+    return ptr;
+}
+
+unsigned char gy_peek(GyHandle* gy, unsigned short addr) {
+    return gy->gb->peekMemory(addr);
+}
+
+void gy_registers(GyHandle* gy, GyRegisters* regs) {
+    struct Registers* r = &gy->gb->gbRegs;
+    regs->af = r->af.w;
+    regs->bc = r->bc.w;
+    regs->de = r->de.w;
+    regs->hl = r->hl.w;
+    regs->sp = r->sp.w;
+    regs->pc = r->pc.w;
+}
+
+static const char* engineNames[] = {
+    "interpreter",
+};
+static_assert(sizeof(engineNames)/sizeof(engineNames[0]) == GY_ENGINE_MAX, "Missing engine name");
+static_assert((int)GY_ENGINE_MAX == (int)NUM_CPU_ENGINES, "Engine lists differ");
+
+const char* gy_engine_name(int engine) {
+    if (engine < 0 || engine >= GY_ENGINE_MAX)
+        return NULL;
+    return engineNames[engine];
+}
+
+void gy_set_engine(GyHandle* gy, int engine) {
+    if (engine >= 0 && engine < GY_ENGINE_MAX)
+        gy->gb->setCpuEngine(engine);
+}
+
+static_assert(GY_HACK_ROCKMAN_MAPPER == HACK_ROCKMAN_MAPPER && GY_HACK_ALL == ALL_HACKS,
+        "Hack lists differ");
+
+int gy_hacks(GyHandle* gy) {
+    return gy->gb->getHacks();
+}
+
+void gy_set_hacks(GyHandle* gy, int hacks) {
+    RomProfile profile = *gy->gb->getRomProfile();
+    profile.hacks = hacks & GY_HACK_ALL;
+    gy->gb->setRomProfile(&profile);
+}
+
+unsigned long long gy_hash(GyHandle* gy) {
+    u64 hash = 14695981039346656037ULL;
+    for (int region=0; region<GY_RAM_MAX; region++) {
+        size_t size;
+        u8* ptr = gy_ram(gy, region, &size);
+        for (size_t i=0; i<size; i++) {
+            hash ^= ptr[i];
+            hash *= 1099511628211ULL;
+        }
+    }
+    return hash;
+}
+
+unsigned long long gy_state_hash(GyHandle* gy) {
+    return gy->gb->getStateHash();
+}
+
+void gy_dirty_pages(GyHandle* gy, int region, unsigned char* bitmap) {
+    size_t size;
+    u8* ptr = gy_ram(gy, region, &size);
+    if (ptr == NULL)
+        return;
+    const u8* dirty = gy->gb->getDirtyPages();
+    int first = (ptr - gy->gb->getArena()) >> DIRTY_PAGE_SHIFT;
+    int pages = (size + DIRTY_PAGE_SIZE-1) >> DIRTY_PAGE_SHIFT;
+
+    memset(bitmap, 0, (pages+7)/8);
+    for (int i=0; i<pages; i++) {
+        int page = first+i;
+        if (dirty[page>>3] & (1<<(page&7)))
+            bitmap[i>>3] |= 1<<(i&7);
+    }
+}
+
+void gy_clear_dirty(GyHandle* gy) {
+    gy->gb->clearDirtyPages();
+}
+
+void gy_set_serial_output(GyHandle* gy, void (*func)(void* user, unsigned char val), void* user) {
+    gy->gb->setSerialOutput(func, user);
+}
+
+size_t gy_serialize(GyHandle* gy, void* buffer, size_t size) {
+    selectHandle(gy);
+    size_t needed = gy->gb->getStateSize();
+    if (buffer == NULL || size < needed)
+        return needed;
+
+    StateStream out = { NULL, (u8*)buffer, (int)size, 0 };
+    gy->gb->saveStateTo(&out);
+    return out.pos;
+}
+
+int gy_deserialize(GyHandle* gy, const void* buffer, size_t size) {
+    selectHandle(gy);
+    StateStream in = { NULL, (u8*)buffer, (int)size, 0 };
+    return gy->gb->loadStateFrom(&in);
+}
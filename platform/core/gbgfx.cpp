@@ -0,0 +1,251 @@
+/* Software renderer for the library. It keeps no caches, so any number of
+ * Gameboys can take turns drawing through it: each scanline is drawn straight
+ * from the main Gameboy's vram, oam and palettes into "framebuffer".
+ *
+ * Known graphical issues:
+ * DMG sprite order (by oam index, like the SDL renderer)
+ * Vertical window split behavior
+ * No SGB palettes or borders
+ */
+
+#include <string.h>
+#include "gbgfx.h"
+#include "gameboy.h"
+#include "framebuffer.h"
+
+// public variables
+
+bool probingForBorder;
+
+int interruptWaitMode;
+int scaleMode;
+int scaleFilter;
+u8 gfxMask;
+volatile int loadedBorderType;
+bool customBorderExists;
+bool sgbBorderLoaded;
+
+thread_local u32* framebuffer = NULL;
+
+
+// private variables
+
+// The same greys the SDL build uses
+const u32 dmgShades[4] = { 0xffffff, 0xc0c0c0, 0x5e5e5e, 0x000000 };
+
+// For drawScanline. Colour ids are 0-3; bgPriority marks cgb tiles drawn over
+// sprites.
+thread_local u8 bgColors[SCREEN_WIDTH];
+thread_local bool bgPriority[SCREEN_WIDTH];
+thread_local u8 spriteColors[SCREEN_WIDTH];
+
+
+// Function definitions
+
+void doAtVBlank(void (*func)(void)) {
+    func();
+}
+
+void initGFX() {
+}
+
+void refreshGFX() {
+}
+
+void clearGFX() {
+    if (framebuffer != NULL)
+        memset(framebuffer, 0xff, SCREEN_WIDTH*SCREEN_HEIGHT*sizeof(u32));
+}
+
+static inline u32 cgbColor(const u8* paletteData, int paletteid, int colorid) {
+    int color = paletteData[paletteid*8+colorid*2] | (paletteData[paletteid*8+colorid*2+1]<<8);
+    int red = (color & 0x1f) << 3;
+    int green = ((color >> 5) & 0x1f) << 3;
+    int blue = ((color >> 10) & 0x1f) << 3;
+    return (red<<16) | (green<<8) | blue;
+}
+
+static inline u32 dmgColor(u8 palette, int colorid) {
+    return dmgShades[(palette >> (colorid*2)) & 3];
+}
+
+// Draws 8 pixels of a background or window tile row, starting at "x" (which
+// may be off the left edge).
+static void drawTileRow(int mapAddr, int pixelY, int x, u32* dest) {
+    u8* ioRam = gameboy->ioRam;
+    int tileNum = gameboy->vram[0][mapAddr];
+    if (!(ioRam[0x40] & 0x10))
+        tileNum = ((s8)tileNum)+0x100;
+
+    int bank = 0, paletteid = 0;
+    bool flipX = false, priority = false;
+    if (gameboy->gbMode == CGB) {
+        u8 attr = gameboy->vram[1][mapAddr];
+        bank = !!(attr & 0x8);
+        paletteid = attr & 0x7;
+        flipX = attr & 0x20;
+        priority = attr & 0x80;
+        if (attr & 0x40)
+            pixelY = 7-pixelY;
+    }
+
+    u8 low = gameboy->vram[bank][(tileNum<<4)+(pixelY<<1)];
+    u8 high = gameboy->vram[bank][(tileNum<<4)+(pixelY<<1)+1];
+    for (int i=0; i<8; i++, x++) {
+        if (x < 0 || x >= SCREEN_WIDTH)
+            continue;
+        int bit = flipX ? i : 7-i;
+        int colorid = ((low >> bit) & 1) | (((high >> bit) & 1) << 1);
+        bgColors[x] = colorid;
+        bgPriority[x] = priority;
+        if (gameboy->gbMode == CGB)
+            dest[x] = cgbColor(gameboy->bgPaletteData, paletteid, colorid);
+        else
+            dest[x] = dmgColor(ioRam[0x47], colorid);
+    }
+}
+
+static void drawSprites(int scanline, u32* dest) {
+    u8* ioRam = gameboy->ioRam;
+    int height = (ioRam[0x40] & 0x4) ? 16 : 8;
+    bool bgMaster = gameboy->gbMode == CGB && !(ioRam[0x40] & 0x1);
+
+    // Find the first 10 sprites on this line, then draw them in reverse so
+    // the lowest oam index ends up on top.
+    int sprites[10];
+    int numSprites = 0;
+    for (int i=0; i<40 && numSprites < 10; i++) {
+        int y = gameboy->hram[i*4]-16;
+        if (scanline >= y && scanline < y+height)
+            sprites[numSprites++] = i;
+    }
+
+    memset(spriteColors, 0, sizeof(spriteColors));
+    for (int s=numSprites-1; s>=0; s--) {
+        u8* oam = &gameboy->hram[sprites[s]*4];
+        int y = oam[0]-16;
+        int x = oam[1]-8;
+        int tileNum = oam[2];
+        u8 attr = oam[3];
+
+        int pixelY = scanline-y;
+        if (attr & 0x40)
+            pixelY = height-1-pixelY;
+        if (height == 16)
+            tileNum = (tileNum & ~1) | (pixelY >= 8);
+        pixelY &= 7;
+
+        int bank = 0;
+        if (gameboy->gbMode == CGB)
+            bank = !!(attr & 0x8);
+        u8 low = gameboy->vram[bank][(tileNum<<4)+(pixelY<<1)];
+        u8 high = gameboy->vram[bank][(tileNum<<4)+(pixelY<<1)+1];
+
+        for (int i=0; i<8; i++) {
+            int px = x+i;
+            if (px < 0 || px >= SCREEN_WIDTH)
+                continue;
+            int bit = (attr & 0x20) ? i : 7-i;
+            int colorid = ((low >> bit) & 1) | (((high >> bit) & 1) << 1);
+            if (colorid == 0)
+                continue;
+            // Behind the background, unless the background is colour 0
+            if (!bgMaster && bgColors[px] != 0 && ((attr & 0x80) || bgPriority[px]))
+                continue;
+            spriteColors[px] = colorid;
+            if (gameboy->gbMode == CGB)
+                dest[px] = cgbColor(gameboy->sprPaletteData, attr & 0x7, colorid);
+            else
+                dest[px] = dmgColor(ioRam[(attr & 0x10) ? 0x49 : 0x48], colorid);
+        }
+    }
+}
+
+void drawScanline(int scanline) {
+    if (framebuffer == NULL || scanline >= SCREEN_HEIGHT)
+        return;
+
+    u8* ioRam = gameboy->ioRam;
+    u32* dest = framebuffer + scanline*SCREEN_WIDTH;
+
+    memset(bgColors, 0, sizeof(bgColors));
+    memset(bgPriority, 0, sizeof(bgPriority));
+
+    // On the dmg, clearing bit 0 blanks the background and window
+    bool bgOn = gameboy->gbMode == CGB || (ioRam[0x40] & 0x1);
+    if (bgOn) {
+        int mapBase = (ioRam[0x40] & 0x8) ? 0x1c00 : 0x1800;
+        int scrollX = ioRam[0x43];
+        int y = (scanline+ioRam[0x42]) & 0xff;
+        for (int tile=0; tile<=SCREEN_WIDTH/8; tile++) {
+            int mapX = ((scrollX>>3)+tile) & 31;
+            drawTileRow(mapBase+(y/8)*32+mapX, y&7, tile*8-(scrollX&7), dest);
+        }
+
+        int winX = ioRam[0x4b]-7;
+        int winY = ioRam[0x4a];
+        if ((ioRam[0x40] & 0x20) && scanline >= winY && winX < SCREEN_WIDTH) {
+            int winMapBase = (ioRam[0x40] & 0x40) ? 0x1c00 : 0x1800;
+            int line = scanline-winY;
+            for (int tile=0; tile<32 && winX+tile*8 < SCREEN_WIDTH; tile++)
+                drawTileRow(winMapBase+(line/8)*32+tile, line&7, winX+tile*8, dest);
+        }
+    }
+    else {
+        for (int x=0; x<SCREEN_WIDTH; x++)
+            dest[x] = dmgShades[0];
+    }
+
+    if (ioRam[0x40] & 0x2)
+        drawSprites(scanline, dest);
+}
+
+void drawScanline_P2(int scanline) {
+}
+
+void drawScreen() {
+}
+
+void displayIcon(int iconid) {
+}
+
+void selectBorder() {
+}
+
+int loadBorder(const char* filename) {
+    return 1;
+}
+
+void checkBorder() {
+}
+
+void refreshScaleMode() {
+}
+
+
+// SGB stub functions
+void refreshSgbPalette() {
+}
+void setSgbMask(int mask) {
+}
+void setSgbTiles(u8* src, u8 flags) {
+}
+void setSgbMap(u8* src) {
+}
+
+
+void writeVram(u16 addr, u8 val) {
+    gameboy->vram[gameboy->vramBank][addr] = val;
+}
+
+void writeVram16(u16 addr, u16 src) {
+    for (int i=0; i<16; i++) {
+        gameboy->vram[gameboy->vramBank][addr++] = gameboy->readMemory(src++);
+    }
+}
+
+void writeHram(u16 addr, u8 val) {
+}
+
+void handleVideoRegister(u8 ioReg, u8 val) {
+}
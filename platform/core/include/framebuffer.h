@@ -0,0 +1,8 @@
+#pragma once
+
+#define SCREEN_WIDTH    160
+#define SCREEN_HEIGHT   144
+
+// Where gbgfx.cpp draws the main Gameboy's scanlines, one u32 per pixel as
+// 0x00RRGGBB. gy_step points it at the handle it's running, on its own thread.
+extern thread_local u32* framebuffer;
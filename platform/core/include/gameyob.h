@@ -0,0 +1,305 @@
+#pragma once
+#include <stddef.h>
+
+// libgameyob-core: the emulator without a frontend.
+//
+// Each handle is one Gameboy with its own rom, cartridge ram and screen.
+// Nothing is read from or written to disk. Different handles can be stepped
+// on different threads at once, but each handle must only be used by one
+// thread at a time, and gy_create, gy_clone and gy_destroy must not run while
+// any other handle is in use. gy_farm_* does the threading for you.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct GyHandle GyHandle;
+
+#define GY_SCREEN_WIDTH     160
+#define GY_SCREEN_HEIGHT    144
+
+// Button bits for gy_step's inputs; a set bit is a pressed button
+#define GY_BUTTON_A         0x01
+#define GY_BUTTON_B         0x02
+#define GY_BUTTON_SELECT    0x04
+#define GY_BUTTON_START     0x08
+#define GY_BUTTON_RIGHT     0x10
+#define GY_BUTTON_LEFT      0x20
+#define GY_BUTTON_UP        0x40
+#define GY_BUTTON_DOWN      0x80
+
+// Regions for gy_ram
+enum {
+    GY_RAM_WRAM = 0,    // All 8 banks, 0x8000 bytes
+    GY_RAM_VRAM,        // Both banks, 0x4000 bytes
+    GY_RAM_OAM,         // fe00-fe9f
+    GY_RAM_IO,          // ff00-ff7f, plus hram and IE up to ffff
+    GY_RAM_SRAM,        // Cartridge ram, 0x2000 bytes per bank; may be empty
+    GY_RAM_MAX
+};
+
+// Returns NULL if the rom is too small to have a header. The rom is copied.
+GyHandle* gy_create(const unsigned char* rom, size_t size);
+void gy_destroy(GyHandle* gy);
+
+// A copy of the handle as it is now, sharing the rom. Much faster than going
+// through gy_serialize, and gy_copy is faster still since it allocates nothing.
+// gy_copy only works between handles made from the same gy_create, through
+// gy_clone, and returns -1 otherwise.
+GyHandle* gy_clone(GyHandle* gy);
+int gy_copy(GyHandle* dest, GyHandle* src);
+
+// Runs "frames" frames. "inputs" holds the buttons for each frame, one byte
+// per frame, or is NULL for no buttons. Returns the number of frames run.
+int gy_step(GyHandle* gy, int frames, const unsigned char* inputs);
+// As gy_step, for up to 4 controllers: "inputs" holds "players" bytes per
+// frame, the first for controller 1. Only super gameboy games that ask for
+// more controllers read the others.
+int gy_step_players(GyHandle* gy, int frames, int players, const unsigned char* inputs);
+
+// Runs "count" opcodes with "buttons" held, handling timers, interrupts and
+// the rest after each one. While the cpu is halted, each event counts as an
+// opcode. Returns the number of frames finished. Runs are repeatable, but
+// events land on opcode boundaries, so this doesn't stay in step with
+// gy_step; use one or the other on handles being compared.
+int gy_step_opcodes(GyHandle* gy, int count, unsigned char buttons);
+
+// Sets what the cartridge's real time clock sees as the time now, in seconds
+// since 1970. By default, or with "seconds" < 0, each step reads the host's
+// clock, which makes two runs of a game that has one differ. Clones start
+// with the same setting. Set it before each step to move the clock along.
+void gy_set_time(GyHandle* gy, long long seconds);
+
+// Turns drawing on or off; it starts on. With it off gy_step runs faster and
+// gy_framebuffer keeps whatever it last showed. The emulated video hardware
+// runs either way, so turning it back on changes nothing the game can see.
+// Clones start with the same setting as the handle they came from.
+void gy_set_video(GyHandle* gy, int enabled);
+int gy_video_enabled(GyHandle* gy);
+
+// The screen as of the last frame, GY_SCREEN_WIDTH*GY_SCREEN_HEIGHT pixels
+// of 0x00RRGGBB. The pointer is good until gy_destroy, and is updated in
+// place by gy_step.
+const unsigned int* gy_framebuffer(GyHandle* gy);
+
+// Direct pointer into the emulator's memory; writes take effect immediately.
+// "size" receives the region's length and may be NULL.
+unsigned char* gy_ram(GyHandle* gy, int region, size_t* size);
+
+// Reads from the gameboy's address space, without side effects
+unsigned char gy_peek(GyHandle* gy, unsigned short addr);
+
+// The cpu's registers as of the end of the last gy_step
+typedef struct GyRegisters {
+    unsigned short af, bc, de, hl, sp, pc;
+} GyRegisters;
+void gy_registers(GyHandle* gy, GyRegisters* regs);
+
+// Cpu cores for gy_set_engine. The interpreter is the reference the others
+// are checked against, with tools/diffrunner.cpp.
+enum {
+    GY_ENGINE_INTERPRETER = 0,
+    GY_ENGINE_MAX
+};
+
+// NULL if "engine" isn't one
+const char* gy_engine_name(int engine);
+// Clones start with the same engine as the handle they came from
+void gy_set_engine(GyHandle* gy, int engine);
+
+// Workarounds for games that need them. gy_create turns on the ones the
+// built-in profile list gives the rom, usually none.
+enum {
+    GY_HACK_ROCKMAN_MAPPER = 0x01,  // Rockman 8's take on MBC1
+    GY_HACK_ALL = 0x01
+};
+int gy_hacks(GyHandle* gy);
+// Replaces the hacks for a handle, to try a game with others. Clones keep the
+// hacks of the handle they came from.
+void gy_set_hacks(GyHandle* gy, int hacks);
+
+// 64-bit FNV-1a of every gy_ram region in order. Equal handles hash equal.
+unsigned long long gy_hash(GyHandle* gy);
+// A 64-bit hash of the same memory, and of what gy_serialize keeps outside
+// of it: the cpu's registers, the rom and ram banks, the timers, the clock,
+// the cgb palettes, where the frame and any hdma had got to, and the sound
+// channels' counters. It only hashes again the 256 byte pages written since
+// it was last called, so it costs in proportion to what the game changed
+// rather than to its ram. Not the same function as gy_hash, and not the same
+// from one version of the library to the next.
+unsigned long long gy_state_hash(GyHandle* gy);
+// Which 256 byte pages of a gy_ram region were written since gy_clear_dirty:
+// bit n&7 of bitmap[n>>3] for the page at offset n*256. "bitmap" must hold
+// (size+2047)/2048 bytes for the region's size. Pages of GY_RAM_IO are always
+// marked. gy_copy and gy_deserialize mark every page.
+void gy_dirty_pages(GyHandle* gy, int region, unsigned char* bitmap);
+void gy_clear_dirty(GyHandle* gy);
+
+// "func" gets each byte the game sends out of the link port, as test roms
+// do to print their results. NULL turns it off.
+void gy_set_serial_output(GyHandle* gy, void (*func)(void* user, unsigned char val), void* user);
+
+// The state is the same format as a save state file. gy_serialize returns the
+// number of bytes written, or the size needed if "buffer" is NULL or too
+// small. gy_deserialize returns 0 on success.
+size_t gy_serialize(GyHandle* gy, void* buffer, size_t size);
+int gy_deserialize(GyHandle* gy, const void* buffer, size_t size);
+
+
+// A farm runs many handles at once over a pool of threads. Each job steps one
+// handle for a number of frames, and its results queue up until gy_farm_poll
+// takes them. Handles made with gy_clone share their rom, so thousands of
+// instances of one game only keep one copy of it.
+typedef struct GyFarm GyFarm;
+
+// Gives the buttons for one frame, numbered from the start of the job. Called
+// on a worker thread.
+typedef unsigned char (*GyInputFunc)(void* user, int frame);
+
+// What each result holds
+#define GY_RESULT_HASH          0x01
+#define GY_RESULT_FRAMEBUFFER   0x02
+#define GY_RESULT_SERIAL        0x04
+
+typedef struct GyJob {
+    GyHandle* gy;               // Must not be in another unfinished job
+    int frames;
+    const unsigned char* inputs;    // As for gy_step, if "input" is NULL
+    GyInputFunc input;
+    void* user;
+    int results;                // GY_RESULT_* bits
+    int reportInterval;         // Frames between results; 0 for one at the end
+} GyJob;
+
+typedef struct GyResult {
+    int job;
+    int frame;                  // Frames run in the job so far
+    int done;                   // Whether this is the job's last result
+    unsigned long long hash;    // gy_hash
+    unsigned int* framebuffer;  // A copy of gy_framebuffer
+    unsigned char* serial;      // Bytes sent since the last result
+    size_t serialSize;
+} GyResult;
+
+// "threads" <= 0 makes one per cpu core
+GyFarm* gy_farm_create(int threads);
+// Waits for unfinished jobs first. Doesn't destroy the handles.
+void gy_farm_destroy(GyFarm* farm);
+
+// Returns the job's id. The job is copied; "inputs" must stay valid until
+// it's done.
+int gy_farm_submit(GyFarm* farm, const GyJob* job);
+// Takes the job's oldest result. Returns 1 if there was one, 0 if the job
+// is still running, or -1 if it's done and every result was taken. Taking
+// the last result frees the job, and its id is unknown from then on. Free
+// the result with gy_result_free.
+int gy_farm_poll(GyFarm* farm, int job, GyResult* result);
+void gy_result_free(GyResult* result);
+// Stops the job at its next result, or before its next frame if it has an
+// input function, which may cancel its own job. Its last result says how far
+// it got.
+void gy_farm_cancel(GyFarm* farm, int job);
+// Waits until every job submitted so far is done
+void gy_farm_wait(GyFarm* farm);
+
+// Emulated frames per second over all threads, counting only the time the
+// farm had work to do
+double gy_farm_fps(GyFarm* farm);
+
+
+// Netplay for two players on one gameboy, each running their own copy of it
+// and sending only their buttons. Player 1 is controller 1 and player 2 is
+// controller 2, so this suits super gameboy games with a 2 player mode.
+// It's not for games played over a link cable, where each player has their
+// own gameboy; gy_netplay doesn't run two handles or the link between them.
+//
+// Each side runs ahead with a guess at the other's buttons (the last ones
+// it got) and keeps a copy of the state at the start of every recent frame.
+// When buttons come in that weren't what was guessed, it goes back to that
+// frame and runs the frames since again, without drawing. Once both sides
+// have every input up to a frame, they swap hashes of it to catch desyncs.
+typedef struct GyNetplay GyNetplay;
+
+// What gy_netplay_step and gy_netplay_idle return
+enum {
+    GY_NETPLAY_OK = 0,
+    GY_NETPLAY_WAITING,         // Too far ahead of the other side; nothing was run
+    GY_NETPLAY_DESYNCED,        // The two sides' states differ
+    GY_NETPLAY_CLOSED,          // The connection closed or failed
+};
+
+// Frames a side may run past the last input it has from the other
+#define GY_NETPLAY_MAX_AHEAD 8
+
+typedef struct {
+    int frame;                  // Frames run
+    int confirmedFrame;         // Frames run with both sides' real inputs
+    int checkedFrame;           // Last frame whose hash both sides agreed on
+    int desyncFrame;            // First frame whose hashes differed, or -1
+    int rollbacks;              // Times it went back
+    int framesReplayed;
+    int longestRollback;        // In frames
+    double longestRollbackMs;   // Wall clock time of the slowest one
+} GyNetplayStats;
+
+// Starts a session on "gy", with "player" 1 or 2, over "fd": a connected,
+// blocking stream socket to the other side. Player 1's state is sent over
+// and loaded on both sides, which must have the same rom. The session sets
+// the clock with gy_set_time from here on. Returns NULL if the other side
+// doesn't answer properly within "timeoutMs". fd is left open.
+GyNetplay* gy_netplay_create(GyHandle* gy, int player, int fd, int timeoutMs);
+void gy_netplay_destroy(GyNetplay* np);
+
+// Reads what the other side has sent, going back if it needs to, then runs
+// the next frame with "buttons" for this player. Once it returns
+// GY_NETPLAY_DESYNCED or GY_NETPLAY_CLOSED it does nothing more.
+int gy_netplay_step(GyNetplay* np, unsigned char buttons);
+// Reads what the other side has sent, going back if it needs to, without
+// running a new frame. Call it while gy_netplay_step is waiting, or at the end
+// to catch up on the other side's last inputs.
+int gy_netplay_idle(GyNetplay* np);
+void gy_netplay_stats(GyNetplay* np, GyNetplayStats* stats);
+
+
+// A store keeps many states in one directory. Each state is split into pages
+// of GY_STORE_PAGE_SIZE bytes, and each different page is kept once, under
+// its SHA-256; a state is just the list of its pages. States from one game
+// share most of their memory, so a large set of them takes a fraction of the
+// space of separate files. Loading a state reads only its own pages, and
+// checks each against its hash. Only one process at a time may have a store
+// open; gy_store_open fails while another has it.
+typedef struct GyStore GyStore;
+
+#define GY_STORE_PAGE_SIZE 1024
+
+// Opens the store in "dir", making it if it doesn't exist. NULL on failure.
+GyStore* gy_store_open(const char* dir);
+void gy_store_close(GyStore* store);
+
+// States are named by the caller. A name is used as a file name, so it can't
+// have a '/' or start with a '.'. Putting a name that's there replaces it.
+// These return 0 on success or -1.
+int gy_store_put(GyStore* store, const char* name, const void* state, size_t size);
+int gy_store_save(GyStore* store, const char* name, GyHandle* gy);
+int gy_store_load(GyStore* store, const char* name, GyHandle* gy);
+int gy_store_remove(GyStore* store, const char* name);
+// A copy of the state, to free(), or NULL if it isn't there
+void* gy_store_get(GyStore* store, const char* name, size_t* size);
+// Calls "func" with each state's name and size
+void gy_store_list(GyStore* store, void (*func)(void* user, const char* name, size_t size), void* user);
+
+// Pages that no state uses any more are kept until gy_store_gc, which rewrites
+// the page file without them. Returns the number of pages dropped, or -1.
+int gy_store_gc(GyStore* store);
+
+typedef struct {
+    int states;
+    unsigned long long stateBytes;  // What the states would take as files
+    int pages;                      // Different pages kept
+    unsigned long long storedBytes; // What the store takes: pages and page lists
+} GyStoreStats;
+void gy_store_stats(GyStore* store, GyStoreStats* stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,63 @@
+#include <string.h>
+#include "inputhelper.h"
+#include "config.h"
+
+// Buttons come in through gy_step, so none of the frontend's key handling
+// is needed. These are what the emulator itself calls.
+
+bool fastForwardMode = false;
+bool fastForwardKey = false;
+
+u8 buttonsPressed;
+
+bool biosExists = false;
+int rumbleInserted = 0;
+
+
+void initInput() {
+}
+
+void flushFatCache() {
+}
+
+bool keyPressed(int key) {
+    return false;
+}
+bool keyPressedAutoRepeat(int key) {
+    return false;
+}
+bool keyJustPressed(int key) {
+    return false;
+}
+
+void forceReleaseKey(int key) {
+}
+
+int mapFuncKey(int funcKey) {
+    return 0;
+}
+int mapMenuKey(int menuKey) {
+    return 0;
+}
+
+void inputUpdateVBlank() {
+}
+
+void system_doRumble(bool rumbleVal) {
+}
+
+int system_getMotionSensorX() {
+    return 0;
+}
+int system_getMotionSensorY() {
+    return 0;
+}
+
+void system_checkPolls() {
+}
+
+void system_waitForVBlank() {
+}
+
+void system_cleanup() {
+}
@@ -0,0 +1,364 @@
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <vector>
+#include "gameyob.h"
+#include "hosttime.h"
+
+// Frames of inputs and states kept. Has to cover GY_NETPLAY_MAX_AHEAD frames
+// back, for going back, and as many forward, for inputs from a side that's
+// ahead.
+#define HISTORY 32
+// Hashes kept while waiting for the other side's
+#define HASHES 64
+
+#define NETPLAY_VERSION 1
+
+enum {
+    MSG_HELLO = 1,      // version, player
+    MSG_STATE,          // time base, size, then the state
+    MSG_INPUT,          // frame, buttons
+    MSG_HASH,           // frame, gy_state_hash at its start
+};
+
+struct GyNetplay {
+    GyHandle* gy;
+    int fd;
+    int me;                     // 0 for player 1
+    int status;
+    long long timeBase;         // Seconds at frame 0
+
+    int frame;
+    int remoteFrames;           // Frames we have the other side's input for
+    int hashedFrames;
+    u8 lastRemote;
+    u8 localInputs[HISTORY];
+    u8 remoteInputs[HISTORY];
+    u8 guesses[HISTORY];        // What a frame ran with for the other side
+    GyHandle* states[HISTORY];  // At the start of each frame
+    int rollbackFrame;          // -1 if there's nothing to go back for
+
+    int localHashFrames[HASHES];
+    u64 localHashes[HASHES];
+    int remoteHashFrames[HASHES];
+    u64 remoteHashes[HASHES];
+
+    std::vector<u8> received;
+    GyNetplayStats stats;
+};
+
+static void putWord(u8* p, u32 val) {
+    for (int i=0; i<4; i++)
+        p[i] = val >> (i*8);
+}
+static void putLong(u8* p, u64 val) {
+    for (int i=0; i<8; i++)
+        p[i] = val >> (i*8);
+}
+static u32 getWord(const u8* p) {
+    u32 val = 0;
+    for (int i=0; i<4; i++)
+        val |= (u32)p[i] << (i*8);
+    return val;
+}
+static u64 getLong(const u8* p) {
+    u64 val = 0;
+    for (int i=0; i<8; i++)
+        val |= (u64)p[i] << (i*8);
+    return val;
+}
+
+static bool sendAll(GyNetplay* np, const u8* buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(np->fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            np->status = GY_NETPLAY_CLOSED;
+            return false;
+        }
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+// Only for the handshake; the session itself never blocks on reads
+static bool readAll(int fd, u8* buf, size_t len, double deadline) {
+    while (len > 0) {
+        int wait = (int)(deadline - getMilliseconds());
+        if (wait < 0)
+            return false;
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        int ret = poll(&pfd, 1, wait);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return false;
+        ssize_t n = recv(fd, buf, len, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool handshake(GyNetplay* np, int timeoutMs) {
+    double deadline = getMilliseconds() + timeoutMs;
+
+    u8 hello[3] = { MSG_HELLO, NETPLAY_VERSION, (u8)np->me };
+    if (!sendAll(np, hello, sizeof(hello)))
+        return false;
+    if (!readAll(np->fd, hello, sizeof(hello), deadline))
+        return false;
+    if (hello[0] != MSG_HELLO || hello[1] != NETPLAY_VERSION || hello[2] == np->me || hello[2] > 1)
+        return false;
+
+    // Player 1's state and clock, so both start from the same place
+    std::vector<u8> state;
+    u8 header[13];
+    if (np->me == 0) {
+        state.resize(gy_serialize(np->gy, NULL, 0));
+        gy_serialize(np->gy, state.data(), state.size());
+        header[0] = MSG_STATE;
+        putLong(header+1, (u64)time(NULL));
+        putWord(header+9, state.size());
+        if (!sendAll(np, header, sizeof(header)) || !sendAll(np, state.data(), state.size()))
+            return false;
+    }
+    else {
+        // Both sides have the same rom, so the state can only be one size;
+        // anything else isn't worth allocating for
+        if (!readAll(np->fd, header, sizeof(header), deadline) || header[0] != MSG_STATE ||
+                getWord(header+9) != gy_serialize(np->gy, NULL, 0))
+            return false;
+        state.resize(getWord(header+9));
+        if (!readAll(np->fd, state.data(), state.size(), deadline))
+            return false;
+    }
+    np->timeBase = (long long)getLong(header+1);
+    return gy_deserialize(np->gy, state.data(), state.size()) == 0;
+}
+
+GyNetplay* gy_netplay_create(GyHandle* gy, int player, int fd, int timeoutMs) {
+    if (player < 1 || player > 2)
+        return NULL;
+
+    GyNetplay* np = new GyNetplay;
+    np->gy = gy;
+    np->fd = fd;
+    np->me = player-1;
+    np->status = GY_NETPLAY_OK;
+    np->frame = 0;
+    np->remoteFrames = 0;
+    np->hashedFrames = 0;
+    np->lastRemote = 0;
+    np->rollbackFrame = -1;
+    for (int i=0; i<HISTORY; i++)
+        np->states[i] = NULL;
+    for (int i=0; i<HASHES; i++) {
+        np->localHashFrames[i] = -1;
+        np->remoteHashFrames[i] = -1;
+    }
+    memset(&np->stats, 0, sizeof(np->stats));
+    np->stats.desyncFrame = -1;
+    np->stats.checkedFrame = -1;
+
+    if (!handshake(np, timeoutMs)) {
+        delete np;
+        return NULL;
+    }
+    for (int i=0; i<HISTORY; i++)
+        np->states[i] = gy_clone(gy);
+    return np;
+}
+
+void gy_netplay_destroy(GyNetplay* np) {
+    if (np == NULL)
+        return;
+    for (int i=0; i<HISTORY; i++)
+        gy_destroy(np->states[i]);
+    delete np;
+}
+
+static void checkHash(GyNetplay* np, int frame) {
+    int slot = frame % HASHES;
+    if (np->localHashFrames[slot] != frame || np->remoteHashFrames[slot] != frame)
+        return;
+    if (np->localHashes[slot] == np->remoteHashes[slot]) {
+        if (frame > np->stats.checkedFrame)
+            np->stats.checkedFrame = frame;
+    }
+    else if (np->status == GY_NETPLAY_OK) {
+        np->stats.desyncFrame = frame;
+        np->status = GY_NETPLAY_DESYNCED;
+    }
+}
+
+static void receiveInput(GyNetplay* np, int frame, u8 buttons) {
+    if (frame != np->remoteFrames || frame >= np->frame + HISTORY - GY_NETPLAY_MAX_AHEAD) {
+        np->status = GY_NETPLAY_CLOSED;
+        return;
+    }
+    int slot = frame % HISTORY;
+    np->remoteInputs[slot] = buttons;
+    np->lastRemote = buttons;
+    np->remoteFrames++;
+
+    // Already run with a guess that was wrong
+    if (frame < np->frame && np->guesses[slot] != buttons) {
+        if (np->rollbackFrame < 0 || frame < np->rollbackFrame)
+            np->rollbackFrame = frame;
+    }
+}
+
+static void receive(GyNetplay* np) {
+    u8 buf[1024];
+    bool closed = false;
+    for (;;) {
+        ssize_t n = recv(np->fd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (n <= 0) {
+            // What came before still counts
+            closed = true;
+            break;
+        }
+        np->received.insert(np->received.end(), buf, buf+n);
+    }
+
+    size_t pos = 0;
+    std::vector<u8>& in = np->received;
+    while (pos < in.size() && np->status != GY_NETPLAY_CLOSED) {
+        const u8* msg = &in[pos];
+        size_t left = in.size() - pos;
+        if (msg[0] == MSG_INPUT) {
+            if (left < 6)
+                break;
+            receiveInput(np, getWord(msg+1), msg[5]);
+            pos += 6;
+        }
+        else if (msg[0] == MSG_HASH) {
+            if (left < 13)
+                break;
+            int frame = getWord(msg+1);
+            np->remoteHashFrames[frame % HASHES] = frame;
+            np->remoteHashes[frame % HASHES] = getLong(msg+5);
+            checkHash(np, frame);
+            pos += 13;
+        }
+        else
+            np->status = GY_NETPLAY_CLOSED;
+    }
+    in.erase(in.begin(), in.begin()+pos);
+    if (closed)
+        np->status = GY_NETPLAY_CLOSED;
+}
+
+static void runFrame(GyNetplay* np, int frame) {
+    int slot = frame % HISTORY;
+    gy_copy(np->states[slot], np->gy);
+
+    u8 inputs[2];
+    inputs[np->me] = np->localInputs[slot];
+    if (frame < np->remoteFrames)
+        inputs[!np->me] = np->remoteInputs[slot];
+    else
+        inputs[!np->me] = np->guesses[slot] = np->lastRemote;
+
+    // A frame is ~1/60th of a second, so the clock ticks as it would live
+    gy_set_time(np->gy, np->timeBase + (long long)frame*70224/4194304);
+    gy_step_players(np->gy, 1, 2, inputs);
+}
+
+// Back to the earliest frame that ran with a wrong guess, then the frames
+// since run again with the inputs there are now. Only the last is drawn.
+static void rollBack(GyNetplay* np) {
+    int from = np->rollbackFrame;
+    np->rollbackFrame = -1;
+    double start = getMilliseconds();
+
+    gy_copy(np->gy, np->states[from % HISTORY]);
+    int video = gy_video_enabled(np->gy);
+    gy_set_video(np->gy, 0);
+    for (int f=from; f<np->frame; f++) {
+        if (f == np->frame-1 && video)
+            gy_set_video(np->gy, 1);
+        runFrame(np, f);
+    }
+
+    int frames = np->frame - from;
+    double time = getMilliseconds() - start;
+    np->stats.rollbacks++;
+    np->stats.framesReplayed += frames;
+    if (frames > np->stats.longestRollback)
+        np->stats.longestRollback = frames;
+    if (time > np->stats.longestRollbackMs)
+        np->stats.longestRollbackMs = time;
+}
+
+// Hashes each frame whose start no longer depends on a guess
+static void hashFrames(GyNetplay* np) {
+    int last = np->frame < np->remoteFrames ? np->frame : np->remoteFrames;
+    while (np->hashedFrames <= last && np->status != GY_NETPLAY_CLOSED) {
+        int frame = np->hashedFrames++;
+        GyHandle* state = frame == np->frame ? np->gy : np->states[frame % HISTORY];
+        u64 hash = gy_state_hash(state);
+
+        int slot = frame % HASHES;
+        np->localHashFrames[slot] = frame;
+        np->localHashes[slot] = hash;
+        u8 msg[13];
+        msg[0] = MSG_HASH;
+        putWord(msg+1, frame);
+        putLong(msg+5, hash);
+        sendAll(np, msg, sizeof(msg));
+        checkHash(np, frame);
+    }
+}
+
+int gy_netplay_idle(GyNetplay* np) {
+    if (np->status != GY_NETPLAY_OK)
+        return np->status;
+    receive(np);
+    if (np->status != GY_NETPLAY_OK)
+        return np->status;
+    if (np->rollbackFrame >= 0)
+        rollBack(np);
+    hashFrames(np);
+    return np->status;
+}
+
+int gy_netplay_step(GyNetplay* np, unsigned char buttons) {
+    if (gy_netplay_idle(np) != GY_NETPLAY_OK)
+        return np->status;
+    if (np->frame - np->remoteFrames >= GY_NETPLAY_MAX_AHEAD)
+        return GY_NETPLAY_WAITING;
+
+    int frame = np->frame;
+    np->localInputs[frame % HISTORY] = buttons;
+    u8 msg[6];
+    msg[0] = MSG_INPUT;
+    putWord(msg+1, frame);
+    msg[5] = buttons;
+    if (!sendAll(np, msg, sizeof(msg)))
+        return np->status;
+
+    runFrame(np, frame);
+    np->frame++;
+    hashFrames(np);
+    return np->status;
+}
+
+void gy_netplay_stats(GyNetplay* np, GyNetplayStats* stats) {
+    *stats = np->stats;
+    stats->frame = np->frame;
+    stats->confirmedFrame = np->frame < np->remoteFrames ? np->frame : np->remoteFrames;
+}
@@ -0,0 +1,278 @@
+#include <string.h>
+#include "soundengine.h"
+#include "gameboy.h"
+
+// The library doesn't produce audio. This keeps the parts of the sound
+// hardware that games can see: the length counters, sweep and envelopes,
+// which turn off the channel status bits in NR52 as they run out. They count
+// as the SDL and 3DS sound engines count them.
+
+SoundEngine::SoundEngine(Gameboy* g)
+{
+    muted = true;
+    chan4FreqRatio = 0;
+    chan1SweepTime = 0;
+    chan1SweepCounter = 0;
+    chan1SweepDir = 0;
+    chan1SweepAmount = 0;
+    memset(chanLen, 0, sizeof(chanLen));
+    memset(chanLenCounter, 0, sizeof(chanLenCounter));
+    memset(chanUseLen, 0, sizeof(chanUseLen));
+    memset(chanFreq, 0, sizeof(chanFreq));
+    memset(chanVol, 0, sizeof(chanVol));
+    memset(chanEnvDir, 0, sizeof(chanEnvDir));
+    memset(chanEnvCounter, 0, sizeof(chanEnvCounter));
+    memset(chanEnvSweep, 0, sizeof(chanEnvSweep));
+    memset(chanOn, 0, sizeof(chanOn));
+    setGameboy(g);
+}
+
+SoundEngine::~SoundEngine() {
+
+}
+
+void SoundEngine::setGameboy(Gameboy* g) {
+    gameboy = g;
+}
+
+void SoundEngine::init() {
+    refresh();
+}
+
+void SoundEngine::refresh() {
+    // Ordering note: Writing a byte to FF26 with bit 7 set enables writes to
+    // the other registers. With bit 7 unset, writes are ignored.
+    handleSoundRegister(0x26, gameboy->readIO(0x26));
+
+    for (int i=0x10; i<=0x3F; i++) {
+        if (i == 0x14 || i == 0x19 || i == 0x1e || i == 0x23)
+            // Don't restart the sound channels.
+            handleSoundRegister(i, gameboy->readIO(i)&~0x80);
+        else
+            handleSoundRegister(i, gameboy->readIO(i));
+    }
+
+    if (gameboy->readIO(0x26) & 1)
+        handleSoundRegister(0x14, gameboy->readIO(0x14)|0x80);
+    if (gameboy->readIO(0x26) & 2)
+        handleSoundRegister(0x19, gameboy->readIO(0x19)|0x80);
+    if (gameboy->readIO(0x26) & 4)
+        handleSoundRegister(0x1e, gameboy->readIO(0x1e)|0x80);
+    if (gameboy->readIO(0x26) & 8)
+        handleSoundRegister(0x23, gameboy->readIO(0x23)|0x80);
+}
+
+void SoundEngine::copyState(SoundEngine* s) {
+    cyclesToSoundEvent = s->cyclesToSoundEvent;
+    chan4FreqRatio = s->chan4FreqRatio;
+    chan1SweepTime = s->chan1SweepTime;
+    chan1SweepCounter = s->chan1SweepCounter;
+    chan1SweepDir = s->chan1SweepDir;
+    chan1SweepAmount = s->chan1SweepAmount;
+    memcpy(chanLen, s->chanLen, sizeof(chanLen));
+    memcpy(chanLenCounter, s->chanLenCounter, sizeof(chanLenCounter));
+    memcpy(chanUseLen, s->chanUseLen, sizeof(chanUseLen));
+    memcpy(chanFreq, s->chanFreq, sizeof(chanFreq));
+    memcpy(chanVol, s->chanVol, sizeof(chanVol));
+    memcpy(chanEnvDir, s->chanEnvDir, sizeof(chanEnvDir));
+    memcpy(chanEnvCounter, s->chanEnvCounter, sizeof(chanEnvCounter));
+    memcpy(chanEnvSweep, s->chanEnvSweep, sizeof(chanEnvSweep));
+    memcpy(chanOn, s->chanOn, sizeof(chanOn));
+}
+
+void SoundEngine::mute() {
+    muted = true;
+}
+
+void SoundEngine::unmute() {
+}
+
+void SoundEngine::updateSound(int cycles)
+{
+    if (chan1SweepTime != 0 && chanOn[0]) {
+        chan1SweepCounter -= cycles;
+        while (chan1SweepCounter <= 0) {
+            chan1SweepCounter += clockSpeed/(128/chan1SweepTime);
+            chanFreq[0] += (chanFreq[0]>>chan1SweepAmount)*chan1SweepDir;
+            if (chanFreq[0] > 0x7FF) {
+                chanOn[0] = 0;
+                gameboy->clearSoundChannel(CHAN_1);
+                break;
+            }
+        }
+        if (chanOn[0])
+            setSoundEventCycles(chan1SweepCounter);
+    }
+
+    for (int i=0; i<4; i++) {
+        if (!chanOn[i])
+            continue;
+        // Channel 3 has no envelope
+        if (i != 2 && chanEnvSweep[i] != 0) {
+            chanEnvCounter[i] -= cycles;
+            if (chanEnvCounter[i] <= 0) {
+                chanEnvCounter[i] = chanEnvSweep[i]*clockSpeed/64;
+                chanVol[i] += chanEnvDir[i];
+                if (chanVol[i] < 0)
+                    chanVol[i] = 0;
+                if (chanVol[i] > 0xF)
+                    chanVol[i] = 0xF;
+            }
+            setSoundEventCycles(chanEnvCounter[i]);
+        }
+        if (chanUseLen[i]) {
+            chanLenCounter[i] -= cycles;
+            if (chanLenCounter[i] <= 0) {
+                chanOn[i] = 0;
+                gameboy->clearSoundChannel(1<<i);
+            }
+            else
+                setSoundEventCycles(chanLenCounter[i]);
+        }
+    }
+}
+
+void SoundEngine::setSoundEventCycles(int cycles) {
+    if (cyclesToSoundEvent > cycles) {
+        cyclesToSoundEvent = cycles;
+    }
+}
+
+void SoundEngine::soundUpdateVBlank() {
+}
+
+void SoundEngine::updateSoundSample() {
+}
+
+void SoundEngine::handleSoundRegister(u8 ioReg, u8 val)
+{
+    switch (ioReg) {
+        // Channel 1
+        case 0x10:
+            chan1SweepTime = (val>>4)&0x7;
+            if (chan1SweepTime != 0)
+                chan1SweepCounter = clockSpeed/(128/chan1SweepTime);
+            chan1SweepDir = (val&0x8) ? -1 : 1;
+            chan1SweepAmount = (val&0x7);
+            break;
+        case 0x11:
+            chanLen[0] = val&0x3F;
+            chanLenCounter[0] = (64-chanLen[0])*clockSpeed/256;
+            break;
+        case 0x12:
+            chanVol[0] = val>>4;
+            chanEnvDir[0] = (val & 0x8) ? 1 : -1;
+            chanEnvSweep[0] = val&0x7;
+            break;
+        case 0x13:
+            chanFreq[0] &= 0x700;
+            chanFreq[0] |= val;
+            break;
+        case 0x14:
+            chanFreq[0] &= 0xFF;
+            chanFreq[0] |= (val&0x7)<<8;
+            if (val & 0x80) {
+                chanLenCounter[0] = (64-chanLen[0])*clockSpeed/256;
+                chanOn[0] = 1;
+                chanVol[0] = gameboy->ioRam[0x12]>>4;
+                chanEnvCounter[0] = chanEnvSweep[0]*clockSpeed/64;
+                if (chan1SweepTime != 0)
+                    chan1SweepCounter = clockSpeed/(128/chan1SweepTime);
+                gameboy->setSoundChannel(CHAN_1);
+            }
+            chanUseLen[0] = !!(val & 0x40);
+            break;
+        // Channel 2
+        case 0x16:
+            chanLen[1] = val&0x3F;
+            chanLenCounter[1] = (64-chanLen[1])*clockSpeed/256;
+            break;
+        case 0x17:
+            chanVol[1] = val>>4;
+            chanEnvDir[1] = (val & 0x8) ? 1 : -1;
+            chanEnvSweep[1] = val&0x7;
+            break;
+        case 0x18:
+            chanFreq[1] &= 0x700;
+            chanFreq[1] |= val;
+            break;
+        case 0x19:
+            chanFreq[1] &= 0xFF;
+            chanFreq[1] |= (val&0x7)<<8;
+            if (val & 0x80) {
+                chanLenCounter[1] = (64-chanLen[1])*clockSpeed/256;
+                chanOn[1] = 1;
+                chanVol[1] = gameboy->ioRam[0x17]>>4;
+                chanEnvCounter[1] = chanEnvSweep[1]*clockSpeed/64;
+                gameboy->setSoundChannel(CHAN_2);
+            }
+            chanUseLen[1] = !!(val & 0x40);
+            break;
+        // Channel 3
+        case 0x1A:
+            if ((val & 0x80) == 0) {
+                chanOn[2] = 0;
+                gameboy->clearSoundChannel(CHAN_3);
+            }
+            break;
+        case 0x1B:
+            chanLen[2] = val;
+            break;
+        case 0x1D:
+            chanFreq[2] &= 0xFF00;
+            chanFreq[2] |= val;
+            break;
+        case 0x1E:
+            chanFreq[2] &= 0xFF;
+            chanFreq[2] |= (val&7)<<8;
+            if ((val & 0x80) && (gameboy->ioRam[0x1A] & 0x80)) {
+                chanOn[2] = 1;
+                chanLenCounter[2] = (256-chanLen[2])*clockSpeed/256;
+                gameboy->setSoundChannel(CHAN_3);
+            }
+            chanUseLen[2] = !!(val & 0x40);
+            break;
+        // Channel 4
+        case 0x20:
+            chanLen[3] = val&0x1F;
+            break;
+        case 0x21:
+            chanVol[3] = val>>4;
+            chanEnvDir[3] = (val & 0x8) ? 1 : -1;
+            chanEnvSweep[3] = val&0x7;
+            break;
+        case 0x23:
+            if (val&0x80) {
+                chanLenCounter[3] = (64-chanLen[3])*clockSpeed/256;
+                chanVol[3] = gameboy->ioRam[0x21]>>4;
+                chanEnvCounter[3] = chanEnvSweep[3]*clockSpeed/64;
+                chanOn[3] = 1;
+                gameboy->setSoundChannel(CHAN_4);
+            }
+            chanUseLen[3] = !!(val&0x40);
+            break;
+        case 0x26:
+            if (!(val & 0x80)) {
+                for (int i=0; i<4; i++)
+                    chanOn[i] = 0;
+                gameboy->clearSoundChannel(CHAN_1);
+                gameboy->clearSoundChannel(CHAN_2);
+                gameboy->clearSoundChannel(CHAN_3);
+                gameboy->clearSoundChannel(CHAN_4);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+// Global functions
+
+void muteSND() {
+}
+void unmuteSND() {
+}
+void enableChannel(int i) {
+}
+void disableChannel(int i) {
+}
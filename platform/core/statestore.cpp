@@ -0,0 +1,486 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "gameyob.h"
+
+// The store's directory holds:
+//  - pages: every page kept, one after another
+//  - hashes: the SHA-256 of each page in "pages", in the same order
+//  - states/<name>: a StateFileHeader, then the hash of each of the state's
+//    pages. The last page is padded with zeros.
+//  - lock: held with flock() while the store is open
+// Pages are only ever appended, and they and a state file are on disk before
+// the state file replaces the old one, so a store that was interrupted still
+// opens; any page without its hash is dropped. Pages are checked against their
+// hash as they're read.
+
+#define HASH_SIZE 32
+#define STATE_MAGIC 0x52535947      // "GYSR"
+#define STATE_VERSION 1
+// Far bigger than any gameboy's state. A damaged state file can't claim more
+// than this, so it can't make gy_store_get allocate more.
+#define MAX_STATE_SIZE (64<<20)
+
+struct StateFileHeader {
+    u32 magic;
+    u32 version;
+    u32 size;
+    u32 pages;
+};
+
+struct PageHash {
+    u8 bytes[HASH_SIZE];
+
+    bool operator==(const PageHash& other) const {
+        return memcmp(bytes, other.bytes, HASH_SIZE) == 0;
+    }
+};
+
+struct PageHashHasher {
+    size_t operator()(const PageHash& hash) const {
+        size_t val;
+        memcpy(&val, hash.bytes, sizeof(val));
+        return val;
+    }
+};
+
+struct GyStore {
+    std::string dir;
+    int lockFd;
+    int pagesFd;
+    int hashesFd;
+    std::unordered_map<PageHash, u32, PageHashHasher> slots;
+    std::vector<PageHash> hashes;   // By slot
+};
+
+
+// SHA-256, as in FIPS 180-4
+
+static const u32 sha256K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static inline u32 rotr(u32 x, int n) {
+    return (x >> n) | (x << (32-n));
+}
+
+static void sha256Block(u32* state, const u8* block) {
+    u32 w[64];
+    for (int i=0; i<16; i++)
+        w[i] = (block[i*4]<<24) | (block[i*4+1]<<16) | (block[i*4+2]<<8) | block[i*4+3];
+    for (int i=16; i<64; i++) {
+        u32 s0 = rotr(w[i-15], 7) ^ rotr(w[i-15], 18) ^ (w[i-15] >> 3);
+        u32 s1 = rotr(w[i-2], 17) ^ rotr(w[i-2], 19) ^ (w[i-2] >> 10);
+        w[i] = w[i-16] + s0 + w[i-7] + s1;
+    }
+
+    u32 a = state[0], b = state[1], c = state[2], d = state[3];
+    u32 e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i=0; i<64; i++) {
+        u32 t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + sha256K[i] + w[i];
+        u32 t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+static PageHash sha256(const u8* data, size_t size) {
+    u32 state[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+    size_t pos = 0;
+    for (; pos+64 <= size; pos += 64)
+        sha256Block(state, data+pos);
+
+    u8 last[128];
+    size_t left = size - pos;
+    memcpy(last, data+pos, left);
+    last[left] = 0x80;
+    size_t end = left < 56 ? 64 : 128;
+    memset(last+left+1, 0, end-left-1);
+    u64 bits = (u64)size*8;
+    for (int i=0; i<8; i++)
+        last[end-1-i] = bits >> (i*8);
+    sha256Block(state, last);
+    if (end == 128)
+        sha256Block(state, last+64);
+
+    PageHash hash;
+    for (int i=0; i<8; i++) {
+        hash.bytes[i*4] = state[i] >> 24;
+        hash.bytes[i*4+1] = state[i] >> 16;
+        hash.bytes[i*4+2] = state[i] >> 8;
+        hash.bytes[i*4+3] = state[i];
+    }
+    return hash;
+}
+
+
+static bool readAll(int fd, void* buf, size_t size, off_t offset) {
+    u8* ptr = (u8*)buf;
+    while (size > 0) {
+        ssize_t n = pread(fd, ptr, size, offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        ptr += n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+}
+
+static bool writeAll(int fd, const void* buf, size_t size, off_t offset) {
+    const u8* ptr = (const u8*)buf;
+    while (size > 0) {
+        ssize_t n = pwrite(fd, ptr, size, offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        ptr += n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+}
+
+static bool validName(const char* name) {
+    return name != NULL && name[0] != '\0' && name[0] != '.' && strchr(name, '/') == NULL &&
+        strlen(name) < 200;
+}
+
+static std::string statePath(GyStore* store, const char* name) {
+    return store->dir + "/states/" + name;
+}
+
+// Reads the page hashes of the state "name"
+static bool readStateFile(GyStore* store, const char* name, StateFileHeader* header,
+        std::vector<PageHash>* pages) {
+    int fd = open(statePath(store, name).c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    bool ok = readAll(fd, header, sizeof(*header), 0) && header->magic == STATE_MAGIC &&
+        header->version == STATE_VERSION && header->size <= MAX_STATE_SIZE &&
+        header->pages == (header->size + GY_STORE_PAGE_SIZE-1) / GY_STORE_PAGE_SIZE;
+    if (ok && pages != NULL) {
+        pages->resize(header->pages);
+        ok = readAll(fd, pages->data(), header->pages*sizeof(PageHash), sizeof(*header));
+    }
+    close(fd);
+    return ok;
+}
+
+// Loads "hashes" and drops any page that was written without its hash
+static bool loadIndex(GyStore* store) {
+    struct stat pagesStat, hashesStat;
+    if (fstat(store->pagesFd, &pagesStat) != 0 || fstat(store->hashesFd, &hashesStat) != 0)
+        return false;
+    size_t count = pagesStat.st_size / GY_STORE_PAGE_SIZE;
+    if ((size_t)hashesStat.st_size / HASH_SIZE < count)
+        count = hashesStat.st_size / HASH_SIZE;
+
+    store->hashes.resize(count);
+    if (count > 0 && !readAll(store->hashesFd, store->hashes.data(), count*HASH_SIZE, 0))
+        return false;
+    if (ftruncate(store->pagesFd, count*GY_STORE_PAGE_SIZE) != 0 ||
+            ftruncate(store->hashesFd, count*HASH_SIZE) != 0)
+        return false;
+
+    store->slots.clear();
+    for (size_t i=0; i<count; i++)
+        store->slots[store->hashes[i]] = i;
+    return true;
+}
+
+// Finishes or undoes a gy_store_gc that was cut short. Renaming hashes.new
+// is the point where it's done: once that's happened, pages.new is the only
+// page file that goes with the hashes.
+static bool finishGc(GyStore* store) {
+    std::string pagesPath = store->dir + "/pages";
+    std::string hashesPath = store->dir + "/hashes";
+    struct stat st;
+    if (stat((hashesPath + ".new").c_str(), &st) == 0) {
+        unlink((pagesPath + ".new").c_str());
+        unlink((hashesPath + ".new").c_str());
+    }
+    else if (stat((pagesPath + ".new").c_str(), &st) == 0)
+        return rename((pagesPath + ".new").c_str(), pagesPath.c_str()) == 0;
+    return true;
+}
+
+// Makes renames and new files in "dir" last through a crash
+static bool syncDir(const std::string& dir) {
+    int fd = open(dir.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    bool ok = fsync(fd) == 0;
+    close(fd);
+    return ok;
+}
+
+static bool openFiles(GyStore* store) {
+    if (!finishGc(store))
+        return false;
+    store->pagesFd = open((store->dir + "/pages").c_str(), O_RDWR | O_CREAT, 0644);
+    store->hashesFd = open((store->dir + "/hashes").c_str(), O_RDWR | O_CREAT, 0644);
+    return store->pagesFd >= 0 && store->hashesFd >= 0 && loadIndex(store);
+}
+
+static void closeFiles(GyStore* store) {
+    if (store->pagesFd >= 0)
+        close(store->pagesFd);
+    if (store->hashesFd >= 0)
+        close(store->hashesFd);
+    store->pagesFd = store->hashesFd = -1;
+}
+
+GyStore* gy_store_open(const char* dir) {
+    mkdir(dir, 0755);
+    mkdir((std::string(dir) + "/states").c_str(), 0755);
+
+    GyStore* store = new GyStore;
+    store->dir = dir;
+    store->pagesFd = store->hashesFd = -1;
+    store->lockFd = open((store->dir + "/lock").c_str(), O_RDWR | O_CREAT, 0644);
+    if (store->lockFd < 0 || flock(store->lockFd, LOCK_EX | LOCK_NB) != 0 || !openFiles(store)) {
+        gy_store_close(store);
+        return NULL;
+    }
+    return store;
+}
+
+void gy_store_close(GyStore* store) {
+    if (store == NULL)
+        return;
+    closeFiles(store);
+    if (store->lockFd >= 0)
+        close(store->lockFd);
+    delete store;
+}
+
+int gy_store_put(GyStore* store, const char* name, const void* state, size_t size) {
+    if (!validName(name) || size > MAX_STATE_SIZE)
+        return -1;
+
+    StateFileHeader header;
+    header.magic = STATE_MAGIC;
+    header.version = STATE_VERSION;
+    header.size = size;
+    header.pages = (size + GY_STORE_PAGE_SIZE-1) / GY_STORE_PAGE_SIZE;
+    std::vector<PageHash> pages(header.pages);
+    bool newPages = false;
+
+    for (u32 i=0; i<header.pages; i++) {
+        u8 page[GY_STORE_PAGE_SIZE];
+        size_t len = size - i*GY_STORE_PAGE_SIZE;
+        if (len > GY_STORE_PAGE_SIZE)
+            len = GY_STORE_PAGE_SIZE;
+        memcpy(page, (const u8*)state + i*GY_STORE_PAGE_SIZE, len);
+        memset(page+len, 0, GY_STORE_PAGE_SIZE-len);
+
+        PageHash hash = sha256(page, GY_STORE_PAGE_SIZE);
+        pages[i] = hash;
+        if (store->slots.count(hash))
+            continue;
+
+        u32 slot = store->hashes.size();
+        if (!writeAll(store->pagesFd, page, GY_STORE_PAGE_SIZE, (off_t)slot*GY_STORE_PAGE_SIZE) ||
+                !writeAll(store->hashesFd, hash.bytes, HASH_SIZE, (off_t)slot*HASH_SIZE))
+            return -1;
+        store->slots[hash] = slot;
+        store->hashes.push_back(hash);
+        newPages = true;
+    }
+    // The pages have to be on disk before a state file that names them
+    if (newPages && (fsync(store->pagesFd) != 0 || fsync(store->hashesFd) != 0))
+        return -1;
+
+    std::string path = statePath(store, name);
+    std::string tmpPath = store->dir + "/states/." + name;
+    int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return -1;
+    bool ok = writeAll(fd, &header, sizeof(header), 0) &&
+        writeAll(fd, pages.data(), pages.size()*sizeof(PageHash), sizeof(header)) &&
+        fsync(fd) == 0;
+    close(fd);
+    if (!ok || rename(tmpPath.c_str(), path.c_str()) != 0) {
+        unlink(tmpPath.c_str());
+        return -1;
+    }
+    return syncDir(store->dir + "/states") ? 0 : -1;
+}
+
+int gy_store_save(GyStore* store, const char* name, GyHandle* gy) {
+    std::vector<u8> state(gy_serialize(gy, NULL, 0));
+    gy_serialize(gy, state.data(), state.size());
+    return gy_store_put(store, name, state.data(), state.size());
+}
+
+void* gy_store_get(GyStore* store, const char* name, size_t* size) {
+    StateFileHeader header;
+    std::vector<PageHash> pages;
+    if (!validName(name) || !readStateFile(store, name, &header, &pages))
+        return NULL;
+
+    u8* state = (u8*)malloc((size_t)header.pages*GY_STORE_PAGE_SIZE + 1);
+    if (state == NULL)
+        return NULL;
+    for (u32 i=0; i<header.pages; i++) {
+        u8* page = state + (size_t)i*GY_STORE_PAGE_SIZE;
+        auto it = store->slots.find(pages[i]);
+        if (it == store->slots.end() ||
+                !readAll(store->pagesFd, page, GY_STORE_PAGE_SIZE, (off_t)it->second*GY_STORE_PAGE_SIZE) ||
+                !(sha256(page, GY_STORE_PAGE_SIZE) == pages[i])) {
+            free(state);
+            return NULL;
+        }
+    }
+    if (size != NULL)
+        *size = header.size;
+    return state;
+}
+
+int gy_store_load(GyStore* store, const char* name, GyHandle* gy) {
+    size_t size;
+    void* state = gy_store_get(store, name, &size);
+    if (state == NULL)
+        return -1;
+    int ret = gy_deserialize(gy, state, size) == 0 ? 0 : -1;
+    free(state);
+    return ret;
+}
+
+int gy_store_remove(GyStore* store, const char* name) {
+    if (!validName(name))
+        return -1;
+    return unlink(statePath(store, name).c_str()) == 0 ? 0 : -1;
+}
+
+// Calls "func" with the header of every state
+template <typename Func>
+static void forEachState(GyStore* store, Func func) {
+    DIR* dir = opendir((store->dir + "/states").c_str());
+    if (dir == NULL)
+        return;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (!validName(entry->d_name))
+            continue;
+        StateFileHeader header;
+        if (readStateFile(store, entry->d_name, &header, NULL))
+            func(entry->d_name, header);
+    }
+    closedir(dir);
+}
+
+void gy_store_list(GyStore* store, void (*func)(void* user, const char* name, size_t size), void* user) {
+    forEachState(store, [&](const char* name, const StateFileHeader& header) {
+        func(user, name, header.size);
+    });
+}
+
+int gy_store_gc(GyStore* store) {
+    // Marks every page some state uses. A page the store doesn't have is left
+    // out, so that "live" is a subset of "hashes"; gy_store_get already fails
+    // on the state that names it.
+    std::unordered_set<PageHash, PageHashHasher> live;
+    bool ok = true;
+    forEachState(store, [&](const char* name, const StateFileHeader& header) {
+        StateFileHeader h;
+        std::vector<PageHash> pages;
+        if (!readStateFile(store, name, &h, &pages)) {
+            ok = false;
+            return;
+        }
+        for (size_t i=0; i<pages.size(); i++) {
+            if (store->slots.count(pages[i]))
+                live.insert(pages[i]);
+        }
+    });
+    if (!ok)
+        return -1;
+
+    int dropped = store->hashes.size() - live.size();
+    if (dropped == 0)
+        return 0;
+
+    // Copies the live pages into new files, which then replace the old ones
+    std::string pagesPath = store->dir + "/pages";
+    std::string hashesPath = store->dir + "/hashes";
+    int pagesFd = open((pagesPath + ".new").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int hashesFd = open((hashesPath + ".new").c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ok = pagesFd >= 0 && hashesFd >= 0;
+
+    u32 slot = 0;
+    for (size_t i=0; i<store->hashes.size() && ok; i++) {
+        if (!live.count(store->hashes[i]))
+            continue;
+        u8 page[GY_STORE_PAGE_SIZE];
+        ok = readAll(store->pagesFd, page, GY_STORE_PAGE_SIZE, (off_t)i*GY_STORE_PAGE_SIZE) &&
+            writeAll(pagesFd, page, GY_STORE_PAGE_SIZE, (off_t)slot*GY_STORE_PAGE_SIZE) &&
+            writeAll(hashesFd, store->hashes[i].bytes, HASH_SIZE, (off_t)slot*HASH_SIZE);
+        slot++;
+    }
+    if (pagesFd >= 0)
+        ok &= fsync(pagesFd) == 0 && close(pagesFd) == 0;
+    if (hashesFd >= 0)
+        ok &= fsync(hashesFd) == 0 && close(hashesFd) == 0;
+
+    // Renaming the hashes is what commits the new files; if that happens and
+    // the pages' rename doesn't, finishGc renames them when the store is next
+    // opened. For the same reason pages.new is unlinked first when giving up.
+    if (ok)
+        ok = rename((hashesPath + ".new").c_str(), hashesPath.c_str()) == 0;
+    if (ok) {
+        rename((pagesPath + ".new").c_str(), pagesPath.c_str());
+        syncDir(store->dir);
+    }
+    else {
+        unlink((pagesPath + ".new").c_str());
+        unlink((hashesPath + ".new").c_str());
+    }
+
+    closeFiles(store);
+    if (!openFiles(store))
+        return -1;
+    return ok ? dropped : -1;
+}
+
+void gy_store_stats(GyStore* store, GyStoreStats* stats) {
+    memset(stats, 0, sizeof(*stats));
+    forEachState(store, [&](const char* name, const StateFileHeader& header) {
+        stats->states++;
+        stats->stateBytes += header.size;
+        stats->storedBytes += sizeof(header) + header.pages*HASH_SIZE;
+    });
+    stats->pages = store->hashes.size();
+    stats->storedBytes += (unsigned long long)stats->pages * (GY_STORE_PAGE_SIZE + HASH_SIZE);
+}
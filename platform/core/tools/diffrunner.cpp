@@ -0,0 +1,400 @@
+// gameyob-diff: runs one rom on two handles in lockstep, and stops at the
+// first point where they differ. Meant for checking a new cpu engine against
+// the interpreter.
+//
+//   gameyob-diff [-a engine] [-b engine] [-g granularity] [-f frames]
+//                [-i inputfile] [-r seed] [-t tracelength] [-v]
+//                [-x hacks] [-s frame] <rom>
+//
+// The handles are compared on their registers, the io page, and every ram
+// region, after each step of the granularity:
+//  - "frame" (the default) steps with gy_step
+//  - "opcode" steps one opcode at a time
+//  - a number steps that many opcodes at a time
+// When a frame or batch ends up different, it's run again from the last
+// point where they matched, an opcode at a time, to find the opcode where
+// they split. The last "-t" opcodes before it (16 by default) are printed.
+//
+// The buttons come from "-i", one byte per frame as for gy_step, or are
+// random with "-r", or are never pressed. "-v" draws the screen on "a" but not
+// on "b", to check that drawing makes no difference to the emulation.
+//
+// "-x" gives "b" other hacks (GY_HACK_* in gameyob.h, as a number) than the
+// ones the rom's profile gives both, to see whether a game puts up with them
+// before giving it a profile.
+//
+// "-s" checks save states instead: "a" runs that many frames on its own, then
+// "b" is made from the rom afresh and given a's state through gy_serialize and
+// gy_deserialize. From there the two must stay the same, down to gy_state_hash,
+// which also covers what isn't in memory.
+// Exits with 0 if the two never differed.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+#include "gameyob.h"
+#include "toolutil.h"
+
+struct TraceEntry {
+    int frame;
+    int opcode;                 // Opcodes into the frame
+    GyRegisters regs;           // Before the opcode ran
+    unsigned char bytes[3];
+};
+
+static const char* regionNames[] = { "wram", "vram", "oam", "io", "sram" };
+
+static std::vector<unsigned char> inputs;
+static int randomSeed = -1;
+static bool compareHashes = false;  // With -s
+
+static unsigned char getButtons(int frame) {
+    if (randomSeed >= 0) {
+        // A new set of buttons every 8 frames, so games see them held down
+        unsigned int x = (frame/8 + 1) * 2654435761u ^ (unsigned int)randomSeed;
+        x ^= x >> 15;
+        x *= 2246822519u;
+        x ^= x >> 13;
+        return (unsigned char)x;
+    }
+    if (frame < (int)inputs.size())
+        return inputs[frame];
+    return 0;
+}
+
+static bool readInputs(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
+        return false;
+    int c;
+    while ((c = fgetc(file)) != EOF)
+        inputs.push_back(c);
+    fclose(file);
+    return true;
+}
+
+static int findEngine(const char* name) {
+    for (int i=0; i<GY_ENGINE_MAX; i++) {
+        if (strcmp(name, gy_engine_name(i)) == 0)
+            return i;
+    }
+    fprintf(stderr, "Unknown engine \"%s\". There's:", name);
+    for (int i=0; i<GY_ENGINE_MAX; i++)
+        fprintf(stderr, " %s", gy_engine_name(i));
+    fprintf(stderr, "\n");
+    return -1;
+}
+
+static bool sameRegisters(const GyRegisters* r1, const GyRegisters* r2) {
+    return r1->af == r2->af && r1->bc == r2->bc && r1->de == r2->de &&
+        r1->hl == r2->hl && r1->sp == r2->sp && r1->pc == r2->pc;
+}
+
+// Both handles are in this process, so their memory is compared directly
+// rather than through gy_hash; it's as fast, and says where they differ.
+static bool sameState(GyHandle* a, GyHandle* b) {
+    GyRegisters ra, rb;
+    gy_registers(a, &ra);
+    gy_registers(b, &rb);
+    if (!sameRegisters(&ra, &rb))
+        return false;
+
+    for (int region=0; region<GY_RAM_MAX; region++) {
+        size_t sizeA, sizeB;
+        unsigned char* ptrA = gy_ram(a, region, &sizeA);
+        unsigned char* ptrB = gy_ram(b, region, &sizeB);
+        if (sizeA != sizeB || memcmp(ptrA, ptrB, sizeA) != 0)
+            return false;
+    }
+    return !compareHashes || gy_state_hash(a) == gy_state_hash(b);
+}
+
+static void printRegisters(const char* name, const GyRegisters* regs) {
+    printf("  %s: af=%04x bc=%04x de=%04x hl=%04x sp=%04x pc=%04x\n", name,
+            regs->af, regs->bc, regs->de, regs->hl, regs->sp, regs->pc);
+}
+
+static void printDifferences(GyHandle* a, GyHandle* b) {
+    GyRegisters ra, rb;
+    gy_registers(a, &ra);
+    gy_registers(b, &rb);
+    if (!sameRegisters(&ra, &rb)) {
+        printf("Registers:\n");
+        printRegisters("a", &ra);
+        printRegisters("b", &rb);
+    }
+
+    for (int region=0; region<GY_RAM_MAX; region++) {
+        size_t sizeA, sizeB;
+        unsigned char* ptrA = gy_ram(a, region, &sizeA);
+        unsigned char* ptrB = gy_ram(b, region, &sizeB);
+        if (sizeA != sizeB) {
+            printf("%s: 0x%zx bytes in a, 0x%zx in b\n", regionNames[region], sizeA, sizeB);
+            continue;
+        }
+
+        // The io page is small and every byte means something, so each one
+        // is listed. For the rest, where it starts is what matters.
+        int count = 0;
+        size_t first = 0;
+        for (size_t i=0; i<sizeA; i++) {
+            if (ptrA[i] == ptrB[i])
+                continue;
+            if (count++ == 0)
+                first = i;
+            if (region == GY_RAM_IO)
+                printf("io ff%02zx: %02x in a, %02x in b\n", i, ptrA[i], ptrB[i]);
+        }
+        if (count > 0 && region != GY_RAM_IO)
+            printf("%s: %d bytes differ, the first at offset 0x%zx (%02x in a, %02x in b)\n",
+                    regionNames[region], count, first, ptrA[first], ptrB[first]);
+    }
+
+    if (compareHashes && gy_state_hash(a) != gy_state_hash(b))
+        printf("State hashes: %016llx in a, %016llx in b\n", gy_state_hash(a), gy_state_hash(b));
+}
+
+static void printTrace(const std::vector<TraceEntry>& trace, size_t count) {
+    size_t length = trace.size();
+    size_t start = count < length ? 0 : count - length;
+    for (size_t i=start; i<count; i++) {
+        const TraceEntry* e = &trace[i % length];
+        printf("  frame %d +%-6d pc=%04x %02x %02x %02x  af=%04x bc=%04x de=%04x hl=%04x sp=%04x\n",
+                e->frame, e->opcode, e->regs.pc, e->bytes[0], e->bytes[1], e->bytes[2],
+                e->regs.af, e->regs.bc, e->regs.de, e->regs.hl, e->regs.sp);
+    }
+}
+
+// Steps both handles an opcode at a time, recording each opcode "a" runs, until
+// they differ or "maxOpcodes" have run. With "toFrameEnd", stops at the end of
+// the frame instead. The buttons are those for "buttonsFrame", or for the
+// frame being run if it's negative. Returns true if they differed.
+static bool stepOpcodes(GyHandle* a, GyHandle* b, int* frame, int* opcode, int maxOpcodes,
+        bool toFrameEnd, int buttonsFrame, std::vector<TraceEntry>* trace, size_t* traced) {
+    for (int i=0; toFrameEnd || i<maxOpcodes; i++) {
+        if (!trace->empty()) {
+            TraceEntry* e = &(*trace)[*traced % trace->size()];
+            e->frame = *frame;
+            e->opcode = *opcode;
+            gy_registers(a, &e->regs);
+            for (int j=0; j<3; j++)
+                e->bytes[j] = gy_peek(a, e->regs.pc+j);
+            (*traced)++;
+        }
+
+        unsigned char buttons = getButtons(buttonsFrame >= 0 ? buttonsFrame : *frame);
+        int framesA = gy_step_opcodes(a, 1, buttons);
+        int framesB = gy_step_opcodes(b, 1, buttons);
+        (*opcode)++;
+        if (framesA != framesB || !sameState(a, b))
+            return true;
+        if (framesA > 0) {
+            (*frame)++;
+            *opcode = 0;
+            if (toFrameEnd)
+                return false;
+        }
+    }
+    return false;
+}
+
+static void printUsage() {
+    fprintf(stderr, "Usage: gameyob-diff [-a engine] [-b engine] [-g frame|opcode|<opcodes>] [-f frames]\n"
+            "                    [-i inputfile] [-r seed] [-t tracelength] [-v]\n"
+            "                    [-x hacks] [-s frame] <rom>\n");
+}
+
+int main(int argc, char* argv[]) {
+    int engineA = GY_ENGINE_INTERPRETER;
+    int engineB = GY_ENGINE_INTERPRETER;
+    int batch = 0;              // Opcodes per step, or 0 for a frame
+    int maxFrames = 3600;
+    int traceLength = 16;
+    bool videoOnA = false;
+    int hacksB = -1;
+    int saveFrame = -1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "a:b:g:f:i:r:t:vx:s:")) != -1) {
+        switch (opt) {
+            case 'a':
+                if ((engineA = findEngine(optarg)) < 0)
+                    return 2;
+                break;
+            case 'b':
+                if ((engineB = findEngine(optarg)) < 0)
+                    return 2;
+                break;
+            case 'g':
+                if (strcmp(optarg, "frame") == 0)
+                    batch = 0;
+                else if (strcmp(optarg, "opcode") == 0)
+                    batch = 1;
+                else if ((batch = atoi(optarg)) <= 0) {
+                    printUsage();
+                    return 2;
+                }
+                break;
+            case 'f':
+                maxFrames = atoi(optarg);
+                break;
+            case 'i':
+                if (!readInputs(optarg)) {
+                    fprintf(stderr, "Couldn't open %s\n", optarg);
+                    return 2;
+                }
+                break;
+            case 'r':
+                randomSeed = atoi(optarg) & 0x7fffffff;
+                break;
+            case 't':
+                traceLength = atoi(optarg);
+                break;
+            case 'v':
+                videoOnA = true;
+                break;
+            case 'x':
+                hacksB = strtol(optarg, NULL, 0);
+                break;
+            case 's':
+                saveFrame = atoi(optarg);
+                compareHashes = true;
+                break;
+            default:
+                printUsage();
+                return 2;
+        }
+    }
+    if (optind != argc-1) {
+        printUsage();
+        return 2;
+    }
+
+    GyHandle* a = loadRom(argv[optind]);
+    if (a == NULL) {
+        fprintf(stderr, "Couldn't load %s\n", argv[optind]);
+        return 2;
+    }
+    gy_set_video(a, videoOnA);
+    gy_set_engine(a, engineA);
+    int frame = 0;
+    GyHandle* b;
+    if (saveFrame >= 0) {
+        for (; frame < saveFrame; frame++) {
+            unsigned char buttons = getButtons(frame);
+            gy_step(a, 1, &buttons);
+        }
+        size_t size = gy_serialize(a, NULL, 0);
+        std::vector<unsigned char> state(size);
+        gy_serialize(a, &state[0], size);
+        b = loadRom(argv[optind]);
+        if (gy_deserialize(b, &state[0], size) != 0) {
+            fprintf(stderr, "Couldn't load a's state into b\n");
+            return 2;
+        }
+    }
+    else
+        b = gy_clone(a);
+    gy_set_video(b, 0);
+    gy_set_engine(b, engineB);
+    if (hacksB >= 0)
+        gy_set_hacks(b, hacksB);
+
+    // Where both last matched, to go back to when a step ends up different
+    GyHandle* lastA = gy_clone(a);
+    GyHandle* lastB = gy_clone(b);
+
+    std::vector<TraceEntry> trace(traceLength > 0 ? traceLength : 0);
+    size_t traced = 0;
+    int opcode = 0;
+    bool differed = false;
+    bool split = false;         // Whether the opcode where they split was found
+
+    printf("Comparing %s (a) with %s (b) on %s\n", gy_engine_name(engineA),
+            gy_engine_name(engineB), argv[optind]);
+    if (gy_hacks(a) != 0 || gy_hacks(b) != 0)
+        printf("Hacks: %#x (a), %#x (b)\n", gy_hacks(a), gy_hacks(b));
+    if (saveFrame >= 0)
+        printf("b loaded a's state at frame %d\n", saveFrame);
+
+    while (frame < maxFrames && !differed) {
+        if (batch == 1) {
+            // Already as fine as it goes
+            differed = split = stepOpcodes(a, b, &frame, &opcode, 1, false, -1, &trace, &traced);
+            continue;
+        }
+
+        int startFrame = frame;
+        int startOpcode = opcode;
+        if (batch == 0) {
+            unsigned char buttons = getButtons(frame);
+            gy_step(a, 1, &buttons);
+            gy_step(b, 1, &buttons);
+            frame++;
+        }
+        else {
+            // A batch that runs into the next frame keeps the buttons it
+            // started with
+            int framesA = gy_step_opcodes(a, batch, getButtons(frame));
+            gy_step_opcodes(b, batch, getButtons(frame));
+            if (framesA > 0) {
+                frame += framesA;
+                opcode = 0;
+            }
+            else
+                opcode += batch;
+        }
+
+        if (sameState(a, b)) {
+            gy_copy(lastA, a);
+            gy_copy(lastB, b);
+            continue;
+        }
+        differed = true;
+
+        // Run the step again from where they last matched, an opcode at a
+        // time. A frame doesn't run quite the same way like that, so it
+        // might not happen again.
+        GyHandle* badA = gy_clone(a);
+        GyHandle* badB = gy_clone(b);
+        int badFrame = frame;
+        int badOpcode = opcode;
+        gy_copy(a, lastA);
+        gy_copy(b, lastB);
+        frame = startFrame;
+        opcode = startOpcode;
+        if (batch == 0)
+            split = stepOpcodes(a, b, &frame, &opcode, 0, true, -1, &trace, &traced);
+        else
+            split = stepOpcodes(a, b, &frame, &opcode, batch, false, startFrame, &trace, &traced);
+
+        if (!split) {
+            printf("Differed after frame %d", badFrame);
+            if (batch > 0)
+                printf(", opcode %d", badOpcode);
+            printf(", but not when that was run again an opcode at a time. Try -g opcode.\n");
+            printDifferences(badA, badB);
+        }
+        gy_destroy(badA);
+        gy_destroy(badB);
+    }
+
+    if (split) {
+        printf("Split at frame %d, opcode %d\n", frame, opcode);
+        if (traced > 0) {
+            printf("The opcodes up to it, as run by a:\n");
+            printTrace(trace, traced);
+        }
+        printDifferences(a, b);
+    }
+    else if (!differed)
+        printf("No differences in %d frames\n", frame);
+
+    gy_destroy(lastA);
+    gy_destroy(lastB);
+    gy_destroy(a);
+    gy_destroy(b);
+    return differed ? 1 : 0;
+}
@@ -0,0 +1,270 @@
+// gameyob-netplay: plays a rom as both sides of a gy_netplay session, with
+// made up buttons, and checks that the two stay in step.
+//
+//   gameyob-netplay [-f frames] [-l port | -c host:port] [-j jitter]
+//                   [-r seed] [-t] [-v] <rom>
+//
+// With "-l" this is player 1 and waits for player 2 on a tcp port; with "-c"
+// it's player 2 and connects to one. With neither, it forks and plays both
+// sides itself over a socket pair. Each player's buttons change every 8
+// frames, from "-r" and the player number, so each side keeps guessing the
+// other's wrong and has to go back. "-j" sleeps up to that many milliseconds
+// before each frame (only on player 2 when playing both sides), for the
+// sides to drift apart; "-t" keeps to the gameboy's frame rate instead of
+// running flat out. "-v" draws the screen, which is off by default.
+//
+// At the end each side prints how much it went back and the hash of its last
+// frame. Exits with 0 if both sides agreed on every frame.
+
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "gameyob.h"
+#include "toolutil.h"
+#include "hosttime.h"
+
+#define TIMEOUT_MS 10000
+
+static int randomSeed = 1;
+
+static unsigned char getButtons(int player, int frame) {
+    unsigned int x = (frame/8 + 1) * 2654435761u ^ (unsigned int)(randomSeed*2 + player);
+    x ^= x >> 15;
+    x *= 2246822519u;
+    x ^= x >> 13;
+    return (unsigned char)x;
+}
+
+static void sleepMs(double ms) {
+    if (ms <= 0)
+        return;
+    struct timespec ts;
+    ts.tv_sec = (time_t)(ms/1000);
+    ts.tv_nsec = (long)((ms - ts.tv_sec*1000.0) * 1000000);
+    nanosleep(&ts, NULL);
+}
+
+static void setNoDelay(int fd) {
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+}
+
+static int listenOn(const char* port) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(atoi(port));
+
+    int server = socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (server < 0 || bind(server, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(server, 1) != 0) {
+        perror("listen");
+        return -1;
+    }
+    printf("Waiting for player 2 on port %s\n", port);
+    int fd = accept(server, NULL, NULL);
+    close(server);
+    if (fd >= 0)
+        setNoDelay(fd);
+    return fd;
+}
+
+static int connectTo(const char* address) {
+    char host[256];
+    const char* colon = strrchr(address, ':');
+    if (colon == NULL || colon - address >= (int)sizeof(host))
+        return -1;
+    memcpy(host, address, colon - address);
+    host[colon - address] = '\0';
+
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, colon+1, &hints, &res) != 0)
+        return -1;
+
+    int fd = -1;
+    for (struct addrinfo* ai = res; ai != NULL && fd < 0; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    if (fd >= 0)
+        setNoDelay(fd);
+    return fd;
+}
+
+static const char* statusNames[] = { "ok", "waiting", "desynced", "connection lost" };
+
+// Returns the exit code
+static int play(const char* romPath, int player, int fd, int frames, int jitterMs,
+        bool realtime, bool video) {
+    GyHandle* gy = loadRom(romPath);
+    if (gy == NULL) {
+        fprintf(stderr, "Couldn't load %s\n", romPath);
+        return 2;
+    }
+    gy_set_video(gy, video);
+    GyNetplay* np = gy_netplay_create(gy, player, fd, TIMEOUT_MS);
+    if (np == NULL) {
+        fprintf(stderr, "Player %d: couldn't start the session\n", player);
+        gy_destroy(gy);
+        return 2;
+    }
+    srand(randomSeed + player);
+
+    GyNetplayStats stats;
+    int status = GY_NETPLAY_OK;
+    double start = getMilliseconds();
+    double lastProgress = start;
+    int frame = 0;
+
+    while (frame < frames && status != GY_NETPLAY_DESYNCED && status != GY_NETPLAY_CLOSED) {
+        if (realtime)
+            sleepMs(start + frame*(70224*1000.0/4194304) - getMilliseconds());
+        if (jitterMs > 0 && status == GY_NETPLAY_OK)
+            sleepMs(rand() % (jitterMs+1));
+
+        status = gy_netplay_step(np, getButtons(player, frame));
+        if (status == GY_NETPLAY_OK) {
+            frame++;
+            lastProgress = getMilliseconds();
+        }
+        else if (status == GY_NETPLAY_WAITING) {
+            if (getMilliseconds() - lastProgress > TIMEOUT_MS)
+                status = GY_NETPLAY_CLOSED;
+            else
+                sleepMs(0.5);
+        }
+    }
+
+    // The hash of the last frame is only checked once the other side has
+    // every input up to it
+    gy_netplay_stats(np, &stats);
+    while (status == GY_NETPLAY_OK && stats.checkedFrame < frames) {
+        if (getMilliseconds() - lastProgress > TIMEOUT_MS) {
+            status = GY_NETPLAY_CLOSED;
+            break;
+        }
+        sleepMs(0.5);
+        status = gy_netplay_idle(np);
+        gy_netplay_stats(np, &stats);
+    }
+    double elapsed = getMilliseconds() - start;
+    // The other side may have hung up as soon as it had everything
+    bool agreed = stats.checkedFrame >= frames && stats.desyncFrame < 0;
+    if (agreed)
+        status = GY_NETPLAY_OK;
+
+    printf("Player %d: %s after %d frames (%.0f fps). Went back %d times over %d frames, "
+            "at most %d frames in %.2f ms. Checked to frame %d, hash %016llx\n",
+            player, statusNames[status], stats.frame, stats.frame*1000/elapsed, stats.rollbacks,
+            stats.framesReplayed, stats.longestRollback, stats.longestRollbackMs,
+            stats.checkedFrame, gy_hash(gy));
+    if (stats.desyncFrame >= 0)
+        printf("Player %d: desynced at frame %d\n", player, stats.desyncFrame);
+
+    gy_netplay_destroy(np);
+    gy_destroy(gy);
+    return agreed ? 0 : 1;
+}
+
+static void printUsage() {
+    fprintf(stderr, "Usage: gameyob-netplay [-f frames] [-l port | -c host:port] [-j jitter]\n"
+            "                       [-r seed] [-t] [-v] <rom>\n");
+}
+
+int main(int argc, char* argv[]) {
+    int frames = 3600;
+    int jitterMs = 0;
+    bool realtime = false;
+    bool video = false;
+    const char* listenPort = NULL;
+    const char* connectAddress = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "f:l:c:j:r:tv")) != -1) {
+        switch (opt) {
+            case 'f':
+                frames = atoi(optarg);
+                break;
+            case 'l':
+                listenPort = optarg;
+                break;
+            case 'c':
+                connectAddress = optarg;
+                break;
+            case 'j':
+                jitterMs = atoi(optarg);
+                break;
+            case 'r':
+                randomSeed = atoi(optarg) & 0x7fffffff;
+                break;
+            case 't':
+                realtime = true;
+                break;
+            case 'v':
+                video = true;
+                break;
+            default:
+                printUsage();
+                return 2;
+        }
+    }
+    if (optind != argc-1 || (listenPort != NULL && connectAddress != NULL)) {
+        printUsage();
+        return 2;
+    }
+    const char* romPath = argv[optind];
+
+    if (listenPort != NULL || connectAddress != NULL) {
+        int fd = listenPort != NULL ? listenOn(listenPort) : connectTo(connectAddress);
+        if (fd < 0) {
+            fprintf(stderr, "Couldn't connect\n");
+            return 2;
+        }
+        int ret = play(romPath, listenPort != NULL ? 1 : 2, fd, frames, jitterMs, realtime, video);
+        close(fd);
+        return ret;
+    }
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        perror("socketpair");
+        return 2;
+    }
+    fflush(stdout);
+    pid_t child = fork();
+    if (child < 0) {
+        perror("fork");
+        return 2;
+    }
+    if (child == 0) {
+        close(fds[0]);
+        int ret = play(romPath, 2, fds[1], frames, jitterMs, realtime, video);
+        close(fds[1]);
+        exit(ret);
+    }
+    close(fds[1]);
+    int ret = play(romPath, 1, fds[0], frames, 0, realtime, video);
+    close(fds[0]);
+
+    int childStatus;
+    waitpid(child, &childStatus, 0);
+    if (!WIFEXITED(childStatus) || WEXITSTATUS(childStatus) != 0)
+        ret = ret != 0 ? ret : 1;
+    return ret;
+}
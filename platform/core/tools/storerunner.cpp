@@ -0,0 +1,174 @@
+// gameyob-store: manages a gy_store directory from the command line.
+//
+//   gameyob-store <dir> add <name> <file>
+//   gameyob-store <dir> get <name> <file>
+//   gameyob-store <dir> rm <name>...
+//   gameyob-store <dir> list
+//   gameyob-store <dir> gc
+//   gameyob-store <dir> stats
+//   gameyob-store <dir> record <rom> <frames> <every>
+//
+// "add" and "get" move states between the store and ordinary files, like the
+// ones gy_serialize writes. "record" runs a rom for that many frames, with
+// made up buttons, and saves a state every "every" frames, as <rom>-<frame>;
+// it's a quick way to see how much a game's states have in common. Every
+// command that checks something exits with 1 if it doesn't hold.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gameyob.h"
+#include "toolutil.h"
+#include "hosttime.h"
+
+static bool writeFile(const char* path, const void* data, size_t size) {
+    FILE* file = fopen(path, "wb");
+    if (file == NULL)
+        return false;
+    bool ok = fwrite(data, 1, size, file) == size;
+    return fclose(file) == 0 && ok;
+}
+
+static void printState(void* user, const char* name, size_t size) {
+    printf("%8zu  %s\n", size, name);
+}
+
+static void printStats(GyStore* store) {
+    GyStoreStats stats;
+    gy_store_stats(store, &stats);
+    printf("%d states, %llu bytes as files; %d pages, %llu bytes stored", stats.states,
+            stats.stateBytes, stats.pages, stats.storedBytes);
+    if (stats.storedBytes > 0)
+        printf(" (%.1fx)", (double)stats.stateBytes / stats.storedBytes);
+    printf("\n");
+}
+
+// Returns the exit code
+static int record(GyStore* store, const char* romPath, int frames, int every) {
+    GyHandle* gy = loadRom(romPath);
+    if (gy == NULL) {
+        fprintf(stderr, "Couldn't load %s\n", romPath);
+        return 2;
+    }
+    gy_set_video(gy, 0);
+
+    const char* base = strrchr(romPath, '/');
+    base = base != NULL ? base+1 : romPath;
+
+    // Each one saved is read back, to check it comes out as it went in
+    int saved = 0;
+    double saveMs = 0, loadMs = 0;
+    for (int frame=0; frame<=frames; frame++) {
+        if (frame % every == 0) {
+            char name[256];
+            snprintf(name, sizeof(name), "%s-%06d", base, frame);
+            if (name[0] == '.')
+                name[0] = '_';
+
+            size_t size = gy_serialize(gy, NULL, 0);
+            void* state = malloc(size);
+            gy_serialize(gy, state, size);
+
+            double start = getMilliseconds();
+            int ret = gy_store_put(store, name, state, size);
+            saveMs += getMilliseconds() - start;
+            start = getMilliseconds();
+            size_t loadedSize = 0;
+            void* loaded = ret == 0 ? gy_store_get(store, name, &loadedSize) : NULL;
+            loadMs += getMilliseconds() - start;
+
+            bool same = loaded != NULL && loadedSize == size && memcmp(loaded, state, size) == 0;
+            free(state);
+            free(loaded);
+            if (!same) {
+                fprintf(stderr, "%s didn't come back as it was saved\n", name);
+                gy_destroy(gy);
+                return 1;
+            }
+            saved++;
+        }
+        unsigned int x = (frame/8 + 1) * 2654435761u;
+        unsigned char buttons = x ^ (x >> 15);
+        gy_step(gy, 1, &buttons);
+    }
+    gy_destroy(gy);
+
+    printf("Saved %d states, %.3f ms each; loaded in %.3f ms each\n", saved, saveMs/saved,
+            loadMs/saved);
+    printStats(store);
+    return 0;
+}
+
+static void printUsage() {
+    fprintf(stderr, "Usage: gameyob-store <dir> add <name> <file>\n"
+            "       gameyob-store <dir> get <name> <file>\n"
+            "       gameyob-store <dir> rm <name>...\n"
+            "       gameyob-store <dir> list | gc | stats\n"
+            "       gameyob-store <dir> record <rom> <frames> <every>\n");
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        printUsage();
+        return 2;
+    }
+    const char* command = argv[2];
+    int args = argc-3;
+    char** arg = argv+3;
+
+    GyStore* store = gy_store_open(argv[1]);
+    if (store == NULL) {
+        fprintf(stderr, "Couldn't open the store in %s\n", argv[1]);
+        return 2;
+    }
+
+    int ret = 0;
+    if (strcmp(command, "add") == 0 && args == 2) {
+        size_t size;
+        void* state = readFile(arg[1], &size);
+        if (state == NULL || gy_store_put(store, arg[0], state, size) != 0) {
+            fprintf(stderr, "Couldn't add %s\n", arg[1]);
+            ret = 1;
+        }
+        free(state);
+    }
+    else if (strcmp(command, "get") == 0 && args == 2) {
+        size_t size;
+        void* state = gy_store_get(store, arg[0], &size);
+        if (state == NULL || !writeFile(arg[1], state, size)) {
+            fprintf(stderr, "Couldn't get %s\n", arg[0]);
+            ret = 1;
+        }
+        free(state);
+    }
+    else if (strcmp(command, "rm") == 0 && args >= 1) {
+        for (int i=0; i<args; i++) {
+            if (gy_store_remove(store, arg[i]) != 0) {
+                fprintf(stderr, "Couldn't remove %s\n", arg[i]);
+                ret = 1;
+            }
+        }
+    }
+    else if (strcmp(command, "list") == 0 && args == 0)
+        gy_store_list(store, printState, NULL);
+    else if (strcmp(command, "gc") == 0 && args == 0) {
+        int dropped = gy_store_gc(store);
+        if (dropped < 0) {
+            fprintf(stderr, "Couldn't collect the store\n");
+            ret = 1;
+        }
+        else
+            printf("Dropped %d pages\n", dropped);
+    }
+    else if (strcmp(command, "stats") == 0 && args == 0)
+        printStats(store);
+    else if (strcmp(command, "record") == 0 && args == 3 && atoi(arg[2]) > 0)
+        ret = record(store, arg[0], atoi(arg[1]), atoi(arg[2]));
+    else {
+        printUsage();
+        ret = 2;
+    }
+
+    gy_store_close(store);
+    return ret;
+}
@@ -0,0 +1,347 @@
+// gameyob-test: runs test roms headless, spread over every core, and prints
+// what each one said and whether it passed.
+//
+//   gameyob-test [-j threads] [-t seconds] [-q] <rom or directory>...
+//
+// Directories are searched for .gb and .gbc files. A test passes or fails as
+// soon as it gives one of these signs, and times out after "-t" emulated
+// seconds (120 by default) otherwise:
+//  - "Passed" or "Failed" sent over the link port (blargg's tests)
+//  - blargg's signature, de b0 61, at a001 in cartridge ram, once a000 is no
+//    longer 80. a000 is 0 if it passed.
+//  - 3 5 8 13 21 34 sent over the link port or left in b, c, d, e, h and l
+//    (mooneye's tests). 42 in all six means it failed.
+// What each test sent is printed when it finishes, unless "-q" is given, and
+// then a table of the results.
+// Exits with 0 if every test passed.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "gameyob.h"
+#include "toolutil.h"
+#include "hosttime.h"
+
+#define FRAMES_PER_SECOND   (4194304.0/70224)
+
+enum {
+    TEST_RUNNING = 0,
+    TEST_PASSED,
+    TEST_FAILED,
+    TEST_TIMEOUT,
+    TEST_ERROR
+};
+
+static const char* resultNames[] = { "RUNNING", "PASS", "FAIL", "TIMEOUT", "ERROR" };
+
+struct Test {
+    std::string path;
+    GyHandle* gy;
+    // Atomic because the test can finish before gy_farm_submit returns. It
+    // can't be cancelled until then.
+    std::atomic<int> job;
+
+    // Only touched by the worker running the test until its job is done
+    std::string serial;
+    size_t serialChecked;   // How much of "serial" was searched already
+    int result;
+    const char* reason;
+    int frames;
+    double startTime;
+    double endTime;
+};
+
+static GyFarm* farm;
+
+static const unsigned char fibonacci[] = { 3, 5, 8, 13, 21, 34 };
+
+static double getSeconds() {
+    return getMilliseconds() / 1000;
+}
+
+static void appendSerial(void* user, unsigned char val) {
+    ((Test*)user)->serial += (char)val;
+}
+
+static bool serialEndsWith(Test* test, const unsigned char* bytes, size_t len) {
+    return test->serial.size() >= len &&
+        memcmp(test->serial.data() + test->serial.size() - len, bytes, len) == 0;
+}
+
+static bool registersAre(const GyRegisters* regs, const unsigned char* values) {
+    return (regs->bc>>8) == values[0] && (regs->bc&0xff) == values[1] &&
+        (regs->de>>8) == values[2] && (regs->de&0xff) == values[3] &&
+        (regs->hl>>8) == values[4] && (regs->hl&0xff) == values[5];
+}
+
+static int checkTest(Test* test) {
+    static const unsigned char failBytes[] = { 0x42, 0x42, 0x42, 0x42, 0x42, 0x42 };
+
+    if (test->serial.size() > test->serialChecked) {
+        // Back up a little in case a word came in over two frames
+        size_t from = test->serialChecked >= 6 ? test->serialChecked - 6 : 0;
+        test->serialChecked = test->serial.size();
+        if (test->serial.find("Passed", from) != std::string::npos) {
+            test->reason = "serial";
+            return TEST_PASSED;
+        }
+        if (test->serial.find("Failed", from) != std::string::npos) {
+            test->reason = "serial";
+            return TEST_FAILED;
+        }
+        if (serialEndsWith(test, fibonacci, 6)) {
+            test->reason = "serial";
+            return TEST_PASSED;
+        }
+        if (serialEndsWith(test, failBytes, 6)) {
+            test->reason = "serial";
+            return TEST_FAILED;
+        }
+    }
+
+    size_t size;
+    const unsigned char* sram = gy_ram(test->gy, GY_RAM_SRAM, &size);
+    if (size >= 4 && sram[1] == 0xde && sram[2] == 0xb0 && sram[3] == 0x61 && sram[0] != 0x80) {
+        test->reason = "sram";
+        return sram[0] == 0 ? TEST_PASSED : TEST_FAILED;
+    }
+
+    GyRegisters regs;
+    gy_registers(test->gy, &regs);
+    if (registersAre(&regs, fibonacci)) {
+        test->reason = "registers";
+        return TEST_PASSED;
+    }
+    if (registersAre(&regs, failBytes)) {
+        test->reason = "registers";
+        return TEST_FAILED;
+    }
+    return TEST_RUNNING;
+}
+
+// Called on the worker thread before each frame, while the handle is between
+// frames, so it's free to look at its memory
+static unsigned char testInput(void* user, int frame) {
+    Test* test = (Test*)user;
+    if (test->result == TEST_RUNNING) {
+        if (frame == 0)
+            test->startTime = getSeconds();
+        test->frames = frame;
+        test->endTime = getSeconds();
+        test->result = checkTest(test);
+    }
+    if (test->result != TEST_RUNNING)
+        gy_farm_cancel(farm, test->job);
+    return 0;
+}
+
+static bool hasRomExtension(const char* name) {
+    const char* dot = strrchr(name, '.');
+    return dot != NULL && (strcasecmp(dot, ".gb") == 0 || strcasecmp(dot, ".gbc") == 0);
+}
+
+static void findRoms(const char* path, std::vector<std::string>* roms) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        fprintf(stderr, "Couldn't find %s\n", path);
+        return;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        roms->push_back(path);
+        return;
+    }
+
+    DIR* dir = opendir(path);
+    if (dir == NULL) {
+        fprintf(stderr, "Couldn't open %s\n", path);
+        return;
+    }
+    std::vector<std::string> entries;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] != '.')
+            entries.push_back(entry->d_name);
+    }
+    closedir(dir);
+
+    std::sort(entries.begin(), entries.end());
+    for (size_t i=0; i<entries.size(); i++) {
+        std::string child = std::string(path) + "/" + entries[i];
+        if (stat(child.c_str(), &st) != 0)
+            continue;
+        if (S_ISDIR(st.st_mode))
+            findRoms(child.c_str(), roms);
+        else if (hasRomExtension(entries[i].c_str()))
+            roms->push_back(child);
+    }
+}
+
+static void loadTest(Test* test) {
+    test->gy = loadRom(test->path.c_str());
+    if (test->gy == NULL) {
+        test->result = TEST_ERROR;
+        test->reason = "couldn't load";
+        return;
+    }
+    // The tests are judged by what they send and leave in memory, never by
+    // the screen
+    gy_set_video(test->gy, 0);
+    gy_set_serial_output(test->gy, appendSerial, test);
+}
+
+static void startTest(Test* test, int timeoutFrames) {
+    if (test->gy == NULL)
+        return;
+    GyJob job;
+    memset(&job, 0, sizeof(job));
+    job.gy = test->gy;
+    job.frames = timeoutFrames;
+    job.input = testInput;
+    job.user = test;
+    test->job = gy_farm_submit(farm, &job);
+}
+
+// Prints the bytes as they came, except for ones that would mess up the
+// terminal
+static void printSerial(Test* test) {
+    printf("== %s\n", test->path.c_str());
+    for (size_t i=0; i<test->serial.size(); i++) {
+        unsigned char c = test->serial[i];
+        if (c == '\n' || (c >= 0x20 && c < 0x7f))
+            putchar(c);
+        else
+            printf("\\x%02x", c);
+    }
+    if (test->serial[test->serial.size()-1] != '\n')
+        putchar('\n');
+}
+
+static void finishTest(Test* test, bool quiet) {
+    if (test->result == TEST_RUNNING) {
+        test->result = TEST_TIMEOUT;
+        test->reason = "";
+        test->frames++;     // testInput wasn't called after the last frame
+    }
+    if (!quiet && !test->serial.empty())
+        printSerial(test);
+}
+
+static void printUsage() {
+    fprintf(stderr, "Usage: gameyob-test [-j threads] [-t seconds] [-q] <rom or directory>...\n");
+}
+
+int main(int argc, char* argv[]) {
+    int threads = 0;
+    double timeout = 120;
+    bool quiet = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "j:t:q")) != -1) {
+        switch (opt) {
+            case 'j':
+                threads = atoi(optarg);
+                break;
+            case 't':
+                timeout = atof(optarg);
+                break;
+            case 'q':
+                quiet = true;
+                break;
+            default:
+                printUsage();
+                return 2;
+        }
+    }
+    if (optind >= argc || timeout <= 0) {
+        printUsage();
+        return 2;
+    }
+
+    std::vector<std::string> roms;
+    for (int i=optind; i<argc; i++)
+        findRoms(argv[i], &roms);
+    if (roms.empty()) {
+        fprintf(stderr, "No roms found\n");
+        return 2;
+    }
+
+    std::vector<Test> tests(roms.size());
+    for (size_t i=0; i<roms.size(); i++) {
+        Test* test = &tests[i];
+        test->path = roms[i];
+        test->gy = NULL;
+        test->job = -1;
+        test->serialChecked = 0;
+        test->result = TEST_RUNNING;
+        test->reason = "";
+        test->frames = 0;
+        test->startTime = test->endTime = 0;
+    }
+
+    farm = gy_farm_create(threads);
+    if (threads <= 0)
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads <= 0)
+        threads = 1;
+    int timeoutFrames = (int)(timeout * FRAMES_PER_SECOND + 0.5);
+    double startTime = getSeconds();
+
+    // Handles can't be created while others run, so every test is loaded
+    // before any starts. Each is printed once it and those before it are done.
+    for (size_t i=0; i<tests.size(); i++)
+        loadTest(&tests[i]);
+    for (size_t i=0; i<tests.size(); i++)
+        startTest(&tests[i], timeoutFrames);
+
+    size_t nextPrint = 0;
+    while (nextPrint < tests.size()) {
+        Test* test = &tests[nextPrint];
+        if (test->job >= 0) {
+            GyResult result;
+            int ret;
+            while ((ret = gy_farm_poll(farm, test->job, &result)) == 1)
+                gy_result_free(&result);
+            if (ret == 0) {
+                usleep(1000);
+                continue;
+            }
+        }
+        finishTest(test, quiet);
+        nextPrint++;
+    }
+    fflush(stdout);
+
+    double totalTime = getSeconds() - startTime;
+    double fps = gy_farm_fps(farm);
+    gy_farm_destroy(farm);
+    for (size_t i=0; i<tests.size(); i++)
+        gy_destroy(tests[i].gy);
+
+    size_t nameWidth = 4;
+    for (size_t i=0; i<tests.size(); i++)
+        nameWidth = std::max(nameWidth, tests[i].path.size());
+
+    int counts[TEST_ERROR+1];
+    memset(counts, 0, sizeof(counts));
+    printf("\n%-*s  %-7s  %9s  %7s  %s\n", (int)nameWidth, "test", "result", "emulated", "host", "how");
+    for (size_t i=0; i<tests.size(); i++) {
+        Test* test = &tests[i];
+        counts[test->result]++;
+        printf("%-*s  %-7s  %8.2fs  %6.2fs  %s\n", (int)nameWidth, test->path.c_str(),
+                resultNames[test->result], test->frames / FRAMES_PER_SECOND,
+                test->endTime - test->startTime, test->reason);
+    }
+    printf("\n%d passed, %d failed, %d timed out, %d errors in %.2fs (%.0f fps on %d threads)\n",
+            counts[TEST_PASSED], counts[TEST_FAILED], counts[TEST_TIMEOUT], counts[TEST_ERROR],
+            totalTime, fps, threads);
+
+    return counts[TEST_PASSED] == (int)tests.size() ? 0 : 1;
+}
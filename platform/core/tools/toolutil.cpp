@@ -0,0 +1,34 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "toolutil.h"
+
+void* readFile(const char* path, size_t* size) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL)
+        return NULL;
+    fseek(file, 0, SEEK_END);
+    long len = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    void* data = NULL;
+    if (len >= 0) {
+        data = malloc(len+1);
+        if (data != NULL && fread(data, 1, len, file) != (size_t)len) {
+            free(data);
+            data = NULL;
+        }
+    }
+    fclose(file);
+    *size = len;
+    return data;
+}
+
+GyHandle* loadRom(const char* path) {
+    size_t size;
+    void* rom = readFile(path, &size);
+    GyHandle* gy = NULL;
+    if (rom != NULL && size > 0)
+        gy = gy_create((const unsigned char*)rom, size);
+    free(rom);
+    return gy;
+}
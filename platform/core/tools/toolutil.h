@@ -0,0 +1,13 @@
+#pragma once
+#include <stddef.h>
+#include "gameyob.h"
+
+// Bits the tools in this directory share. They're linked into each tool, not
+// into the library.
+
+// The whole of the file at "path", which the caller frees, or NULL if it
+// can't be read. "size" receives its length.
+void* readFile(const char* path, size_t* size);
+
+// A handle running the rom at "path", or NULL if it can't be read or loaded
+GyHandle* loadRom(const char* path);
@@ -9,6 +9,7 @@
 
 #include <nds.h>
 #include <nds/fifomessages.h>
+#include <string.h>
 #include <time.h>
 #include "mmu.h"
 #include "console.h"
@@ -112,6 +113,26 @@ void SoundEngine::refresh() {
         handleSoundRegister(0x23, gameboy->readIO(0x23)|0x80);
 }
 
+void SoundEngine::copyState(SoundEngine* s) {
+    // The ARM7 only hears about this when refresh() is called
+    cyclesToSoundEvent = s->cyclesToSoundEvent;
+    chan4FreqRatio = s->chan4FreqRatio;
+    chan1SweepTime = s->chan1SweepTime;
+    chan1SweepCounter = s->chan1SweepCounter;
+    chan1SweepDir = s->chan1SweepDir;
+    chan1SweepAmount = s->chan1SweepAmount;
+    memcpy(chanLen, s->chanLen, sizeof(chanLen));
+    memcpy(chanLenCounter, s->chanLenCounter, sizeof(chanLenCounter));
+    memcpy(chanUseLen, s->chanUseLen, sizeof(chanUseLen));
+    memcpy(chanFreq, s->chanFreq, sizeof(chanFreq));
+    memcpy(chanVol, s->chanVol, sizeof(chanVol));
+    memcpy(chanEnvDir, s->chanEnvDir, sizeof(chanEnvDir));
+    memcpy(chanEnvCounter, s->chanEnvCounter, sizeof(chanEnvCounter));
+    memcpy(chanEnvSweep, s->chanEnvSweep, sizeof(chanEnvSweep));
+    memcpy(pcmVals, s->pcmVals, sizeof(pcmVals));
+    memcpy(sampleData, s->sampleData, 0x20);
+}
+
 void SoundEngine::mute() {
     // sharedPtr accesses won't affect the main soundEngine
     muted = true;
@@ -276,10 +276,14 @@ void handlePacketCommand(int command, u8* data) {
             break;
         case NIFI_CMD_TRANSFER_SRAM:
             {
-                if (nifiLinkType == LINK_SGB)
+                if (nifiLinkType == LINK_SGB) {
                     memcpy(gameboy->externRam, data, gameboy->getNumSramBanks()*0x2000);
-                else if (gb2)
+                    gameboy->markDirtyRange(gameboy->externRam, gameboy->getNumSramBanks()*0x2000);
+                }
+                else if (gb2) {
                     memcpy(gb2->externRam, data, gb2->getNumSramBanks()*0x2000);
+                    gb2->markDirtyRange(gb2->externRam, gb2->getNumSramBanks()*0x2000);
+                }
                 else
                     printLog("GB2 NOT INITIALIZED!\n");
                 printLog("Received SRAM.\n");
@@ -48,6 +48,7 @@ void iprintfColored(int palette, const char* format, ...) {
     vprintf(format, args);
     va_end(args);
 }
+#ifndef ASYNC_LOG
 void printLog(const char* format, ...) {
     va_list args;
     va_start(args, format);
@@ -55,6 +56,7 @@ void printLog(const char* format, ...) {
     vprintf(format, args);
     va_end(args);
 }
+#endif
 
 int checkRumble() {
     return 0;
@@ -5,7 +5,13 @@
 
 #include "gbgfx.h"
 #include "gameboy.h"
+#include "gbmanager.h"
+#include "menu.h"
+#include "telemetry.h"
+#include "pipeline.h"
+#include "shmexport.h"
 #include <math.h>
+#include <stdio.h>
 #include <SDL/SDL.h>
 #include <GL/gl.h>
 
@@ -26,7 +32,9 @@ bool sgbBorderLoaded;
 // private variables
 
 u32 gbColors[4];
-Uint32 pixels[32*32*64];
+TripleBuffer<EmuFrame> emuFrames;
+Uint32* pixels;         // The back buffer of emuFrames
+bool frameDrawn;        // Whether any scanlines went into it
 u8 tileCache[2][0x1800][8][8];
 
 int tileSize;
@@ -76,6 +84,20 @@ bool sprPalettesModified[8];
 
 bool openglInitialized = false;
 
+// For the fps / telemetry overlay, only used by the render thread. It's drawn
+// over a copy so the emulated frame isn't changed.
+Uint32 overlayPixels[256*144];
+
+// 3x5 font, one bit per pixel starting from the top left
+const u16 overlayDigits[] = {
+    0x7b6f, 0x2c97, 0x73e7, 0x73cf, 0x5bc9, 0x79cf, 0x79ef, 0x7249, 0x7bef, 0x7bcf
+};
+const u16 overlayLetters[] = {
+    0x2bed, 0x6bae, 0x3923, 0x6b6e, 0x79a7, 0x79a4, 0x396b, 0x5bed, 0x7497, 0x126a,
+    0x5bad, 0x4927, 0x5fed, 0x6b6d, 0x2b6a, 0x6ba4, 0x2b73, 0x6bad, 0x388e, 0x7492,
+    0x5b6f, 0x5b6a, 0x5bfd, 0x5aad, 0x5a92, 0x72a7
+};
+
 // Private functions
 void drawSprite(int scanline, int spriteNum);
 
@@ -83,6 +105,7 @@ void updateBgPalette(int paletteid);
 void updateBgPaletteDMG();
 void updateSprPalette(int paletteid);
 void updateSprPaletteDMG(int paletteid);
+bool drawOverlay(EmuFrame* frame);
 
 
 // Function definitions
@@ -104,11 +127,14 @@ void initGFX()
         glOrtho(0, 160, 144, 0, -1, 1); //Sets orthographic (2D) projection
 
         glRasterPos2f(0, 0);
-        glPixelZoom(scale, -scale);
+        glPixelZoom(1, -1);     // The render thread scales
 
         SDL_Surface* gbScreen = SDL_CreateRGBSurface(SDL_SWSURFACE, 256*scale, 256*scale, 32, 0, 0, 0, 0);
         format = gbScreen->format;
 
+        pixels = emuFrames.getBack()->pixels;
+        frameDrawn = false;
+
         openglInitialized = true;
     }
 
@@ -154,6 +180,8 @@ void clearGFX() {
 
 void drawScanline(int scanline)
 {
+    frameDrawn = true;
+
     for (int i=0; i<8; i++) {
         if (bgPalettesModified[i]) {
             if (gameboy->gbMode == GB)
@@ -401,29 +429,131 @@ void drawScanline_P2(int scanline) {
 
 }
 
+// Hands the frame to the render thread. Nothing is handed on if nothing was
+// drawn, as when the lcd is off or the emulator is paused, so the last
+// frame stays up.
 void drawScreen()
 {
-    glDrawPixels(256, 144, GL_BGRA, GL_UNSIGNED_BYTE, pixels);
+    if (!frameDrawn)
+        return;
+    frameDrawn = false;
+
+    EmuFrame* frame = emuFrames.getBack();
+    frame->fps = fpsOutput ? lastFps : -1;
+#ifdef TELEMETRY
+    frame->showTelemetry = telemetryOverlay && telemetryActive;
+    if (frame->showTelemetry)
+        telemetryGetSummary(&frame->telemetry);
+#endif
+    shmExportScreen(frame->pixels);
+    emuFrames.publish();
+    pixels = emuFrames.getBack()->pixels;
+}
 
-	SDL_GL_SwapBuffers();
+// Overlay and nearest neighbour scaling, on the render thread
+void renderFrame(EmuFrame* frame, Uint32* dest)
+{
+    Uint32* src = drawOverlay(frame) ? overlayPixels : frame->pixels;
+    int width = 160*scale;
+
+    for (int y=0; y<144; y++) {
+        Uint32* row = dest + y*scale*width;
+        Uint32* out = row;
+        for (int x=0; x<160; x++) {
+            for (int i=0; i<scale; i++)
+                *out++ = src[y*256+x];
+        }
+        for (int i=1; i<scale; i++)
+            memcpy(row+i*width, row, width*sizeof(Uint32));
+    }
+}
 
-	/*
-	Uint32* screenPixels = gbScreen->pixels;
-	int t,x,y;
-	int var;
-	for (t=0; t<256*144; t++)
-	{
-		screenPixels[t] = pixels[t];
-	}
-	SDL_Rect rect;
-	rect.x = 0;
-	rect.y = 0;
-	rect.w = 160*scale;
-	rect.h = 144*scale;
-	SDL_BlitSurface(gbScreen, &rect, screen, NULL);
-	SDL_Flip(screen);*/
+u16 getOverlayGlyph(char c) {
+    if (c >= '0' && c <= '9')
+        return overlayDigits[c-'0'];
+    if (c >= 'a' && c <= 'z')
+        c -= 'a'-'A';
+    if (c >= 'A' && c <= 'Z')
+        return overlayLetters[c-'A'];
+    switch (c) {
+        case '.':
+            return 0x0002;
+        case '%':
+            return 0x52a5;
+        case ':':
+            return 0x0410;
+        case '/':
+            return 0x12a4;
+        case '-':
+            return 0x01c0;
+        default:
+            return 0;
+    }
+}
+
+void shadeOverlay(int x, int y, int w, int h) {
+    for (int j=y; j<y+h && j<144; j++) {
+        for (int i=x; i<x+w && i<160; i++)
+            overlayPixels[j*256+i] = (overlayPixels[j*256+i]>>2) & 0x3f3f3f3f;
+    }
+}
+
+void drawOverlayText(int x, int y, const char* text, Uint32 color) {
+    for (; *text && x < 160; text++, x+=4) {
+        u16 glyph = getOverlayGlyph(*text);
+        for (int row=0; row<5; row++) {
+            for (int col=0; col<3 && x+col<160; col++) {
+                if (glyph & (0x4000>>(row*3+col)))
+                    overlayPixels[(y+row)*256+x+col] = color;
+            }
+        }
+    }
 }
 
+// Returns false if there's nothing to draw
+bool drawOverlay(EmuFrame* frame) {
+    char line[48];
+    Uint32 white = SDL_MapRGB(format, 255, 255, 255);
+
+#ifdef TELEMETRY
+    if (frame->showTelemetry) {
+        TelemetrySummary& summary = frame->telemetry;
+
+        memcpy(overlayPixels, frame->pixels, sizeof(overlayPixels));
+        shadeOverlay(0, 0, 160, 13+NUM_TEL_SUBSYSTEMS*6);
+
+        snprintf(line, sizeof(line), "FPS %.1f  MEAN %.2fMS", summary.fps, summary.mean);
+        drawOverlayText(1, 1, line, white);
+        snprintf(line, sizeof(line), "P50 %.1f P95 %.1f P99 %.1f MAX %.1f",
+                summary.p50, summary.p95, summary.p99, summary.max);
+        drawOverlayText(1, 7, line, white);
+
+        Uint32 barColor = SDL_MapRGB(format, 64, 192, 64);
+        for (int i=0; i<NUM_TEL_SUBSYSTEMS; i++) {
+            int subsystem = (i+1) % NUM_TEL_SUBSYSTEMS; // "other" goes last
+            int y = 13+i*6;
+            snprintf(line, sizeof(line), "%-7s %3d%%", telemetryNames[subsystem], (int)(summary.share[subsystem]+0.5f));
+            drawOverlayText(1, y, line, white);
+
+            int width = (int)summary.share[subsystem];
+            for (int row=y; row<y+5; row++) {
+                for (int x=50; x<50+width && x<160; x++)
+                    overlayPixels[row*256+x] = barColor;
+            }
+        }
+        return true;
+    }
+#endif
+
+    if (frame->fps != -1) {
+        memcpy(overlayPixels, frame->pixels, sizeof(overlayPixels));
+        shadeOverlay(0, 0, 35, 7);
+        snprintf(line, sizeof(line), "FPS %d", frame->fps);
+        drawOverlayText(1, 1, line, white);
+        return true;
+    }
+    return false;
+}
 
 void displayIcon(int iconid) {
 
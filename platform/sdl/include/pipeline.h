@@ -0,0 +1,78 @@
+#pragma once
+#include <atomic>
+#include <SDL.h>
+#ifdef TELEMETRY
+#include "telemetry.h"
+#endif
+
+// The SDL build runs in three threads:
+//  - emulation: mgr_runFrame and mgr_updateVBlank, paced to the gameboy's
+//    frame rate. drawScreen only hands the finished frame on.
+//  - render: draws the overlay and scales the frame up.
+//  - present: the main thread, which owns the window. Shows the newest scaled
+//    frame and turns SDL events into the input state read by the emulator.
+// Each pair of threads shares a TripleBuffer, so none of them ever waits for
+// another; a thread that falls behind just skips frames.
+
+// Three buffers shared by one producer and one consumer. The producer always
+// has a buffer to draw into, and the consumer always gets the newest one that
+// was finished.
+template <typename T>
+class TripleBuffer {
+    public:
+        TripleBuffer() : back(0), middle(1), front(2) {}
+
+        T* getBuffer(int i) { return &buffers[i]; }
+
+        // Producer
+        T* getBack() { return &buffers[back]; }
+        void publish() {
+            back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & 3;
+        }
+
+        // Consumer. Returns false if nothing was published since the last call.
+        bool update() {
+            if (!(middle.load(std::memory_order_relaxed) & FRESH))
+                return false;
+            front = middle.exchange(front, std::memory_order_acq_rel) & 3;
+            return true;
+        }
+        T* getFront() { return &buffers[front]; }
+
+    private:
+        enum { FRESH = 4 };
+
+        T buffers[3];
+        int back;
+        std::atomic<int> middle;
+        int front;
+};
+
+// One emulated frame, 256 pixels wide of which the left 160 are shown, and
+// what the overlay needs to draw over it
+struct EmuFrame {
+    Uint32 pixels[256*144];
+    int fps;                    // -1 if the fps isn't shown
+#ifdef TELEMETRY
+    bool showTelemetry;
+    TelemetrySummary telemetry;
+#endif
+};
+
+struct ScaledFrame {
+    Uint32* pixels;             // 160*scale by 144*scale
+};
+
+extern TripleBuffer<EmuFrame> emuFrames;    // gbgfx.cpp
+
+// gbgfx.cpp, called from the render thread
+void renderFrame(EmuFrame* frame, Uint32* dest);
+
+// inputhelper.cpp, called from the present thread
+void pumpInputEvents();
+
+// Called from the main thread once everything is set up; never returns
+void runPipeline();
+// Called from the emulation thread after it's saved and cleaned up for
+// exiting. Ends the thread, so it never returns.
+void stopEmulationThread();
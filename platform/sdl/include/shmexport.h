@@ -0,0 +1,75 @@
+#pragma once
+#include <stdint.h>
+
+// --shm-export puts the running gameboy in a POSIX shared memory segment, so
+// bots, trackers and stream overlays on the same machine can read it instead
+// of scraping the screen. The gameboy's arena is allocated in the segment, so
+// its memory is shared as it runs rather than copied out.
+//
+// The segment starts with a ShmExportHeader; every offset in it is from the
+// start of the segment. "sequence" is a seqlock: it's odd while a frame is
+// running and memory is changing, and goes up by 2 each frame. Between frames
+// (most of each 1/60th of a second, except in fast forward) it's even and
+// nothing changes. To get a consistent view:
+//
+//   do {
+//       seq = __atomic_load_n(&header->sequence, __ATOMIC_ACQUIRE);
+//       ... copy out what you need ...
+//       __atomic_thread_fence(__ATOMIC_ACQUIRE);
+//   } while ((seq & 1) || seq != __atomic_load_n(&header->sequence, __ATOMIC_RELAXED));
+//
+// The screen is the one thing copied in, and only while someone is reading:
+// write the frame number you last read to "readerFrame" to keep it coming.
+
+#define SHM_EXPORT_MAGIC    "GYSHM"
+#define SHM_EXPORT_VERSION  1
+#define SHM_EXPORT_DEFAULT_NAME "/gameyob"
+
+// Frames the screen keeps being copied after a reader last wrote readerFrame
+#define SHM_READER_TIMEOUT  60
+
+struct ShmExportHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t size;              // Of the whole segment
+
+    uint32_t sequence;
+    uint32_t readerFrame;       // Written by readers
+
+    // Fixed
+    uint32_t screenOffset;      // 256*144 pixels of 0xAARRGGBB; the left 160 of each row show
+    uint32_t vramOffset;        // 2 banks of 0x2000
+    uint32_t wramOffset;        // 8 banks of 0x1000
+    uint32_t oamOffset;         // fe00-fe9f
+    uint32_t ioOffset;          // ff00-ff7f
+    uint32_t hramOffset;        // ff80-ffff
+    uint32_t sramOffset;        // Cartridge ram
+
+    // As of the end of the last frame
+    uint32_t frame;             // Frames since the export started
+    uint32_t screenFrame;       // The frame the screen is from
+    uint32_t sramSize;          // 0 if the cartridge has no ram
+    uint16_t af, bc, de, hl, sp, pc;
+    uint16_t romBank;
+    uint8_t ly;
+    uint8_t sramBank;
+    uint8_t wramBank;
+    uint8_t vramBank;
+    uint8_t doubleSpeed;
+};
+
+#ifdef __cplusplus
+class Gameboy;
+
+// Exports "gb" under "name" from here on. False if the segment couldn't be
+// made.
+bool shmExportStart(const char* name, Gameboy* gb);
+// Removes the name; the emulator and readers keep what they've mapped
+void shmExportStop();
+
+// The emulation thread brackets each frame with these
+void shmExportBeginFrame();
+void shmExportEndFrame();
+// From drawScreen, with the finished frame
+void shmExportScreen(const uint32_t* pixels);
+#endif
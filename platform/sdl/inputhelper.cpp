@@ -5,6 +5,7 @@
 #include <string.h>
 #include <dirent.h>
 #include <unistd.h>
+#include <atomic>
 
 #include "inputhelper.h"
 #include "gameboy.h"
@@ -20,10 +21,18 @@
 #include "romfile.h"
 #include "io.h"
 #include "gbmanager.h"
+#include "pipeline.h"
 
 bool keysPressed[512];
 bool keysJustPressed[512];
 
+// Written by the present thread, which gets the SDL events, and read by the
+// emulation thread in system_checkPolls. A key pressed and released between
+// two polls still shows up in keysJustPressed.
+static std::atomic<u32> hostKeysHeld[512/32];
+static std::atomic<u32> hostKeysHit[512/32];
+static std::atomic<bool> quitRequested(false);
+
 int keysForceReleased=0;
 int repeatStartTimer=0;
 int repeatTimer=0;
@@ -106,31 +115,48 @@ int system_getMotionSensorY() {
     return 0;
 }
 
-void system_checkPolls() {
-    memset(keysJustPressed, 0, sizeof(keysJustPressed));
-
+void pumpInputEvents() {
     SDL_Event event;
     while (SDL_PollEvent(&event))
     {
+        // Only key events have a key
+        int key;
         switch (event.type)
         {
             case SDL_QUIT:
-                mgr_save();
-                mgr_exit();
+                quitRequested = true;
+                break;
+            case SDL_KEYDOWN:
+                key = event.key.keysym.sym;
+                hostKeysHeld[key/32].fetch_or(1u<<(key%32), std::memory_order_relaxed);
+                hostKeysHit[key/32].fetch_or(1u<<(key%32), std::memory_order_relaxed);
+                break;
+            case SDL_KEYUP:
+                key = event.key.keysym.sym;
+                hostKeysHeld[key/32].fetch_and(~(1u<<(key%32)), std::memory_order_relaxed);
+                break;
+        }
+    }
+}
+
+void system_checkPolls() {
+    if (quitRequested.load()) {
+        mgr_save();
+        mgr_exit();
 #ifdef LOG
-				fclose(logFile);
+        fclose(logFile);
 #endif
-                exit(0);
-				break;
-			case SDL_KEYDOWN:
-                keysPressed[event.key.keysym.sym] = true;
-                keysJustPressed[event.key.keysym.sym] = true;
-				break;
-			case SDL_KEYUP:
-                keysPressed[event.key.keysym.sym] = false;
-				break;
-		}
-	}
+        stopEmulationThread();
+    }
+
+    for (int i=0; i<512/32; i++) {
+        u32 held = hostKeysHeld[i].load(std::memory_order_relaxed);
+        u32 hit = hostKeysHit[i].exchange(0, std::memory_order_relaxed);
+        for (int j=0; j<32; j++) {
+            keysPressed[i*32+j] = held & (1u<<j);
+            keysJustPressed[i*32+j] = hit & (1u<<j);
+        }
+    }
 }
 
 void system_waitForVBlank() {
@@ -1,5 +1,7 @@
 #include <SDL/SDL.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "gbgfx.h"
 #include "soundengine.h"
 #include "inputhelper.h"
@@ -9,14 +11,141 @@
 #include "romfile.h"
 #include "menu.h"
 #include "gbmanager.h"
+#include "pipeline.h"
+#include "nifi.h"
+#include "shmexport.h"
+#ifdef CPU_PROFILE
+#include "profiler.h"
+#endif
+#ifdef MEM_PROFILE
+#include "memprofile.h"
+#endif
+#ifdef TELEMETRY
+#include "telemetry.h"
+#endif
+#ifdef CHROME_TRACE
+#include "trace.h"
+#endif
 
 extern int scale;
 
 SDL_Surface* screen;
 
 
+void printUsage(const char* program) {
+    printf("Usage: %s [options] rom\n", program);
+    printf("  --link-host=addr    Wait for another GameYob to link with, on [host:]port or a unix socket\n");
+    printf("  --link-connect=addr Link with another GameYob waiting on addr\n");
+    printf("  --shm-export[=name] Share the gameboy's memory and screen with other programs, as %s by default\n", SHM_EXPORT_DEFAULT_NAME);
+#ifdef CPU_PROFILE
+    printf("  --profile           Profile emulated code, report written to <rom>.prof\n");
+    printf("  --profile-by-count  Sort the profile by instruction count instead of cycles\n");
+#endif
+#ifdef MEM_PROFILE
+    printf("  --memprofile        Count memory accesses, written to <rom>.mem.csv and <rom>.mem.txt\n");
+#endif
+#ifdef TELEMETRY
+    printf("  --telemetry         Time each subsystem, written to <rom>.telemetry.csv and .json\n");
+    printf("  --telemetry-overlay Same, and show frame times over the game screen\n");
+#endif
+#ifdef CHROME_TRACE
+    printf("  --trace[=file]      Record a timeline in Chrome trace format, to <rom>.trace.json by default\n");
+#endif
+#ifdef ASYNC_LOG
+    printf("  --log-level=level   Lowest level to log: debug, info (default), warning, error or none\n");
+#endif
+}
+
+#ifdef ASYNC_LOG
+bool setLogLevel(const char* name) {
+    const char* names[] = { "debug", "info", "warning", "error", "none" };
+    for (int i=0; i<=LOG_LEVEL_NONE; i++) {
+        if (strcmp(name, names[i]) == 0) {
+            logLevel = i;
+            return true;
+        }
+    }
+    return false;
+}
+#endif
+
 int main(int argc, char* argv[])
 {
+    char* filename = NULL;
+    const char* linkHost = NULL;
+    const char* linkConnect = NULL;
+    const char* shmName = NULL;
+#ifdef ASYNC_LOG
+    startAsyncLog();
+    atexit(stopAsyncLog);
+#endif
+    for (int i=1; i<argc; i++) {
+        if (strncmp(argv[i], "--link-host=", 12) == 0) {
+            linkHost = argv[i]+12;
+            continue;
+        }
+        if (strncmp(argv[i], "--link-connect=", 15) == 0) {
+            linkConnect = argv[i]+15;
+            continue;
+        }
+        if (strcmp(argv[i], "--shm-export") == 0) {
+            shmName = SHM_EXPORT_DEFAULT_NAME;
+            continue;
+        }
+        if (strncmp(argv[i], "--shm-export=", 13) == 0) {
+            shmName = argv[i]+13;
+            continue;
+        }
+#ifdef CPU_PROFILE
+        if (strcmp(argv[i], "--profile") == 0) {
+            cpuProfilerEnabled = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--profile-by-count") == 0) {
+            cpuProfilerEnabled = true;
+            cpuProfilerByCount = true;
+            continue;
+        }
+#endif
+#ifdef MEM_PROFILE
+        if (strcmp(argv[i], "--memprofile") == 0) {
+            memProfilerEnabled = true;
+            continue;
+        }
+#endif
+#ifdef TELEMETRY
+        if (strcmp(argv[i], "--telemetry") == 0) {
+            telemetryEnabled = true;
+            continue;
+        }
+        if (strcmp(argv[i], "--telemetry-overlay") == 0) {
+            telemetryEnabled = true;
+            telemetryOverlay = true;
+            continue;
+        }
+#endif
+#ifdef CHROME_TRACE
+        if (strcmp(argv[i], "--trace") == 0) {
+            traceEnabled = true;
+            continue;
+        }
+        if (strncmp(argv[i], "--trace=", 8) == 0) {
+            traceEnabled = true;
+            strncpy(traceFilename, argv[i]+8, MAX_FILENAME_LEN-1);
+            continue;
+        }
+#endif
+#ifdef ASYNC_LOG
+        if (strncmp(argv[i], "--log-level=", 12) == 0 && setLogLevel(argv[i]+12))
+            continue;
+#endif
+        if (argv[i][0] == '-') {
+            printUsage(argv[0]);
+            return 1;
+        }
+        filename = argv[i];
+    }
+
 	if (SDL_Init(SDL_INIT_EVERYTHING) == -1)
 		return 1;
 
@@ -38,25 +167,30 @@ int main(int argc, char* argv[])
 	SDL_WM_SetCaption("GameYob", NULL);
 
     mgr_init();
+    if (shmName != NULL) {
+        if (!shmExportStart(shmName, gameboy))
+            return 1;
+        atexit(shmExportStop);
+    }
 
 	initInput();
     setMenuDefaults();
     readConfigFile();
     initGFX();
 
-    if (argc >= 2) {
-        char* filename = argv[1];
+    if (filename != NULL) {
         mgr_loadRom(filename);
+        if (linkHost != NULL && !nifiHost(linkHost))
+            return 1;
+        if (linkConnect != NULL && !nifiConnect(linkConnect))
+            return 1;
     }
     else {
         printf("Give me a gameboy rom pls\n");
         return 1;
     }
 
-    for (;;) {
-        mgr_runFrame();
-        mgr_updateVBlank();
-    }
+    runPipeline();
 
 	return 0;
 }
@@ -1,22 +1,803 @@
+// The link cable between two GameYob processes, over a socket. It stands in
+// for the DS's nifi link; see nifiHost and nifiConnect.
+//
+// Neither side stops to wait for the other on each byte. Each clock pulse is
+// stamped with the cycle it happened on, counted from when the two linked
+// ("link time"), and both Gameboys run on guessing what the other side did:
+// the side whose clock sent a byte guesses what comes back, and the side
+// with the external clock guesses that no pulse arrived. When a message shows
+// that a guess was wrong, the Gameboy goes back to the last frame that started
+// before the mistake, from copies of the last LINK_HISTORY frames, and runs
+// the frames since again, this time with the right bytes. Between two
+// processes on one machine that's rarely more than a frame or two.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <vector>
+#include "nifi.h"
+#include "gameboy.h"
+#include "gbgfx.h"
+#include "gbmanager.h"
+#include "menu.h"
+#include "romfile.h"
+#include "timer.h"
+#include "console.h"
+#include "hosttime.h"
+
 volatile int linkReceivedData;
 volatile int linkSendData;
 volatile bool transferWaiting;
-volatile bool transferReady;
 volatile bool receivedPacket;
 volatile int nifiSendid;
 bool nifiEnabled;
 
-void enableNifi() {}
-void disableNifi() {}
+#define LINK_MAGIC          0x4c424f59  // "YOBL"
+#define LINK_VERSION        1
+#define LINK_HISTORY        32          // Frames that can be gone back over
+// How far one side may get ahead of the other, in link time. A wrong guess
+// can't be older than this, plus a little for messages still on the way.
+#define LINK_MAX_AHEAD      (8*CYCLES_PER_FRAME)
+#define LINK_TIMEOUT_MS     10000       // Silence before giving up on the other side
+#define LINK_CONNECT_MS     10000       // How long nifiConnect keeps trying
+#define NO_ROLLBACK         INT64_MAX
+
+enum LinkCmd {
+    LINK_CMD_HELLO=0,   // u32 magic, u8 version, 16 bytes of rom title
+    LINK_CMD_TIME,      // s64 link time: the sender is at least this far
+    LINK_CMD_CLOCK,     // u32 id, s64 stamp, u8 byte: the sender's clock sent a byte
+    LINK_CMD_REVISE,    // u32 id: the sender's clocks from this one on didn't happen
+    LINK_CMD_REPLY,     // u32 id, u8 byte: what a clock got back
+    LINK_CMD_WAITING,   // u8 byte: what a clock from now on is likely to get back
+
+    LINK_CMD_MAX
+};
+// Not counting the command byte
+const int linkCmdSizes[] = { 21, 8, 13, 4, 5, 1 };
+
+// A byte our clock sent
+struct SentClock {
+    u32 id;
+    s64 stamp;
+    u8 val;
+    int reply;      // -1 until the other side says
+    u8 used;        // What the Gameboy was given
+};
+
+// A byte the other side's clock sent
+struct ReceivedClock {
+    u32 id;
+    s64 stamp;
+    u8 val;
+    bool applied;   // The Gameboy has got to it
+    int sentReply;  // -1 until a reply was sent
+};
+
+// The start of a frame, after the input for it was read
+struct LinkFrame {
+    Gameboy* snapshot;
+    s64 start;
+    u8 buttons;
+    bool checkedInput;
+    time_t rawTime;
+};
+
+static u8 linkTransfer(void* data, u8 val);
+static u8 linkClocked(void* data, u8 val);
+
+static const LinkCable socketCable = {
+    linkTransfer,
+    linkClocked,
+};
+
+static int linkSocket = -1;
+static bool linkIsHost;
+static u64 linkOrigin;          // totalCycles at link time 0
+static RomFile* linkRom;
+static std::vector<u8> sendBuffer;
+static std::vector<u8> receiveBuffer;
+static u64 lastReceiveTime;
+
+static s64 remoteTime;
+static u8 remoteWaiting;        // From LINK_CMD_WAITING
+static int sentWaiting;
+
+static std::vector<SentClock> sentClocks;
+// While frames are being run again, the first clock that hasn't happened
+// again yet. Otherwise sentClocks.size().
+static size_t sentCursor;
+static u32 nextClockId;
+// What came back for the clocks that reviseSentClocks dropped, in order. The
+// clocks that replace them most likely get the same.
+static std::vector<u8> predictions;
+static size_t nextPrediction;
+static std::vector<ReceivedClock> receivedClocks;
+
+static LinkFrame history[LINK_HISTORY];
+static int frameNum;            // Frames since linking; history holds the last ones
+static Gameboy* replayGb;       // Where frames are run again
+
+
+static s64 linkTime(Gameboy* gb) {
+    return (s64)(gb->totalCycles - linkOrigin);
+}
+
+static void putInt(u64 val, int bytes) {
+    for (int i=0; i<bytes; i++)
+        sendBuffer.push_back((val >> (i*8)) & 0xff);
+}
+
+static u64 getInt(const u8* ptr, int bytes) {
+    u64 val = 0;
+    for (int i=0; i<bytes; i++)
+        val |= (u64)ptr[i] << (i*8);
+    return val;
+}
+
+
+// Messages are kept in sendBuffer until flushMessages
+
+static void sendTime(s64 time) {
+    sendBuffer.push_back(LINK_CMD_TIME);
+    putInt(time, 8);
+}
+
+static void sendClock(SentClock* clock) {
+    sendBuffer.push_back(LINK_CMD_CLOCK);
+    putInt(clock->id, 4);
+    putInt(clock->stamp, 8);
+    putInt(clock->val, 1);
+}
+
+static void sendRevise(u32 id) {
+    sendBuffer.push_back(LINK_CMD_REVISE);
+    putInt(id, 4);
+}
+
+static void sendReply(u32 id, u8 val) {
+    sendBuffer.push_back(LINK_CMD_REPLY);
+    putInt(id, 4);
+    putInt(val, 1);
+}
+
+static void sendWaiting(u8 val) {
+    sendBuffer.push_back(LINK_CMD_WAITING);
+    putInt(val, 1);
+}
+
+// Reads whatever has arrived into receiveBuffer. False if the link is gone.
+static bool receiveMessages() {
+    u8 buffer[4096];
+    for (;;) {
+        ssize_t len = recv(linkSocket, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (len > 0) {
+            receiveBuffer.insert(receiveBuffer.end(), buffer, buffer+len);
+            lastReceiveTime = getMilliseconds();
+            continue;
+        }
+        if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return true;
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len == 0)
+            printLog("Link closed by the other side\n");
+        else
+            printLog("Link error: %s\n", strerror(errno));
+        return false;
+    }
+}
+
+// Sends everything in sendBuffer, reading while the socket is full so that
+// both sides can't block on each other. False if the link is gone.
+static bool flushMessages() {
+    size_t pos = 0;
+    while (pos < sendBuffer.size()) {
+        ssize_t len = send(linkSocket, &sendBuffer[pos], sendBuffer.size()-pos,
+                MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (len > 0) {
+            pos += len;
+            continue;
+        }
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            printLog("Link error: %s\n", strerror(errno));
+            return false;
+        }
+        struct pollfd pfd = { linkSocket, POLLIN | POLLOUT, 0 };
+        poll(&pfd, 1, 100);
+        if ((pfd.revents & POLLIN) && !receiveMessages())
+            return false;
+        if (getMilliseconds() - lastReceiveTime > LINK_TIMEOUT_MS) {
+            printLog("Link timed out\n");
+            return false;
+        }
+    }
+    sendBuffer.clear();
+    return true;
+}
+
+
+// Sets cycleToSerialTransfer for the other side's next clock. cycleCount
+// starts again from 0 each frame, so this is done at the start of each.
+static void scheduleClock(Gameboy* gb) {
+    gb->cycleToSerialTransfer = -1;
+    for (size_t i=0; i<receivedClocks.size(); i++) {
+        if (!receivedClocks[i].applied) {
+            s64 wait = receivedClocks[i].stamp - linkTime(gb);
+            gb->cycleToSerialTransfer = gb->cycleCount + (wait > 0 ? (int)wait : 0);
+            return;
+        }
+    }
+}
+
+// Drops the clocks that happened before a rollback but not after it
+static void reviseSentClocks() {
+    if (sentCursor < sentClocks.size()) {
+        for (size_t i=sentCursor; i<sentClocks.size(); i++) {
+            SentClock* clock = &sentClocks[i];
+            predictions.push_back(clock->reply != -1 ? clock->reply : clock->used);
+        }
+        sendRevise(sentClocks[sentCursor].id);
+        sentClocks.resize(sentCursor);
+    }
+}
+
+// Our clock finished a byte
+static u8 linkTransfer(void* data, u8 val) {
+    s64 stamp = linkTime((Gameboy*)data);
+
+    if (sentCursor < sentClocks.size()) {
+        SentClock* clock = &sentClocks[sentCursor];
+        if (clock->stamp == stamp && clock->val == val) {
+            // The same byte as the first time round, so the other side
+            // doesn't need to hear about it again
+            sentCursor++;
+            if (clock->reply != -1)
+                clock->used = clock->reply;
+            return clock->used;
+        }
+        reviseSentClocks();
+    }
+
+    SentClock clock;
+    clock.id = nextClockId++;
+    clock.stamp = stamp;
+    clock.val = val;
+    clock.reply = -1;
+    if (nextPrediction < predictions.size())
+        clock.used = predictions[nextPrediction++];
+    else
+        clock.used = remoteWaiting;
+    sentClocks.push_back(clock);
+    sentCursor = sentClocks.size();
+    sendClock(&clock);
+    return clock.used;
+}
+
+// The other side's clock reached us
+static u8 linkClocked(void* data, u8 val) {
+    u8 received = 0xff;
+    for (size_t i=0; i<receivedClocks.size(); i++) {
+        ReceivedClock* clock = &receivedClocks[i];
+        if (!clock->applied) {
+            clock->applied = true;
+            if (clock->sentReply != val) {
+                sendReply(clock->id, val);
+                clock->sentReply = val;
+            }
+            received = clock->val;
+            break;
+        }
+    }
+    scheduleClock((Gameboy*)data);
+    return received;
+}
+
+// Handles the complete messages in receiveBuffer. "now" is the link time of
+// the frame about to start. Returns the link time that must be gone back to
+// before, or NO_ROLLBACK.
+static s64 handleMessages(s64 now) {
+    s64 rollbackTime = NO_ROLLBACK;
+    size_t pos = 0;
+    while (pos < receiveBuffer.size()) {
+        u8 command = receiveBuffer[pos];
+        if (command >= LINK_CMD_MAX) {
+            printLog("Link error: bad message %d\n", command);
+            nifiStop();
+            return NO_ROLLBACK;
+        }
+        if (pos+1+linkCmdSizes[command] > receiveBuffer.size())
+            break;
+        const u8* msg = &receiveBuffer[pos+1];
+        pos += 1+linkCmdSizes[command];
+
+        switch(command) {
+            case LINK_CMD_TIME:
+                remoteTime = getInt(msg, 8);
+                break;
+            case LINK_CMD_CLOCK:
+                {
+                    ReceivedClock clock;
+                    clock.id = getInt(msg, 4);
+                    clock.stamp = getInt(msg+4, 8);
+                    clock.val = msg[12];
+                    clock.applied = false;
+                    clock.sentReply = -1;
+                    receivedClocks.push_back(clock);
+                    // Too late; we guessed it didn't happen
+                    if (clock.stamp <= now && clock.stamp < rollbackTime)
+                        rollbackTime = clock.stamp;
+                    break;
+                }
+            case LINK_CMD_REVISE:
+                {
+                    u32 id = getInt(msg, 4);
+                    size_t first = 0;
+                    while (first < receivedClocks.size() && receivedClocks[first].id < id)
+                        first++;
+                    for (size_t i=first; i<receivedClocks.size(); i++) {
+                        ReceivedClock* clock = &receivedClocks[i];
+                        if (clock->applied && clock->stamp < rollbackTime)
+                            rollbackTime = clock->stamp;
+                    }
+                    receivedClocks.resize(first);
+                    break;
+                }
+            case LINK_CMD_REPLY:
+                {
+                    u32 id = getInt(msg, 4);
+                    for (size_t i=0; i<sentClocks.size(); i++) {
+                        SentClock* clock = &sentClocks[i];
+                        if (clock->id == id) {
+                            clock->reply = msg[4];
+                            if (clock->used != clock->reply && clock->stamp < rollbackTime)
+                                rollbackTime = clock->stamp;
+                            break;
+                        }
+                    }
+                    break;
+                }
+            case LINK_CMD_WAITING:
+                remoteWaiting = msg[0];
+                break;
+            default:
+                break;
+        }
+    }
+    receiveBuffer.erase(receiveBuffer.begin(), receiveBuffer.begin()+pos);
+    return rollbackTime;
+}
+
+
+static LinkFrame* getFrame(int num) {
+    return &history[num % LINK_HISTORY];
+}
+
+static void takeSnapshot(LinkFrame* frame, Gameboy* gb) {
+    if (frame->snapshot == NULL)
+        frame->snapshot = gb->clone();
+    else
+        frame->snapshot->copyFrom(gb);
+}
+
+// Notes what mgr_updateVBlank did to the Gameboy before this frame
+static void recordFrame(LinkFrame* frame) {
+    frame->start = linkTime(gameboy);
+    frame->buttons = gameboy->controllers[0];
+    frame->checkedInput = !isMenuOn() && !probingForBorder;
+    frame->rawTime = rawTime;
+}
+
+// Does to gb what mgr_updateVBlank did before the frame
+static void replayFrameInput(LinkFrame* frame, Gameboy* gb) {
+    gb->controllers[0] = frame->buttons;
+    if (frame->checkedInput)
+        gb->checkInput();
+    rawTime = frame->rawTime;
+}
+
+// Goes back to the last frame that started before "time", and runs the
+// frames since then again, up to the start of the current one
+static void rollBack(s64 time) {
+    int oldest = frameNum >= LINK_HISTORY ? frameNum-LINK_HISTORY+1 : 0;
+    int num = frameNum;
+    while (num >= oldest && getFrame(num)->start >= time)
+        num--;
+    if (num < oldest) {
+        printLog("Link lost sync: a byte came %d frames late\n", frameNum-oldest);
+        nifiStop();
+        return;
+    }
+
+#ifdef LINK_DEBUG
+    printLogAt(LOG_LEVEL_DEBUG, "Link: went back %d frames\n", frameNum-num);
+#endif
+    LinkFrame* frame = getFrame(num);
+    for (size_t i=0; i<receivedClocks.size(); i++) {
+        if (receivedClocks[i].stamp > frame->start)
+            receivedClocks[i].applied = false;
+    }
+    sentCursor = 0;
+    while (sentCursor < sentClocks.size() && sentClocks[sentCursor].stamp <= frame->start)
+        sentCursor++;
+
+    replayGb->copyFrom(frame->snapshot);
+    rawTime = frame->rawTime;
+    for (;;) {
+        scheduleClock(replayGb);
+        int ret = 0;
+        while (!(ret & RET_VBLANK))
+            ret |= replayGb->runEmul();
+        replayGb->cycleCount = 0;
+
+        frame = getFrame(++num);
+        replayFrameInput(frame, replayGb);
+        if (num == frameNum)
+            break;
+        frame->start = linkTime(replayGb);
+        takeSnapshot(frame, replayGb);
+    }
+    reviseSentClocks();
+    predictions.clear();
+    nextPrediction = 0;
+
+    gameboy->restoreFrom(replayGb);
+    frame->start = linkTime(gameboy);
+}
+
+// Forgets clocks that can't be gone back to any more
+static void pruneClocks() {
+    int oldest = frameNum >= LINK_HISTORY ? frameNum-LINK_HISTORY+1 : 0;
+    s64 start = getFrame(oldest)->start;
+
+    size_t count = 0;
+    while (count < sentClocks.size() && sentClocks[count].stamp < start &&
+            sentClocks[count].reply == sentClocks[count].used)
+        count++;
+    sentClocks.erase(sentClocks.begin(), sentClocks.begin()+count);
+    sentCursor = sentClocks.size();
+
+    count = 0;
+    while (count < receivedClocks.size() && receivedClocks[count].stamp < start &&
+            receivedClocks[count].applied)
+        count++;
+    receivedClocks.erase(receivedClocks.begin(), receivedClocks.begin()+count);
+}
+
+
+static bool writeAll(int fd, const u8* data, int len) {
+    while (len > 0) {
+        ssize_t written = send(fd, data, len, MSG_NOSIGNAL);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return false;
+        data += written;
+        len -= written;
+    }
+    return true;
+}
+
+static bool readAll(int fd, u8* data, int len, int timeoutMs) {
+    u64 deadline = getMilliseconds() + timeoutMs;
+    while (len > 0) {
+        u64 now = getMilliseconds();
+        if (now >= deadline)
+            return false;
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        if (poll(&pfd, 1, deadline-now) <= 0)
+            continue;
+        ssize_t got = recv(fd, data, len, 0);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return false;
+        data += got;
+        len -= got;
+    }
+    return true;
+}
+
+static void getHello(u8* hello) {
+    hello[0] = LINK_CMD_HELLO;
+    for (int i=0; i<4; i++)
+        hello[1+i] = (LINK_MAGIC >> (i*8)) & 0xff;
+    hello[5] = LINK_VERSION;
+    const char* title = gameboy->getRomFile()->getRomTitle();
+    memset(hello+6, 0, 16);
+    memcpy(hello+6, title, strnlen(title, 16));
+}
+
+// Takes over "fd" once it's connected
+static bool startLink(int fd, bool host) {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)); // Fails harmlessly on unix sockets
+
+    u8 hello[1+21], remoteHello[1+21];
+    getHello(hello);
+    if (!writeAll(fd, hello, sizeof(hello)) || !readAll(fd, remoteHello, sizeof(remoteHello), LINK_TIMEOUT_MS)) {
+        printLog("The other side didn't answer\n");
+        close(fd);
+        return false;
+    }
+    if (memcmp(remoteHello, hello, 5) != 0 || remoteHello[5] != LINK_VERSION) {
+        printLog("The other side isn't a GameYob this one can link to\n");
+        close(fd);
+        return false;
+    }
+    if (memcmp(remoteHello+6, hello+6, 16) != 0)
+        printLog("Linked to a different game, %.16s\n", (char*)remoteHello+6);
+    else
+        printLog("Linked\n");
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    linkSocket = fd;
+    linkIsHost = host;
+    linkOrigin = gameboy->totalCycles;
+    linkRom = gameboy->getRomFile();
+    lastReceiveTime = getMilliseconds();
+    remoteTime = 0;
+    remoteWaiting = 0xff;
+    sentWaiting = -1;
+    sentCursor = 0;
+    nextClockId = 0;
+
+    gameboy->setLinkCable(&socketCable, gameboy);
+    gameboy->cycleToSerialTransfer = -1;
+    replayGb = gameboy->clone();
+    replayGb->setLinkCable(&socketCable, replayGb);
+
+    frameNum = 0;
+    recordFrame(getFrame(0));
+    takeSnapshot(getFrame(0), gameboy);
+    return true;
+}
+
+// An address with a '/' in it is a unix socket. Otherwise it's
+// [host:]port, on localhost if no host is given.
+static bool getAddress(const char* address, struct sockaddr_storage* addr, socklen_t* len) {
+    memset(addr, 0, sizeof(*addr));
+    if (strchr(address, '/') != NULL) {
+        struct sockaddr_un* un = (struct sockaddr_un*)addr;
+        if (strlen(address) >= sizeof(un->sun_path))
+            return false;
+        un->sun_family = AF_UNIX;
+        strcpy(un->sun_path, address);
+        *len = sizeof(struct sockaddr_un);
+        return true;
+    }
+
+    char host[256] = "localhost";
+    const char* port = strrchr(address, ':');
+    if (port != NULL) {
+        // Brackets around ipv6 addresses are left off
+        const char* start = address;
+        const char* end = port;
+        if (*start == '[' && end > start && *(end-1) == ']') {
+            start++;
+            end--;
+        }
+        if (end-start >= (int)sizeof(host))
+            return false;
+        memcpy(host, start, end-start);
+        host[end-start] = '\0';
+        port++;
+    }
+    else
+        port = address;
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* result;
+    if (getaddrinfo(host, port, &hints, &result) != 0)
+        return false;
+    memcpy(addr, result->ai_addr, result->ai_addrlen);
+    *len = result->ai_addrlen;
+    freeaddrinfo(result);
+    return true;
+}
+
+bool nifiHost(const char* address) {
+    nifiStop();
+    struct sockaddr_storage addr;
+    socklen_t len;
+    if (!getAddress(address, &addr, &len)) {
+        printLog("Bad link address: %s\n", address);
+        return false;
+    }
+
+    int listener = socket(addr.ss_family, SOCK_STREAM, 0);
+    if (listener < 0) {
+        printLog("Couldn't listen on %s: %s\n", address, strerror(errno));
+        return false;
+    }
+    const char* path = NULL;
+    if (addr.ss_family == AF_UNIX) {
+        // A socket left behind by a GameYob that didn't get to remove it
+        path = ((struct sockaddr_un*)&addr)->sun_path;
+        struct stat st;
+        if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+            unlink(path);
+    }
+    else {
+        int one = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    }
+    if (bind(listener, (struct sockaddr*)&addr, len) != 0 || listen(listener, 1) != 0) {
+        printLog("Couldn't listen on %s: %s\n", address, strerror(errno));
+        close(listener);
+        return false;
+    }
+
+    printLog("Waiting for the other GameYob on %s\n", address);
+    int fd;
+    do {
+        fd = accept(listener, NULL, NULL);
+    } while (fd < 0 && errno == EINTR);
+    int error = errno;
+    close(listener);
+    if (path != NULL)
+        unlink(path);
+    if (fd < 0) {
+        printLog("Couldn't link on %s: %s\n", address, strerror(error));
+        return false;
+    }
+    return startLink(fd, true);
+}
+
+bool nifiConnect(const char* address) {
+    nifiStop();
+    struct sockaddr_storage addr;
+    socklen_t len;
+    if (!getAddress(address, &addr, &len)) {
+        printLog("Bad link address: %s\n", address);
+        return false;
+    }
+
+    // The other side may not be listening yet
+    u64 deadline = getMilliseconds() + LINK_CONNECT_MS;
+    for (;;) {
+        int fd = socket(addr.ss_family, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, (struct sockaddr*)&addr, len) == 0)
+            return startLink(fd, false);
+        int error = errno;
+        if (fd >= 0)
+            close(fd);
+        if ((error != ECONNREFUSED && error != ENOENT) || getMilliseconds() >= deadline) {
+            printLog("Couldn't connect to %s: %s\n", address, strerror(error));
+            return false;
+        }
+        usleep(100000);
+    }
+}
+
+
+void enableNifi() {
+    nifiEnabled = true;
+}
+void disableNifi() {
+    nifiStop();
+    nifiEnabled = false;
+}
+
+// The DS's packets aren't used here
+int nifiSendPacket(u8 command, u8* data, u32 dataLen, bool acknowledge) {
+    return 0;
+}
+
+void nifiStop() {
+    if (linkSocket == -1)
+        return;
+    close(linkSocket);
+    linkSocket = -1;
+
+    // Whatever was guessed last stays, as if the cable was pulled out
+    gameboy->setLinkCable(NULL, NULL);
+    gameboy->cycleToSerialTransfer = -1;
+    delete replayGb;
+    replayGb = NULL;
+    for (int i=0; i<LINK_HISTORY; i++) {
+        delete history[i].snapshot;
+        history[i].snapshot = NULL;
+    }
+    sentClocks.clear();
+    receivedClocks.clear();
+    predictions.clear();
+    nextPrediction = 0;
+    sendBuffer.clear();
+    receiveBuffer.clear();
+}
+
+// There's no menu for it; see the --link options
+void nifiInterLinkMenu() {
+    printLog("Start GameYob with --link-host or --link-connect to link\n");
+}
+
+bool nifiIsHost() {
+    return linkSocket != -1 && linkIsHost;
+}
+bool nifiIsClient() {
+    return linkSocket != -1 && !linkIsHost;
+}
+bool nifiIsLinked() {
+    return linkSocket != -1;
+}
+
+// The link keeps running while paused; the other side just gets ahead and
+// waits
+void nifiPause() {}
+void nifiUnpause() {}
+
+// Called between frames, after mgr_updateVBlank. Fixes any wrong guesses,
+// keeps the two sides within LINK_MAX_AHEAD of each other, and sends what
+// happened during the frame.
+void nifiUpdateInput() {
+    if (linkSocket == -1)
+        return;
+    if (gameboy->getRomFile() != linkRom) {
+        printLog("Link closed: another rom was loaded\n");
+        nifiStop();
+        return;
+    }
+
+    s64 now = linkTime(gameboy);
+    if (now != getFrame(frameNum)->start)
+        frameNum++;
+    recordFrame(getFrame(frameNum));
+
+    for (;;) {
+        if (!receiveMessages()) {
+            nifiStop();
+            return;
+        }
+        s64 rollbackTime = handleMessages(now);
+        if (rollbackTime != NO_ROLLBACK)
+            rollBack(rollbackTime);
+        if (linkSocket == -1)
+            return;
+        now = linkTime(gameboy);
 
-void nifiSendPacket(u8 command, u8* data, int dataLen) {}
+        if (now - remoteTime <= LINK_MAX_AHEAD)
+            break;
 
-void nifiHostMenu(int value) {}
-void nifiClientMenu(int value) {}
+        // Too far ahead; wait for the other side to catch up
+        sendTime(now);
+        if (!flushMessages()) {
+            nifiStop();
+            return;
+        }
+        struct pollfd pfd = { linkSocket, POLLIN, 0 };
+        poll(&pfd, 1, 100);
+        if (getMilliseconds() - lastReceiveTime > LINK_TIMEOUT_MS) {
+            printLog("Link timed out\n");
+            nifiStop();
+            return;
+        }
+    }
 
-bool nifiIsHost() {}
-bool nifiIsClient() {}
-bool nifiIsLinked() {}
+    takeSnapshot(getFrame(frameNum), gameboy);
+    scheduleClock(gameboy);
+    pruneClocks();
 
-void nifiCheckInput() {}
-void nifiUpdateInput() {}
+    int waiting = (gameboy->ioRam[0x02] & 0x81) == 0x80 ? gameboy->ioRam[0x01] : 0xff;
+    if (waiting != sentWaiting) {
+        sendWaiting(waiting);
+        sentWaiting = waiting;
+    }
+    sendTime(now);
+    if (!flushMessages())
+        nifiStop();
+}
@@ -0,0 +1,98 @@
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <thread>
+#include <SDL.h>
+#include <GL/gl.h>
+#include "pipeline.h"
+#include "inputhelper.h"
+#include "gbmanager.h"
+#include "nifi.h"
+#include "shmexport.h"
+#include "hosttime.h"
+
+#define FRAME_NANOSECONDS   16742706    // 70224 cycles at 4194304 Hz
+#define MAX_FRAMES_BEHIND   4
+
+extern int scale;
+
+static TripleBuffer<ScaledFrame> scaledFrames;
+
+static std::atomic<bool> renderRunning(false);
+static std::atomic<bool> emulationStopped(false);
+
+// Nothing waits on vsync any more, so the emulation thread keeps time itself.
+// Fast forward runs flat out, and after a long stall (a slow host, a file
+// chooser) it starts counting again rather than racing to catch up.
+static void waitForNextFrame(u64* deadline) {
+    u64 now = getNanoseconds();
+    *deadline += FRAME_NANOSECONDS;
+    if (fastForwardKey || fastForwardMode || now > *deadline + MAX_FRAMES_BEHIND*FRAME_NANOSECONDS) {
+        *deadline = now;
+        return;
+    }
+    if (now < *deadline) {
+        struct timespec ts;
+        ts.tv_sec = *deadline / 1000000000;
+        ts.tv_nsec = *deadline % 1000000000;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    }
+}
+
+static void emulationThreadFunc() {
+    u64 deadline = getNanoseconds();
+    for (;;) {
+        shmExportBeginFrame();
+        mgr_runFrame();
+        mgr_updateVBlank();
+        shmExportEndFrame();
+        nifiUpdateInput();
+        waitForNextFrame(&deadline);
+    }
+}
+
+static void renderThreadFunc() {
+    while (renderRunning.load()) {
+        if (!emuFrames.update()) {
+            usleep(1000);
+            continue;
+        }
+        renderFrame(emuFrames.getFront(), scaledFrames.getBack()->pixels);
+        scaledFrames.publish();
+    }
+}
+
+void runPipeline() {
+    for (int i=0; i<3; i++)
+        scaledFrames.getBuffer(i)->pixels = new Uint32[160*scale*144*scale];
+
+    renderRunning = true;
+    std::thread renderThread(renderThreadFunc);
+    std::thread emulationThread(emulationThreadFunc);
+
+    while (!emulationStopped.load()) {
+        pumpInputEvents();
+
+        if (scaledFrames.update()) {
+            glDrawPixels(160*scale, 144*scale, GL_BGRA, GL_UNSIGNED_BYTE, scaledFrames.getFront()->pixels);
+            SDL_GL_SwapBuffers();
+        }
+        else
+            SDL_Delay(1);
+    }
+
+    emulationThread.join();
+    renderRunning = false;
+    renderThread.join();
+    system_cleanup();
+    exit(0);
+}
+
+// The emulation thread only stops from wherever system_checkPolls was called,
+// which may be deep in a menu or the file chooser, so it ends right there.
+// pthread_exit unwinds its stack on the way out, and runPipeline joins it.
+void stopEmulationThread() {
+    emulationStopped = true;
+    pthread_exit(NULL);
+}
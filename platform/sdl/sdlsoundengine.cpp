@@ -1,13 +1,12 @@
-#include "Sync_Audio.h"
-#include "Blip_Buffer.h"
 #include "SDL.h"
 #include "soundengine.h"
 #include "gameboy.h"
-#include <math.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
-
-
+// The SDL port plays no sound. Only what games can see of the sound hardware
+// is emulated.
 
 SoundEngine::SoundEngine(Gameboy* g)
 {
@@ -17,12 +16,10 @@ SoundEngine::SoundEngine(Gameboy* g)
     chanPolarity[1] = 1;
     chanPolarity[2] = 1;
     chanPolarity[3] = 1;
-    timePassed = 0;
     setGameboy(g);
 }
 
 SoundEngine::~SoundEngine() {
-
 }
 
 void SoundEngine::setGameboy(Gameboy* g) {
@@ -30,16 +27,6 @@ void SoundEngine::setGameboy(Gameboy* g) {
 }
 
 void SoundEngine::init() {
-	audio.stop();
-
-	// Setup buffer
-	buf.clock_rate(clockSpeed);
-	buf.set_sample_rate(44100);
-	
-	// Setup synth
-	synth.volume( 0.50 );
-	synth.output( &buf );
-
 	srand(time(NULL));
 
     refresh();
@@ -70,37 +57,54 @@ void SoundEngine::refresh() {
     unmute();
 }
 
+void SoundEngine::copyState(SoundEngine* s) {
+    cyclesToSoundEvent = s->cyclesToSoundEvent;
+    chan4FreqRatio = s->chan4FreqRatio;
+    chan1SweepTime = s->chan1SweepTime;
+    chan1SweepCounter = s->chan1SweepCounter;
+    chan1SweepDir = s->chan1SweepDir;
+    chan1SweepAmount = s->chan1SweepAmount;
+    memcpy(chanLen, s->chanLen, sizeof(chanLen));
+    memcpy(chanLenCounter, s->chanLenCounter, sizeof(chanLenCounter));
+    memcpy(chanUseLen, s->chanUseLen, sizeof(chanUseLen));
+    memcpy(chanFreq, s->chanFreq, sizeof(chanFreq));
+    memcpy(chanVol, s->chanVol, sizeof(chanVol));
+    memcpy(chanEnvDir, s->chanEnvDir, sizeof(chanEnvDir));
+    memcpy(chanEnvCounter, s->chanEnvCounter, sizeof(chanEnvCounter));
+    memcpy(chanEnvSweep, s->chanEnvSweep, sizeof(chanEnvSweep));
+
+    lfsr = s->lfsr;
+    noiseVal = s->noiseVal;
+    chan3WavPos = s->chan3WavPos;
+    memcpy(chanPolarity, s->chanPolarity, sizeof(chanPolarity));
+    memcpy(chanPolarityCounter, s->chanPolarityCounter, sizeof(chanPolarityCounter));
+    chan4Width = s->chan4Width;
+    memcpy(chanDuty, s->chanDuty, sizeof(chanDuty));
+    memcpy(chanFreqClocks, s->chanFreqClocks, sizeof(chanFreqClocks));
+    memcpy(chanOn, s->chanOn, sizeof(chanOn));
+    memcpy(chanToOut1, s->chanToOut1, sizeof(chanToOut1));
+    memcpy(chanToOut2, s->chanToOut2, sizeof(chanToOut2));
+    SO1Vol = s->SO1Vol;
+    SO2Vol = s->SO2Vol;
+}
+
 void SoundEngine::mute() {
     muted = true;
-    audio.stop();
 }
 
 void SoundEngine::unmute() {
     muted = false;
-    if (gameboy->isMainGameboy())
-        audio.start(44100, 1, 100);
 }
 
 
 void SoundEngine::updateSound(int cycles)
 {
-    return;
-    setSoundEventCycles(50);
-	timePassed += cycles;
-//	chanOn[0] = 0;
-//	chanOn[1] = 0;
-//	chanOn[2] = 0;
-//	chanOn[3] = 0;
-	// Total tone
-	double tone=0;
-	// SO1 & SO2
-	double tone1=0;
-	double tone2=0;
-
-	if (chan1SweepTime != 0)
+    // Lengths, sweep and envelopes. Games can see them in NR52, so they run
+    // even though nothing is heard.
+	if (chan1SweepTime != 0 && chanOn[0])
 	{
 		chan1SweepCounter -= cycles;
-		if (chan1SweepCounter <= 0)
+		while (chan1SweepCounter <= 0)
 		{
 			chan1SweepCounter = (clockSpeed/(128/chan1SweepTime))+chan1SweepCounter;
 			chanFreq[0] += (chanFreq[0]>>chan1SweepAmount)*chan1SweepDir;
@@ -109,187 +113,45 @@ void SoundEngine::updateSound(int cycles)
 			{
 				chanOn[0] = 0;
 				gameboy->clearSoundChannel(CHAN_1);
+				break;
 			}
 		}
+        if (chanOn[0])
+            setSoundEventCycles(chan1SweepCounter);
 	}
-	for (int i=0; i<2; i++)
+	for (int i=0; i<4; i++)
 	{
-		//chan2On = 0;
-		if (chanOn[i])
+		if (!chanOn[i])
+			continue;
+		// Channel 3 has no envelope
+		if (i != 2 && chanEnvSweep[i] != 0)
 		{
-			if (chanEnvSweep[i] != 0)
+			chanEnvCounter[i] -= cycles;
+			if (chanEnvCounter[i] <= 0)
 			{
-				chanEnvCounter[i] -= cycles;
-				if (chanEnvCounter[i] <= 0)
-				{
-					chanEnvCounter[i] = chanEnvSweep[i]*clockSpeed/64;
-					chanVol[i] += chanEnvDir[i];
-					if (chanVol[i] < 0)
-						chanVol[i] = 0;
-					if (chanVol[i] > 0xF)
-						chanVol[i] = 0xF;
-				}
-			}
-			chanPolarityCounter[i] -= cycles;
-			if (chanPolarityCounter[i] <= 0)
-			{
-				int oldPolarityCounter = chanPolarityCounter[i];
-				chanPolarity[i] *= -1;
-
-				if (chanDuty[i] == 0)
-				{
-					if (chanPolarity[i] == 1)
-						chanPolarityCounter[i] = clockSpeed/((double)131072/(2048-chanFreq[i]))*(((double)1/8));
-					else
-						chanPolarityCounter[i] = clockSpeed/((double)131072/(2048-chanFreq[i]))*(((double)7/8));
-				}
-				else if (chanDuty[i] == 1)
-				{
-					if (chanPolarity[i] == 1)
-						chanPolarityCounter[i] = clockSpeed/((double)131072/(2048-chanFreq[i]))*(((double)1/4));
-					else
-						chanPolarityCounter[i] = clockSpeed/((double)131072/(2048-chanFreq[i]))*(((double)3/4));
-				}
-				else if (chanDuty[i] == 2)
-					chanPolarityCounter[i] = clockSpeed/((double)131072/(2048-chanFreq[i]))/2;
-				else if (chanDuty[i] == 3)
-				{
-					if (chanPolarity[i] == 1)
-						chanPolarityCounter[i] = clockSpeed/((double)131072/(2048-chanFreq[i]))*(((double)3/4));
-					else
-						chanPolarityCounter[i] = clockSpeed/((double)131072/(2048-chanFreq[i]))*(((double)1/4));
-				}
-				chanPolarityCounter[i] += oldPolarityCounter;
-			}
-
-			if (chanToOut1[i])
-				tone1 += chanPolarity[i] * chanVol[i];
-			if (chanToOut2[i])
-				tone2 += chanPolarity[i] * chanVol[i];
-
-			if (chanUseLen[i])
-			{
-				chanLenCounter[i] -= cycles;
-				if (chanLenCounter[i] <= 0)
-				{
-					chanOn[i] = 0;
-					if (i==0)
-						gameboy->clearSoundChannel(CHAN_1);
-					else
-						gameboy->clearSoundChannel(CHAN_2);
-				}
+				chanEnvCounter[i] = chanEnvSweep[i]*clockSpeed/64;
+				chanVol[i] += chanEnvDir[i];
+				if (chanVol[i] < 0)
+					chanVol[i] = 0;
+				if (chanVol[i] > 0xF)
+					chanVol[i] = 0xF;
 			}
+            setSoundEventCycles(chanEnvCounter[i]);
 		}
-
-	}
-
-	// Channel 3
-	if (chanOn[2])
-	{
-		static double analog[] = { -1, -0.8667, -0.7334, -0.6, -0.4668, -0.3335, -0.2, -0.067, 0.0664, 0.2, 0.333, 0.4668, 0.6, 0.7334, 0.8667, 1  } ;
-		if (chanVol[2] >= 0)
+		if (chanUseLen[i])
 		{
-			int wavTone = gameboy->ioRam[0x30+(chan3WavPos/2)];
-			wavTone = chan3WavPos%2? wavTone&0xF : wavTone>>4;
-			if (chanToOut1[2])
-				tone1 += (analog[wavTone])*(0xF >> chanVol[2]);
-			if (chanToOut2[2])
-				tone2 += (analog[wavTone])*(0xF >> chanVol[2]);
-		}
-		chanPolarityCounter[2] -= cycles;
-		if (chanPolarityCounter[2] <= 0)
-		{
-			chanPolarityCounter[2] = clockSpeed/(65536/(2048-chanFreq[2])*32) + chanPolarityCounter[2];
-			//chanPolarityCounter[2] = clockSpeed/((131072/(2048-chanFreq[2]))*16);
-			chanFreqClocks[2] = chanPolarityCounter[2];
-
-			chan3WavPos++;
-			if (chan3WavPos >= 32)
-				chan3WavPos = 0;
-		}
-
-		if (chanUseLen[2])
-		{
-			chanLenCounter[2] -= cycles;
-			if (chanLenCounter[2] <= 0)
+			chanLenCounter[i] -= cycles;
+			if (chanLenCounter[i] <= 0)
 			{
-				chanOn[2] = 0;
-				chanPolarityCounter[2] = 0;
-				gameboy->clearSoundChannel(CHAN_3);
+				chanOn[i] = 0;
+				if (i == 2)
+					chanPolarityCounter[2] = 0;
+				gameboy->clearSoundChannel(1<<i);
 			}
-		}
-	}
-	if (chanOn[3])
-	{
-		chanEnvCounter[3] -= cycles;
-		if (chanEnvSweep[3] != 0 && chanEnvCounter[3] <= 0)
-		{
-			chanEnvCounter[3] = chanEnvSweep[3]*clockSpeed/64;
-			chanVol[3] += chanEnvDir[3];
-			if (chanVol[3] < 0)
-				chanVol[3] = 0;
-			if (chanVol[3] > 0xF)
-				chanVol[3] = 0xF;
-		}
-		chanPolarityCounter[3] -= cycles;
-		if (chanPolarityCounter[3] <= 0)
-        {
-            //chanPolarityCounter[3] = 
-            chanPolarityCounter[3] = clockSpeed/((int)(524288 / chan4FreqRatio) >> (chanFreq[3]+1))+chanPolarityCounter[3];
-
-            noiseVal = (lfsr&1)^((lfsr>>1)&1);
-            if (noiseVal)
-                chanPolarity[3] = -1;
             else
-                chanPolarity[3] = 1;
-            lfsr >>= 1;
-            if (chan4Width)
-            {
-                lfsr &= ~(1<<6);
-                lfsr |= (noiseVal<<6);
-            }
-            else {
-                lfsr &= ~(1<<14);
-                lfsr |= (noiseVal<<14);
-            }
-        }
-
-		if (chanToOut1[3])
-			tone1 += chanPolarity[3]*chanVol[3]*2;
-		if (chanToOut2[3])
-			tone2 += chanPolarity[3]*chanVol[3]*2;
-		if (chanUseLen[3])
-		{
-			chanLenCounter[3] -= cycles;
-			if (chanLenCounter[3] <= 0)
-			{
-				chanOn[3] = 0;
-				gameboy->clearSoundChannel(CHAN_4);
-			}
+                setSoundEventCycles(chanLenCounter[i]);
 		}
 	}
-	tone1 *= SO1Vol;
-	tone2 *= SO2Vol;
-	tone = (tone1 + tone2)/20 + SO1Vol;
-	//tone *= 10;
-	//if (tone != 0)
-	//	printf("%d\n", tone);
-	//if (tone != 0)
-	//	printf("%d\n", tone);
-
-    if (!muted) {
-        synth.update(0, tone);
-        buf.end_frame(cycles);
-
-        if (timePassed >= 1000)
-        {
-            timePassed = 0;
-
-            blip_sample_t samples[1024];
-            int count = buf.read_samples(samples, 1024);
-            audio.write(samples, count);
-        }
-    }
 }
 
 
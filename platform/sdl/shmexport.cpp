@@ -0,0 +1,135 @@
+// Exports the running gameboy through POSIX shared memory; see shmexport.h
+// for the layout and how to read it.
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shmexport.h"
+#include "gameboy.h"
+
+#define SCREEN_BYTES    (256*144*4)
+#define HEADER_BYTES    ARENA_PAGE_SIZE
+#define ARENA_OFFSET    (HEADER_BYTES + SCREEN_BYTES)
+// Room for the biggest arena there is, so it never has to move
+#define ARENA_BYTES     MAX_ARENA_SIZE
+#define SEGMENT_BYTES   (ARENA_OFFSET + ARENA_BYTES)
+
+static_assert(SCREEN_BYTES % ARENA_PAGE_SIZE == 0, "The arena must start on a page");
+static_assert(sizeof(ShmExportHeader) <= HEADER_BYTES, "Header too big");
+
+static char segmentName[256];
+static u8* segment = NULL;
+static ShmExportHeader* header = NULL;
+static Gameboy* exportedGb = NULL;
+
+// The arena always lives at the same place in the segment
+static u8* resizeArena(void* data, u8* arena, int oldSize, int newSize) {
+    return segment + ARENA_OFFSET;
+}
+static void releaseArena(void* data, u8* arena) {
+}
+
+static const ArenaAllocator shmAllocator = {
+    resizeArena,
+    releaseArena,
+};
+
+bool shmExportStart(const char* name, Gameboy* gb) {
+    if (segment != NULL || strlen(name) >= sizeof(segmentName))
+        return false;
+
+    // A segment left by a GameYob that didn't exit cleanly is replaced
+    shm_unlink(name);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        perror("shm_open");
+        return false;
+    }
+    if (ftruncate(fd, SEGMENT_BYTES) != 0) {
+        perror("ftruncate");
+        close(fd);
+        shm_unlink(name);
+        return false;
+    }
+    void* ptr = mmap(NULL, SEGMENT_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED) {
+        perror("mmap");
+        shm_unlink(name);
+        return false;
+    }
+    strcpy(segmentName, name);
+    segment = (u8*)ptr;
+
+    header = (ShmExportHeader*)segment;
+    memcpy(header->magic, SHM_EXPORT_MAGIC, sizeof(SHM_EXPORT_MAGIC));
+    header->version = SHM_EXPORT_VERSION;
+    header->size = SEGMENT_BYTES;
+    header->screenOffset = HEADER_BYTES;
+    header->vramOffset = ARENA_OFFSET + ARENA_VRAM;
+    header->wramOffset = ARENA_OFFSET + ARENA_WRAM;
+    header->oamOffset = ARENA_OFFSET + ARENA_HIGHRAM + 0xe00;
+    header->ioOffset = ARENA_OFFSET + ARENA_HIGHRAM + 0xf00;
+    header->hramOffset = ARENA_OFFSET + ARENA_HIGHRAM + 0xf80;
+    header->sramOffset = ARENA_OFFSET + ARENA_SRAM;
+
+    exportedGb = gb;
+    gb->setArenaAllocator(&shmAllocator, NULL);
+    shmExportEndFrame();
+    return true;
+}
+
+void shmExportStop() {
+    if (segment != NULL)
+        shm_unlink(segmentName);
+}
+
+void shmExportBeginFrame() {
+    if (header == NULL)
+        return;
+    __atomic_store_n(&header->sequence, header->sequence+1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void shmExportEndFrame() {
+    if (header == NULL)
+        return;
+    Gameboy* gb = exportedGb;
+    if (!(header->sequence & 1)) {
+        // Only from shmExportStart
+        __atomic_store_n(&header->sequence, header->sequence+1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+    }
+
+    header->frame++;
+    int arenaSize = gb->getArenaSize();
+    header->sramSize = arenaSize > ARENA_SRAM+ARENA_PAGE_SIZE ? arenaSize - ARENA_SRAM - ARENA_PAGE_SIZE : 0;
+    header->af = gb->gbRegs.af.w;
+    header->bc = gb->gbRegs.bc.w;
+    header->de = gb->gbRegs.de.w;
+    header->hl = gb->gbRegs.hl.w;
+    header->sp = gb->gbRegs.sp.w;
+    header->pc = gb->gbRegs.pc.w;
+    header->romBank = gb->getBank(0x4000);
+    header->ly = gb->quickReadIO(0x44);
+    header->sramBank = gb->getBank(0xa000);
+    header->wramBank = gb->getBank(0xd000);
+    header->vramBank = gb->getBank(0x8000);
+    header->doubleSpeed = gb->isDoubleSpeed();
+
+    __atomic_store_n(&header->sequence, header->sequence+1, __ATOMIC_RELEASE);
+}
+
+void shmExportScreen(const uint32_t* pixels) {
+    if (header == NULL)
+        return;
+    // Nobody's been reading lately
+    u32 readerFrame = __atomic_load_n(&header->readerFrame, __ATOMIC_RELAXED);
+    if (readerFrame == 0 || header->frame - readerFrame > SHM_READER_TIMEOUT)
+        return;
+    memcpy(segment + HEADER_BYTES, pixels, SCREEN_BYTES);
+    header->screenFrame = header->frame+1;
+}